@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lightmqtt/packet.h"
+#include "lightmqtt/client.h"
+
+#include "helpers.h"
+#include "stub_broker.h"
+
+#define BENCH_TOPIC "bench/lightmqtt/client"
+#define BENCH_SEQ_SIZE 4
+
+typedef struct {
+    lmqtt_publish_t publish;
+    unsigned char *payload;
+    unsigned long seq;
+    int in_use;
+} bench_message_t;
+
+typedef struct {
+    lmqtt_qos_t qos;
+    size_t payload_size;
+    size_t rx_buffer_size;
+    size_t tx_buffer_size;
+} bench_case_t;
+
+static lmqtt_client_t client;
+static stub_broker_t broker;
+static int connected;
+static unsigned long delivered;
+static lmqtt_qos_t current_qos;
+
+static bench_message_t *messages;
+static bench_ns_t *sent_at;
+static bench_ns_t *latencies;
+
+static const lmqtt_qos_t qos_values[] = { LMQTT_QOS_0, LMQTT_QOS_1,
+    LMQTT_QOS_2 };
+static const size_t payload_sizes[] = { 16, 256, 4096 };
+static const size_t buffer_sizes[] = { 256, 4096, 65536 };
+
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+static void record_latency(unsigned long seq)
+{
+    latencies[seq] = bench_now() - sent_at[seq];
+    delivered += 1;
+}
+
+static int on_connect(void *data, lmqtt_connect_t *connect, int succeeded)
+{
+    connected = succeeded;
+    return 1;
+}
+
+static int on_publish(void *data, lmqtt_publish_t *publish, int succeeded)
+{
+    bench_message_t *message = (bench_message_t *) publish;
+
+    if (!succeeded)
+        return 0;
+
+    if (publish->qos != LMQTT_QOS_0)
+        record_latency(message->seq);
+    message->in_use = 0;
+    return 1;
+}
+
+static void on_broker_publish(void *data, unsigned char *payload, size_t len)
+{
+    unsigned long seq;
+
+    /* QoS 1 and 2 messages are only delivered when the client receives the
+       final acknowledgement (see on_publish()) */
+    if (current_qos != LMQTT_QOS_0 || len < BENCH_SEQ_SIZE)
+        return;
+
+    seq = ((unsigned long) payload[0] << 24) | (payload[1] << 16) |
+        (payload[2] << 8) | payload[3];
+    record_latency(seq);
+}
+
+static int run_step(void)
+{
+    lmqtt_string_t *str_rd, *str_wr;
+    int res = lmqtt_client_run_once(&client, &str_rd, &str_wr);
+
+    if (LMQTT_IS_ERROR(res)) {
+        fprintf(stderr, "client error: %d\n", LMQTT_ERROR_NUM(res));
+        return 0;
+    }
+    if (LMQTT_IS_EOF(res)) {
+        fprintf(stderr, "unexpected eof\n");
+        return 0;
+    }
+    if (stub_broker_process(&broker) < 0) {
+        fprintf(stderr, "malformed stream\n");
+        return 0;
+    }
+    return 1;
+}
+
+static int enqueue(bench_case_t *bc, size_t window, unsigned long seq)
+{
+    size_t i;
+
+    for (i = 0; i < window; i++) {
+        bench_message_t *message = &messages[i];
+        if (message->in_use)
+            continue;
+
+        memset(&message->publish, 0, sizeof(message->publish));
+        message->publish.qos = bc->qos;
+        message->publish.topic.buf = BENCH_TOPIC;
+        message->publish.topic.len = strlen(BENCH_TOPIC);
+        message->publish.payload.buf = (char *) message->payload;
+        message->publish.payload.len = bc->payload_size;
+        message->payload[0] = (seq >> 24) & 0xff;
+        message->payload[1] = (seq >> 16) & 0xff;
+        message->payload[2] = (seq >> 8) & 0xff;
+        message->payload[3] = seq & 0xff;
+        message->seq = seq;
+
+        sent_at[seq] = bench_now();
+        if (!lmqtt_client_publish(&client, &message->publish))
+            return 0;
+        message->in_use = 1;
+        return 1;
+    }
+
+    return 0;
+}
+
+static int run_case(bench_case_t *bc, unsigned long count, size_t window)
+{
+    lmqtt_store_entry_t *entries;
+    unsigned char *rx_buffer;
+    unsigned char *tx_buffer;
+    lmqtt_packet_id_t id_set_items[16];
+
+    lmqtt_connect_t connect_data;
+    lmqtt_client_callbacks_t client_callbacks;
+    lmqtt_client_buffers_t buffers;
+
+    unsigned long seq = 0;
+    bench_ns_t start, elapsed;
+    size_t i;
+    int ok = 1;
+
+    entries = calloc(window + 8, sizeof(*entries));
+    rx_buffer = malloc(bc->rx_buffer_size);
+    tx_buffer = malloc(bc->tx_buffer_size);
+    for (i = 0; i < window; i++) {
+        messages[i].payload = calloc(1, bc->payload_size);
+        messages[i].in_use = 0;
+    }
+
+    memset(&connect_data, 0, sizeof(connect_data));
+    memset(&client_callbacks, 0, sizeof(client_callbacks));
+    memset(&buffers, 0, sizeof(buffers));
+
+    stub_broker_init(&broker);
+    broker.on_publish = &on_broker_publish;
+
+    client_callbacks.data = &broker;
+    client_callbacks.read = &stub_client_read;
+    client_callbacks.write = &stub_client_write;
+    client_callbacks.get_time = &bench_get_time;
+
+    buffers.store_size = (window + 8) * sizeof(*entries);
+    buffers.store = entries;
+    buffers.rx_buffer_size = bc->rx_buffer_size;
+    buffers.rx_buffer = rx_buffer;
+    buffers.tx_buffer_size = bc->tx_buffer_size;
+    buffers.tx_buffer = tx_buffer;
+    buffers.id_set_size = sizeof(id_set_items);
+    buffers.id_set = id_set_items;
+
+    lmqtt_client_initialize(&client, &client_callbacks, &buffers);
+    lmqtt_client_set_on_connect(&client, &on_connect, NULL);
+    lmqtt_client_set_on_publish(&client, &on_publish, NULL);
+
+    connect_data.clean_session = 1;
+    connect_data.client_id.buf = "bench";
+    connect_data.client_id.len = 5;
+
+    connected = 0;
+    delivered = 0;
+    current_qos = bc->qos;
+    lmqtt_client_connect(&client, &connect_data);
+    while (ok && !connected)
+        ok = run_step();
+
+    start = bench_now();
+    while (ok && delivered < count) {
+        while (seq < count && enqueue(bc, window, seq))
+            seq++;
+        ok = run_step();
+    }
+    elapsed = bench_now() - start;
+
+    if (ok) {
+        bench_sort(latencies, count);
+        printf("{\"bench\": \"client\", \"transport\": \"memory\", "
+            "\"qos\": %d, \"payload\": %lu, \"rx_buffer\": %lu, "
+            "\"tx_buffer\": %lu, \"window\": %lu, \"messages\": %lu, "
+            "\"elapsed_ns\": %lld, \"msgs_per_sec\": %.0f, "
+            "\"p50_ns\": %lld, \"p99_ns\": %lld}\n",
+            (int) bc->qos, (unsigned long) bc->payload_size,
+            (unsigned long) bc->rx_buffer_size,
+            (unsigned long) bc->tx_buffer_size, (unsigned long) window,
+            count, elapsed, count * 1e9 / (elapsed > 0 ? elapsed : 1),
+            bench_percentile(latencies, count, 50),
+            bench_percentile(latencies, count, 99));
+        fflush(stdout);
+    }
+
+    lmqtt_client_finalize(&client);
+
+    for (i = 0; i < window; i++)
+        free(messages[i].payload);
+    free(tx_buffer);
+    free(rx_buffer);
+    free(entries);
+    return ok;
+}
+
+#define HAS_OPT_ARG(str) (i + 1 < argc && strcmp(str, argv[i]) == 0)
+
+int main(int argc, const char *argv[])
+{
+    unsigned long count = 20000;
+    size_t window = 64;
+    int only_qos = -1;
+    int opt_error = 0;
+    size_t q, p, b;
+
+    for (int i = 1; i < argc; ) {
+        if (HAS_OPT_ARG("-n")) {
+            count = strtoul(argv[i + 1], NULL, 10);
+            i += 2;
+            continue;
+        }
+        if (HAS_OPT_ARG("-w")) {
+            window = strtoul(argv[i + 1], NULL, 10);
+            i += 2;
+            continue;
+        }
+        if (HAS_OPT_ARG("-q")) {
+            only_qos = atoi(argv[i + 1]);
+            i += 2;
+            continue;
+        }
+        opt_error = 1;
+        break;
+    }
+
+    if (opt_error || count == 0 || window == 0) {
+        fprintf(stderr, "Syntax error.\n\n");
+        fprintf(stderr, "Usage: %s [-n <COUNT>] [-w <WINDOW>] [-q <QOS>]\n",
+            argv[0]);
+        fprintf(stderr, "    -n COUNT   Messages per case (default: 20000)\n");
+        fprintf(stderr, "    -w WINDOW  Publishes queued at once "
+            "(default: 64)\n");
+        fprintf(stderr, "    -q QOS     Run only cases with the given QoS\n");
+        return 1;
+    }
+
+    messages = calloc(window, sizeof(*messages));
+    sent_at = calloc(count, sizeof(*sent_at));
+    latencies = calloc(count, sizeof(*latencies));
+
+    for (q = 0; q < COUNT_OF(qos_values); q++) {
+        if (only_qos >= 0 && only_qos != (int) qos_values[q])
+            continue;
+        for (p = 0; p < COUNT_OF(payload_sizes); p++) {
+            for (b = 0; b < COUNT_OF(buffer_sizes); b++) {
+                bench_case_t bc;
+                bc.qos = qos_values[q];
+                bc.payload_size = payload_sizes[p];
+                bc.rx_buffer_size = buffer_sizes[b];
+                bc.tx_buffer_size = buffer_sizes[b];
+                if (!run_case(&bc, count, window))
+                    return 1;
+            }
+        }
+    }
+
+    free(latencies);
+    free(sent_at);
+    free(messages);
+    return 0;
+}
@@ -0,0 +1,336 @@
+/* must match the library sources built into this program, see Makefile.am */
+#define LMQTT_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lightmqtt/packet.h"
+#include "lightmqtt/types.h"
+
+#include "helpers.h"
+
+/*
+ * private functions which will be benchmarked (exposed by LMQTT_TEST)
+ */
+
+size_t encode_remaining_length(long len, unsigned char *buf);
+
+lmqtt_encode_result_t encode_buffer_encode(
+    lmqtt_encode_buffer_t *encode_buffer, lmqtt_store_value_t *value,
+    encode_buffer_builder_t builder, size_t offset, unsigned char *buf,
+    size_t buf_len, size_t *bytes_written);
+
+void puback_build(lmqtt_store_value_t *value,
+    lmqtt_encode_buffer_t *encode_buffer);
+
+lmqtt_encode_result_t string_encode(lmqtt_string_t *str, int encode_len,
+    int encode_if_empty, size_t offset, unsigned char *buf, size_t buf_len,
+    size_t *bytes_written, lmqtt_encode_buffer_t *encode_buffer);
+
+lmqtt_decode_result_t fixed_header_decode(lmqtt_fixed_header_t *header,
+    unsigned char b, lmqtt_error_t *error);
+
+/*
+ * benchmark cases
+ */
+
+#define PUBLISH_PACKETS 64
+#define PUBLISH_PAYLOAD_SIZE 64
+#define STRING_SIZE 64
+
+typedef struct {
+    const char *name;
+    /* bytes processed by each operation; 0 if not applicable */
+    size_t bytes_per_op;
+    void (*setup)(void);
+    unsigned long (*run)(unsigned long);
+} bench_codec_t;
+
+static volatile unsigned long sink;
+
+static unsigned char out_buf[4096];
+
+static unsigned long run_fixed_header_decode(unsigned long ops)
+{
+    static const unsigned char header[] = { 0x32, 0xc1, 0x02 };
+    unsigned long i, res = 0;
+
+    for (i = 0; i < ops; i++) {
+        lmqtt_fixed_header_t fh;
+        lmqtt_error_t error;
+        size_t j;
+
+        memset(&fh, 0, sizeof(fh));
+        for (j = 0; j < sizeof(header); j++)
+            res += fixed_header_decode(&fh, header[j], &error);
+        res += fh.remaining_length;
+    }
+
+    return res;
+}
+
+static unsigned long run_encode_remaining_length(unsigned long ops)
+{
+    static const long values[] = { 2, 321, 16384, 2097152 };
+    unsigned long i, res = 0;
+
+    /* average output is (1 + 2 + 3 + 4) / 4 bytes */
+    for (i = 0; i < ops; i++)
+        res += encode_remaining_length(values[i & 3], out_buf);
+
+    return res;
+}
+
+static lmqtt_string_t encode_str;
+static char encode_str_buf[STRING_SIZE];
+
+static void setup_string_encode(void)
+{
+    memset(&encode_str, 0, sizeof(encode_str));
+    memset(encode_str_buf, 'x', sizeof(encode_str_buf));
+    encode_str.buf = encode_str_buf;
+    encode_str.len = sizeof(encode_str_buf);
+}
+
+static unsigned long run_string_encode(unsigned long ops)
+{
+    unsigned long i, res = 0;
+    lmqtt_encode_buffer_t eb;
+
+    memset(&eb, 0, sizeof(eb));
+    for (i = 0; i < ops; i++) {
+        size_t cnt;
+        res += string_encode(&encode_str, 1, 1, 0, out_buf, sizeof(out_buf),
+            &cnt, &eb);
+        res += cnt;
+    }
+
+    return res;
+}
+
+static unsigned long run_encode_buffer_encode(unsigned long ops)
+{
+    unsigned long i, res = 0;
+    lmqtt_encode_buffer_t eb;
+    lmqtt_store_value_t value;
+
+    memset(&eb, 0, sizeof(eb));
+    memset(&value, 0, sizeof(value));
+    for (i = 0; i < ops; i++) {
+        size_t cnt;
+        value.packet_id = (lmqtt_packet_id_t) i;
+        res += encode_buffer_encode(&eb, &value, &puback_build, 0, out_buf,
+            sizeof(out_buf), &cnt);
+        res += cnt;
+    }
+
+    return res;
+}
+
+static unsigned char publish_stream[PUBLISH_PACKETS *
+    (4 + sizeof("bench/topic") - 1 + PUBLISH_PAYLOAD_SIZE)];
+static size_t publish_stream_len;
+static lmqtt_rx_buffer_t rx_buffer;
+static lmqtt_message_callbacks_t message_callbacks;
+static char rx_topic[64];
+static char rx_payload[PUBLISH_PAYLOAD_SIZE];
+
+static int on_message(void *data, lmqtt_publish_t *publish)
+{
+    return 1;
+}
+
+static lmqtt_allocate_result_t on_message_allocate_topic(void *data,
+    lmqtt_publish_t *publish, size_t size)
+{
+    publish->topic.buf = rx_topic;
+    publish->topic.len = size;
+    return LMQTT_ALLOCATE_SUCCESS;
+}
+
+static lmqtt_allocate_result_t on_message_allocate_payload(void *data,
+    lmqtt_publish_t *publish, size_t size)
+{
+    publish->payload.buf = rx_payload;
+    publish->payload.len = size;
+    return LMQTT_ALLOCATE_SUCCESS;
+}
+
+static void setup_rx_buffer_decode_publish(void)
+{
+    static const char topic[] = "bench/topic";
+    size_t topic_len = sizeof(topic) - 1;
+    size_t i;
+
+    publish_stream_len = 0;
+    for (i = 0; i < PUBLISH_PACKETS; i++) {
+        unsigned char *p = &publish_stream[publish_stream_len];
+        p[0] = LMQTT_TYPE_PUBLISH << 4;
+        p[1] = 2 + topic_len + PUBLISH_PAYLOAD_SIZE;
+        p[2] = 0;
+        p[3] = topic_len;
+        memcpy(&p[4], topic, topic_len);
+        memset(&p[4 + topic_len], 'p', PUBLISH_PAYLOAD_SIZE);
+        publish_stream_len += 4 + topic_len + PUBLISH_PAYLOAD_SIZE;
+    }
+
+    memset(&message_callbacks, 0, sizeof(message_callbacks));
+    message_callbacks.on_publish = &on_message;
+    message_callbacks.on_publish_allocate_topic = &on_message_allocate_topic;
+    message_callbacks.on_publish_allocate_payload =
+        &on_message_allocate_payload;
+
+    memset(&rx_buffer, 0, sizeof(rx_buffer));
+    rx_buffer.message_callbacks = &message_callbacks;
+}
+
+static unsigned long run_rx_buffer_decode_publish(unsigned long ops)
+{
+    unsigned long i, res = 0;
+
+    /* each operation decodes a whole stream of PUBLISH_PACKETS packets */
+    for (i = 0; i < ops; i++) {
+        size_t cnt;
+        res += lmqtt_rx_buffer_decode(&rx_buffer, publish_stream,
+            publish_stream_len, &cnt);
+        res += cnt;
+    }
+
+    return res;
+}
+
+#define STORE_DEPTH 64
+
+static lmqtt_store_t store;
+static lmqtt_store_entry_t store_entries[STORE_DEPTH];
+
+static void setup_store_pop_marked_by(void)
+{
+    lmqtt_store_value_t value;
+    int i;
+
+    memset(&store, 0, sizeof(store));
+    memset(&value, 0, sizeof(value));
+    store.entries = store_entries;
+    store.capacity = STORE_DEPTH;
+
+    for (i = 0; i < STORE_DEPTH; i++) {
+        value.packet_id = lmqtt_store_get_id(&store);
+        lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1, &value);
+        lmqtt_store_mark_current(&store);
+    }
+}
+
+static unsigned long run_store_pop_marked_by(unsigned long ops)
+{
+    unsigned long i, res = 0;
+    lmqtt_store_value_t value;
+
+    /* acknowledge the oldest in-flight entry and queue a new one, keeping the
+       store full of marked entries (as with a saturated QoS 1 window) */
+    for (i = 0; i < ops; i++) {
+        lmqtt_packet_id_t id = (lmqtt_packet_id_t) (store.next_packet_id -
+            STORE_DEPTH);
+        res += lmqtt_store_pop_marked_by(&store, LMQTT_KIND_PUBLISH_1, id,
+            &value);
+        value.packet_id = lmqtt_store_get_id(&store);
+        lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1, &value);
+        lmqtt_store_mark_current(&store);
+    }
+
+    return res;
+}
+
+static const bench_codec_t cases[] = {
+    { "fixed_header_decode", 3, NULL, &run_fixed_header_decode },
+    { "encode_remaining_length", 0, NULL, &run_encode_remaining_length },
+    { "string_encode", STRING_SIZE + 2, &setup_string_encode,
+        &run_string_encode },
+    { "encode_buffer_encode", 4, NULL, &run_encode_buffer_encode },
+    { "rx_buffer_decode_publish", sizeof(publish_stream),
+        &setup_rx_buffer_decode_publish, &run_rx_buffer_decode_publish },
+    { "store_pop_marked_by", 0, &setup_store_pop_marked_by,
+        &run_store_pop_marked_by }
+};
+
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+static void run_codec(const bench_codec_t *bc, bench_ns_t min_time)
+{
+    unsigned long ops = 1000;
+    bench_ns_t elapsed;
+    unsigned long long cycles;
+
+    if (bc->setup)
+        bc->setup();
+    sink += bc->run(ops);
+
+    /* grow the number of iterations until the run is long enough to be
+       measured reliably */
+    while (1) {
+        bench_ns_t start = bench_now();
+        unsigned long long start_cycles = bench_cycles();
+
+        sink += bc->run(ops);
+
+        cycles = bench_cycles() - start_cycles;
+        elapsed = bench_now() - start;
+        if (elapsed >= min_time)
+            break;
+        ops *= elapsed > 0 && min_time / elapsed < 10 ? 2 : 10;
+    }
+
+    printf("{\"bench\": \"codec\", \"name\": \"%s\", \"ops\": %lu, "
+        "\"ns_per_op\": %.3f", bc->name, ops, (double) elapsed / ops);
+    if (bench_has_cycles()) {
+        printf(", \"cycles_per_op\": %.3f", (double) cycles / ops);
+        if (bc->bytes_per_op > 0)
+            printf(", \"cycles_per_byte\": %.4f",
+                (double) cycles / ops / bc->bytes_per_op);
+    }
+    printf("}\n");
+    fflush(stdout);
+}
+
+#define HAS_OPT_ARG(str) (i + 1 < argc && strcmp(str, argv[i]) == 0)
+
+int main(int argc, const char *argv[])
+{
+    long min_time_ms = 200;
+    const char *only = NULL;
+    int opt_error = 0;
+    size_t c;
+
+    for (int i = 1; i < argc; ) {
+        if (HAS_OPT_ARG("-t")) {
+            min_time_ms = atol(argv[i + 1]);
+            i += 2;
+            continue;
+        }
+        if (HAS_OPT_ARG("-b")) {
+            only = argv[i + 1];
+            i += 2;
+            continue;
+        }
+        opt_error = 1;
+        break;
+    }
+
+    if (opt_error || min_time_ms <= 0) {
+        fprintf(stderr, "Syntax error.\n\n");
+        fprintf(stderr, "Usage: %s [-t <MSECS>] [-b <NAME>]\n", argv[0]);
+        fprintf(stderr, "    -t MSECS   Minimum time per benchmark "
+            "(default: 200)\n");
+        fprintf(stderr, "    -b NAME    Run only the given benchmark\n");
+        return 1;
+    }
+
+    for (c = 0; c < COUNT_OF(cases); c++) {
+        if (only && strcmp(only, cases[c].name) != 0)
+            continue;
+        run_codec(&cases[c], min_time_ms * 1000000LL);
+    }
+
+    return 0;
+}
@@ -0,0 +1,2 @@
+#define LMQTT_TEST
+#include "../src/lmqtt_time.c"
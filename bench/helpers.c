@@ -0,0 +1,72 @@
+#include "helpers.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#   include <x86intrin.h>
+#   define BENCH_HAS_RDTSC 1
+#else
+#   define BENCH_HAS_RDTSC 0
+#endif
+
+bench_ns_t bench_now(void)
+{
+    struct timespec tim;
+
+    clock_gettime(CLOCK_MONOTONIC, &tim);
+    return (bench_ns_t) tim.tv_sec * 1000000000LL + tim.tv_nsec;
+}
+
+int bench_has_cycles(void)
+{
+    return BENCH_HAS_RDTSC;
+}
+
+/* Returns the time stamp counter, or 0 where it is not available. Note the TSC
+   ticks at a constant rate which may differ from the actual core clock. */
+unsigned long long bench_cycles(void)
+{
+#if BENCH_HAS_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+lmqtt_io_result_t bench_get_time(long *secs, long *nsecs)
+{
+    struct timespec tim;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &tim) == 0) {
+        *secs = tim.tv_sec;
+        *nsecs = tim.tv_nsec;
+        return LMQTT_IO_SUCCESS;
+    }
+
+    return LMQTT_IO_ERROR;
+}
+
+static int compare_ns(const void *a, const void *b)
+{
+    bench_ns_t x = *((const bench_ns_t *) a);
+    bench_ns_t y = *((const bench_ns_t *) b);
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+void bench_sort(bench_ns_t *values, size_t count)
+{
+    qsort(values, count, sizeof(values[0]), &compare_ns);
+}
+
+bench_ns_t bench_percentile(bench_ns_t *sorted, size_t count, int pct)
+{
+    size_t i;
+
+    if (count == 0)
+        return 0;
+
+    i = (count * pct + 99) / 100;
+    return sorted[i > 0 ? i - 1 : 0];
+}
@@ -0,0 +1,16 @@
+#ifndef _BENCH_HELPERS_H
+#define _BENCH_HELPERS_H
+
+#include <stddef.h>
+#include "lightmqtt/core.h"
+
+typedef long long bench_ns_t;
+
+bench_ns_t bench_now(void);
+int bench_has_cycles(void);
+unsigned long long bench_cycles(void);
+lmqtt_io_result_t bench_get_time(long *secs, long *nsecs);
+void bench_sort(bench_ns_t *values, size_t count);
+bench_ns_t bench_percentile(bench_ns_t *sorted, size_t count, int pct);
+
+#endif
@@ -0,0 +1,219 @@
+#include "stub_broker.h"
+
+#include <string.h>
+
+#include "lightmqtt/types.h"
+
+/******************************************************************************
+ * mem_pipe_t
+ ******************************************************************************/
+
+static void mem_pipe_init(mem_pipe_t *pipe)
+{
+    pipe->pos = 0;
+    pipe->len = 0;
+}
+
+static size_t mem_pipe_read(mem_pipe_t *pipe, void *buf, size_t buf_len)
+{
+    size_t cnt = pipe->len - pipe->pos;
+
+    if (cnt > buf_len)
+        cnt = buf_len;
+    memcpy(buf, &pipe->buf[pipe->pos], cnt);
+    pipe->pos += cnt;
+
+    if (pipe->pos == pipe->len)
+        mem_pipe_init(pipe);
+    return cnt;
+}
+
+static size_t mem_pipe_write(mem_pipe_t *pipe, const void *buf, size_t buf_len)
+{
+    size_t cnt;
+
+    if (pipe->pos > 0 && pipe->len + buf_len > sizeof(pipe->buf)) {
+        memmove(pipe->buf, &pipe->buf[pipe->pos], pipe->len - pipe->pos);
+        pipe->len -= pipe->pos;
+        pipe->pos = 0;
+    }
+
+    cnt = sizeof(pipe->buf) - pipe->len;
+    if (cnt > buf_len)
+        cnt = buf_len;
+    memcpy(&pipe->buf[pipe->len], buf, cnt);
+    pipe->len += cnt;
+    return cnt;
+}
+
+static size_t mem_pipe_space(mem_pipe_t *pipe)
+{
+    return sizeof(pipe->buf) - (pipe->len - pipe->pos);
+}
+
+/******************************************************************************
+ * stub_broker_t
+ ******************************************************************************/
+
+/* Returns the total packet length, 0 if the packet is still incomplete or -1 if
+   the remaining length is malformed. */
+static long stub_broker_packet_length(unsigned char *buf, size_t len,
+    long *header_len, long *remaining_length)
+{
+    long mult = 1;
+    long value = 0;
+    size_t i;
+
+    for (i = 1; i < len && i <= 4; i++) {
+        value += (buf[i] & 127) * mult;
+        mult *= 128;
+        if ((buf[i] & 128) == 0) {
+            *header_len = i + 1;
+            *remaining_length = value;
+            return len >= i + 1 + value ? i + 1 + value : 0;
+        }
+    }
+
+    return i > 4 ? -1 : 0;
+}
+
+static void stub_broker_respond_id(stub_broker_t *broker, unsigned char type,
+    unsigned char *packet_id)
+{
+    unsigned char resp[4];
+
+    resp[0] = type;
+    resp[1] = 2;
+    resp[2] = packet_id[0];
+    resp[3] = packet_id[1];
+    mem_pipe_write(&broker->to_client, resp, sizeof(resp));
+}
+
+static void stub_broker_handle_subscribe(stub_broker_t *broker,
+    unsigned char *var, long len)
+{
+    unsigned char resp[256];
+    long pos = 2;
+    size_t cnt = 4;
+
+    while (pos + 2 < len && cnt < sizeof(resp)) {
+        long topic_len = (var[pos] << 8) | var[pos + 1];
+        pos += 2 + topic_len;
+        if (pos >= len)
+            break;
+        resp[cnt++] = var[pos++] & 3;
+    }
+
+    resp[0] = LMQTT_TYPE_SUBACK << 4;
+    resp[1] = cnt - 2;
+    resp[2] = var[0];
+    resp[3] = var[1];
+    mem_pipe_write(&broker->to_client, resp, cnt);
+}
+
+static void stub_broker_handle_publish(stub_broker_t *broker,
+    unsigned char flags, unsigned char *var, long len)
+{
+    int qos = (flags >> 1) & 3;
+    long topic_len = (var[0] << 8) | var[1];
+    long pos = 2 + topic_len;
+    unsigned char *packet_id = &var[pos];
+
+    if (qos > 0)
+        pos += 2;
+
+    if (broker->on_publish)
+        broker->on_publish(broker->on_publish_data, &var[pos], len - pos);
+
+    if (qos == 1)
+        stub_broker_respond_id(broker, LMQTT_TYPE_PUBACK << 4, packet_id);
+    else if (qos == 2)
+        stub_broker_respond_id(broker, LMQTT_TYPE_PUBREC << 4, packet_id);
+}
+
+static void stub_broker_handle(stub_broker_t *broker, unsigned char *packet,
+    long header_len, long len)
+{
+    static const unsigned char connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    static const unsigned char pingresp[] = { 0xd0, 0x00 };
+    unsigned char *var = &packet[header_len];
+
+    switch (packet[0] >> 4) {
+        case LMQTT_TYPE_CONNECT:
+            mem_pipe_write(&broker->to_client, connack, sizeof(connack));
+            break;
+        case LMQTT_TYPE_SUBSCRIBE:
+            stub_broker_handle_subscribe(broker, var, len);
+            break;
+        case LMQTT_TYPE_UNSUBSCRIBE:
+            stub_broker_respond_id(broker, LMQTT_TYPE_UNSUBACK << 4, var);
+            break;
+        case LMQTT_TYPE_PUBLISH:
+            stub_broker_handle_publish(broker, packet[0] & 0x0f, var, len);
+            break;
+        case LMQTT_TYPE_PUBREL:
+            stub_broker_respond_id(broker, LMQTT_TYPE_PUBCOMP << 4, var);
+            break;
+        case LMQTT_TYPE_PINGREQ:
+            mem_pipe_write(&broker->to_client, pingresp, sizeof(pingresp));
+            break;
+        case LMQTT_TYPE_DISCONNECT:
+            broker->disconnected = 1;
+            break;
+    }
+}
+
+void stub_broker_init(stub_broker_t *broker)
+{
+    memset(broker, 0, sizeof(*broker));
+    mem_pipe_init(&broker->to_broker);
+    mem_pipe_init(&broker->to_client);
+}
+
+/* Consumes every complete packet available in `to_broker`, as long as there is
+   room for the largest possible response. Returns the number of packets
+   handled, or -1 if the stream is malformed. */
+int stub_broker_process(stub_broker_t *broker)
+{
+    mem_pipe_t *in = &broker->to_broker;
+    int result = 0;
+
+    while (in->len > in->pos && mem_pipe_space(&broker->to_client) >= 256) {
+        long header_len, remaining_length;
+        long len = stub_broker_packet_length(&in->buf[in->pos],
+            in->len - in->pos, &header_len, &remaining_length);
+
+        if (len < 0)
+            return -1;
+        if (len == 0)
+            break;
+
+        stub_broker_handle(broker, &in->buf[in->pos], header_len,
+            remaining_length);
+        in->pos += len;
+        broker->packets_received += 1;
+        result += 1;
+    }
+
+    if (in->pos == in->len)
+        mem_pipe_init(in);
+    return result;
+}
+
+lmqtt_io_result_t stub_client_read(void *data, void *buf, size_t buf_len,
+    size_t *bytes_read, int *os_error)
+{
+    stub_broker_t *broker = (stub_broker_t *) data;
+
+    *bytes_read = mem_pipe_read(&broker->to_client, buf, buf_len);
+    return *bytes_read > 0 ? LMQTT_IO_SUCCESS : LMQTT_IO_WOULD_BLOCK;
+}
+
+lmqtt_io_result_t stub_client_write(void *data, void *buf, size_t buf_len,
+    size_t *bytes_written, int *os_error)
+{
+    stub_broker_t *broker = (stub_broker_t *) data;
+
+    *bytes_written = mem_pipe_write(&broker->to_broker, buf, buf_len);
+    return *bytes_written > 0 ? LMQTT_IO_SUCCESS : LMQTT_IO_WOULD_BLOCK;
+}
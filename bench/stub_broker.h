@@ -0,0 +1,40 @@
+#ifndef _BENCH_STUB_BROKER_H
+#define _BENCH_STUB_BROKER_H
+
+#include <stddef.h>
+#include "lightmqtt/core.h"
+
+#define MEM_PIPE_SIZE 262144
+
+/* One direction of an in-memory connection. Bytes are appended at `len` and
+   consumed from `pos`; the buffer is compacted when the reader catches up. */
+typedef struct {
+    unsigned char buf[MEM_PIPE_SIZE];
+    size_t pos;
+    size_t len;
+} mem_pipe_t;
+
+typedef void (*stub_broker_on_publish_t)(void *, unsigned char *, size_t);
+
+/* Server side of a single connection. `to_broker` is written by the client and
+   `to_client` is read by it (see stub_client_read() and stub_client_write()).
+   The broker answers CONNECT, SUBSCRIBE, UNSUBSCRIBE, PUBLISH, PUBREL and
+   PINGREQ with the corresponding acknowledgement. */
+typedef struct {
+    mem_pipe_t to_broker;
+    mem_pipe_t to_client;
+    int disconnected;
+    unsigned long packets_received;
+    stub_broker_on_publish_t on_publish;
+    void *on_publish_data;
+} stub_broker_t;
+
+void stub_broker_init(stub_broker_t *broker);
+int stub_broker_process(stub_broker_t *broker);
+
+lmqtt_io_result_t stub_client_read(void *data, void *buf, size_t buf_len,
+    size_t *bytes_read, int *os_error);
+lmqtt_io_result_t stub_client_write(void *data, void *buf, size_t buf_len,
+    size_t *bytes_written, int *os_error);
+
+#endif
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#include "lightmqtt/broker.h"
+
+#include "helpers.h"
+
+#define MAX_CLIENTS 32
+#define MESSAGE_COUNT 64
+#define MESSAGE_SIZE 1024
+
+typedef struct {
+    int socket_fd;
+    int blocked_wr;
+    lmqtt_broker_session_t session;
+    lmqtt_store_entry_t entries[32];
+    unsigned char rx_buffer[512];
+    unsigned char tx_buffer[512];
+    lmqtt_packet_id_t id_set_items[16];
+    lmqtt_broker_delivery_t deliveries[32];
+    lmqtt_subscription_t subscriptions[64];
+    char topics[256];
+} client_slot_t;
+
+static lmqtt_broker_t broker;
+static lmqtt_broker_node_t nodes[256];
+static lmqtt_broker_subscription_t subscriptions[256];
+static lmqtt_broker_message_t messages[MESSAGE_COUNT];
+static char message_data[MESSAGE_COUNT * MESSAGE_SIZE];
+static client_slot_t slots[MAX_CLIENTS];
+
+void accept_client(int listen_fd)
+{
+    lmqtt_client_callbacks_t callbacks;
+    lmqtt_broker_session_buffers_t buffers;
+    client_slot_t *slot = NULL;
+    int fd;
+    int i;
+
+    fd = socket_accept(listen_fd);
+    if (fd == -1)
+        return;
+
+    for (i = 0; i < MAX_CLIENTS && !slot; i++) {
+        if (slots[i].socket_fd == -1)
+            slot = &slots[i];
+    }
+
+    if (!slot) {
+        fprintf(stderr, "too many clients\n");
+        socket_close(fd);
+        return;
+    }
+
+    slot->socket_fd = fd;
+    slot->blocked_wr = 0;
+
+    callbacks.data = &slot->socket_fd;
+    callbacks.read = &file_read;
+    callbacks.write = &file_write;
+    callbacks.get_time = &get_time;
+
+    buffers.store_size = sizeof(slot->entries);
+    buffers.store = slot->entries;
+    buffers.rx_buffer_size = sizeof(slot->rx_buffer);
+    buffers.rx_buffer = slot->rx_buffer;
+    buffers.tx_buffer_size = sizeof(slot->tx_buffer);
+    buffers.tx_buffer = slot->tx_buffer;
+    buffers.id_set_size = sizeof(slot->id_set_items) /
+        sizeof(slot->id_set_items[0]);
+    buffers.id_set = slot->id_set_items;
+    buffers.deliveries_size = sizeof(slot->deliveries);
+    buffers.deliveries = slot->deliveries;
+    buffers.subscriptions_size = sizeof(slot->subscriptions);
+    buffers.subscriptions = slot->subscriptions;
+    buffers.topics_size = sizeof(slot->topics);
+    buffers.topics = slot->topics;
+
+    lmqtt_broker_session_initialize(&slot->session, &broker, &callbacks,
+        &buffers);
+    fprintf(stderr, "client %d connected\n", (int) (slot - slots));
+}
+
+void close_client(client_slot_t *slot)
+{
+    lmqtt_broker_session_finalize(&slot->session);
+    socket_close(slot->socket_fd);
+    slot->socket_fd = -1;
+}
+
+void process_client(client_slot_t *slot)
+{
+    int res = lmqtt_broker_session_run_once(&slot->session);
+
+    if (LMQTT_IS_ERROR(res)) {
+        fprintf(stderr, "client %d error: %d\n", (int) (slot - slots),
+            LMQTT_ERROR_NUM(res));
+        close_client(slot);
+        return;
+    }
+
+    if (LMQTT_IS_EOF(res)) {
+        fprintf(stderr, "client %d disconnected\n", (int) (slot - slots));
+        close_client(slot);
+        return;
+    }
+
+    slot->blocked_wr = LMQTT_WOULD_BLOCK_CONN_WR(res);
+}
+
+void run(const char *address, unsigned short port)
+{
+    lmqtt_broker_buffers_t buffers;
+    int listen_fd;
+    int i;
+
+    buffers.nodes_size = sizeof(nodes);
+    buffers.nodes = nodes;
+    buffers.subscriptions_size = sizeof(subscriptions);
+    buffers.subscriptions = subscriptions;
+    buffers.messages_size = sizeof(messages);
+    buffers.messages = messages;
+    buffers.message_data_size = sizeof(message_data);
+    buffers.message_data = message_data;
+
+    lmqtt_broker_initialize(&broker, &buffers);
+
+    for (i = 0; i < MAX_CLIENTS; i++)
+        slots[i].socket_fd = -1;
+
+    listen_fd = socket_listen(address, port);
+    if (listen_fd == -1) {
+        fprintf(stderr, "socket_listen failed\n");
+        exit(1);
+    }
+
+    fprintf(stderr, "listening on %s:%u\n", address, port);
+
+    while (1) {
+        struct timeval timeout;
+        fd_set read_set;
+        fd_set write_set;
+        int max_fd = listen_fd;
+        int pending = 0;
+
+        FD_ZERO(&read_set);
+        FD_ZERO(&write_set);
+        FD_SET(listen_fd, &read_set);
+
+        for (i = 0; i < MAX_CLIENTS; i++) {
+            client_slot_t *slot = &slots[i];
+
+            if (slot->socket_fd == -1)
+                continue;
+
+            FD_SET(slot->socket_fd, &read_set);
+            if (slot->blocked_wr)
+                FD_SET(slot->socket_fd, &write_set);
+            else if (lmqtt_broker_session_has_output(&slot->session))
+                pending = 1;
+            if (slot->socket_fd > max_fd)
+                max_fd = slot->socket_fd;
+        }
+
+        /* messages published by a client are queued to its subscribers, which
+           must be processed without waiting for them to become readable; the
+           timeout also lets idle sessions detect keep alive expiration */
+        timeout.tv_sec = pending ? 0 : 1;
+        timeout.tv_usec = 0;
+
+        if (select(max_fd + 1, &read_set, &write_set, NULL, &timeout) == -1) {
+            fprintf(stderr, "select failed: %d!\n", errno);
+            exit(1);
+        }
+
+        if (FD_ISSET(listen_fd, &read_set))
+            accept_client(listen_fd);
+
+        for (i = 0; i < MAX_CLIENTS; i++) {
+            if (slots[i].socket_fd != -1)
+                process_client(&slots[i]);
+        }
+    }
+}
+
+#define HAS_OPT_ARG(str) (i + 1 < argc && strcmp(str, argv[i]) == 0)
+
+int main(int argc, const char *argv[])
+{
+    const char *address = "127.0.0.1";
+    unsigned short port = 1883;
+    int opt_error = 0;
+
+    for (int i = 1; i < argc; ) {
+        if (HAS_OPT_ARG("-h")) {
+            address = argv[i + 1];
+            i += 2;
+            continue;
+        }
+        if (HAS_OPT_ARG("-p")) {
+            port = atoi(argv[i + 1]);
+            i += 2;
+            continue;
+        }
+        opt_error = 1;
+        break;
+    }
+
+    if (opt_error) {
+        fprintf(stderr, "Syntax error.\n\n");
+        fprintf(stderr, "Usage: %s [-h <HOST>] [-p <PORT>]\n", argv[0]);
+        fprintf(stderr, "    -h HOST    Address to listen on "
+            "(default: 127.0.0.1)\n");
+        fprintf(stderr, "    -p PORT    Port to listen on (default: 1883)\n");
+        return 1;
+    }
+
+    run(address, port);
+    return 0;
+}
@@ -87,6 +87,36 @@ int socket_open(const char *address, unsigned short port)
     return result;
 }
 
+int socket_listen(const char *address, unsigned short port)
+{
+    struct sockaddr_in sin;
+    int reuse = 1;
+
+    int result = socket(AF_INET, SOCK_STREAM, 0);
+    fcntl(result, F_SETFL, O_NONBLOCK);
+    setsockopt(result, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    if (inet_pton(AF_INET, address, &sin.sin_addr) == 0 ||
+            bind(result, (struct sockaddr *) &sin, sizeof(sin)) != 0 ||
+            listen(result, 16) != 0) {
+        close(result);
+        return -1;
+    }
+
+    return result;
+}
+
+int socket_accept(int fd)
+{
+    int result = accept(fd, NULL, NULL);
+
+    if (result != -1)
+        fcntl(result, F_SETFL, O_NONBLOCK);
+    return result;
+}
+
 void socket_close(int fd)
 {
     close(fd);
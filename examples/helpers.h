@@ -10,6 +10,8 @@ lmqtt_io_result_t file_read(void *data, void *buf, size_t buf_len,
 lmqtt_io_result_t file_write(void *data, void *buf, size_t buf_len,
     size_t *bytes_written, int *os_error);
 int socket_open(const char *address, unsigned short port);
+int socket_listen(const char *address, unsigned short port);
+int socket_accept(int fd);
 void socket_close(int fd);
 
 #endif
@@ -25,12 +25,22 @@ int on_connect(void *data, lmqtt_connect_t *connect, int succeeded)
     return 1;
 }
 
-void fail_connection(unsigned int secs)
+void on_reconnect(void *data, unsigned int attempts, long secs, long nsecs)
 {
-    socket_close(socket_fd);
+    fprintf(stderr, "recovered after %u attempt(s) in %ld.%03ld seconds\n",
+        attempts, secs, nsecs / 1000000);
+}
+
+void fail_connection()
+{
+    long secs, nsecs;
+
+    if (socket_fd != -1)
+        socket_close(socket_fd);
     socket_fd = -1;
-    fprintf(stderr, "waiting %u seconds...\n", secs);
-    sleep(secs);
+    if (lmqtt_client_get_timeout(&client, &secs, &nsecs))
+        fprintf(stderr, "reconnecting in %ld.%03ld seconds...\n", secs,
+            nsecs / 1000000);
 }
 
 void run(const char *address, unsigned short port)
@@ -68,13 +78,18 @@ void run(const char *address, unsigned short port)
     lmqtt_client_initialize(&client, &client_callbacks, &buffers);
 
     lmqtt_client_set_on_connect(&client, on_connect, &client);
+    lmqtt_client_set_on_reconnect(&client, on_reconnect, &client);
     lmqtt_client_set_default_timeout(&client, default_timeout);
+    lmqtt_client_set_reconnect(&client, 1, 60, 0);
 
     connect_data.keep_alive = keep_alive;
     connect_data.clean_session = 0;
     connect_data.client_id.buf = id;
     connect_data.client_id.len = strlen(id);
 
+    lmqtt_client_connect(&client, &connect_data);
+    socket_fd = socket_open(address, port);
+
     while (1) {
         long secs, nsecs;
         int max_fd;
@@ -84,28 +99,32 @@ void run(const char *address, unsigned short port)
         int res;
 
         if (socket_fd == -1) {
-            socket_fd = socket_open(address, port);
-            if (socket_fd == -1) {
-                fprintf(stderr, "socket_open failed\n");
-                exit(1);
+            if (!lmqtt_client_reconnect(&client)) {
+                lmqtt_client_get_timeout(&client, &secs, &nsecs);
+                timeout.tv_sec = secs;
+                timeout.tv_usec = nsecs / 1000;
+                select(0, NULL, NULL, NULL, &timeout);
+                continue;
             }
 
-            fprintf(stderr, "socket opened\n");
-            lmqtt_client_reset(&client);
-            lmqtt_client_connect(&client, &connect_data);
+            /* if this fails the client fails writing and schedules the next
+               attempt */
+            socket_fd = socket_open(address, port);
+            fprintf(stderr, socket_fd == -1 ? "socket_open failed\n" :
+                "socket opened\n");
         }
 
         res = lmqtt_client_run_once(&client, &str_rd, &str_wr);
 
         if (LMQTT_IS_ERROR(res)) {
             fprintf(stderr, "client error: %d\n", LMQTT_ERROR_NUM(res));
-            fail_connection(5);
+            fail_connection();
             continue;
         }
 
         if (LMQTT_IS_EOF_RD(res)) {
             fprintf(stderr, "they disconnected\n");
-            fail_connection(5);
+            fail_connection();
             continue;
         }
 
@@ -0,0 +1,163 @@
+#ifndef _LIGHTMQTT_BROKER_H_
+#define _LIGHTMQTT_BROKER_H_
+
+#include <lightmqtt/client.h>
+
+/* maximum length of a single level of a topic filter (e.g. "sensors" in
+   "sensors/+/temperature") */
+#ifndef LMQTT_BROKER_LEVEL_SIZE
+#define LMQTT_BROKER_LEVEL_SIZE 32
+#endif
+
+/* maximum number of SUBACK packets queued in a session at a time */
+#ifndef LMQTT_BROKER_MAX_SUBACKS
+#define LMQTT_BROKER_MAX_SUBACKS 4
+#endif
+
+#define LMQTT_BROKER_NODE_SIZE sizeof(lmqtt_broker_node_t)
+#define LMQTT_BROKER_SUBSCRIPTION_SIZE sizeof(lmqtt_broker_subscription_t)
+#define LMQTT_BROKER_MESSAGE_SIZE sizeof(lmqtt_broker_message_t)
+#define LMQTT_BROKER_DELIVERY_SIZE sizeof(lmqtt_broker_delivery_t)
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+struct _lmqtt_broker_t;
+struct _lmqtt_broker_session_t;
+struct _lmqtt_broker_subscription_t;
+
+typedef struct _lmqtt_broker_node_t {
+    struct _lmqtt_broker_node_t *parent;
+    struct _lmqtt_broker_node_t *children;
+    struct _lmqtt_broker_node_t *next;
+    struct _lmqtt_broker_subscription_t *subscriptions;
+    size_t level_len;
+    char level[LMQTT_BROKER_LEVEL_SIZE];
+} lmqtt_broker_node_t;
+
+typedef struct _lmqtt_broker_subscription_t {
+    lmqtt_broker_node_t *node;
+    struct _lmqtt_broker_session_t *session;
+    lmqtt_qos_t qos;
+    struct _lmqtt_broker_subscription_t *next;
+    struct _lmqtt_broker_subscription_t *session_next;
+} lmqtt_broker_subscription_t;
+
+/* a received message, shared by all deliveries to its subscribers */
+typedef struct _lmqtt_broker_message_t {
+    int refs;
+    size_t topic_len;
+    size_t payload_len;
+    char *buf;
+    struct _lmqtt_broker_message_t *next;
+} lmqtt_broker_message_t;
+
+typedef struct _lmqtt_broker_delivery_t {
+    lmqtt_publish_t publish;
+    lmqtt_broker_message_t *message;
+    struct _lmqtt_broker_session_t *session;
+    struct _lmqtt_broker_delivery_t *next;
+} lmqtt_broker_delivery_t;
+
+/* `message_data` is split evenly among the messages, limiting the size of the
+   topic plus payload of each PUBLISH; larger messages are dropped */
+typedef struct _lmqtt_broker_buffers_t {
+    size_t nodes_size;
+    void *nodes;
+    size_t subscriptions_size;
+    void *subscriptions;
+    size_t messages_size;
+    void *messages;
+    size_t message_data_size;
+    void *message_data;
+} lmqtt_broker_buffers_t;
+
+/* `subscriptions` (an array of lmqtt_subscription_t) and `topics` hold the
+   topic filters of incoming SUBSCRIBE and UNSUBSCRIBE packets; `deliveries`
+   limits how many messages may be queued to the session */
+typedef struct _lmqtt_broker_session_buffers_t {
+    size_t store_size;
+    void *store;
+    size_t rx_buffer_size;
+    void *rx_buffer;
+    size_t tx_buffer_size;
+    void *tx_buffer;
+    size_t id_set_size;
+    void *id_set;
+    size_t deliveries_size;
+    void *deliveries;
+    size_t subscriptions_size;
+    void *subscriptions;
+    size_t topics_size;
+    void *topics;
+} lmqtt_broker_session_buffers_t;
+
+typedef struct _lmqtt_broker_session_t {
+    struct _lmqtt_broker_t *broker;
+
+    int connected;
+    int disconnected;
+    unsigned short keep_alive;
+    lmqtt_time_t last_touch;
+    unsigned long generation;
+
+    lmqtt_rx_buffer_t rx_state;
+    lmqtt_tx_buffer_t tx_state;
+    unsigned char *read_buf;
+    size_t read_buf_capacity;
+    unsigned char *write_buf;
+    size_t write_buf_pos;
+    size_t write_buf_capacity;
+    lmqtt_store_t store;
+
+    lmqtt_client_callbacks_t callbacks;
+    lmqtt_message_callbacks_t message_callbacks;
+    lmqtt_request_callbacks_t request_callbacks;
+
+    lmqtt_connect_t connack;
+    lmqtt_subscribe_t subacks[LMQTT_BROKER_MAX_SUBACKS];
+    int suback_count;
+    int suback_next;
+    lmqtt_subscription_t *requests;
+    size_t requests_used;
+    size_t requests_capacity;
+    char *topics;
+    size_t topics_used;
+    size_t topics_capacity;
+
+    lmqtt_broker_delivery_t *free_deliveries;
+    lmqtt_broker_subscription_t *subscriptions;
+    lmqtt_broker_message_t *rx_message;
+
+    lmqtt_error_t error;
+    int os_error;
+} lmqtt_broker_session_t;
+
+typedef struct _lmqtt_broker_t {
+    lmqtt_broker_node_t root;
+    lmqtt_broker_node_t *free_nodes;
+    lmqtt_broker_subscription_t *free_subscriptions;
+    lmqtt_broker_message_t *free_messages;
+    size_t message_capacity;
+    unsigned long generation;
+    unsigned long dropped;
+} lmqtt_broker_t;
+
+void lmqtt_broker_initialize(lmqtt_broker_t *broker,
+    lmqtt_broker_buffers_t *buffers);
+unsigned long lmqtt_broker_get_dropped(lmqtt_broker_t *broker);
+
+void lmqtt_broker_session_initialize(lmqtt_broker_session_t *session,
+    lmqtt_broker_t *broker, lmqtt_client_callbacks_t *callbacks,
+    lmqtt_broker_session_buffers_t *buffers);
+void lmqtt_broker_session_finalize(lmqtt_broker_session_t *session);
+int lmqtt_broker_session_has_output(lmqtt_broker_session_t *session);
+int lmqtt_broker_session_get_os_error(lmqtt_broker_session_t *session);
+int lmqtt_broker_session_run_once(lmqtt_broker_session_t *session);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -11,6 +11,7 @@
 #define LMQTT_RES_WOULD_BLOCK_DATA_WR 0x0800
 #define LMQTT_RES_EOF                 0x1000
 #define LMQTT_RES_QUEUEABLE           0x2000
+#define LMQTT_RES_WOULD_BLOCK_POOL    0x4000
 
 #define LMQTT_RES_EOF_RD (LMQTT_RES_EOF | LMQTT_RES_WOULD_BLOCK_CONN_RD)
 #define LMQTT_RES_EOF_WR (LMQTT_RES_EOF | LMQTT_RES_WOULD_BLOCK_CONN_WR)
@@ -33,6 +34,8 @@
     (((res) & LMQTT_RES_EOF_WR) == LMQTT_RES_EOF_WR)
 #define LMQTT_IS_QUEUEABLE(res) \
     (((res) & LMQTT_RES_QUEUEABLE) != 0)
+#define LMQTT_WOULD_BLOCK_POOL(res) \
+    (((res) & LMQTT_RES_WOULD_BLOCK_POOL) != 0)
 #define LMQTT_ERROR_NUM(res) \
     ((res) & LMQTT_RES_ERROR)
 
@@ -47,6 +50,46 @@ typedef struct _lmqtt_client_callbacks_t {
     lmqtt_get_time_t get_time;
 } lmqtt_client_callbacks_t;
 
+/* fixed-size buffers shared by many clients; free buffers are chained through
+   their first bytes, so `buffer_size` must hold at least a pointer */
+typedef struct _lmqtt_buffer_pool_t {
+    unsigned char *free_list;
+    size_t buffer_size;
+    size_t available;
+} lmqtt_buffer_pool_t;
+
+/* allocator for incoming messages: topics and payloads are taken from the
+   smallest of `classes` (sorted by buffer size) with a free buffer large
+   enough and given back after on_publish, so the buffers are only valid
+   during that callback; QoS 0 messages which do not fit are ignored, while
+   QoS 1 and 2 ones fail the connection so that they are not acknowledged */
+typedef struct _lmqtt_message_slab_t {
+    lmqtt_buffer_pool_t *classes;
+    size_t class_count;
+    lmqtt_message_on_publish_t on_publish;
+    void *on_publish_data;
+    unsigned long hits;
+    unsigned long misses;
+
+    struct {
+        lmqtt_buffer_pool_t *topic_class;
+        void *topic;
+        lmqtt_buffer_pool_t *payload_class;
+        void *payload;
+    } internal;
+} lmqtt_message_slab_t;
+
+/* publish objects owned by the client: lmqtt_client_publish_copy() copies the
+   topic and payload of a message into one of `items` and its slice of `data`,
+   and the object is given back once on_publish has been called for it */
+typedef struct _lmqtt_publish_pool_t {
+    lmqtt_buffer_pool_t free;
+    lmqtt_publish_t *items;
+    size_t count;
+    char *data;
+    size_t data_size;
+} lmqtt_publish_pool_t;
+
 typedef struct _lmqtt_client_buffers_t {
     size_t store_size;
     void *store;
@@ -62,6 +105,35 @@ typedef int (*lmqtt_client_on_connect_t)(void *, lmqtt_connect_t *, int);
 typedef int (*lmqtt_client_on_subscribe_t)(void *, lmqtt_subscribe_t *, int);
 typedef int (*lmqtt_client_on_unsubscribe_t)(void *, lmqtt_subscribe_t *, int);
 typedef int (*lmqtt_client_on_publish_t)(void *, lmqtt_publish_t *, int);
+/* called after a successful reconnection with the number of attempts and the
+   time elapsed since the connection was lost */
+typedef void (*lmqtt_client_on_reconnect_t)(void *, unsigned int, long, long);
+
+typedef struct _lmqtt_reconnect_t {
+    unsigned short min_delay;
+    unsigned short max_delay;
+    unsigned long seed;
+    unsigned int attempts;
+    long delay;
+    int pending;
+    lmqtt_time_t lost_at;
+    lmqtt_time_t failed_at;
+    lmqtt_connect_t *connect;
+} lmqtt_reconnect_t;
+
+/* subscriptions acknowledged by the server; when it did not keep the session
+   they are restored with a single SUBSCRIBE after CONNACK (topics are
+   referenced, not copied) */
+typedef struct _lmqtt_subscription_registry_t {
+    lmqtt_subscription_t *items;
+    /* copy of `items` sent by the restore SUBSCRIBE, so that the registry can
+       change while it is in flight */
+    lmqtt_subscription_t *restore_items;
+    size_t capacity;
+    size_t count;
+    int restoring;
+    lmqtt_subscribe_t subscribe;
+} lmqtt_subscription_registry_t;
 
 struct _lmqtt_client_t;
 
@@ -74,9 +146,21 @@ typedef struct _lmqtt_client_t {
     void *on_unsubscribe_data;
     lmqtt_client_on_publish_t on_publish;
     void *on_publish_data;
+    lmqtt_client_on_reconnect_t on_reconnect;
+    void *on_reconnect_data;
 
     int closed;
     int clean_session;
+    unsigned short inflight_window;
+    unsigned short keep_alive_jitter;
+    lmqtt_rate_limiter_t *connect_limiter;
+    lmqtt_buffer_pool_t *buffer_pool;
+    lmqtt_publish_pool_t *publish_pool;
+    long subscribe_batch_size;
+    lmqtt_subscription_registry_t registry;
+    int preconnect_queue;
+    size_t preconnect_count;
+    int pipeline_connect;
 
     lmqtt_rx_buffer_t rx_state;
     lmqtt_tx_buffer_t tx_state;
@@ -90,6 +174,9 @@ typedef struct _lmqtt_client_t {
     lmqtt_store_t connect_store;
     lmqtt_store_t *current_store;
     lmqtt_store_entry_t connect_store_entry;
+    lmqtt_publish_ring_t qos0_ring;
+    lmqtt_ack_queue_t ack_queue;
+    lmqtt_reconnect_t reconnect;
 
     lmqtt_client_callbacks_t callbacks;
     lmqtt_message_callbacks_t message_callbacks;
@@ -118,7 +205,15 @@ int lmqtt_client_subscribe(lmqtt_client_t *client,
 int lmqtt_client_unsubscribe(lmqtt_client_t *client,
     lmqtt_subscribe_t *subscribe);
 int lmqtt_client_publish(lmqtt_client_t *client, lmqtt_publish_t *publish);
+/* publishes a copy of `publish` taken from the client's publish pool, so the
+   message and its buffers may be reused as soon as this returns; on_publish
+   receives the copy, not `publish`, and the copy is recycled once the callback
+   returns, so the message should be identified by its `user_data`, which is
+   copied along */
+int lmqtt_client_publish_copy(lmqtt_client_t *client,
+    lmqtt_publish_t *publish);
 int lmqtt_client_disconnect(lmqtt_client_t *client);
+int lmqtt_client_reconnect(lmqtt_client_t *client);
 
 void lmqtt_client_set_on_connect(lmqtt_client_t *client,
     lmqtt_client_on_connect_t on_connect, void *on_connect_data);
@@ -128,9 +223,72 @@ void lmqtt_client_set_on_unsubscribe(lmqtt_client_t *client,
     lmqtt_client_on_unsubscribe_t on_unsubscribe, void *on_unsubscribe_data);
 void lmqtt_client_set_on_publish(lmqtt_client_t *client,
     lmqtt_client_on_publish_t on_publish, void *on_publish_data);
+void lmqtt_client_set_on_reconnect(lmqtt_client_t *client,
+    lmqtt_client_on_reconnect_t on_reconnect, void *on_reconnect_data);
 void lmqtt_client_set_message_callbacks(lmqtt_client_t *client,
     lmqtt_message_callbacks_t *message_callbacks);
 
+/* limits the number of unacknowledged QoS 1 and 2 messages from the next
+   connection on; with MQTT 5 the Receive Maximum given by the server also
+   applies. While the window is full, only acknowledgements and PINGREQ are
+   sent ahead of the held messages; other requests keep their order */
+void lmqtt_client_set_inflight_window(lmqtt_client_t *client,
+    unsigned short window);
+/* [MQTT 5] table used to send repeated topics as topic aliases */
+void lmqtt_client_set_topic_aliases(lmqtt_client_t *client,
+    lmqtt_topic_alias_t *aliases, size_t aliases_size);
+/* QoS 0 messages are queued here instead of the main store, and sent ahead of
+   it; must be set before connecting */
+void lmqtt_client_set_qos_0_ring(lmqtt_client_t *client,
+    lmqtt_publish_t **items, size_t items_size);
+/* acknowledgements to incoming QoS 1 and 2 messages are queued here instead of
+   the main store, and sent ahead of it; must be set before connecting */
+void lmqtt_client_set_ack_queue(lmqtt_client_t *client,
+    lmqtt_ack_t *items, size_t items_size);
+/* after a lost connection, lmqtt_client_reconnect() waits a random delay
+   between half and all of `min_delay` (in seconds), doubled for each failed
+   attempt up to `max_delay`; clients with the same `seed` (0 derives it from
+   the client id) wait the same delays */
+void lmqtt_client_set_reconnect(lmqtt_client_t *client,
+    unsigned short min_delay, unsigned short max_delay, unsigned long seed);
+/* sends each PINGREQ up to `percent` (at most 50) of the keep alive period
+   early, at random, so that clients started together drift apart */
+void lmqtt_client_set_keep_alive_jitter(lmqtt_client_t *client,
+    unsigned short percent);
+/* limits the rate of lmqtt_client_reconnect(); the limiter may be shared by
+   many clients */
+void lmqtt_client_set_connect_limiter(lmqtt_client_t *client,
+    lmqtt_rate_limiter_t *limiter);
+/* borrows rx and tx buffers from `pool` only while there is partial data in
+   them, instead of using those given to lmqtt_client_initialize(); when the
+   pool is empty lmqtt_client_run_once() reports LMQTT_WOULD_BLOCK_POOL instead
+   of blocking on the connection, which may well be ready: the client should
+   not be polled for that direction but run again once another client of the
+   pool has made progress (or after its timeout) */
+void lmqtt_client_set_buffer_pool(lmqtt_client_t *client,
+    lmqtt_buffer_pool_t *pool);
+void lmqtt_client_set_publish_pool(lmqtt_client_t *client,
+    lmqtt_publish_pool_t *pool);
+/* accepts publishes and subscriptions while the client is not connected,
+   queueing them to be sent after the next CONNACK, even if the session is
+   discarded */
+void lmqtt_client_set_preconnect_queue(lmqtt_client_t *client,
+    int enabled);
+/* sends the requests queued with the pre-connect queue right after CONNECT,
+   without waiting for CONNACK, when there is nothing left from a previous
+   session; they are sent again if the connection is refused */
+void lmqtt_client_set_pipelined_connect(lmqtt_client_t *client,
+    int enabled);
+/* keeps track of the subscriptions in the first half of `items`, the second
+   half holding the copy sent when restoring them; subscriptions which do not
+   fit are not restored */
+void lmqtt_client_set_subscription_registry(lmqtt_client_t *client,
+    lmqtt_subscription_t *items, size_t items_size);
+/* sends SUBSCRIBE requests queued one after the other in a single packet,
+   while its remaining length does not exceed `max_length` (0 disables it);
+   on_subscribe is still called once for each request */
+void lmqtt_client_set_subscribe_batch(lmqtt_client_t *client,
+    long max_length);
 void lmqtt_client_set_default_timeout(lmqtt_client_t *client,
     unsigned short secs);
 int lmqtt_client_get_os_error(lmqtt_client_t *client);
@@ -138,6 +296,23 @@ int lmqtt_client_get_timeout(lmqtt_client_t *client, long *secs, long *nsecs);
 int lmqtt_client_run_once(lmqtt_client_t *client, lmqtt_string_t **str_rd,
     lmqtt_string_t **str_wr);
 
+void lmqtt_buffer_pool_initialize(lmqtt_buffer_pool_t *pool, void *memory,
+    size_t memory_size, size_t buffer_size);
+void *lmqtt_buffer_pool_get(lmqtt_buffer_pool_t *pool);
+void lmqtt_buffer_pool_put(lmqtt_buffer_pool_t *pool, void *buffer);
+
+/* `data_size` bytes of `data` are split evenly between the objects in
+   `items`; each slice holds the topic followed by the payload */
+void lmqtt_publish_pool_initialize(lmqtt_publish_pool_t *pool,
+    lmqtt_publish_t *items, size_t items_size, void *data, size_t data_size);
+
+void lmqtt_message_slab_initialize(lmqtt_message_slab_t *slab,
+    lmqtt_buffer_pool_t *classes, size_t class_count);
+/* replaces the allocation callbacks in `callbacks` by the slab's; the
+   on_publish callback and its data are kept and called by the slab */
+void lmqtt_message_slab_set_callbacks(lmqtt_message_slab_t *slab,
+    lmqtt_message_callbacks_t *callbacks);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -86,7 +86,37 @@ typedef enum {
     /* UNSUBACK callback returned 0 */
     LMQTT_ERROR_CALLBACK_UNSUBACK,
     /* PUBLISH callback returned 0 */
-    LMQTT_ERROR_CALLBACK_PUBLISH
+    LMQTT_ERROR_CALLBACK_PUBLISH,
+    /* client-specific packet (CONNACK, SUBACK etc.) received in server role */
+    LMQTT_ERROR_DECODE_FIXED_HEADER_CLIENT_SPECIFIC,
+    /* protocol name or level in CONNECT is not MQTT 3.1.1 */
+    LMQTT_ERROR_DECODE_CONNECT_INVALID_PROTOCOL,
+    /* invalid combination of flags in variable header of CONNECT */
+    LMQTT_ERROR_DECODE_CONNECT_INVALID_FLAGS,
+    /* CONNECT payload does not match its flags and remaining length */
+    LMQTT_ERROR_DECODE_CONNECT_INVALID_LENGTH,
+    /* SUBSCRIBE or UNSUBSCRIBE payload has an empty or truncated topic */
+    LMQTT_ERROR_DECODE_SUBSCRIBE_INVALID_LENGTH,
+    /* invalid requested QoS byte in SUBSCRIBE payload */
+    LMQTT_ERROR_DECODE_SUBSCRIBE_INVALID_QOS,
+    /* string or subscription allocate callback returned an error */
+    LMQTT_ERROR_DECODE_REQUEST_ALLOCATE_FAILED,
+    /* [OS error] error writing request string using callback */
+    LMQTT_ERROR_DECODE_REQUEST_WRITE_FAILED,
+    /* store has no space available to respond to PINGREQ or UNSUBSCRIBE */
+    LMQTT_ERROR_DECODE_REQUEST_STORE_FULL,
+    /* CONNECT callback returned 0 */
+    LMQTT_ERROR_CALLBACK_CONNECT,
+    /* SUBSCRIBE callback returned 0 */
+    LMQTT_ERROR_CALLBACK_SUBSCRIBE,
+    /* UNSUBSCRIBE callback returned 0 */
+    LMQTT_ERROR_CALLBACK_UNSUBSCRIBE,
+    /* DISCONNECT callback returned 0 */
+    LMQTT_ERROR_CALLBACK_DISCONNECT,
+    /* [MQTT 5] malformed or unknown property in incoming packet */
+    LMQTT_ERROR_DECODE_INVALID_PROPERTIES,
+    /* [MQTT 5] CONNACK failed with a reason code not defined in MQTT 3.1.1 */
+    LMQTT_ERROR_CONNACK_REFUSED
 } lmqtt_error_t;
 
 typedef lmqtt_io_result_t (*lmqtt_io_callback_t)(void *, void *, size_t,
@@ -102,4 +132,14 @@ typedef lmqtt_io_result_t (*lmqtt_io_callback_t)(void *, void *, size_t,
     #define LMQTT_STATIC static
 #endif
 
+/* Functions which tests replace with mocks are called through pointers to
+   their `_impl` versions in test builds, and directly otherwise */
+#ifdef LMQTT_TEST
+    #define LMQTT_MOCKABLE(name) (*name)
+    #define LMQTT_MOCKABLE_IMPL(name) name##_impl
+#else
+    #define LMQTT_MOCKABLE(name) name
+    #define LMQTT_MOCKABLE_IMPL(name) name
+#endif
+
 #endif
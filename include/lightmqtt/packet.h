@@ -5,10 +5,25 @@
 #include <lightmqtt/core.h>
 #include <lightmqtt/store.h>
 
+/* maximum length of a topic kept in the topic alias table; longer topics are
+   always sent in full */
+#ifndef LMQTT_TOPIC_ALIAS_SIZE
+#define LMQTT_TOPIC_ALIAS_SIZE 64
+#endif
+
+#define LMQTT_TOPIC_ALIAS_ENTRY_SIZE sizeof(lmqtt_topic_alias_t)
+#define LMQTT_PUBLISH_RING_ENTRY_SIZE sizeof(lmqtt_publish_t *)
+#define LMQTT_ACK_QUEUE_ENTRY_SIZE sizeof(lmqtt_ack_t)
+
 #ifdef  __cplusplus
 extern "C" {
 #endif
 
+typedef enum {
+    LMQTT_PROTOCOL_MQTT_3_1_1 = 0,
+    LMQTT_PROTOCOL_MQTT_5
+} lmqtt_protocol_t;
+
 typedef enum {
     LMQTT_KIND_CONNECT = 200,
     LMQTT_KIND_PUBLISH_0,
@@ -21,7 +36,11 @@ typedef enum {
     LMQTT_KIND_SUBSCRIBE,
     LMQTT_KIND_UNSUBSCRIBE,
     LMQTT_KIND_PINGREQ,
-    LMQTT_KIND_DISCONNECT
+    LMQTT_KIND_DISCONNECT,
+    LMQTT_KIND_CONNACK,
+    LMQTT_KIND_SUBACK,
+    LMQTT_KIND_UNSUBACK,
+    LMQTT_KIND_PINGRESP
 } lmqtt_kind_t;
 
 typedef enum {
@@ -30,6 +49,12 @@ typedef enum {
     LMQTT_QOS_2
 } lmqtt_qos_t;
 
+typedef enum {
+    LMQTT_PUBLISH_STATUS_NONE = 0,
+    LMQTT_PUBLISH_STATUS_CONFLATED,
+    LMQTT_PUBLISH_STATUS_EXPIRED
+} lmqtt_publish_status_t;
+
 typedef enum {
     LMQTT_ENCODE_FINISHED = 110,
     LMQTT_ENCODE_CONTINUE,
@@ -63,12 +88,37 @@ typedef struct _lmqtt_id_set_t {
     size_t count;
 } lmqtt_id_set_t;
 
+typedef struct _lmqtt_topic_alias_t {
+    size_t len;
+    char topic[LMQTT_TOPIC_ALIAS_SIZE];
+} lmqtt_topic_alias_t;
+
+/* outgoing topic aliases (MQTT 5) of the current connection; alias `n` maps to
+   `items[n - 1]`, and at most `maximum` (as given by the server in CONNACK)
+   aliases are used */
+typedef struct _lmqtt_topic_alias_set_t {
+    lmqtt_topic_alias_t *items;
+    size_t capacity;
+    size_t count;
+    size_t next;
+    unsigned short maximum;
+} lmqtt_topic_alias_set_t;
+
+typedef struct _lmqtt_string_segment_t {
+    char *buf;
+    long len;
+} lmqtt_string_segment_t;
+
 typedef struct _lmqtt_string_t {
     long len;
     char *buf;
     void *data;
     lmqtt_io_callback_t read;
     lmqtt_io_callback_t write;
+    /* when set (instead of `buf` or the callbacks) the string is the
+       concatenation of the segments; see lmqtt_string_set_segments() */
+    lmqtt_string_segment_t *segments;
+    size_t segment_count;
     struct {
         long pos;
     } internal;
@@ -117,8 +167,14 @@ typedef struct _lmqtt_connect_t {
     lmqtt_string_t will_message;
     lmqtt_string_t user_name;
     lmqtt_string_t password;
+    lmqtt_protocol_t protocol;
+    /* [MQTT 5] sent as a property if greater than zero */
+    unsigned long session_expiry_interval;
     struct {
         unsigned char session_present;
+        unsigned char return_code;
+        unsigned short topic_alias_maximum;
+        unsigned short receive_maximum;
     } response;
 } lmqtt_connect_t;
 
@@ -127,27 +183,108 @@ typedef struct _lmqtt_subscribe_t {
     lmqtt_subscription_t *subscriptions;
     struct {
         lmqtt_subscription_t *current;
+        lmqtt_protocol_t protocol;
+        /* requests sent in the same packet; see lmqtt_subscribe_append() */
+        struct _lmqtt_subscribe_t *next;
     } internal;
 } lmqtt_subscribe_t;
 
+struct _lmqtt_shared_payload_t;
+
+typedef void (*lmqtt_shared_payload_release_t)(void *,
+    struct _lmqtt_shared_payload_t *);
+
+/* immutable payload shared by many messages; `references` counts the queued
+   messages using it and `release` is called when the last one completes */
+typedef struct _lmqtt_shared_payload_t {
+    lmqtt_string_t payload;
+    unsigned int references;
+    lmqtt_shared_payload_release_t release;
+    void *release_data;
+} lmqtt_shared_payload_t;
+
 typedef struct _lmqtt_publish_t {
     lmqtt_qos_t qos;
     unsigned char retain;
     lmqtt_string_t topic;
     lmqtt_string_t payload;
+    /* replace a queued, unsent message with the same topic which also has
+       this flag set instead of queueing a new one */
+    unsigned char conflate;
+    /* seconds a QoS 0 message may wait in the queue before it is dropped
+       unsent (0 means no limit) */
+    unsigned short expiry;
+    /* set by lmqtt_publish_set_shared_payload() */
+    lmqtt_shared_payload_t *shared_payload;
+    /* not used by the library; kept in the copy made by
+       lmqtt_client_publish_copy() */
+    void *user_data;
+    struct {
+        lmqtt_publish_status_t status;
+    } response;
     struct {
         int encode_count;
+        lmqtt_time_t queued_at;
+        lmqtt_protocol_t protocol;
+        unsigned short topic_alias;
+        int omit_topic;
     } internal;
 } lmqtt_publish_t;
 
+/* fixed-size FIFO of QoS 0 messages which the encoder sends ahead of the
+   store, without taking store entries */
+typedef struct _lmqtt_publish_ring_t {
+    lmqtt_publish_t **items;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    lmqtt_store_entry_callback_t callback;
+    void *callback_data;
+} lmqtt_publish_ring_t;
+
+/* a PUBACK, PUBREC or PUBCOMP waiting to be sent */
+typedef struct _lmqtt_ack_t {
+    lmqtt_packet_id_t packet_id;
+    /* first byte of the packet */
+    unsigned char type;
+} lmqtt_ack_t;
+
+/* fixed-size FIFO of acknowledgements to incoming messages, which the encoder
+   sends ahead of everything else without taking store entries */
+typedef struct _lmqtt_ack_queue_t {
+    lmqtt_ack_t *items;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    /* acknowledgements which went to the store because the queue was full;
+       new ones follow them there until they are sent, to keep their order */
+    size_t spilled;
+} lmqtt_ack_queue_t;
+
 typedef struct _lmqtt_tx_buffer_t {
     lmqtt_store_t *store;
+    lmqtt_publish_ring_t *qos0_ring;
+    lmqtt_ack_queue_t *ack_queue;
 
     int closed;
 
+    lmqtt_protocol_t protocol;
+    lmqtt_topic_alias_set_t topic_aliases;
+
+    /* maximum number of QoS 1 and 2 PUBLISH packets waiting to be
+       acknowledged (0 means no limit); further PUBLISH packets are kept in the
+       store while other packets are sent ahead of them */
+    unsigned short inflight_window;
+
+    /* store whose packets are sent once `store` has nothing left to send,
+       e.g. requests written right after CONNECT without waiting for CONNACK */
+    lmqtt_store_t *pipeline_store;
+
     struct {
         int pos;
         size_t offset;
+        int from_ring;
+        int from_ack_queue;
         lmqtt_encode_buffer_t buffer;
         lmqtt_error_t error;
         int os_error;
@@ -160,6 +297,11 @@ typedef lmqtt_encode_result_t (*lmqtt_encoder_t)(lmqtt_store_value_t *,
 typedef lmqtt_encoder_t (*lmqtt_encoder_finder_t)(lmqtt_tx_buffer_t *,
     lmqtt_store_value_t *);
 
+/* writes a whole packet at once; returns the number of bytes written, or 0 if
+   the packet must be encoded field by field instead */
+typedef size_t (*lmqtt_fast_encoder_t)(lmqtt_tx_buffer_t *,
+    lmqtt_store_value_t *, unsigned char *, size_t);
+
 typedef struct _lmqtt_decode_bytes_t {
     size_t buf_len;
     unsigned char *buf;
@@ -194,10 +336,58 @@ typedef struct _lmqtt_message_callbacks_t {
     void *on_publish_data;
 } lmqtt_message_callbacks_t;
 
+typedef int (*lmqtt_request_on_connect_t)(void *, lmqtt_connect_t *);
+typedef int (*lmqtt_request_on_subscribe_t)(void *, lmqtt_packet_id_t,
+    lmqtt_subscribe_t *);
+typedef int (*lmqtt_request_on_disconnect_t)(void *);
+typedef lmqtt_allocate_result_t (*lmqtt_request_on_allocate_subscriptions_t)(
+    void *, lmqtt_subscribe_t *, size_t);
+typedef lmqtt_allocate_result_t (*lmqtt_request_on_allocate_string_t)(void *,
+    lmqtt_string_t *, size_t);
+
+/* on_allocate_subscriptions must point `subscriptions` to an array with room for
+   the given number of entries; CONNACK and SUBACK responses are appended to the
+   store by the user, while PINGRESP and UNSUBACK are appended automatically */
+typedef struct _lmqtt_request_callbacks_t {
+    lmqtt_request_on_connect_t on_connect;
+    lmqtt_request_on_subscribe_t on_subscribe;
+    lmqtt_request_on_subscribe_t on_unsubscribe;
+    lmqtt_request_on_disconnect_t on_disconnect;
+    lmqtt_request_on_allocate_subscriptions_t on_allocate_subscriptions;
+    lmqtt_request_on_allocate_string_t on_allocate_string;
+    void *on_request_data;
+} lmqtt_request_callbacks_t;
+
+/* state of the decoding of the property list (MQTT 5) of an incoming packet;
+   `end` is the position of its last byte in the remaining length */
+typedef struct _lmqtt_property_decoder_t {
+    int len_finished;
+    long len;
+    long len_multiplier;
+    long end;
+    unsigned char id;
+    int type;
+    int strings;
+    int string_len;
+    long remaining;
+    unsigned long value;
+} lmqtt_property_decoder_t;
+
 typedef struct _lmqtt_rx_buffer_t {
     lmqtt_store_t *store;
+    /* when set, acknowledgements are queued here instead of `store` while
+       there is room */
+    lmqtt_ack_queue_t *ack_queue;
     lmqtt_message_callbacks_t *message_callbacks;
 
+    /* when set, the buffer decodes packets sent by clients (CONNECT,
+       SUBSCRIBE etc.) instead of packets sent by servers */
+    int server_role;
+    lmqtt_request_callbacks_t *request_callbacks;
+
+    /* protocol of incoming packets in client role */
+    lmqtt_protocol_t protocol;
+
     lmqtt_id_set_t id_set;
 
     struct {
@@ -210,12 +400,24 @@ typedef struct _lmqtt_rx_buffer_t {
         lmqtt_store_value_t value;
         lmqtt_publish_t publish;
         int ignore_publish;
+        lmqtt_connect_t connect;
+        lmqtt_subscribe_t subscribe;
+        unsigned char connect_flags;
+        int field;
+        long field_start;
+        unsigned short field_len;
+        int ignore_field;
+        lmqtt_property_decoder_t property;
         lmqtt_string_t *blocking_str;
         lmqtt_error_t error;
         int os_error;
     } internal;
 } lmqtt_rx_buffer_t;
 
+/* points `str` to `count` segments and sets its length to their sum */
+void lmqtt_string_set_segments(lmqtt_string_t *str,
+    lmqtt_string_segment_t *segments, size_t count);
+
 int lmqtt_id_set_clear(lmqtt_id_set_t *id_set);
 int lmqtt_id_set_contains(lmqtt_id_set_t *id_set, lmqtt_packet_id_t id);
 int lmqtt_id_set_put(lmqtt_id_set_t *id_set, lmqtt_packet_id_t id);
@@ -223,23 +425,42 @@ int lmqtt_id_set_remove(lmqtt_id_set_t *id_set, lmqtt_packet_id_t id);
 
 int lmqtt_connect_validate(lmqtt_connect_t *connect);
 int lmqtt_subscribe_validate(lmqtt_subscribe_t *subscribe);
+/* chains `subscribe` to `batch` so both are sent in a single packet, unless
+   the remaining length of that packet would exceed `max_length` */
+int lmqtt_subscribe_append(lmqtt_subscribe_t *batch,
+    lmqtt_subscribe_t *subscribe, long max_length);
 int lmqtt_publish_validate(lmqtt_publish_t *publish);
+/* makes `publish` send the payload of `shared`, which must not use a read
+   callback */
+void lmqtt_publish_set_shared_payload(lmqtt_publish_t *publish,
+    lmqtt_shared_payload_t *shared);
+
+int lmqtt_publish_ring_push(lmqtt_publish_ring_t *ring,
+    lmqtt_publish_t *publish);
+int lmqtt_publish_ring_shift(lmqtt_publish_ring_t *ring,
+    lmqtt_publish_t **publish);
+
+int lmqtt_ack_queue_push(lmqtt_ack_queue_t *queue, unsigned char type,
+    lmqtt_packet_id_t packet_id);
+int lmqtt_ack_queue_shift(lmqtt_ack_queue_t *queue, lmqtt_ack_t *ack);
 
 void lmqtt_tx_buffer_reset(lmqtt_tx_buffer_t *state);
 void lmqtt_tx_buffer_finish(lmqtt_tx_buffer_t *state);
 lmqtt_string_t *lmqtt_tx_buffer_get_blocking_str(lmqtt_tx_buffer_t *state);
-extern lmqtt_error_t (*lmqtt_tx_buffer_get_error)(lmqtt_tx_buffer_t *state,
-    int *os_error);
-extern lmqtt_io_result_t (*lmqtt_tx_buffer_encode)(lmqtt_tx_buffer_t *state,
-    unsigned char *buf, size_t buf_len, size_t *bytes_written);
+extern lmqtt_error_t LMQTT_MOCKABLE(lmqtt_tx_buffer_get_error)(
+    lmqtt_tx_buffer_t *state, int *os_error);
+extern lmqtt_io_result_t LMQTT_MOCKABLE(lmqtt_tx_buffer_encode)(
+    lmqtt_tx_buffer_t *state, unsigned char *buf, size_t buf_len,
+    size_t *bytes_written);
 
 void lmqtt_rx_buffer_reset(lmqtt_rx_buffer_t *state);
 void lmqtt_rx_buffer_finish(lmqtt_rx_buffer_t *state);
 lmqtt_string_t *lmqtt_rx_buffer_get_blocking_str(lmqtt_rx_buffer_t *state);
-extern lmqtt_error_t (*lmqtt_rx_buffer_get_error)(lmqtt_rx_buffer_t *state,
-    int *os_error);
-extern lmqtt_io_result_t (*lmqtt_rx_buffer_decode)(lmqtt_rx_buffer_t *state,
-    unsigned char *buf, size_t buf_len, size_t *bytes_read);
+extern lmqtt_error_t LMQTT_MOCKABLE(lmqtt_rx_buffer_get_error)(
+    lmqtt_rx_buffer_t *state, int *os_error);
+extern lmqtt_io_result_t LMQTT_MOCKABLE(lmqtt_rx_buffer_decode)(
+    lmqtt_rx_buffer_t *state, unsigned char *buf, size_t buf_len,
+    size_t *bytes_read);
 
 #ifdef  __cplusplus
 }
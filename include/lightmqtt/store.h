@@ -21,20 +21,40 @@ typedef struct _lmqtt_store_value_t {
     void *callback_data;
 } lmqtt_store_value_t;
 
+typedef struct _lmqtt_store_data_t {
+    void *value;
+    lmqtt_store_entry_callback_t callback;
+    void *callback_data;
+} lmqtt_store_data_t;
+
+/* the space taken by each entry of a store; the entries themselves are not kept
+   in this layout (see lmqtt_store_t) */
 typedef struct _lmqtt_store_entry_t {
-    int kind;
-    lmqtt_store_value_t value;
+    lmqtt_store_data_t data;
+    lmqtt_packet_id_t packet_id;
+    short kind;
 } lmqtt_store_entry_t;
 
 typedef struct _lmqtt_store_t {
     lmqtt_get_time_t get_time;
     unsigned short keep_alive;
+    /* milliseconds by which the keep alive period is shortened */
+    long keep_alive_offset;
     unsigned short timeout;
     lmqtt_packet_id_t next_packet_id;
     lmqtt_time_t last_touch;
     size_t count;
     size_t pos;
     size_t capacity;
+    /* index of the oldest entry; the entries wrap around the end of the
+       arrays */
+    size_t head;
+    /* number of QoS 1 and 2 messages sent and not completely acknowledged;
+       see lmqtt_store_count_inflight() */
+    size_t inflight;
+    /* memory for `capacity` entries, which the store splits in three arrays:
+       the data of all entries, then their packet ids and then their kinds, so
+       that searches by kind and packet id do not touch the data */
     lmqtt_store_entry_t *entries;
 } lmqtt_store_t;
 
@@ -47,6 +67,9 @@ int lmqtt_store_append(lmqtt_store_t *store, int kind,
 int lmqtt_store_get_at(lmqtt_store_t *store, size_t pos, int *kind,
     lmqtt_store_value_t *value);
 int lmqtt_store_delete_at(lmqtt_store_t *store, size_t pos);
+int lmqtt_store_replace_at(lmqtt_store_t *store, size_t pos, int kind,
+    lmqtt_store_value_t *value);
+int lmqtt_store_move_to_current(lmqtt_store_t *store, size_t pos);
 int lmqtt_store_peek(lmqtt_store_t *store, int *kind,
     lmqtt_store_value_t *value);
 int lmqtt_store_mark_current(lmqtt_store_t *store);
@@ -56,6 +79,9 @@ int lmqtt_store_pop_marked_by(lmqtt_store_t *store, int kind,
 int lmqtt_store_shift(lmqtt_store_t *store, int *kind,
     lmqtt_store_value_t *value);
 void lmqtt_store_unmark_all(lmqtt_store_t *store);
+/* counts the marked QoS 1 and 2 PUBLISH entries and all PUBREL entries, i.e.
+   the messages counted against the in-flight window */
+size_t lmqtt_store_count_inflight(lmqtt_store_t *store);
 int lmqtt_store_get_timeout(lmqtt_store_t *store, size_t *count, long *secs,
     long *nsecs);
 void lmqtt_store_touch(lmqtt_store_t *store);
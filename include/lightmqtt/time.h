@@ -14,11 +14,30 @@ typedef struct _lmqtt_time_t {
     long nsecs;
 } lmqtt_time_t;
 
+/* token bucket allowing `rate` events per second, with bursts of up to
+   `burst` events; may be shared by many clients */
+typedef struct _lmqtt_rate_limiter_t {
+    lmqtt_get_time_t get_time;
+    unsigned short rate;
+    unsigned short burst;
+    long tokens;
+    lmqtt_time_t last;
+} lmqtt_rate_limiter_t;
+
 int lmqtt_time_get_timeout_to(lmqtt_time_t *tm, lmqtt_get_time_t get_time,
     unsigned short when, long *secs, long *nsecs);
+int lmqtt_time_get_timeout_to_msecs(lmqtt_time_t *tm,
+    lmqtt_get_time_t get_time, long when, long *secs, long *nsecs);
+void lmqtt_time_get_elapsed(lmqtt_time_t *tm, lmqtt_get_time_t get_time,
+    long *secs, long *nsecs);
 
 void lmqtt_time_touch(lmqtt_time_t *tm, lmqtt_get_time_t get_time);
 
+void lmqtt_rate_limiter_initialize(lmqtt_rate_limiter_t *limiter,
+    lmqtt_get_time_t get_time, unsigned short rate, unsigned short burst);
+int lmqtt_rate_limiter_acquire(lmqtt_rate_limiter_t *limiter, long *secs,
+    long *nsecs);
+
 #ifdef  __cplusplus
 }
 #endif
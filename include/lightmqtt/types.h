@@ -22,7 +22,8 @@ typedef enum {
     LMQTT_IO_STATUS_READY = 0, /* = EOF */
     LMQTT_IO_STATUS_BLOCK_CONN,
     LMQTT_IO_STATUS_BLOCK_DATA,
-    LMQTT_IO_STATUS_ERROR
+    LMQTT_IO_STATUS_ERROR,
+    LMQTT_IO_STATUS_BLOCK_POOL
 } lmqtt_io_status_t;
 
 #endif
@@ -0,0 +1,7 @@
+/* The whole library as a single translation unit, which lets the compiler
+   inline calls between modules; built with --enable-amalgamation */
+#include "lmqtt_time.c"
+#include "lmqtt_store.c"
+#include "lmqtt_packet.c"
+#include "lmqtt_client.c"
+#include "lmqtt_broker.c"
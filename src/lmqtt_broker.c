@@ -0,0 +1,768 @@
+#include <lightmqtt/broker.h>
+#include <lightmqtt/types.h>
+#include <string.h>
+#include <assert.h>
+
+#define LMQTT_SUBACK_FAILURE 0x80
+
+/******************************************************************************
+ * lmqtt_broker_t PRIVATE functions
+ ******************************************************************************/
+
+LMQTT_STATIC long broker_level_len(const char *buf, long len)
+{
+    long i = 0;
+
+    while (i < len && buf[i] != '/')
+        i++;
+    return i;
+}
+
+LMQTT_STATIC int broker_validate_filter(lmqtt_string_t *topic)
+{
+    long pos = 0;
+
+    if (!topic->buf || topic->len <= 0)
+        return 0;
+
+    while (pos <= topic->len) {
+        const char *level = &topic->buf[pos];
+        long level_len = broker_level_len(level, topic->len - pos);
+        long i;
+
+        if (level_len > LMQTT_BROKER_LEVEL_SIZE)
+            return 0;
+        for (i = 0; i < level_len; i++) {
+            if ((level[i] == '+' || level[i] == '#') && level_len != 1)
+                return 0;
+        }
+        /* a multi-level wildcard must be the last character of the filter */
+        if (level_len == 1 && level[0] == '#' && pos + 1 < topic->len)
+            return 0;
+
+        pos += level_len + 1;
+    }
+
+    return 1;
+}
+
+LMQTT_STATIC lmqtt_broker_node_t *broker_find_child(lmqtt_broker_node_t *node,
+    const char *level, long level_len)
+{
+    lmqtt_broker_node_t *child;
+
+    for (child = node->children; child; child = child->next) {
+        if ((long) child->level_len == level_len &&
+                memcmp(child->level, level, level_len) == 0)
+            return child;
+    }
+
+    return NULL;
+}
+
+LMQTT_STATIC lmqtt_broker_node_t *broker_add_child(lmqtt_broker_t *broker,
+    lmqtt_broker_node_t *node, const char *level, long level_len)
+{
+    lmqtt_broker_node_t *child = broker->free_nodes;
+
+    if (!child)
+        return NULL;
+
+    broker->free_nodes = child->next;
+    memset(child, 0, sizeof(*child));
+    child->parent = node;
+    child->level_len = level_len;
+    memcpy(child->level, level, level_len);
+    child->next = node->children;
+    node->children = child;
+    return child;
+}
+
+/* Returns unused nodes, starting from `node` towards the root, to the free
+   list */
+LMQTT_STATIC void broker_prune(lmqtt_broker_t *broker,
+    lmqtt_broker_node_t *node)
+{
+    while (node != &broker->root && !node->children && !node->subscriptions) {
+        lmqtt_broker_node_t *parent = node->parent;
+        lmqtt_broker_node_t **cur = &parent->children;
+
+        while (*cur != node)
+            cur = &(*cur)->next;
+        *cur = node->next;
+
+        node->next = broker->free_nodes;
+        broker->free_nodes = node;
+        node = parent;
+    }
+}
+
+LMQTT_STATIC lmqtt_broker_node_t *broker_find_node(lmqtt_broker_t *broker,
+    lmqtt_string_t *topic, int create)
+{
+    lmqtt_broker_node_t *node = &broker->root;
+    long pos = 0;
+
+    while (pos <= topic->len) {
+        const char *level = &topic->buf[pos];
+        long level_len = broker_level_len(level, topic->len - pos);
+        lmqtt_broker_node_t *child = broker_find_child(node, level, level_len);
+
+        if (!child && create)
+            child = broker_add_child(broker, node, level, level_len);
+        if (!child) {
+            broker_prune(broker, node);
+            return NULL;
+        }
+
+        node = child;
+        pos += level_len + 1;
+    }
+
+    return node;
+}
+
+LMQTT_STATIC int broker_subscribe(lmqtt_broker_t *broker,
+    lmqtt_broker_session_t *session, lmqtt_subscription_t *subscription)
+{
+    lmqtt_qos_t qos = subscription->requested_qos > LMQTT_QOS_1 ?
+        LMQTT_QOS_1 : subscription->requested_qos;
+    lmqtt_broker_node_t *node;
+    lmqtt_broker_subscription_t *sub;
+
+    if (!broker_validate_filter(&subscription->topic))
+        return LMQTT_SUBACK_FAILURE;
+
+    node = broker_find_node(broker, &subscription->topic, 1);
+    if (!node)
+        return LMQTT_SUBACK_FAILURE;
+
+    /* a subscription with the same filter replaces the existing one
+       (MQTT-3.8.4-3) */
+    for (sub = node->subscriptions; sub; sub = sub->next) {
+        if (sub->session == session) {
+            sub->qos = qos;
+            return qos;
+        }
+    }
+
+    sub = broker->free_subscriptions;
+    if (!sub) {
+        broker_prune(broker, node);
+        return LMQTT_SUBACK_FAILURE;
+    }
+
+    broker->free_subscriptions = sub->next;
+    sub->node = node;
+    sub->session = session;
+    sub->qos = qos;
+    sub->next = node->subscriptions;
+    node->subscriptions = sub;
+    sub->session_next = session->subscriptions;
+    session->subscriptions = sub;
+    return qos;
+}
+
+LMQTT_STATIC void broker_remove_subscription(lmqtt_broker_t *broker,
+    lmqtt_broker_subscription_t *sub)
+{
+    lmqtt_broker_subscription_t **cur;
+
+    for (cur = &sub->node->subscriptions; *cur != sub; cur = &(*cur)->next)
+        ;
+    *cur = sub->next;
+
+    for (cur = &sub->session->subscriptions; *cur != sub;
+            cur = &(*cur)->session_next)
+        ;
+    *cur = sub->session_next;
+
+    broker_prune(broker, sub->node);
+
+    sub->next = broker->free_subscriptions;
+    broker->free_subscriptions = sub;
+}
+
+LMQTT_STATIC void broker_unsubscribe(lmqtt_broker_t *broker,
+    lmqtt_broker_session_t *session, lmqtt_subscription_t *subscription)
+{
+    lmqtt_broker_node_t *node;
+    lmqtt_broker_subscription_t *sub;
+
+    if (!broker_validate_filter(&subscription->topic))
+        return;
+
+    node = broker_find_node(broker, &subscription->topic, 0);
+    if (!node)
+        return;
+
+    for (sub = node->subscriptions; sub; sub = sub->next) {
+        if (sub->session == session) {
+            broker_remove_subscription(broker, sub);
+            return;
+        }
+    }
+}
+
+LMQTT_STATIC void broker_release_message(lmqtt_broker_t *broker,
+    lmqtt_broker_message_t *message)
+{
+    assert(message->refs > 0);
+
+    if (--message->refs == 0) {
+        message->next = broker->free_messages;
+        broker->free_messages = message;
+    }
+}
+
+LMQTT_STATIC int broker_on_delivered(void *data, void *unused)
+{
+    lmqtt_broker_delivery_t *delivery = (lmqtt_broker_delivery_t *) data;
+    lmqtt_broker_session_t *session = delivery->session;
+
+    broker_release_message(session->broker, delivery->message);
+    delivery->next = session->free_deliveries;
+    session->free_deliveries = delivery;
+    return 1;
+}
+
+LMQTT_STATIC lmqtt_packet_id_t broker_session_get_id(
+    lmqtt_broker_session_t *session)
+{
+    lmqtt_packet_id_t id = lmqtt_store_get_id(&session->store);
+
+    /* zero is not a valid packet identifier (MQTT-2.3.1-1) */
+    return id != 0 ? id : lmqtt_store_get_id(&session->store);
+}
+
+LMQTT_STATIC int broker_session_enqueue(lmqtt_broker_session_t *session,
+    lmqtt_broker_message_t *message, lmqtt_qos_t qos)
+{
+    lmqtt_broker_delivery_t *delivery = session->free_deliveries;
+    lmqtt_store_value_t value;
+
+    if (!delivery || !lmqtt_store_is_queueable(&session->store))
+        return 0;
+
+    session->free_deliveries = delivery->next;
+    delivery->message = message;
+    memset(&delivery->publish, 0, sizeof(delivery->publish));
+    delivery->publish.qos = qos;
+    delivery->publish.topic.len = message->topic_len;
+    delivery->publish.topic.buf = message->buf;
+    delivery->publish.payload.len = message->payload_len;
+    delivery->publish.payload.buf = message->buf + message->topic_len;
+
+    value.packet_id = qos == LMQTT_QOS_0 ? 0 : broker_session_get_id(session);
+    value.value = &delivery->publish;
+    value.callback = &broker_on_delivered;
+    value.callback_data = delivery;
+
+    lmqtt_store_append(&session->store, qos == LMQTT_QOS_0 ?
+        LMQTT_KIND_PUBLISH_0 : LMQTT_KIND_PUBLISH_1, &value);
+    message->refs++;
+    return 1;
+}
+
+LMQTT_STATIC void broker_deliver(lmqtt_broker_t *broker,
+    lmqtt_broker_node_t *node, lmqtt_broker_message_t *message,
+    lmqtt_qos_t qos)
+{
+    lmqtt_broker_subscription_t *sub;
+
+    for (sub = node->subscriptions; sub; sub = sub->next) {
+        lmqtt_broker_session_t *session = sub->session;
+
+        /* overlapping subscriptions of a session receive the message once */
+        if (session->generation == broker->generation)
+            continue;
+        session->generation = broker->generation;
+
+        if (!broker_session_enqueue(session, message,
+                qos < sub->qos ? qos : sub->qos))
+            broker->dropped++;
+    }
+}
+
+/* Delivers the message to the subscribers whose filters match `topic`, which
+   holds the topic levels below `node`; `len` is negative after the last
+   level */
+LMQTT_STATIC void broker_match(lmqtt_broker_t *broker,
+    lmqtt_broker_node_t *node, const char *topic, long len,
+    lmqtt_broker_message_t *message, lmqtt_qos_t qos)
+{
+    lmqtt_broker_node_t *child;
+    long level_len;
+    int wildcards;
+
+    if (len < 0) {
+        broker_deliver(broker, node, message, qos);
+        /* "a/#" also matches "a" */
+        if ((child = broker_find_child(node, "#", 1)))
+            broker_deliver(broker, child, message, qos);
+        return;
+    }
+
+    /* topics starting with '$' are not matched by wildcards in the first
+       level (MQTT-4.7.2-1) */
+    wildcards = node != &broker->root || len == 0 || topic[0] != '$';
+    level_len = broker_level_len(topic, len);
+
+    for (child = node->children; child; child = child->next) {
+        if (child->level_len == 1 && child->level[0] == '#') {
+            if (wildcards)
+                broker_deliver(broker, child, message, qos);
+        } else if ((child->level_len == 1 && child->level[0] == '+' &&
+                wildcards) || ((long) child->level_len == level_len &&
+                memcmp(child->level, topic, level_len) == 0)) {
+            if (level_len < len)
+                broker_match(broker, child, topic + level_len + 1,
+                    len - level_len - 1, message, qos);
+            else
+                broker_match(broker, child, NULL, -1, message, qos);
+        }
+    }
+}
+
+/******************************************************************************
+ * lmqtt_broker_session_t PRIVATE functions
+ ******************************************************************************/
+
+LMQTT_STATIC int broker_session_on_connect(void *data,
+    lmqtt_connect_t *connect)
+{
+    lmqtt_broker_session_t *session = (lmqtt_broker_session_t *) data;
+    lmqtt_store_value_t value;
+
+    /* a second CONNECT is a protocol violation (MQTT-3.1.0-2) */
+    if (session->connected)
+        return 0;
+
+    session->connected = 1;
+    session->keep_alive = connect->keep_alive;
+
+    /* sessions are not persisted, therefore `session_present` is always 0 */
+    memset(&session->connack, 0, sizeof(session->connack));
+
+    memset(&value, 0, sizeof(value));
+    value.value = &session->connack;
+    return lmqtt_store_append(&session->store, LMQTT_KIND_CONNACK, &value);
+}
+
+LMQTT_STATIC int broker_session_on_suback(void *data, void *unused)
+{
+    lmqtt_broker_session_t *session = (lmqtt_broker_session_t *) data;
+
+    session->suback_count--;
+    return 1;
+}
+
+LMQTT_STATIC int broker_session_on_subscribe(void *data,
+    lmqtt_packet_id_t packet_id, lmqtt_subscribe_t *subscribe)
+{
+    lmqtt_broker_session_t *session = (lmqtt_broker_session_t *) data;
+    lmqtt_subscribe_t *suback = &session->subacks[session->suback_next];
+    lmqtt_store_value_t value;
+    int i;
+
+    for (i = 0; i < subscribe->count; i++) {
+        lmqtt_subscription_t *subscription = &subscribe->subscriptions[i];
+        subscription->return_code = (unsigned char) broker_subscribe(
+            session->broker, session, subscription);
+    }
+
+    memset(suback, 0, sizeof(*suback));
+    suback->count = subscribe->count;
+    suback->subscriptions = subscribe->subscriptions;
+
+    value.packet_id = packet_id;
+    value.value = suback;
+    value.callback = &broker_session_on_suback;
+    value.callback_data = session;
+
+    if (!lmqtt_store_append(&session->store, LMQTT_KIND_SUBACK, &value))
+        return 0;
+
+    session->suback_next++;
+    session->suback_count++;
+    return 1;
+}
+
+LMQTT_STATIC int broker_session_on_unsubscribe(void *data,
+    lmqtt_packet_id_t packet_id, lmqtt_subscribe_t *subscribe)
+{
+    lmqtt_broker_session_t *session = (lmqtt_broker_session_t *) data;
+    int i;
+
+    for (i = 0; i < subscribe->count; i++)
+        broker_unsubscribe(session->broker, session,
+            &subscribe->subscriptions[i]);
+
+    return 1;
+}
+
+LMQTT_STATIC int broker_session_on_disconnect(void *data)
+{
+    lmqtt_broker_session_t *session = (lmqtt_broker_session_t *) data;
+
+    session->disconnected = 1;
+    return 1;
+}
+
+/* The return codes of a SUBSCRIBE are kept in `requests` until its SUBACK is
+   sent, so the array is only rewound when no SUBACK is pending */
+LMQTT_STATIC lmqtt_allocate_result_t broker_session_on_allocate_subscriptions(
+    void *data, lmqtt_subscribe_t *subscribe, size_t max_count)
+{
+    lmqtt_broker_session_t *session = (lmqtt_broker_session_t *) data;
+
+    if (!session->connected)
+        return LMQTT_ALLOCATE_ERROR;
+
+    if (session->suback_count == 0) {
+        session->suback_next = 0;
+        session->requests_used = 0;
+    }
+    session->topics_used = 0;
+
+    if (session->suback_next >= LMQTT_BROKER_MAX_SUBACKS ||
+            max_count > session->requests_capacity - session->requests_used)
+        return LMQTT_ALLOCATE_ERROR;
+
+    subscribe->subscriptions = &session->requests[session->requests_used];
+    session->requests_used += max_count;
+    return LMQTT_ALLOCATE_SUCCESS;
+}
+
+LMQTT_STATIC lmqtt_allocate_result_t broker_session_on_allocate_string(
+    void *data, lmqtt_string_t *str, size_t size)
+{
+    lmqtt_broker_session_t *session = (lmqtt_broker_session_t *) data;
+
+    /* fields of CONNECT (client id, will, user name etc.) are not used */
+    if (session->rx_state.internal.header.type == LMQTT_TYPE_CONNECT ||
+            size > session->topics_capacity - session->topics_used)
+        return LMQTT_ALLOCATE_IGNORE;
+
+    str->buf = &session->topics[session->topics_used];
+    str->len = size;
+    session->topics_used += size;
+    return LMQTT_ALLOCATE_SUCCESS;
+}
+
+LMQTT_STATIC lmqtt_allocate_result_t broker_session_on_allocate_topic(
+    void *data, lmqtt_publish_t *publish, size_t size)
+{
+    lmqtt_broker_session_t *session = (lmqtt_broker_session_t *) data;
+    lmqtt_broker_t *broker = session->broker;
+    lmqtt_broker_message_t *message = broker->free_messages;
+
+    if (!session->connected)
+        return LMQTT_ALLOCATE_ERROR;
+
+    if (!message || size > broker->message_capacity) {
+        broker->dropped++;
+        return LMQTT_ALLOCATE_IGNORE;
+    }
+
+    broker->free_messages = message->next;
+    message->refs = 1;
+    message->topic_len = size;
+    message->payload_len = 0;
+    session->rx_message = message;
+
+    publish->topic.buf = message->buf;
+    publish->topic.len = size;
+    return LMQTT_ALLOCATE_SUCCESS;
+}
+
+LMQTT_STATIC lmqtt_allocate_result_t broker_session_on_allocate_payload(
+    void *data, lmqtt_publish_t *publish, size_t size)
+{
+    lmqtt_broker_session_t *session = (lmqtt_broker_session_t *) data;
+    lmqtt_broker_t *broker = session->broker;
+    lmqtt_broker_message_t *message = session->rx_message;
+
+    if (size > broker->message_capacity - message->topic_len) {
+        /* on_publish_deallocate is not called for ignored messages */
+        broker_release_message(broker, message);
+        session->rx_message = NULL;
+        broker->dropped++;
+        return LMQTT_ALLOCATE_IGNORE;
+    }
+
+    message->payload_len = size;
+    publish->payload.buf = message->buf + message->topic_len;
+    publish->payload.len = size;
+    return LMQTT_ALLOCATE_SUCCESS;
+}
+
+LMQTT_STATIC int broker_session_on_publish(void *data,
+    lmqtt_publish_t *publish)
+{
+    lmqtt_broker_session_t *session = (lmqtt_broker_session_t *) data;
+    lmqtt_broker_t *broker = session->broker;
+    lmqtt_broker_message_t *message = session->rx_message;
+
+    broker->generation++;
+    broker_match(broker, &broker->root, message->buf,
+        (long) message->topic_len, message,
+        publish->qos > LMQTT_QOS_1 ? LMQTT_QOS_1 : publish->qos);
+    return 1;
+}
+
+LMQTT_STATIC void broker_session_on_deallocate(void *data,
+    lmqtt_publish_t *publish)
+{
+    lmqtt_broker_session_t *session = (lmqtt_broker_session_t *) data;
+
+    broker_release_message(session->broker, session->rx_message);
+    session->rx_message = NULL;
+}
+
+LMQTT_STATIC int broker_session_fail(lmqtt_broker_session_t *session,
+    lmqtt_error_t error, int os_error)
+{
+    session->error = error;
+    session->os_error = os_error;
+    return error & LMQTT_RES_ERROR;
+}
+
+LMQTT_STATIC int broker_session_is_expired(lmqtt_broker_session_t *session)
+{
+    long when = (long) session->keep_alive + session->keep_alive / 2;
+    long secs, nsecs;
+
+    /* the client is disconnected after one and a half times the keep alive
+       period without receiving anything (MQTT-3.1.2-24) */
+    if (when > 0xffff)
+        when = 0xffff;
+
+    return lmqtt_time_get_timeout_to(&session->last_touch,
+        session->callbacks.get_time, (unsigned short) when, &secs, &nsecs) &&
+        secs == 0 && nsecs == 0;
+}
+
+/******************************************************************************
+ * lmqtt_broker_t PUBLIC functions
+ ******************************************************************************/
+
+void lmqtt_broker_initialize(lmqtt_broker_t *broker,
+    lmqtt_broker_buffers_t *buffers)
+{
+    lmqtt_broker_node_t *nodes = buffers->nodes;
+    lmqtt_broker_subscription_t *subscriptions = buffers->subscriptions;
+    lmqtt_broker_message_t *messages = buffers->messages;
+    size_t node_count = buffers->nodes_size / LMQTT_BROKER_NODE_SIZE;
+    size_t subscription_count = buffers->subscriptions_size /
+        LMQTT_BROKER_SUBSCRIPTION_SIZE;
+    size_t message_count = buffers->messages_size / LMQTT_BROKER_MESSAGE_SIZE;
+    size_t i;
+
+    memset(broker, 0, sizeof(*broker));
+
+    for (i = node_count; i > 0; i--) {
+        nodes[i - 1].next = broker->free_nodes;
+        broker->free_nodes = &nodes[i - 1];
+    }
+
+    for (i = subscription_count; i > 0; i--) {
+        subscriptions[i - 1].next = broker->free_subscriptions;
+        broker->free_subscriptions = &subscriptions[i - 1];
+    }
+
+    if (message_count > 0)
+        broker->message_capacity = buffers->message_data_size / message_count;
+    for (i = message_count; i > 0; i--) {
+        messages[i - 1].refs = 0;
+        messages[i - 1].buf = (char *) buffers->message_data +
+            (i - 1) * broker->message_capacity;
+        messages[i - 1].next = broker->free_messages;
+        broker->free_messages = &messages[i - 1];
+    }
+}
+
+unsigned long lmqtt_broker_get_dropped(lmqtt_broker_t *broker)
+{
+    return broker->dropped;
+}
+
+/******************************************************************************
+ * lmqtt_broker_session_t PUBLIC functions
+ ******************************************************************************/
+
+void lmqtt_broker_session_initialize(lmqtt_broker_session_t *session,
+    lmqtt_broker_t *broker, lmqtt_client_callbacks_t *callbacks,
+    lmqtt_broker_session_buffers_t *buffers)
+{
+    lmqtt_broker_delivery_t *deliveries = buffers->deliveries;
+    size_t delivery_count = buffers->deliveries_size /
+        LMQTT_BROKER_DELIVERY_SIZE;
+    size_t i;
+
+    memset(session, 0, sizeof(*session));
+
+    session->broker = broker;
+    memcpy(&session->callbacks, callbacks, sizeof(*callbacks));
+    session->store.get_time = callbacks->get_time;
+    session->store.entries = buffers->store;
+    session->store.capacity = buffers->store_size / LMQTT_STORE_ENTRY_SIZE;
+    session->read_buf_capacity = buffers->rx_buffer_size;
+    session->read_buf = buffers->rx_buffer;
+    session->write_buf_capacity = buffers->tx_buffer_size;
+    session->write_buf = buffers->tx_buffer;
+    session->requests = buffers->subscriptions;
+    session->requests_capacity = buffers->subscriptions_size /
+        sizeof(lmqtt_subscription_t);
+    session->topics = buffers->topics;
+    session->topics_capacity = buffers->topics_size;
+
+    for (i = delivery_count; i > 0; i--) {
+        deliveries[i - 1].session = session;
+        deliveries[i - 1].next = session->free_deliveries;
+        session->free_deliveries = &deliveries[i - 1];
+    }
+
+    session->message_callbacks.on_publish = &broker_session_on_publish;
+    session->message_callbacks.on_publish_allocate_topic =
+        &broker_session_on_allocate_topic;
+    session->message_callbacks.on_publish_allocate_payload =
+        &broker_session_on_allocate_payload;
+    session->message_callbacks.on_publish_deallocate =
+        &broker_session_on_deallocate;
+    session->message_callbacks.on_publish_data = session;
+
+    session->request_callbacks.on_connect = &broker_session_on_connect;
+    session->request_callbacks.on_subscribe = &broker_session_on_subscribe;
+    session->request_callbacks.on_unsubscribe =
+        &broker_session_on_unsubscribe;
+    session->request_callbacks.on_disconnect = &broker_session_on_disconnect;
+    session->request_callbacks.on_allocate_subscriptions =
+        &broker_session_on_allocate_subscriptions;
+    session->request_callbacks.on_allocate_string =
+        &broker_session_on_allocate_string;
+    session->request_callbacks.on_request_data = session;
+
+    session->rx_state.store = &session->store;
+    session->rx_state.server_role = 1;
+    session->rx_state.message_callbacks = &session->message_callbacks;
+    session->rx_state.request_callbacks = &session->request_callbacks;
+    session->rx_state.id_set.capacity = buffers->id_set_size;
+    session->rx_state.id_set.items = buffers->id_set;
+    session->tx_state.store = &session->store;
+
+    lmqtt_time_touch(&session->last_touch, callbacks->get_time);
+}
+
+void lmqtt_broker_session_finalize(lmqtt_broker_session_t *session)
+{
+    lmqtt_store_value_t value;
+
+    while (session->subscriptions)
+        broker_remove_subscription(session->broker, session->subscriptions);
+
+    if (session->rx_message) {
+        broker_release_message(session->broker, session->rx_message);
+        session->rx_message = NULL;
+    }
+
+    while (lmqtt_store_shift(&session->store, NULL, &value)) {
+        if (value.callback)
+            value.callback(value.callback_data, value.value);
+    }
+
+    session->connected = 0;
+    broker_session_fail(session, LMQTT_ERROR_CLOSED, 0);
+}
+
+int lmqtt_broker_session_has_output(lmqtt_broker_session_t *session)
+{
+    return !session->error && (session->write_buf_pos > 0 ||
+        lmqtt_store_has_current(&session->store));
+}
+
+int lmqtt_broker_session_get_os_error(lmqtt_broker_session_t *session)
+{
+    return session->os_error;
+}
+
+int lmqtt_broker_session_run_once(lmqtt_broker_session_t *session)
+{
+    int result;
+    int progress;
+
+    if (session->error)
+        return session->error & LMQTT_RES_ERROR;
+    if (session->disconnected)
+        return LMQTT_RES_EOF;
+    if (broker_session_is_expired(session))
+        return broker_session_fail(session, LMQTT_ERROR_TIMEOUT, 0);
+
+    do {
+        lmqtt_io_result_t res;
+        lmqtt_error_t error;
+        size_t cnt, decoded;
+        int os_error = 0;
+
+        result = 0;
+        progress = 0;
+
+        /* encode queued packets and write them to the connection */
+        if (lmqtt_tx_buffer_encode(&session->tx_state,
+                &session->write_buf[session->write_buf_pos],
+                session->write_buf_capacity - session->write_buf_pos,
+                &cnt) == LMQTT_IO_ERROR) {
+            error = lmqtt_tx_buffer_get_error(&session->tx_state, &os_error);
+            return broker_session_fail(session, error, os_error);
+        }
+        session->write_buf_pos += cnt;
+
+        if (session->write_buf_pos > 0) {
+            res = session->callbacks.write(session->callbacks.data,
+                session->write_buf, session->write_buf_pos, &cnt, &os_error);
+            if (res == LMQTT_IO_ERROR)
+                return broker_session_fail(session,
+                    LMQTT_ERROR_CONNECTION_WRITE, os_error);
+            if (res == LMQTT_IO_WOULD_BLOCK) {
+                result |= LMQTT_RES_WOULD_BLOCK_CONN_WR;
+            } else if (cnt == 0) {
+                session->disconnected = 1;
+                return LMQTT_RES_EOF_WR;
+            } else {
+                memmove(&session->write_buf[0], &session->write_buf[cnt],
+                    session->write_buf_pos - cnt);
+                session->write_buf_pos -= cnt;
+                progress = 1;
+            }
+        }
+
+        /* read from the connection and decode the received packets; strings
+           are allocated in memory, so the decoder never blocks */
+        res = session->callbacks.read(session->callbacks.data,
+            session->read_buf, session->read_buf_capacity, &cnt, &os_error);
+        if (res == LMQTT_IO_ERROR)
+            return broker_session_fail(session, LMQTT_ERROR_CONNECTION_READ,
+                os_error);
+        if (res == LMQTT_IO_WOULD_BLOCK) {
+            result |= LMQTT_RES_WOULD_BLOCK_CONN_RD;
+        } else if (cnt == 0) {
+            session->disconnected = 1;
+            return LMQTT_RES_EOF_RD;
+        } else {
+            lmqtt_time_touch(&session->last_touch,
+                session->callbacks.get_time);
+            if (lmqtt_rx_buffer_decode(&session->rx_state, session->read_buf,
+                    cnt, &decoded) == LMQTT_IO_ERROR) {
+                error = lmqtt_rx_buffer_get_error(&session->rx_state,
+                    &os_error);
+                return broker_session_fail(session, error, os_error);
+            }
+            assert(decoded == cnt);
+            if (session->disconnected)
+                return LMQTT_RES_EOF;
+            progress = 1;
+        }
+    } while (progress);
+
+    return result;
+}
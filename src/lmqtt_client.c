@@ -98,17 +98,27 @@ LMQTT_STATIC void client_set_state_connecting(lmqtt_client_t *client);
 LMQTT_STATIC void client_set_state_connected(lmqtt_client_t *client);
 LMQTT_STATIC void client_set_state_failed(lmqtt_client_t *client);
 
+/* gives back all entries of `store` except the last `keep` ones */
 LMQTT_STATIC void client_flush_store(lmqtt_client_t *client,
-    lmqtt_store_t *store)
+    lmqtt_store_t *store, size_t keep)
 {
     lmqtt_store_value_t value;
 
-    while (lmqtt_store_shift(store, NULL, &value)) {
+    while (store->count > keep && lmqtt_store_shift(store, NULL, &value)) {
         if (value.callback)
             value.callback(value.callback_data, value.value);
     }
 }
 
+LMQTT_STATIC void client_flush_qos_0_ring(lmqtt_client_t *client)
+{
+    lmqtt_publish_ring_t *ring = &client->qos0_ring;
+    lmqtt_publish_t *publish;
+
+    while (lmqtt_publish_ring_shift(ring, &publish))
+        ring->callback(ring->callback_data, publish);
+}
+
 LMQTT_STATIC void client_cleanup_stores(lmqtt_client_t *client,
     int keep_session)
 {
@@ -124,11 +134,16 @@ LMQTT_STATIC void client_cleanup_stores(lmqtt_client_t *client,
                 i++;
         }
     } else {
-        client_flush_store(client, &client->main_store);
+        /* messages queued while disconnected belong to the next session */
+        client_flush_store(client, &client->main_store,
+            client->preconnect_count);
+        client_flush_qos_0_ring(client);
+        client->ack_queue.count = 0;
+        client->ack_queue.spilled = 0;
         lmqtt_id_set_clear(&client->rx_state.id_set);
     }
 
-    client_flush_store(client, &client->connect_store);
+    client_flush_store(client, &client->connect_store, 0);
 }
 
 LMQTT_STATIC void client_set_current_store(lmqtt_client_t *client,
@@ -137,6 +152,67 @@ LMQTT_STATIC void client_set_current_store(lmqtt_client_t *client,
     client->current_store = store;
     client->rx_state.store = store;
     client->tx_state.store = store;
+    client->tx_state.qos0_ring = store == &client->main_store &&
+        client->qos0_ring.capacity > 0 ? &client->qos0_ring : NULL;
+    client->rx_state.ack_queue = store == &client->main_store &&
+        client->ack_queue.capacity > 0 ? &client->ack_queue : NULL;
+    client->tx_state.ack_queue = client->rx_state.ack_queue;
+}
+
+LMQTT_STATIC unsigned long client_next_random(lmqtt_client_t *client)
+{
+    unsigned long x = client->reconnect.seed;
+    size_t i;
+
+    if (x == 0 && client->reconnect.connect) {
+        /* different clients should not retry in lockstep */
+        lmqtt_string_t *id = &client->reconnect.connect->client_id;
+        x = 2166136261UL;
+        for (i = 0; id->buf && i < (size_t) id->len; i++)
+            x = ((x ^ (unsigned char) id->buf[i]) * 16777619UL) & 0xffffffffUL;
+    }
+    if (x == 0)
+        x = 2463534242UL;
+
+    x ^= (x << 13) & 0xffffffffUL;
+    x ^= x >> 17;
+    x ^= (x << 5) & 0xffffffffUL;
+    client->reconnect.seed = x;
+    return x;
+}
+
+LMQTT_STATIC void client_draw_keep_alive_offset(lmqtt_client_t *client)
+{
+    long max = (long) client->main_store.keep_alive * 10 *
+        (long) client->keep_alive_jitter;
+
+    client->main_store.keep_alive_offset = max > 0 ?
+        (long) (client_next_random(client) % (unsigned long) (max + 1)) : 0;
+}
+
+LMQTT_STATIC void client_schedule_reconnect(lmqtt_client_t *client)
+{
+    lmqtt_reconnect_t *reconnect = &client->reconnect;
+    long max = (long) reconnect->max_delay * 1000;
+    long delay = (long) reconnect->min_delay * 1000;
+    unsigned int i;
+
+    if (delay == 0 || !reconnect->connect)
+        return;
+
+    for (i = 0; i < reconnect->attempts && delay < max; i++)
+        delay *= 2;
+    if (delay > max)
+        delay = max;
+
+    if (reconnect->attempts == 0)
+        lmqtt_time_touch(&reconnect->lost_at, client->callbacks.get_time);
+    lmqtt_time_touch(&reconnect->failed_at, client->callbacks.get_time);
+
+    reconnect->delay = delay / 2 +
+        (long) (client_next_random(client) % (unsigned long) (delay / 2 + 1));
+    reconnect->attempts++;
+    reconnect->pending = 1;
 }
 
 #define TRANSFER_EXEC(transfer, func, left, right) \
@@ -164,6 +240,9 @@ LMQTT_STATIC lmqtt_io_status_t client_buffer_transfer(lmqtt_client_t *client,
         lmqtt_store_touch(client->current_store);
 
     if (transfer_is_eof(input) || transfer_is_eof(output)) {
+        /* the encoder is only closed if we sent DISCONNECT */
+        if (!client->tx_state.closed)
+            client_schedule_reconnect(client);
         client_set_state_initial(client);
         return LMQTT_IO_STATUS_READY;
     }
@@ -218,30 +297,63 @@ static lmqtt_io_result_t client_wrapper_write(lmqtt_client_t *client,
     return result;
 }
 
+LMQTT_STATIC int client_borrow_buffer(lmqtt_client_t *client,
+    unsigned char **buf)
+{
+    if (client->buffer_pool && !*buf)
+        *buf = lmqtt_buffer_pool_get(client->buffer_pool);
+
+    return *buf != NULL;
+}
+
+/* pooled buffers are only kept while they hold partial data */
+LMQTT_STATIC void client_return_buffer(lmqtt_client_t *client,
+    unsigned char **buf, size_t buf_pos)
+{
+    if (client->buffer_pool && *buf && buf_pos == 0) {
+        lmqtt_buffer_pool_put(client->buffer_pool, *buf);
+        *buf = NULL;
+    }
+}
+
 LMQTT_STATIC lmqtt_io_status_t client_process_input(lmqtt_client_t *client)
 {
     lmqtt_transfer_t input;
     lmqtt_transfer_t output;
+    lmqtt_io_status_t result;
     transfer_initialize(&input, &client_wrapper_read,
         LMQTT_IO_STATUS_BLOCK_CONN);
     transfer_initialize(&output, &client_wrapper_decode,
         LMQTT_IO_STATUS_BLOCK_DATA);
 
-    return client_buffer_transfer(client, &input, &output,
+    if (!client_borrow_buffer(client, &client->read_buf))
+        return LMQTT_IO_STATUS_BLOCK_POOL;
+
+    result = client_buffer_transfer(client, &input, &output,
         client->read_buf, &client->read_buf_pos, client->read_buf_capacity);
+
+    client_return_buffer(client, &client->read_buf, client->read_buf_pos);
+    return result;
 }
 
 LMQTT_STATIC lmqtt_io_status_t client_process_output(lmqtt_client_t *client)
 {
     lmqtt_transfer_t input;
     lmqtt_transfer_t output;
+    lmqtt_io_status_t result;
     transfer_initialize(&input, &client_wrapper_encode,
         LMQTT_IO_STATUS_BLOCK_DATA);
     transfer_initialize(&output, &client_wrapper_write,
         LMQTT_IO_STATUS_BLOCK_CONN);
 
-    return client_buffer_transfer(client, &input, &output,
+    if (!client_borrow_buffer(client, &client->write_buf))
+        return LMQTT_IO_STATUS_BLOCK_POOL;
+
+    result = client_buffer_transfer(client, &input, &output,
         client->write_buf, &client->write_buf_pos, client->write_buf_capacity);
+
+    client_return_buffer(client, &client->write_buf, client->write_buf_pos);
+    return result;
 }
 
 LMQTT_STATIC lmqtt_io_status_t client_keep_alive(lmqtt_client_t *client)
@@ -264,9 +376,142 @@ LMQTT_STATIC lmqtt_io_status_t client_keep_alive(lmqtt_client_t *client)
     }
 
     client->internal.pingreq(client);
+    client_draw_keep_alive_offset(client);
     return LMQTT_IO_STATUS_READY;
 }
 
+LMQTT_STATIC long client_registry_find(lmqtt_client_t *client,
+    lmqtt_string_t *topic)
+{
+    lmqtt_subscription_registry_t *registry = &client->registry;
+    size_t i;
+
+    if (!topic->buf)
+        return -1;
+
+    for (i = 0; i < registry->count; i++) {
+        lmqtt_string_t *item = &registry->items[i].topic;
+        if (item->len == topic->len &&
+                memcmp(item->buf, topic->buf, topic->len) == 0)
+            return (long) i;
+    }
+
+    return -1;
+}
+
+LMQTT_STATIC void client_registry_put(lmqtt_client_t *client,
+    lmqtt_subscription_t *subscription)
+{
+    lmqtt_subscription_registry_t *registry = &client->registry;
+    long i;
+
+    /* MQTT 5 failure codes are all greater than 0x80 */
+    if (!subscription->topic.buf || subscription->return_code >= 0x80)
+        return;
+
+    i = client_registry_find(client, &subscription->topic);
+    if (i < 0) {
+        if (registry->count >= registry->capacity)
+            return;
+        i = (long) registry->count++;
+    }
+
+    registry->items[i] = *subscription;
+}
+
+LMQTT_STATIC void client_registry_remove_at(lmqtt_client_t *client,
+    size_t pos)
+{
+    lmqtt_subscription_registry_t *registry = &client->registry;
+
+    memmove(&registry->items[pos], &registry->items[pos + 1],
+        sizeof(registry->items[0]) * (registry->count - pos - 1));
+    registry->count--;
+}
+
+LMQTT_STATIC int client_on_restore_suback(void *data,
+    lmqtt_subscribe_t *subscribe)
+{
+    lmqtt_client_t *client = (lmqtt_client_t *) data;
+    lmqtt_subscription_registry_t *registry = &client->registry;
+    int i;
+
+    registry->restoring = 0;
+    if (client->closed)
+        return 1;
+
+    /* the registry may have changed since the request was queued, so the
+       results are matched by topic; the subscriptions the server did not
+       accept are forgotten */
+    for (i = 0; i < subscribe->count; i++) {
+        lmqtt_subscription_t *restored = &subscribe->subscriptions[i];
+        long pos = client_registry_find(client, &restored->topic);
+
+        if (pos < 0)
+            continue;
+        if (restored->return_code >= 0x80)
+            client_registry_remove_at(client, (size_t) pos);
+        else
+            registry->items[pos].return_code = restored->return_code;
+    }
+
+    return 1;
+}
+
+LMQTT_STATIC void client_restore_subscriptions(lmqtt_client_t *client,
+    lmqtt_connect_t *connect)
+{
+    lmqtt_subscription_registry_t *registry = &client->registry;
+    lmqtt_store_t *store = &client->main_store;
+    lmqtt_store_value_t value;
+
+    if (connect->response.session_present || registry->count == 0 ||
+            registry->restoring)
+        return;
+
+    memcpy(registry->restore_items, registry->items,
+        sizeof(registry->items[0]) * registry->count);
+    memset(&registry->subscribe, 0, sizeof(registry->subscribe));
+    registry->subscribe.count = (int) registry->count;
+    registry->subscribe.subscriptions = registry->restore_items;
+
+    value.packet_id = lmqtt_store_get_id(store);
+    value.value = &registry->subscribe;
+    value.callback = (lmqtt_store_entry_callback_t) &client_on_restore_suback;
+    value.callback_data = client;
+
+    /* sent ahead of the other queued requests */
+    if (lmqtt_store_append(store, LMQTT_KIND_SUBSCRIBE, &value)) {
+        lmqtt_store_move_to_current(store, store->count - 1);
+        registry->restoring = 1;
+    }
+}
+
+/* returns the last queued request if it is a SUBSCRIBE which was not encoded
+   yet, or NULL */
+LMQTT_STATIC lmqtt_subscribe_t *client_find_subscribe_batch(
+    lmqtt_client_t *client)
+{
+    lmqtt_store_t *store = &client->main_store;
+    size_t last = store->count - 1;
+    int kind;
+    lmqtt_store_value_t value;
+
+    if (store->count == 0 || last < store->pos ||
+            !lmqtt_store_get_at(store, last, &kind, &value) ||
+            kind != LMQTT_KIND_SUBSCRIBE ||
+            value.value == &client->registry.subscribe)
+        return NULL;
+
+    /* the current entry may be partially written */
+    if (last == store->pos && !client->tx_state.internal.from_ring &&
+            (client->tx_state.internal.pos != 0 ||
+            client->tx_state.internal.offset != 0))
+        return NULL;
+
+    return value.value;
+}
+
 LMQTT_STATIC int client_subscribe_with_kind(lmqtt_client_t *client,
     lmqtt_subscribe_t *subscribe, lmqtt_kind_t kind,
     lmqtt_store_entry_callback_t cb)
@@ -277,6 +522,14 @@ LMQTT_STATIC int client_subscribe_with_kind(lmqtt_client_t *client,
     if (!lmqtt_subscribe_validate(subscribe))
         return 0;
 
+    subscribe->internal.next = NULL;
+    if (kind == LMQTT_KIND_SUBSCRIBE && client->subscribe_batch_size > 0) {
+        lmqtt_subscribe_t *batch = client_find_subscribe_batch(client);
+        if (batch && lmqtt_subscribe_append(batch, subscribe,
+                client->subscribe_batch_size))
+            return 1;
+    }
+
     packet_id = lmqtt_store_get_id(&client->main_store);
 
     value.packet_id = packet_id;
@@ -297,7 +550,28 @@ LMQTT_STATIC int client_on_connack(void *data, lmqtt_connect_t *connect)
     } else {
         client->clean_session = connect->clean_session;
         client->main_store.keep_alive = connect->keep_alive;
+        client_draw_keep_alive_offset(client);
+        client->tx_state.topic_aliases.maximum =
+            connect->response.topic_alias_maximum;
+        client->tx_state.inflight_window = client->inflight_window;
+        if (connect->protocol == LMQTT_PROTOCOL_MQTT_5 &&
+                connect->response.receive_maximum > 0 &&
+                (client->inflight_window == 0 ||
+                connect->response.receive_maximum < client->inflight_window))
+            client->tx_state.inflight_window =
+                connect->response.receive_maximum;
         client_set_state_connected(client);
+        client_restore_subscriptions(client, connect);
+
+        if (client->reconnect.attempts > 0) {
+            long secs, nsecs;
+            lmqtt_time_get_elapsed(&client->reconnect.lost_at,
+                client->callbacks.get_time, &secs, &nsecs);
+            if (client->on_reconnect)
+                client->on_reconnect(client->on_reconnect_data,
+                    client->reconnect.attempts, secs, nsecs);
+            client->reconnect.attempts = 0;
+        }
 
         if (client->on_connect)
             return client->on_connect(client->on_connect_data, connect, 1);
@@ -309,17 +583,37 @@ LMQTT_STATIC int client_on_connack(void *data, lmqtt_connect_t *connect)
 LMQTT_STATIC int client_on_suback(void *data, lmqtt_subscribe_t *subscribe)
 {
     lmqtt_client_t *client = (lmqtt_client_t *) data;
+    int result = 1;
 
-    if (client->on_subscribe)
-        return client->on_subscribe(client->on_subscribe_data, subscribe,
-            !client->closed);
+    /* requests batched into the same packet are chained to the first one */
+    while (subscribe) {
+        lmqtt_subscribe_t *next = subscribe->internal.next;
+        int i;
 
-    return 1;
+        for (i = 0; !client->closed && i < subscribe->count; i++)
+            client_registry_put(client, &subscribe->subscriptions[i]);
+
+        if (client->on_subscribe &&
+                !client->on_subscribe(client->on_subscribe_data, subscribe,
+                    !client->closed))
+            result = 0;
+        subscribe = next;
+    }
+
+    return result;
 }
 
 LMQTT_STATIC int client_on_unsuback(void *data, lmqtt_subscribe_t *subscribe)
 {
     lmqtt_client_t *client = (lmqtt_client_t *) data;
+    int i;
+
+    for (i = 0; !client->closed && i < subscribe->count; i++) {
+        long pos = client_registry_find(client,
+            &subscribe->subscriptions[i].topic);
+        if (pos >= 0)
+            client_registry_remove_at(client, (size_t) pos);
+    }
 
     if (client->on_unsubscribe)
         return client->on_unsubscribe(client->on_unsubscribe_data, subscribe,
@@ -328,15 +622,39 @@ LMQTT_STATIC int client_on_unsuback(void *data, lmqtt_subscribe_t *subscribe)
     return 1;
 }
 
-LMQTT_STATIC int client_on_publish(void *data, lmqtt_publish_t *publish)
+LMQTT_STATIC int client_is_pooled_publish(lmqtt_client_t *client,
+    lmqtt_publish_t *publish)
 {
-    lmqtt_client_t *client = (lmqtt_client_t *) data;
+    lmqtt_publish_pool_t *pool = client->publish_pool;
+
+    return pool && publish >= pool->items && publish < pool->items + pool->count;
+}
+
+LMQTT_STATIC int client_notify_publish(lmqtt_client_t *client,
+    lmqtt_publish_t *publish, int succeeded)
+{
+    lmqtt_shared_payload_t *shared = publish->shared_payload;
+    int result = 1;
 
     if (client->on_publish)
-        return client->on_publish(client->on_publish_data, publish,
-            !client->closed);
+        result = client->on_publish(client->on_publish_data, publish,
+            succeeded);
 
-    return 1;
+    if (shared && --shared->references == 0 && shared->release)
+        shared->release(shared->release_data, shared);
+
+    if (client_is_pooled_publish(client, publish))
+        lmqtt_buffer_pool_put(&client->publish_pool->free, publish);
+
+    return result;
+}
+
+LMQTT_STATIC int client_on_publish(void *data, lmqtt_publish_t *publish)
+{
+    lmqtt_client_t *client = (lmqtt_client_t *) data;
+
+    return client_notify_publish(client, publish, !client->closed &&
+        publish->response.status == LMQTT_PUBLISH_STATUS_NONE);
 }
 
 LMQTT_STATIC int client_on_pingresp(void *data, void *unused)
@@ -367,16 +685,19 @@ LMQTT_STATIC int client_do_connect(lmqtt_client_t *client,
             &value))
         return 0;
 
+    client->reconnect.connect = connect;
+
+    /* topic aliases are only valid during a single connection */
+    client->rx_state.protocol = connect->protocol;
+    client->tx_state.protocol = connect->protocol;
+    client->tx_state.topic_aliases.count = 0;
+    client->tx_state.topic_aliases.next = 0;
+    client->tx_state.topic_aliases.maximum = 0;
+
     client_set_state_connecting(client);
     return 1;
 }
 
-LMQTT_STATIC int client_do_subscribe_fail(lmqtt_client_t *client,
-    lmqtt_subscribe_t *subscribe)
-{
-    return 0;
-}
-
 LMQTT_STATIC int client_do_subscribe(lmqtt_client_t *client,
     lmqtt_subscribe_t *subscribe)
 {
@@ -385,6 +706,19 @@ LMQTT_STATIC int client_do_subscribe(lmqtt_client_t *client,
         (lmqtt_store_entry_callback_t) &client_on_suback);
 }
 
+LMQTT_STATIC int client_do_subscribe_preconnect(lmqtt_client_t *client,
+    lmqtt_subscribe_t *subscribe)
+{
+    size_t count = client->main_store.count;
+
+    if (!client->preconnect_queue || !client_do_subscribe(client, subscribe))
+        return 0;
+
+    if (client->main_store.count > count)
+        client->preconnect_count++;
+    return 1;
+}
+
 LMQTT_STATIC int client_do_unsubscribe_fail(lmqtt_client_t *client,
     lmqtt_subscribe_t *subscribe)
 {
@@ -399,22 +733,100 @@ LMQTT_STATIC int client_do_unsubscribe(lmqtt_client_t *client,
         (lmqtt_store_entry_callback_t) &client_on_unsuback);
 }
 
-LMQTT_STATIC int client_do_publish_fail(lmqtt_client_t *client,
+LMQTT_STATIC int client_is_conflatable(lmqtt_publish_t *queued,
     lmqtt_publish_t *publish)
 {
-    return 0;
+    return queued != publish && queued->conflate && queued->topic.buf &&
+        queued->topic.len == publish->topic.len &&
+        memcmp(queued->topic.buf, publish->topic.buf, publish->topic.len) == 0;
 }
 
-LMQTT_STATIC int client_do_publish(lmqtt_client_t *client,
+/* returns the position of a queued, not yet encoded PUBLISH which may be
+   replaced by `publish`, or -1 if there is none */
+LMQTT_STATIC long client_find_conflatable(lmqtt_client_t *client,
     lmqtt_publish_t *publish)
+{
+    lmqtt_store_t *store = &client->main_store;
+    size_t i = store->pos;
+    int kind;
+    lmqtt_store_value_t value;
+
+    if (!publish->conflate || !publish->topic.buf)
+        return -1;
+
+    /* the current entry may be partially written */
+    if (!client->tx_state.internal.from_ring &&
+            (client->tx_state.internal.pos != 0 ||
+            client->tx_state.internal.offset != 0))
+        i++;
+
+    for (; lmqtt_store_get_at(store, i, &kind, &value); i++) {
+        if ((kind == LMQTT_KIND_PUBLISH_0 || kind == LMQTT_KIND_PUBLISH_1 ||
+                kind == LMQTT_KIND_PUBLISH_2) &&
+                client_is_conflatable(value.value, publish))
+            return (long) i;
+    }
+
+    return -1;
+}
+
+/* the replaced message was never sent; give it back to the application */
+LMQTT_STATIC void client_release_conflated(lmqtt_client_t *client,
+    lmqtt_publish_t *replaced)
+{
+    replaced->response.status = LMQTT_PUBLISH_STATUS_CONFLATED;
+    client_notify_publish(client, replaced, 0);
+}
+
+LMQTT_STATIC int client_do_publish_qos_0_ring(lmqtt_client_t *client,
+    lmqtt_publish_t *publish)
+{
+    lmqtt_publish_ring_t *ring = &client->qos0_ring;
+    size_t i = 0;
+
+    if (publish->conflate && publish->topic.buf) {
+        /* the oldest message may be partially written */
+        if (client->tx_state.internal.from_ring)
+            i++;
+
+        for (; i < ring->count; i++) {
+            lmqtt_publish_t **item =
+                &ring->items[(ring->head + i) % ring->capacity];
+
+            if (client_is_conflatable(*item, publish)) {
+                lmqtt_publish_t *replaced = *item;
+                *item = publish;
+                client_release_conflated(client, replaced);
+                return 1;
+            }
+        }
+    }
+
+    return lmqtt_publish_ring_push(ring, publish);
+}
+
+LMQTT_STATIC int client_queue_publish(lmqtt_client_t *client,
+    lmqtt_publish_t *publish, int use_ring)
 {
     int kind;
     lmqtt_qos_t qos = publish->qos;
     lmqtt_store_value_t value;
+    lmqtt_store_value_t replaced;
+    long pos;
 
     if (!lmqtt_publish_validate(publish))
         return 0;
 
+    publish->response.status = LMQTT_PUBLISH_STATUS_NONE;
+    if (qos == LMQTT_QOS_0 && publish->expiry > 0)
+        lmqtt_time_touch(&publish->internal.queued_at,
+            client->main_store.get_time);
+
+    if (qos == LMQTT_QOS_0 && use_ring && client->qos0_ring.capacity > 0)
+        return client_do_publish_qos_0_ring(client, publish);
+
+    pos = client_find_conflatable(client, publish);
+
     if (qos == LMQTT_QOS_0) {
         kind = LMQTT_KIND_PUBLISH_0;
         value.packet_id = 0;
@@ -427,7 +839,34 @@ LMQTT_STATIC int client_do_publish(lmqtt_client_t *client,
     value.callback = (lmqtt_store_entry_callback_t) &client_on_publish;
     value.callback_data = client;
 
-    return lmqtt_store_append(&client->main_store, kind, &value);
+    if (pos < 0)
+        return lmqtt_store_append(&client->main_store, kind, &value);
+
+    lmqtt_store_get_at(&client->main_store, (size_t) pos, NULL, &replaced);
+    lmqtt_store_replace_at(&client->main_store, (size_t) pos, kind, &value);
+    client_release_conflated(client, replaced.value);
+    return 1;
+}
+
+LMQTT_STATIC int client_do_publish(lmqtt_client_t *client,
+    lmqtt_publish_t *publish)
+{
+    return client_queue_publish(client, publish, 1);
+}
+
+/* queues messages in the main store until the next CONNACK; the QoS 0 ring is
+   not used since it is flushed with the session */
+LMQTT_STATIC int client_do_publish_preconnect(lmqtt_client_t *client,
+    lmqtt_publish_t *publish)
+{
+    size_t count = client->main_store.count;
+
+    if (!client->preconnect_queue || !client_queue_publish(client, publish, 0))
+        return 0;
+
+    if (client->main_store.count > count)
+        client->preconnect_count++;
+    return 1;
 }
 
 LMQTT_STATIC int client_do_pingreq_fail(lmqtt_client_t *client)
@@ -471,9 +910,9 @@ LMQTT_STATIC void client_set_state_initial(lmqtt_client_t *client)
     lmqtt_tx_buffer_finish(&client->tx_state);
 
     client->internal.connect = client_do_connect;
-    client->internal.subscribe = client_do_subscribe_fail;
+    client->internal.subscribe = client_do_subscribe_preconnect;
     client->internal.unsubscribe = client_do_unsubscribe_fail;
-    client->internal.publish = client_do_publish_fail;
+    client->internal.publish = client_do_publish_preconnect;
     client->internal.pingreq = client_do_pingreq_fail;
     client->internal.disconnect = client_do_disconnect_fail;
 }
@@ -488,6 +927,17 @@ LMQTT_STATIC void client_set_state_connecting(lmqtt_client_t *client)
     lmqtt_tx_buffer_reset(&client->tx_state);
     client->read_buf_pos = 0;
     client->write_buf_pos = 0;
+    client_return_buffer(client, &client->read_buf, 0);
+    client_return_buffer(client, &client->write_buf, 0);
+
+    /* only messages queued for this connection are sent before CONNACK; the
+       ones sent during a refused attempt are sent again */
+    client->tx_state.pipeline_store = NULL;
+    if (client->pipeline_connect &&
+            client->main_store.count == client->preconnect_count) {
+        lmqtt_store_unmark_all(&client->main_store);
+        client->tx_state.pipeline_store = &client->main_store;
+    }
 
     client->internal.connect = client_do_connect_fail;
 }
@@ -498,10 +948,14 @@ LMQTT_STATIC void client_set_state_connected(lmqtt_client_t *client)
     client->os_error = 0;
     client->closed = 0;
 
+    /* packets pipelined after CONNECT were sent on this connection */
+    if (client->tx_state.store != &client->main_store)
+        lmqtt_store_unmark_all(&client->main_store);
+    client->tx_state.pipeline_store = NULL;
+
     client_set_current_store(client, &client->main_store);
     client_cleanup_stores(client, !client->clean_session);
-
-    lmqtt_store_unmark_all(&client->main_store);
+    client->preconnect_count = 0;
 
     client->internal.subscribe = client_do_subscribe;
     client->internal.unsubscribe = client_do_unsubscribe;
@@ -513,12 +967,14 @@ LMQTT_STATIC void client_set_state_connected(lmqtt_client_t *client)
 LMQTT_STATIC void client_set_state_failed(lmqtt_client_t *client)
 {
     assert(client->error);
+    if (!client->closed && client->error != LMQTT_ERROR_CLOSED)
+        client_schedule_reconnect(client);
     client->closed = 1;
 
     client->internal.connect = client_do_connect_fail;
-    client->internal.subscribe = client_do_subscribe_fail;
+    client->internal.subscribe = client_do_subscribe_preconnect;
     client->internal.unsubscribe = client_do_unsubscribe_fail;
-    client->internal.publish = client_do_publish_fail;
+    client->internal.publish = client_do_publish_preconnect;
     client->internal.pingreq = client_do_pingreq_fail;
     client->internal.disconnect = client_do_disconnect_fail;
 }
@@ -541,6 +997,9 @@ LMQTT_STATIC int client_process_buffer(lmqtt_client_t *client,
     if (res == LMQTT_IO_STATUS_BLOCK_CONN) {
         *return_val |= conn_val;
     }
+    if (res == LMQTT_IO_STATUS_BLOCK_POOL) {
+        *return_val |= LMQTT_RES_WOULD_BLOCK_POOL;
+    }
     if (res == LMQTT_IO_STATUS_BLOCK_DATA) {
         if ((*blk_str_out = *blk_str_in))
             *return_val |= data_val;
@@ -586,8 +1045,14 @@ void lmqtt_client_finalize(lmqtt_client_t *client)
     client->error = LMQTT_ERROR_CLOSED;
     client->os_error = 0;
     client_set_state_failed(client);
+    client->reconnect.pending = 0;
+    client->read_buf_pos = 0;
+    client->write_buf_pos = 0;
+    client_return_buffer(client, &client->read_buf, 0);
+    client_return_buffer(client, &client->write_buf, 0);
 
     lmqtt_rx_buffer_finish(&client->rx_state);
+    client->preconnect_count = 0;
     client_cleanup_stores(client, 0);
 }
 
@@ -609,7 +1074,67 @@ int lmqtt_client_unsubscribe(lmqtt_client_t *client,
 
 int lmqtt_client_publish(lmqtt_client_t *client, lmqtt_publish_t *publish)
 {
-    return client->internal.publish(client, publish);
+    lmqtt_shared_payload_t *shared = publish->shared_payload;
+
+    /* referenced before queueing: conflation may release the message being
+       replaced, which can share the same payload */
+    if (shared)
+        shared->references++;
+
+    if (!client->internal.publish(client, publish)) {
+        if (shared)
+            shared->references--;
+        return 0;
+    }
+    return 1;
+}
+
+int lmqtt_client_publish_copy(lmqtt_client_t *client,
+    lmqtt_publish_t *publish)
+{
+    lmqtt_publish_pool_t *pool = client->publish_pool;
+    lmqtt_publish_t *copy;
+    char *data;
+
+    /* a shared payload is referenced rather than copied */
+    long payload_len = publish->shared_payload ? 0 : publish->payload.len;
+
+    if (!pool || !publish->topic.buf ||
+            (payload_len > 0 && !publish->payload.buf) ||
+            publish->topic.len < 0 || payload_len < 0 ||
+            (size_t) publish->topic.len + (size_t) payload_len >
+                pool->data_size)
+        return 0;
+
+    copy = lmqtt_buffer_pool_get(&pool->free);
+    if (!copy)
+        return 0;
+
+    data = &pool->data[(size_t) (copy - pool->items) * pool->data_size];
+    memcpy(data, publish->topic.buf, publish->topic.len);
+    if (payload_len > 0)
+        memcpy(&data[publish->topic.len], publish->payload.buf, payload_len);
+
+    /* user_data is kept so on_publish can tell the message apart */
+    *copy = *publish;
+    memset(&copy->topic, 0, sizeof(copy->topic));
+    memset(&copy->internal, 0, sizeof(copy->internal));
+    copy->topic.len = publish->topic.len;
+    copy->topic.buf = data;
+    if (publish->shared_payload) {
+        lmqtt_publish_set_shared_payload(copy, publish->shared_payload);
+    } else {
+        memset(&copy->payload, 0, sizeof(copy->payload));
+        copy->payload.len = payload_len;
+        copy->payload.buf = &data[publish->topic.len];
+    }
+
+    if (!lmqtt_client_publish(client, copy)) {
+        lmqtt_buffer_pool_put(&pool->free, copy);
+        return 0;
+    }
+
+    return 1;
 }
 
 int lmqtt_client_disconnect(lmqtt_client_t *client)
@@ -617,6 +1142,32 @@ int lmqtt_client_disconnect(lmqtt_client_t *client)
     return client->internal.disconnect(client);
 }
 
+int lmqtt_client_reconnect(lmqtt_client_t *client)
+{
+    long secs, nsecs;
+
+    if (!client->reconnect.pending)
+        return 0;
+
+    lmqtt_time_get_timeout_to_msecs(&client->reconnect.failed_at,
+        client->callbacks.get_time, client->reconnect.delay, &secs, &nsecs);
+    if (secs != 0 || nsecs != 0)
+        return 0;
+
+    if (client->connect_limiter &&
+            !lmqtt_rate_limiter_acquire(client->connect_limiter, &secs,
+                &nsecs)) {
+        lmqtt_time_touch(&client->reconnect.failed_at,
+            client->callbacks.get_time);
+        client->reconnect.delay = secs * 1000 + nsecs / 1000000;
+        return 0;
+    }
+
+    client->reconnect.pending = 0;
+    lmqtt_client_reset(client);
+    return client->internal.connect(client, client->reconnect.connect);
+}
+
 void lmqtt_client_set_on_connect(lmqtt_client_t *client,
     lmqtt_client_on_connect_t on_connect, void *on_connect_data)
 {
@@ -645,6 +1196,13 @@ void lmqtt_client_set_on_publish(lmqtt_client_t *client,
     client->on_publish_data = on_publish_data;
 }
 
+void lmqtt_client_set_on_reconnect(lmqtt_client_t *client,
+    lmqtt_client_on_reconnect_t on_reconnect, void *on_reconnect_data)
+{
+    client->on_reconnect = on_reconnect;
+    client->on_reconnect_data = on_reconnect_data;
+}
+
 void lmqtt_client_set_message_callbacks(lmqtt_client_t *client,
     lmqtt_message_callbacks_t *message_callbacks)
 {
@@ -652,6 +1210,107 @@ void lmqtt_client_set_message_callbacks(lmqtt_client_t *client,
         sizeof(*message_callbacks));
 }
 
+void lmqtt_client_set_inflight_window(lmqtt_client_t *client,
+    unsigned short window)
+{
+    client->inflight_window = window;
+}
+
+void lmqtt_client_set_topic_aliases(lmqtt_client_t *client,
+    lmqtt_topic_alias_t *aliases, size_t aliases_size)
+{
+    client->tx_state.topic_aliases.items = aliases;
+    client->tx_state.topic_aliases.capacity =
+        aliases_size / LMQTT_TOPIC_ALIAS_ENTRY_SIZE;
+    client->tx_state.topic_aliases.count = 0;
+    client->tx_state.topic_aliases.next = 0;
+}
+
+void lmqtt_client_set_qos_0_ring(lmqtt_client_t *client,
+    lmqtt_publish_t **items, size_t items_size)
+{
+    client->qos0_ring.items = items;
+    client->qos0_ring.capacity = items_size / LMQTT_PUBLISH_RING_ENTRY_SIZE;
+    client->qos0_ring.head = 0;
+    client->qos0_ring.count = 0;
+    client->qos0_ring.callback =
+        (lmqtt_store_entry_callback_t) &client_on_publish;
+    client->qos0_ring.callback_data = client;
+}
+
+void lmqtt_client_set_ack_queue(lmqtt_client_t *client,
+    lmqtt_ack_t *items, size_t items_size)
+{
+    client->ack_queue.items = items;
+    client->ack_queue.capacity = items_size / LMQTT_ACK_QUEUE_ENTRY_SIZE;
+    client->ack_queue.head = 0;
+    client->ack_queue.count = 0;
+    client->ack_queue.spilled = 0;
+}
+
+void lmqtt_client_set_reconnect(lmqtt_client_t *client,
+    unsigned short min_delay, unsigned short max_delay, unsigned long seed)
+{
+    client->reconnect.min_delay = min_delay;
+    client->reconnect.max_delay = max_delay < min_delay ? min_delay : max_delay;
+    client->reconnect.seed = seed & 0xffffffffUL;
+}
+
+void lmqtt_client_set_keep_alive_jitter(lmqtt_client_t *client,
+    unsigned short percent)
+{
+    client->keep_alive_jitter = percent > 50 ? 50 : percent;
+}
+
+void lmqtt_client_set_connect_limiter(lmqtt_client_t *client,
+    lmqtt_rate_limiter_t *limiter)
+{
+    client->connect_limiter = limiter;
+}
+
+void lmqtt_client_set_buffer_pool(lmqtt_client_t *client,
+    lmqtt_buffer_pool_t *pool)
+{
+    client->buffer_pool = pool;
+    client->read_buf = NULL;
+    client->read_buf_capacity = pool->buffer_size;
+    client->write_buf = NULL;
+    client->write_buf_capacity = pool->buffer_size;
+}
+
+void lmqtt_client_set_subscribe_batch(lmqtt_client_t *client,
+    long max_length)
+{
+    client->subscribe_batch_size = max_length;
+}
+
+void lmqtt_client_set_preconnect_queue(lmqtt_client_t *client,
+    int enabled)
+{
+    client->preconnect_queue = enabled;
+}
+
+void lmqtt_client_set_pipelined_connect(lmqtt_client_t *client,
+    int enabled)
+{
+    client->pipeline_connect = enabled;
+}
+
+void lmqtt_client_set_subscription_registry(lmqtt_client_t *client,
+    lmqtt_subscription_t *items, size_t items_size)
+{
+    client->registry.capacity = items_size / sizeof(lmqtt_subscription_t) / 2;
+    client->registry.items = items;
+    client->registry.restore_items = items + client->registry.capacity;
+    client->registry.count = 0;
+}
+
+void lmqtt_client_set_publish_pool(lmqtt_client_t *client,
+    lmqtt_publish_pool_t *pool)
+{
+    client->publish_pool = pool;
+}
+
 void lmqtt_client_set_default_timeout(lmqtt_client_t *client,
     unsigned short secs)
 {
@@ -668,6 +1327,10 @@ int lmqtt_client_get_timeout(lmqtt_client_t *client, long *secs, long *nsecs)
 {
     size_t cnt;
 
+    if (client->reconnect.pending)
+        return lmqtt_time_get_timeout_to_msecs(&client->reconnect.failed_at,
+            client->callbacks.get_time, client->reconnect.delay, secs, nsecs);
+
     return lmqtt_store_get_timeout(client->current_store, &cnt, secs, nsecs);
 }
 
@@ -714,3 +1377,176 @@ int lmqtt_client_run_once(lmqtt_client_t *client, lmqtt_string_t **str_rd,
         result |= LMQTT_RES_QUEUEABLE;
     return result;
 }
+
+/******************************************************************************
+ * lmqtt_buffer_pool_t PUBLIC functions
+ ******************************************************************************/
+
+void lmqtt_buffer_pool_initialize(lmqtt_buffer_pool_t *pool, void *memory,
+    size_t memory_size, size_t buffer_size)
+{
+    unsigned char *buf = (unsigned char *) memory;
+    size_t i;
+
+    pool->free_list = NULL;
+    pool->buffer_size = buffer_size;
+    pool->available = 0;
+
+    if (buffer_size < sizeof(unsigned char *))
+        return;
+
+    for (i = 0; i + buffer_size <= memory_size; i += buffer_size)
+        lmqtt_buffer_pool_put(pool, &buf[i]);
+}
+
+void *lmqtt_buffer_pool_get(lmqtt_buffer_pool_t *pool)
+{
+    unsigned char *buf = pool->free_list;
+
+    if (!buf)
+        return NULL;
+
+    memcpy(&pool->free_list, buf, sizeof(pool->free_list));
+    pool->available--;
+    return buf;
+}
+
+void lmqtt_buffer_pool_put(lmqtt_buffer_pool_t *pool, void *buffer)
+{
+    memcpy(buffer, &pool->free_list, sizeof(pool->free_list));
+    pool->free_list = (unsigned char *) buffer;
+    pool->available++;
+}
+
+/******************************************************************************
+ * lmqtt_publish_pool_t PUBLIC functions
+ ******************************************************************************/
+
+void lmqtt_publish_pool_initialize(lmqtt_publish_pool_t *pool,
+    lmqtt_publish_t *items, size_t items_size, void *data, size_t data_size)
+{
+    pool->items = items;
+    pool->count = items_size / sizeof(lmqtt_publish_t);
+    pool->data = (char *) data;
+    pool->data_size = pool->count > 0 ? data_size / pool->count : 0;
+
+    lmqtt_buffer_pool_initialize(&pool->free, items,
+        pool->count * sizeof(lmqtt_publish_t), sizeof(lmqtt_publish_t));
+}
+
+/******************************************************************************
+ * lmqtt_message_slab_t PRIVATE functions
+ ******************************************************************************/
+
+LMQTT_STATIC void message_slab_release(lmqtt_buffer_pool_t **pool,
+    void **buffer)
+{
+    if (*pool)
+        lmqtt_buffer_pool_put(*pool, *buffer);
+    *pool = NULL;
+    *buffer = NULL;
+}
+
+LMQTT_STATIC lmqtt_allocate_result_t message_slab_allocate(
+    lmqtt_message_slab_t *slab, lmqtt_publish_t *publish, lmqtt_string_t *str,
+    size_t len, lmqtt_buffer_pool_t **pool, void **buffer)
+{
+    size_t i;
+
+    str->len = len;
+    str->buf = NULL;
+    if (len == 0)
+        return LMQTT_ALLOCATE_SUCCESS;
+
+    for (i = 0; i < slab->class_count; i++) {
+        lmqtt_buffer_pool_t *cls = &slab->classes[i];
+        if (cls->buffer_size >= len && cls->available > 0) {
+            *pool = cls;
+            *buffer = lmqtt_buffer_pool_get(cls);
+            str->buf = (char *) *buffer;
+            slab->hits++;
+            return LMQTT_ALLOCATE_SUCCESS;
+        }
+    }
+
+    slab->misses++;
+
+    /* a QoS 1 or 2 message would still be acknowledged if ignored, so the
+       connection is dropped instead and the broker delivers it again */
+    return publish->qos == LMQTT_QOS_0 ? LMQTT_ALLOCATE_IGNORE :
+        LMQTT_ALLOCATE_ERROR;
+}
+
+LMQTT_STATIC lmqtt_allocate_result_t message_slab_allocate_topic(void *data,
+    lmqtt_publish_t *publish, size_t len)
+{
+    lmqtt_message_slab_t *slab = (lmqtt_message_slab_t *) data;
+
+    /* buffers of a message which was interrupted by a disconnection are never
+       deallocated by the decoder */
+    message_slab_release(&slab->internal.topic_class, &slab->internal.topic);
+    message_slab_release(&slab->internal.payload_class,
+        &slab->internal.payload);
+
+    return message_slab_allocate(slab, publish, &publish->topic, len,
+        &slab->internal.topic_class, &slab->internal.topic);
+}
+
+LMQTT_STATIC lmqtt_allocate_result_t message_slab_allocate_payload(void *data,
+    lmqtt_publish_t *publish, size_t len)
+{
+    lmqtt_message_slab_t *slab = (lmqtt_message_slab_t *) data;
+    lmqtt_allocate_result_t result = message_slab_allocate(slab, publish,
+        &publish->payload, len, &slab->internal.payload_class,
+        &slab->internal.payload);
+
+    /* an ignored message is not deallocated, so the topic must be given back
+       here */
+    if (result == LMQTT_ALLOCATE_IGNORE)
+        message_slab_release(&slab->internal.topic_class,
+            &slab->internal.topic);
+    return result;
+}
+
+LMQTT_STATIC void message_slab_deallocate(void *data,
+    lmqtt_publish_t *publish)
+{
+    lmqtt_message_slab_t *slab = (lmqtt_message_slab_t *) data;
+
+    message_slab_release(&slab->internal.topic_class, &slab->internal.topic);
+    message_slab_release(&slab->internal.payload_class,
+        &slab->internal.payload);
+}
+
+LMQTT_STATIC int message_slab_on_publish(void *data, lmqtt_publish_t *publish)
+{
+    lmqtt_message_slab_t *slab = (lmqtt_message_slab_t *) data;
+
+    return slab->on_publish ?
+        slab->on_publish(slab->on_publish_data, publish) : 1;
+}
+
+/******************************************************************************
+ * lmqtt_message_slab_t PUBLIC functions
+ ******************************************************************************/
+
+void lmqtt_message_slab_initialize(lmqtt_message_slab_t *slab,
+    lmqtt_buffer_pool_t *classes, size_t class_count)
+{
+    memset(slab, 0, sizeof(*slab));
+    slab->classes = classes;
+    slab->class_count = class_count;
+}
+
+void lmqtt_message_slab_set_callbacks(lmqtt_message_slab_t *slab,
+    lmqtt_message_callbacks_t *callbacks)
+{
+    slab->on_publish = callbacks->on_publish;
+    slab->on_publish_data = callbacks->on_publish_data;
+
+    callbacks->on_publish = &message_slab_on_publish;
+    callbacks->on_publish_allocate_topic = &message_slab_allocate_topic;
+    callbacks->on_publish_allocate_payload = &message_slab_allocate_payload;
+    callbacks->on_publish_deallocate = &message_slab_deallocate;
+    callbacks->on_publish_data = slab;
+}
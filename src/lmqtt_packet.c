@@ -17,6 +17,18 @@
 #define LMQTT_PACKET_ID_SIZE 2
 #define LMQTT_REMAINING_LENGTH_MAX_SIZE 4
 
+#define LMQTT_PROPERTY_SESSION_EXPIRY_INTERVAL 0x11
+#define LMQTT_PROPERTY_RECEIVE_MAXIMUM 0x21
+#define LMQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM 0x22
+#define LMQTT_PROPERTY_TOPIC_ALIAS 0x23
+
+#define LMQTT_PROPERTY_TYPE_BYTE 1
+#define LMQTT_PROPERTY_TYPE_TWO_BYTE 2
+#define LMQTT_PROPERTY_TYPE_FOUR_BYTE 4
+#define LMQTT_PROPERTY_TYPE_VARIABLE 5
+#define LMQTT_PROPERTY_TYPE_STRING 6
+#define LMQTT_PROPERTY_TYPE_STRING_PAIR 7
+
 #define STRING_LEN_BYTE(val, num) (((val) >> ((num) * 8)) & 0xff)
 
 #define LMQTT_QOS_TO_CONNECT_WILL_QOS(x) ((x) << 3)
@@ -46,11 +58,36 @@ LMQTT_STATIC size_t encode_remaining_length(long len, unsigned char *buf)
     return result;
 }
 
+/* returns the type of the value of an MQTT 5 property (binary data has the same
+   layout as strings), or 0 if the property is unknown */
+LMQTT_STATIC int property_get_type(unsigned char id)
+{
+    switch (id) {
+        case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28:
+        case 0x29: case 0x2a:
+            return LMQTT_PROPERTY_TYPE_BYTE;
+        case 0x13: case 0x21: case 0x22: case 0x23:
+            return LMQTT_PROPERTY_TYPE_TWO_BYTE;
+        case 0x02: case 0x11: case 0x18: case 0x27:
+            return LMQTT_PROPERTY_TYPE_FOUR_BYTE;
+        case 0x0b:
+            return LMQTT_PROPERTY_TYPE_VARIABLE;
+        case 0x03: case 0x08: case 0x09: case 0x12: case 0x15: case 0x16:
+        case 0x1a: case 0x1c: case 0x1f:
+            return LMQTT_PROPERTY_TYPE_STRING;
+        case 0x26:
+            return LMQTT_PROPERTY_TYPE_STRING_PAIR;
+    }
+    return 0;
+}
+
 LMQTT_STATIC int kind_expects_response(lmqtt_kind_t kind)
 {
     return kind != LMQTT_KIND_PUBLISH_0 && kind != LMQTT_KIND_PUBACK &&
         kind != LMQTT_KIND_PUBREC && kind != LMQTT_KIND_PUBCOMP &&
-        kind != LMQTT_KIND_DISCONNECT;
+        kind != LMQTT_KIND_DISCONNECT && kind != LMQTT_KIND_CONNACK &&
+        kind != LMQTT_KIND_SUBACK && kind != LMQTT_KIND_UNSUBACK &&
+        kind != LMQTT_KIND_PINGRESP;
 }
 
 /******************************************************************************
@@ -202,9 +239,54 @@ static lmqtt_string_result_t string_move(lmqtt_string_t *str,
     return LMQTT_STRING_INVALID_OBJECT;
 }
 
+/* moves data between `buf` and the segments of `str`, starting at the
+   segment which contains the current position */
+static lmqtt_string_result_t string_move_segments(lmqtt_string_t *str,
+    unsigned char *buf, size_t buf_len, int to_segments, size_t *bytes_moved,
+    int *os_error)
+{
+    long start = 0;
+    size_t i;
+
+    *bytes_moved = 0;
+    *os_error = 0;
+
+    if (str->buf || str->read || str->write)
+        return LMQTT_STRING_INVALID_OBJECT;
+
+    assert(str->internal.pos + buf_len <= str->len);
+
+    for (i = 0; i < str->segment_count && *bytes_moved < buf_len; i++) {
+        lmqtt_string_segment_t *segment = &str->segments[i];
+
+        if (str->internal.pos < start + segment->len) {
+            long seg_pos = str->internal.pos - start;
+            size_t cnt = (size_t) (segment->len - seg_pos);
+
+            if (cnt > buf_len - *bytes_moved)
+                cnt = buf_len - *bytes_moved;
+
+            if (to_segments)
+                memcpy(&segment->buf[seg_pos], &buf[*bytes_moved], cnt);
+            else
+                memcpy(&buf[*bytes_moved], &segment->buf[seg_pos], cnt);
+
+            *bytes_moved += cnt;
+            str->internal.pos += (long) cnt;
+        }
+        start += segment->len;
+    }
+
+    return LMQTT_STRING_SUCCESS;
+}
+
 LMQTT_STATIC lmqtt_string_result_t string_read(lmqtt_string_t *str,
     unsigned char *buf, size_t buf_len, size_t *bytes_read, int *os_error)
 {
+    if (str->segments)
+        return string_move_segments(str, buf, buf_len, 0, bytes_read,
+            os_error);
+
     return string_move(str, buf, buf_len, str->read, buf,
         (unsigned char *) &str->buf[str->internal.pos], bytes_read, os_error);
 }
@@ -212,6 +294,10 @@ LMQTT_STATIC lmqtt_string_result_t string_read(lmqtt_string_t *str,
 LMQTT_STATIC lmqtt_string_result_t string_write(lmqtt_string_t *str,
     unsigned char *buf, size_t buf_len, size_t *bytes_written, int *os_error)
 {
+    if (str->segments)
+        return string_move_segments(str, buf, buf_len, 1, bytes_written,
+            os_error);
+
     return string_move(str, buf, buf_len, str->write, (unsigned char *)
         &str->buf[str->internal.pos], buf, bytes_written, os_error);
 }
@@ -295,6 +381,22 @@ LMQTT_STATIC int string_validate_field_length(lmqtt_string_t *str)
     return str->len >= 0 && str->len <= 0xffff;
 }
 
+/******************************************************************************
+ * lmqtt_string_t PUBLIC functions
+ ******************************************************************************/
+
+void lmqtt_string_set_segments(lmqtt_string_t *str,
+    lmqtt_string_segment_t *segments, size_t count)
+{
+    size_t i;
+
+    str->segments = segments;
+    str->segment_count = count;
+    str->len = 0;
+    for (i = 0; i < count; i++)
+        str->len += segments[i].len;
+}
+
 /******************************************************************************
  * lmqtt_fixed_header_t PRIVATE functions
  ******************************************************************************/
@@ -385,16 +487,29 @@ LMQTT_STATIC lmqtt_decode_result_t fixed_header_decode(
 
 #define LMQTT_CONNECT_HEADER_SIZE 10
 
+/* length of the properties of an MQTT 5 CONNECT, not including the length
+   byte itself */
+LMQTT_STATIC long connect_calc_properties_length(lmqtt_connect_t *connect)
+{
+    return connect->session_expiry_interval > 0 ? 5 : 0;
+}
+
 LMQTT_STATIC long connect_calc_remaining_length(lmqtt_connect_t *connect)
 {
-    return LMQTT_CONNECT_HEADER_SIZE +
+    long properties_len = 0;
+
+    if (connect->protocol == LMQTT_PROTOCOL_MQTT_5)
+        properties_len = 1 + connect_calc_properties_length(connect) +
+            (connect->will_topic.len > 0 ? 1 : 0);
+
+    return LMQTT_CONNECT_HEADER_SIZE + properties_len +
         /* client_id is always present in payload */
         LMQTT_STRING_LEN_SIZE + connect->client_id.len +
         string_calc_field_length(&connect->will_topic) +
         string_calc_field_length(&connect->will_message) +
         string_calc_field_length(&connect->user_name) +
         string_calc_field_length(&connect->password);
- }
+}
 
 LMQTT_STATIC void connect_build_fixed_header(lmqtt_store_value_t *value,
     lmqtt_encode_buffer_t *encode_buffer)
@@ -424,10 +539,13 @@ LMQTT_STATIC void connect_build_variable_header(lmqtt_store_value_t *value,
 {
     unsigned char flags;
     lmqtt_connect_t *connect = value->value;
+    size_t len = LMQTT_CONNECT_HEADER_SIZE;
 
-    assert(sizeof(encode_buffer->buf) >= LMQTT_CONNECT_HEADER_SIZE);
+    assert(sizeof(encode_buffer->buf) >= LMQTT_CONNECT_HEADER_SIZE + 6);
 
     memcpy(encode_buffer->buf, "\x00\x04MQTT\x04", 7);
+    if (connect->protocol == LMQTT_PROTOCOL_MQTT_5)
+        encode_buffer->buf[6] = 5;
 
     flags = LMQTT_QOS_TO_CONNECT_WILL_QOS(connect->will_qos);
     if (connect->clean_session)
@@ -444,7 +562,19 @@ LMQTT_STATIC void connect_build_variable_header(lmqtt_store_value_t *value,
 
     encode_buffer->buf[8] = STRING_LEN_BYTE(connect->keep_alive, 1);
     encode_buffer->buf[9] = STRING_LEN_BYTE(connect->keep_alive, 0);
-    encode_buffer->buf_len = 10;
+
+    if (connect->protocol == LMQTT_PROTOCOL_MQTT_5) {
+        int i;
+        encode_buffer->buf[len++] = connect_calc_properties_length(connect);
+        if (connect->session_expiry_interval > 0) {
+            encode_buffer->buf[len++] = LMQTT_PROPERTY_SESSION_EXPIRY_INTERVAL;
+            for (i = 3; i >= 0; i--)
+                encode_buffer->buf[len++] = STRING_LEN_BYTE(
+                    connect->session_expiry_interval, i);
+        }
+    }
+
+    encode_buffer->buf_len = len;
 }
 
 LMQTT_STATIC lmqtt_encode_result_t connect_encode_variable_header(
@@ -465,6 +595,21 @@ LMQTT_STATIC lmqtt_encode_result_t connect_encode_payload_client_id(
         bytes_written, encode_buffer);
 }
 
+LMQTT_STATIC void connect_build_will_properties(lmqtt_store_value_t *value,
+    lmqtt_encode_buffer_t *encode_buffer)
+{
+    encode_buffer->buf[0] = 0;
+    encode_buffer->buf_len = 1;
+}
+
+LMQTT_STATIC lmqtt_encode_result_t connect_encode_will_properties(
+    lmqtt_store_value_t *value, lmqtt_encode_buffer_t *encode_buffer,
+    size_t offset, unsigned char *buf, size_t buf_len, size_t *bytes_written)
+{
+    return encode_buffer_encode(encode_buffer, value,
+        connect_build_will_properties, offset, buf, buf_len, bytes_written);
+}
+
 LMQTT_STATIC lmqtt_encode_result_t connect_encode_payload_will_topic(
     lmqtt_store_value_t *value, lmqtt_encode_buffer_t *encode_buffer,
     size_t offset, unsigned char *buf, size_t buf_len, size_t *bytes_written)
@@ -540,11 +685,11 @@ int lmqtt_connect_validate(lmqtt_connect_t *connect)
  * lmqtt_subscribe_t PRIVATE functions
  ******************************************************************************/
 
-LMQTT_STATIC long subscribe_calc_remaining_length(lmqtt_subscribe_t *subscribe,
+LMQTT_STATIC long subscribe_calc_topics_length(lmqtt_subscribe_t *subscribe,
     int include_qos)
 {
     int i;
-    long result = LMQTT_PACKET_ID_SIZE;
+    long result = 0;
 
     for (i = 0; i < subscribe->count; i++)
         result += subscribe->subscriptions[i].topic.len +
@@ -553,6 +698,42 @@ LMQTT_STATIC long subscribe_calc_remaining_length(lmqtt_subscribe_t *subscribe,
     return result;
 }
 
+LMQTT_STATIC long subscribe_calc_remaining_length(lmqtt_subscribe_t *subscribe,
+    int include_qos)
+{
+    long result = LMQTT_PACKET_ID_SIZE;
+
+    if (subscribe->internal.protocol == LMQTT_PROTOCOL_MQTT_5)
+        result += 1;
+
+    for (; subscribe; subscribe = subscribe->internal.next)
+        result += subscribe_calc_topics_length(subscribe, include_qos);
+
+    return result;
+}
+
+/* number of subscriptions in `subscribe` and the requests chained to it */
+LMQTT_STATIC long subscribe_get_count(lmqtt_subscribe_t *subscribe)
+{
+    long result = 0;
+
+    for (; subscribe; subscribe = subscribe->internal.next)
+        result += subscribe->count;
+
+    return result;
+}
+
+LMQTT_STATIC lmqtt_subscription_t *subscribe_get_subscription(
+    lmqtt_subscribe_t *subscribe, long pos)
+{
+    while (subscribe && pos >= subscribe->count) {
+        pos -= subscribe->count;
+        subscribe = subscribe->internal.next;
+    }
+
+    return subscribe ? &subscribe->subscriptions[pos] : NULL;
+}
+
 LMQTT_STATIC void subscribe_build_header_subscribe(
     lmqtt_store_value_t *value, lmqtt_encode_buffer_t *encode_buffer)
 {
@@ -561,6 +742,8 @@ LMQTT_STATIC void subscribe_build_header_subscribe(
     encode_buffer_encode_packet_id(
         encode_buffer, (LMQTT_TYPE_SUBSCRIBE << 4) | 0x02,
         subscribe_calc_remaining_length(subscribe, 1), value->packet_id);
+    if (subscribe->internal.protocol == LMQTT_PROTOCOL_MQTT_5)
+        encode_buffer->buf[encode_buffer->buf_len++] = 0;
 }
 
 LMQTT_STATIC lmqtt_encode_result_t subscribe_encode_header_subscribe(
@@ -579,6 +762,8 @@ LMQTT_STATIC void subscribe_build_header_unsubscribe(
     encode_buffer_encode_packet_id(
         encode_buffer, (LMQTT_TYPE_UNSUBSCRIBE << 4) | 0x02,
         subscribe_calc_remaining_length(subscribe, 0), value->packet_id);
+    if (subscribe->internal.protocol == LMQTT_PROTOCOL_MQTT_5)
+        encode_buffer->buf[encode_buffer->buf_len++] = 0;
 }
 
 LMQTT_STATIC lmqtt_encode_result_t subscribe_encode_header_unsubscribe(
@@ -641,23 +826,55 @@ int lmqtt_subscribe_validate(lmqtt_subscribe_t *subscribe)
     return 1;
 }
 
+int lmqtt_subscribe_append(lmqtt_subscribe_t *batch,
+    lmqtt_subscribe_t *subscribe, long max_length)
+{
+    if (subscribe_calc_remaining_length(batch, 1) +
+            subscribe_calc_topics_length(subscribe, 1) > max_length)
+        return 0;
+
+    while (batch->internal.next)
+        batch = batch->internal.next;
+
+    subscribe->internal.next = NULL;
+    batch->internal.next = subscribe;
+    return 1;
+}
+
 /******************************************************************************
  * lmqtt_publish_t PRIVATE functions
  ******************************************************************************/
 
+/* length of the properties of an MQTT 5 PUBLISH, including the length byte */
+LMQTT_STATIC long publish_calc_properties_length(lmqtt_publish_t *publish)
+{
+    if (publish->internal.protocol != LMQTT_PROTOCOL_MQTT_5)
+        return 0;
+    return publish->internal.topic_alias > 0 ? 4 : 1;
+}
+
 LMQTT_STATIC long publish_calc_remaining_length(lmqtt_publish_t *publish)
 {
-    return LMQTT_STRING_LEN_SIZE + (long) publish->topic.len +
+    return LMQTT_STRING_LEN_SIZE +
+        (publish->internal.omit_topic ? 0 : (long) publish->topic.len) +
         (publish->qos == LMQTT_QOS_0 ? 0 : LMQTT_PACKET_ID_SIZE) +
-        (long) publish->payload.len;
+        publish_calc_properties_length(publish) + (long) publish->payload.len;
+}
+
+LMQTT_STATIC unsigned char publish_get_type(lmqtt_publish_t *publish)
+{
+    unsigned char type = LMQTT_TYPE_PUBLISH << 4;
+
+    type |= publish->retain ? 0x01 : 0x00;
+    type |= LMQTT_QOS_TO_PUBLISH_QOS(publish->qos);
+    type |= publish->internal.encode_count > 0 ? 0x08 : 0x00;
+    return type;
 }
 
 LMQTT_STATIC void publish_build_fixed_header(lmqtt_store_value_t *value,
     lmqtt_encode_buffer_t *encode_buffer)
 {
-    int i;
     size_t v;
-    unsigned char type;
     lmqtt_publish_t *publish = value->value;
 
     /* lmqtt_client_t is supposed to validate packet length */
@@ -666,11 +883,7 @@ LMQTT_STATIC void publish_build_fixed_header(lmqtt_store_value_t *value,
     v = encode_remaining_length(publish_calc_remaining_length(publish),
         encode_buffer->buf + 1);
 
-    type = LMQTT_TYPE_PUBLISH << 4;
-    type |= publish->retain ? 0x01 : 0x00;
-    type |= LMQTT_QOS_TO_PUBLISH_QOS(publish->qos);
-    type |= publish->internal.encode_count > 0 ? 0x08 : 0x00;
-    encode_buffer->buf[0] = type;
+    encode_buffer->buf[0] = publish_get_type(publish);
     encode_buffer->buf_len = 1 + v;
 }
 
@@ -682,12 +895,24 @@ LMQTT_STATIC lmqtt_encode_result_t publish_encode_fixed_header(
         publish_build_fixed_header, offset, buf, buf_len, bytes_written);
 }
 
+LMQTT_STATIC void publish_build_empty_topic(lmqtt_store_value_t *value,
+    lmqtt_encode_buffer_t *encode_buffer)
+{
+    encode_buffer->buf[0] = 0;
+    encode_buffer->buf[1] = 0;
+    encode_buffer->buf_len = LMQTT_STRING_LEN_SIZE;
+}
+
 LMQTT_STATIC lmqtt_encode_result_t publish_encode_topic(
     lmqtt_store_value_t *value, lmqtt_encode_buffer_t *encode_buffer,
     size_t offset, unsigned char *buf, size_t buf_len, size_t *bytes_written)
 {
     lmqtt_publish_t *publish = value->value;
 
+    if (publish->internal.omit_topic)
+        return encode_buffer_encode(encode_buffer, value,
+            publish_build_empty_topic, offset, buf, buf_len, bytes_written);
+
     return string_encode(&publish->topic, 1, 1, offset, buf, buf_len,
         bytes_written, encode_buffer);
 }
@@ -713,6 +938,30 @@ LMQTT_STATIC lmqtt_encode_result_t publish_encode_packet_id(
         publish_build_packet_id, offset, buf, buf_len, bytes_written);
 }
 
+LMQTT_STATIC void publish_build_properties(lmqtt_store_value_t *value,
+    lmqtt_encode_buffer_t *encode_buffer)
+{
+    lmqtt_publish_t *publish = value->value;
+    unsigned short alias = publish->internal.topic_alias;
+
+    encode_buffer->buf[0] = publish_calc_properties_length(publish) - 1;
+    encode_buffer->buf_len = 1;
+    if (alias > 0) {
+        encode_buffer->buf[1] = LMQTT_PROPERTY_TOPIC_ALIAS;
+        encode_buffer->buf[2] = STRING_LEN_BYTE(alias, 1);
+        encode_buffer->buf[3] = STRING_LEN_BYTE(alias, 0);
+        encode_buffer->buf_len = 4;
+    }
+}
+
+LMQTT_STATIC lmqtt_encode_result_t publish_encode_properties(
+    lmqtt_store_value_t *value, lmqtt_encode_buffer_t *encode_buffer,
+    size_t offset, unsigned char *buf, size_t buf_len, size_t *bytes_written)
+{
+    return encode_buffer_encode(encode_buffer, value,
+        publish_build_properties, offset, buf, buf_len, bytes_written);
+}
+
 LMQTT_STATIC lmqtt_encode_result_t publish_encode_payload(
     lmqtt_store_value_t *value, lmqtt_encode_buffer_t *encode_buffer,
     size_t offset, unsigned char *buf, size_t buf_len, size_t *bytes_written)
@@ -730,9 +979,79 @@ int lmqtt_publish_validate(lmqtt_publish_t *publish)
 {
     return string_validate_field_length(&publish->topic) &&
         publish->topic.len > 0 && IS_VALID_LMQTT_QOS(publish->qos) &&
+        (!publish->shared_payload || !publish->payload.read) &&
         publish_calc_remaining_length(publish) <= 0xfffffff;
 }
 
+void lmqtt_publish_set_shared_payload(lmqtt_publish_t *publish,
+    lmqtt_shared_payload_t *shared)
+{
+    /* each message gets its own copy of the string, so its position is never
+       shared between messages */
+    publish->payload = shared->payload;
+    memset(&publish->payload.internal, 0, sizeof(publish->payload.internal));
+    publish->shared_payload = shared;
+}
+
+/******************************************************************************
+ * lmqtt_publish_ring_t PUBLIC functions
+ ******************************************************************************/
+
+int lmqtt_publish_ring_push(lmqtt_publish_ring_t *ring,
+    lmqtt_publish_t *publish)
+{
+    if (ring->count >= ring->capacity)
+        return 0;
+
+    ring->items[(ring->head + ring->count) % ring->capacity] = publish;
+    ring->count++;
+    return 1;
+}
+
+int lmqtt_publish_ring_shift(lmqtt_publish_ring_t *ring,
+    lmqtt_publish_t **publish)
+{
+    if (ring->count == 0)
+        return 0;
+
+    if (publish)
+        *publish = ring->items[ring->head];
+    ring->head = (ring->head + 1) % ring->capacity;
+    ring->count--;
+    return 1;
+}
+
+/******************************************************************************
+ * lmqtt_ack_queue_t PUBLIC functions
+ ******************************************************************************/
+
+int lmqtt_ack_queue_push(lmqtt_ack_queue_t *queue, unsigned char type,
+    lmqtt_packet_id_t packet_id)
+{
+    lmqtt_ack_t *ack;
+
+    if (queue->count >= queue->capacity)
+        return 0;
+
+    ack = &queue->items[(queue->head + queue->count) % queue->capacity];
+    ack->packet_id = packet_id;
+    ack->type = type;
+    queue->count++;
+    return 1;
+}
+
+int lmqtt_ack_queue_shift(lmqtt_ack_queue_t *queue, lmqtt_ack_t *ack)
+{
+    if (queue->count == 0)
+        return 0;
+
+    if (ack)
+        *ack = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    return 1;
+}
+
 /******************************************************************************
  * (puback) PUBLIC functions
  ******************************************************************************/
@@ -853,6 +1172,114 @@ LMQTT_STATIC lmqtt_encode_result_t disconnect_encode_fixed_header(
         buf, buf_len, bytes_written);
 }
 
+/******************************************************************************
+ * (connack) PUBLIC functions
+ ******************************************************************************/
+
+LMQTT_STATIC void connack_build(lmqtt_store_value_t *value,
+    lmqtt_encode_buffer_t *encode_buffer)
+{
+    lmqtt_connect_t *connect = value->value;
+
+    assert(sizeof(encode_buffer->buf) >= 4);
+
+    encode_buffer->buf[0] = LMQTT_TYPE_CONNACK << 4;
+    encode_buffer->buf[1] = 2;
+    /* session present must be 0 if the connection is being refused (see
+       MQTT-3.2.2-4) */
+    encode_buffer->buf[2] = connect->response.return_code == 0 &&
+        connect->response.session_present ? 1 : 0;
+    encode_buffer->buf[3] = connect->response.return_code;
+    encode_buffer->buf_len = 4;
+}
+
+LMQTT_STATIC lmqtt_encode_result_t connack_encode_fixed_header(
+    lmqtt_store_value_t *value, lmqtt_encode_buffer_t *encode_buffer,
+    size_t offset, unsigned char *buf, size_t buf_len, size_t *bytes_written)
+{
+    return encode_buffer_encode(encode_buffer, value, &connack_build, offset,
+        buf, buf_len, bytes_written);
+}
+
+/******************************************************************************
+ * (suback) PUBLIC functions
+ ******************************************************************************/
+
+LMQTT_STATIC void suback_build_header(lmqtt_store_value_t *value,
+    lmqtt_encode_buffer_t *encode_buffer)
+{
+    lmqtt_subscribe_t *subscribe = value->value;
+
+    encode_buffer_encode_packet_id(encode_buffer, LMQTT_TYPE_SUBACK << 4,
+        LMQTT_PACKET_ID_SIZE + subscribe->count, value->packet_id);
+}
+
+LMQTT_STATIC lmqtt_encode_result_t suback_encode_header(
+    lmqtt_store_value_t *value, lmqtt_encode_buffer_t *encode_buffer,
+    size_t offset, unsigned char *buf, size_t buf_len, size_t *bytes_written)
+{
+    return encode_buffer_encode(encode_buffer, value, &suback_build_header,
+        offset, buf, buf_len, bytes_written);
+}
+
+LMQTT_STATIC void suback_build_return_code(lmqtt_store_value_t *value,
+    lmqtt_encode_buffer_t *encode_buffer)
+{
+    lmqtt_subscribe_t *subscribe = value->value;
+
+    encode_buffer->buf[0] = subscribe->internal.current->return_code;
+    encode_buffer->buf_len = 1;
+}
+
+LMQTT_STATIC lmqtt_encode_result_t suback_encode_return_code(
+    lmqtt_store_value_t *value, lmqtt_encode_buffer_t *encode_buffer,
+    size_t offset, unsigned char *buf, size_t buf_len, size_t *bytes_written)
+{
+    return encode_buffer_encode(encode_buffer, value,
+        &suback_build_return_code, offset, buf, buf_len, bytes_written);
+}
+
+/******************************************************************************
+ * (unsuback) PUBLIC functions
+ ******************************************************************************/
+
+LMQTT_STATIC void unsuback_build(lmqtt_store_value_t *value,
+    lmqtt_encode_buffer_t *encode_buffer)
+{
+    encode_buffer_encode_packet_id(encode_buffer, LMQTT_TYPE_UNSUBACK << 4,
+        LMQTT_PACKET_ID_SIZE, value->packet_id);
+}
+
+LMQTT_STATIC lmqtt_encode_result_t unsuback_encode_fixed_header(
+    lmqtt_store_value_t *value, lmqtt_encode_buffer_t *encode_buffer,
+    size_t offset, unsigned char *buf, size_t buf_len, size_t *bytes_written)
+{
+    return encode_buffer_encode(encode_buffer, value, &unsuback_build, offset,
+        buf, buf_len, bytes_written);
+}
+
+/******************************************************************************
+ * (pingresp) PUBLIC functions
+ ******************************************************************************/
+
+LMQTT_STATIC void pingresp_build(lmqtt_store_value_t *value,
+    lmqtt_encode_buffer_t *encode_buffer)
+{
+    assert(sizeof(encode_buffer->buf) >= 2);
+
+    encode_buffer->buf[0] = LMQTT_TYPE_PINGRESP << 4;
+    encode_buffer->buf[1] = 0;
+    encode_buffer->buf_len = 2;
+}
+
+LMQTT_STATIC lmqtt_encode_result_t pingresp_encode_fixed_header(
+    lmqtt_store_value_t *value, lmqtt_encode_buffer_t *encode_buffer,
+    size_t offset, unsigned char *buf, size_t buf_len, size_t *bytes_written)
+{
+    return encode_buffer_encode(encode_buffer, value, &pingresp_build, offset,
+        buf, buf_len, bytes_written);
+}
+
 /******************************************************************************
  * lmqtt_tx_buffer_t PRIVATE functions
  ******************************************************************************/
@@ -860,14 +1287,23 @@ LMQTT_STATIC lmqtt_encode_result_t disconnect_encode_fixed_header(
 LMQTT_STATIC lmqtt_encoder_t tx_buffer_finder_connect(
     lmqtt_tx_buffer_t *tx_buffer, lmqtt_store_value_t *value)
 {
-    switch (tx_buffer->internal.pos) {
+    lmqtt_connect_t *connect = value->value;
+    int p = tx_buffer->internal.pos;
+
+    /* will properties are only present in MQTT 5 */
+    if (p >= 3 && (connect->protocol != LMQTT_PROTOCOL_MQTT_5 ||
+            connect->will_topic.len == 0))
+        p += 1;
+
+    switch (p) {
         case 0: return &connect_encode_fixed_header;
         case 1: return &connect_encode_variable_header;
         case 2: return &connect_encode_payload_client_id;
-        case 3: return &connect_encode_payload_will_topic;
-        case 4: return &connect_encode_payload_will_message;
-        case 5: return &connect_encode_payload_user_name;
-        case 6: return &connect_encode_payload_password;
+        case 3: return &connect_encode_will_properties;
+        case 4: return &connect_encode_payload_will_topic;
+        case 5: return &connect_encode_payload_will_message;
+        case 6: return &connect_encode_payload_user_name;
+        case 7: return &connect_encode_payload_password;
     }
     return 0;
 }
@@ -880,12 +1316,14 @@ LMQTT_STATIC lmqtt_encoder_t tx_buffer_finder_subscribe(
 
     if (p == 0) {
         subscribe->internal.current = 0;
+        subscribe->internal.protocol = tx_buffer->protocol;
         return &subscribe_encode_header_subscribe;
     }
 
     p -= 1;
-    if (p >= 0 && p < subscribe->count * 2) {
-        subscribe->internal.current = &subscribe->subscriptions[p / 2];
+    if (p >= 0 && p < subscribe_get_count(subscribe) * 2) {
+        subscribe->internal.current = subscribe_get_subscription(subscribe,
+            p / 2);
         return p % 2 == 0 ? &subscribe_encode_topic : &subscribe_encode_qos;
     }
 
@@ -900,6 +1338,7 @@ LMQTT_STATIC lmqtt_encoder_t tx_buffer_finder_unsubscribe(
 
     if (p == 0) {
         subscribe->internal.current = 0;
+        subscribe->internal.protocol = tx_buffer->protocol;
         return &subscribe_encode_header_unsubscribe;
     }
 
@@ -912,24 +1351,79 @@ LMQTT_STATIC lmqtt_encoder_t tx_buffer_finder_unsubscribe(
     return 0;
 }
 
+/* Looks up (or assigns) the alias of the topic of an MQTT 5 PUBLISH; the first
+   packet with a new alias carries both the topic and the alias, and the
+   following ones only the alias. Topics which cannot be copied to the alias
+   table (too long or read via callback) are always sent in full. */
+LMQTT_STATIC void tx_buffer_resolve_topic_alias(lmqtt_tx_buffer_t *tx_buffer,
+    lmqtt_publish_t *publish)
+{
+    lmqtt_topic_alias_set_t *aliases = &tx_buffer->topic_aliases;
+    lmqtt_topic_alias_t *alias;
+    size_t len = (size_t) publish->topic.len;
+    size_t limit = aliases->capacity;
+    size_t i;
+
+    publish->internal.protocol = tx_buffer->protocol;
+    publish->internal.topic_alias = 0;
+    publish->internal.omit_topic = 0;
+
+    if (tx_buffer->protocol != LMQTT_PROTOCOL_MQTT_5 || !publish->topic.buf ||
+            len > LMQTT_TOPIC_ALIAS_SIZE)
+        return;
+
+    for (i = 0; i < aliases->count; i++) {
+        alias = &aliases->items[i];
+        if (alias->len == len && memcmp(alias->topic, publish->topic.buf,
+                len) == 0) {
+            publish->internal.topic_alias = (unsigned short) (i + 1);
+            publish->internal.omit_topic = 1;
+            return;
+        }
+    }
+
+    if (limit > aliases->maximum)
+        limit = aliases->maximum;
+    if (limit == 0)
+        return;
+
+    if (aliases->count < limit) {
+        i = aliases->count++;
+    } else {
+        /* table is full; replace aliases in round-robin order */
+        i = aliases->next % limit;
+        aliases->next = (i + 1) % limit;
+    }
+
+    alias = &aliases->items[i];
+    alias->len = len;
+    memcpy(alias->topic, publish->topic.buf, len);
+    publish->internal.topic_alias = (unsigned short) (i + 1);
+}
+
 LMQTT_STATIC lmqtt_encoder_t tx_buffer_finder_publish(
     lmqtt_tx_buffer_t *tx_buffer, lmqtt_store_value_t *value)
 {
     lmqtt_publish_t *publish = value->value;
+    int p = tx_buffer->internal.pos;
 
-    if (publish->qos == LMQTT_QOS_0) {
-        switch (tx_buffer->internal.pos) {
-            case 0: return &publish_encode_fixed_header;
-            case 1: return &publish_encode_topic;
-            case 2: return &publish_encode_payload;
-        }
-    } else {
-        switch (tx_buffer->internal.pos) {
-            case 0: return &publish_encode_fixed_header;
-            case 1: return &publish_encode_topic;
-            case 2: return &publish_encode_packet_id;
-            case 3: return &publish_encode_payload;
-        }
+    /* the finder is called again for the fixed header if the output buffer
+       fills up before it is completely written; the alias must be resolved
+       only once, since the header depends on it */
+    if (p == 0 && !tx_buffer->internal.buffer.encoded)
+        tx_buffer_resolve_topic_alias(tx_buffer, publish);
+
+    if (p >= 2 && publish->qos == LMQTT_QOS_0)
+        p += 1;
+    if (p >= 3 && publish->internal.protocol != LMQTT_PROTOCOL_MQTT_5)
+        p += 1;
+
+    switch (p) {
+        case 0: return &publish_encode_fixed_header;
+        case 1: return &publish_encode_topic;
+        case 2: return &publish_encode_packet_id;
+        case 3: return &publish_encode_properties;
+        case 4: return &publish_encode_payload;
     }
 
     publish->internal.encode_count++;
@@ -972,29 +1466,428 @@ LMQTT_STATIC lmqtt_encoder_t tx_buffer_finder_disconnect(
     return tx_buffer->internal.pos == 0 ? &disconnect_encode_fixed_header : 0;
 }
 
-static lmqtt_encoder_finder_t tx_buffer_finder_by_kind_impl(
-    lmqtt_kind_t kind)
+LMQTT_STATIC lmqtt_encoder_t tx_buffer_finder_connack(
+    lmqtt_tx_buffer_t *tx_buffer, lmqtt_store_value_t *value)
 {
-    switch (kind) {
-        case LMQTT_KIND_CONNECT: return &tx_buffer_finder_connect;
-        case LMQTT_KIND_SUBSCRIBE: return &tx_buffer_finder_subscribe;
-        case LMQTT_KIND_UNSUBSCRIBE: return &tx_buffer_finder_unsubscribe;
-        case LMQTT_KIND_PUBLISH_0:
-        case LMQTT_KIND_PUBLISH_1:
-        case LMQTT_KIND_PUBLISH_2: return &tx_buffer_finder_publish;
-        case LMQTT_KIND_PUBACK: return &tx_buffer_finder_puback;
+    return tx_buffer->internal.pos == 0 ? &connack_encode_fixed_header : 0;
+}
+
+LMQTT_STATIC lmqtt_encoder_t tx_buffer_finder_suback(
+    lmqtt_tx_buffer_t *tx_buffer, lmqtt_store_value_t *value)
+{
+    lmqtt_subscribe_t *subscribe = value->value;
+    int p = tx_buffer->internal.pos;
+
+    if (p == 0) {
+        subscribe->internal.current = 0;
+        return &suback_encode_header;
+    }
+
+    p -= 1;
+    if (p >= 0 && p < subscribe->count) {
+        subscribe->internal.current = &subscribe->subscriptions[p];
+        return &suback_encode_return_code;
+    }
+
+    return 0;
+}
+
+LMQTT_STATIC lmqtt_encoder_t tx_buffer_finder_unsuback(
+    lmqtt_tx_buffer_t *tx_buffer, lmqtt_store_value_t *value)
+{
+    return tx_buffer->internal.pos == 0 ? &unsuback_encode_fixed_header : 0;
+}
+
+LMQTT_STATIC lmqtt_encoder_t tx_buffer_finder_pingresp(
+    lmqtt_tx_buffer_t *tx_buffer, lmqtt_store_value_t *value)
+{
+    return tx_buffer->internal.pos == 0 ? &pingresp_encode_fixed_header : 0;
+}
+
+static lmqtt_encoder_finder_t LMQTT_MOCKABLE_IMPL(tx_buffer_finder_by_kind)(
+    lmqtt_kind_t kind)
+{
+    switch (kind) {
+        case LMQTT_KIND_CONNECT: return &tx_buffer_finder_connect;
+        case LMQTT_KIND_SUBSCRIBE: return &tx_buffer_finder_subscribe;
+        case LMQTT_KIND_UNSUBSCRIBE: return &tx_buffer_finder_unsubscribe;
+        case LMQTT_KIND_PUBLISH_0:
+        case LMQTT_KIND_PUBLISH_1:
+        case LMQTT_KIND_PUBLISH_2: return &tx_buffer_finder_publish;
+        case LMQTT_KIND_PUBACK: return &tx_buffer_finder_puback;
         case LMQTT_KIND_PUBREC: return &tx_buffer_finder_pubrec;
         case LMQTT_KIND_PUBREL: return &tx_buffer_finder_pubrel;
         case LMQTT_KIND_PUBCOMP: return &tx_buffer_finder_pubcomp;
         case LMQTT_KIND_PINGREQ: return &tx_buffer_finder_pingreq;
         case LMQTT_KIND_DISCONNECT: return &tx_buffer_finder_disconnect;
+        case LMQTT_KIND_CONNACK: return &tx_buffer_finder_connack;
+        case LMQTT_KIND_SUBACK: return &tx_buffer_finder_suback;
+        case LMQTT_KIND_UNSUBACK: return &tx_buffer_finder_unsuback;
+        case LMQTT_KIND_PINGRESP: return &tx_buffer_finder_pingresp;
     }
     return NULL;
 }
 
+#ifdef LMQTT_TEST
 /* Enable mocking of tx_buffer_finder_by_kind() */
 LMQTT_STATIC lmqtt_encoder_finder_t (*tx_buffer_finder_by_kind)(
     lmqtt_kind_t) = &tx_buffer_finder_by_kind_impl;
+#endif
+
+/* Fast encoders write the whole packet straight to the output buffer, without
+   going through the finder and the encode buffer for each field. They give up
+   (returning 0) before writing anything if the packet might not fit in `buf`;
+   the packet is then encoded field by field, which can resume when the output
+   buffer fills up. */
+
+LMQTT_STATIC size_t tx_buffer_encode_packet_id_fast(unsigned char type,
+    lmqtt_packet_id_t packet_id, unsigned char *buf, size_t buf_len)
+{
+    if (buf_len < 2 + LMQTT_PACKET_ID_SIZE)
+        return 0;
+
+    buf[0] = type;
+    buf[1] = LMQTT_PACKET_ID_SIZE;
+    buf[2] = STRING_LEN_BYTE(packet_id, 1);
+    buf[3] = STRING_LEN_BYTE(packet_id, 0);
+    return 2 + LMQTT_PACKET_ID_SIZE;
+}
+
+LMQTT_STATIC size_t tx_buffer_encode_empty_fast(unsigned char type,
+    unsigned char *buf, size_t buf_len)
+{
+    if (buf_len < 2)
+        return 0;
+
+    buf[0] = type;
+    buf[1] = 0;
+    return 2;
+}
+
+LMQTT_STATIC size_t tx_buffer_encode_puback_fast(lmqtt_tx_buffer_t *tx_buffer,
+    lmqtt_store_value_t *value, unsigned char *buf, size_t buf_len)
+{
+    return tx_buffer_encode_packet_id_fast(LMQTT_TYPE_PUBACK << 4,
+        value->packet_id, buf, buf_len);
+}
+
+LMQTT_STATIC size_t tx_buffer_encode_pubrec_fast(lmqtt_tx_buffer_t *tx_buffer,
+    lmqtt_store_value_t *value, unsigned char *buf, size_t buf_len)
+{
+    return tx_buffer_encode_packet_id_fast(LMQTT_TYPE_PUBREC << 4,
+        value->packet_id, buf, buf_len);
+}
+
+LMQTT_STATIC size_t tx_buffer_encode_pubrel_fast(lmqtt_tx_buffer_t *tx_buffer,
+    lmqtt_store_value_t *value, unsigned char *buf, size_t buf_len)
+{
+    return tx_buffer_encode_packet_id_fast((LMQTT_TYPE_PUBREL << 4) | 0x02,
+        value->packet_id, buf, buf_len);
+}
+
+LMQTT_STATIC size_t tx_buffer_encode_pubcomp_fast(
+    lmqtt_tx_buffer_t *tx_buffer, lmqtt_store_value_t *value,
+    unsigned char *buf, size_t buf_len)
+{
+    return tx_buffer_encode_packet_id_fast(LMQTT_TYPE_PUBCOMP << 4,
+        value->packet_id, buf, buf_len);
+}
+
+LMQTT_STATIC size_t tx_buffer_encode_unsuback_fast(
+    lmqtt_tx_buffer_t *tx_buffer, lmqtt_store_value_t *value,
+    unsigned char *buf, size_t buf_len)
+{
+    return tx_buffer_encode_packet_id_fast(LMQTT_TYPE_UNSUBACK << 4,
+        value->packet_id, buf, buf_len);
+}
+
+LMQTT_STATIC size_t tx_buffer_encode_pingreq_fast(
+    lmqtt_tx_buffer_t *tx_buffer, lmqtt_store_value_t *value,
+    unsigned char *buf, size_t buf_len)
+{
+    return tx_buffer_encode_empty_fast(LMQTT_TYPE_PINGREQ << 4, buf, buf_len);
+}
+
+LMQTT_STATIC size_t tx_buffer_encode_pingresp_fast(
+    lmqtt_tx_buffer_t *tx_buffer, lmqtt_store_value_t *value,
+    unsigned char *buf, size_t buf_len)
+{
+    return tx_buffer_encode_empty_fast(LMQTT_TYPE_PINGRESP << 4, buf,
+        buf_len);
+}
+
+LMQTT_STATIC size_t tx_buffer_encode_disconnect_fast(
+    lmqtt_tx_buffer_t *tx_buffer, lmqtt_store_value_t *value,
+    unsigned char *buf, size_t buf_len)
+{
+    return tx_buffer_encode_empty_fast(LMQTT_TYPE_DISCONNECT << 4, buf,
+        buf_len);
+}
+
+/* copies the whole content of a string which is not read via callback */
+LMQTT_STATIC size_t tx_buffer_copy_string(lmqtt_string_t *str,
+    unsigned char *buf)
+{
+    size_t cnt;
+    int os_error;
+
+    memset(&str->internal, 0, sizeof(str->internal));
+    string_read(str, buf, (size_t) str->len, &cnt, &os_error);
+    assert((long) cnt == str->len);
+    return cnt;
+}
+
+LMQTT_STATIC size_t tx_buffer_encode_publish_fast(
+    lmqtt_tx_buffer_t *tx_buffer, lmqtt_store_value_t *value,
+    unsigned char *buf, size_t buf_len)
+{
+    lmqtt_publish_t *publish = value->value;
+    long properties_len;
+    size_t pos;
+
+    if (publish->topic.read || publish->payload.read)
+        return 0;
+
+    /* the topic alias is not resolved yet, so check against the largest
+       packet it can produce (full topic plus alias property) */
+    if (buf_len < 1 + LMQTT_REMAINING_LENGTH_MAX_SIZE + LMQTT_STRING_LEN_SIZE +
+            (size_t) publish->topic.len + LMQTT_PACKET_ID_SIZE + 4 +
+            (size_t) publish->payload.len)
+        return 0;
+
+    tx_buffer_resolve_topic_alias(tx_buffer, publish);
+
+    /* lmqtt_client_t is supposed to validate packet length */
+    assert(lmqtt_publish_validate(publish));
+
+    buf[0] = publish_get_type(publish);
+    pos = 1 + encode_remaining_length(publish_calc_remaining_length(publish),
+        buf + 1);
+
+    if (publish->internal.omit_topic) {
+        buf[pos++] = 0;
+        buf[pos++] = 0;
+    } else {
+        buf[pos++] = STRING_LEN_BYTE(publish->topic.len, 1);
+        buf[pos++] = STRING_LEN_BYTE(publish->topic.len, 0);
+        pos += tx_buffer_copy_string(&publish->topic, buf + pos);
+    }
+
+    if (publish->qos != LMQTT_QOS_0) {
+        buf[pos++] = STRING_LEN_BYTE(value->packet_id, 1);
+        buf[pos++] = STRING_LEN_BYTE(value->packet_id, 0);
+    }
+
+    properties_len = publish_calc_properties_length(publish);
+    if (properties_len > 0) {
+        buf[pos++] = (unsigned char) (properties_len - 1);
+        if (publish->internal.topic_alias > 0) {
+            buf[pos++] = LMQTT_PROPERTY_TOPIC_ALIAS;
+            buf[pos++] = STRING_LEN_BYTE(publish->internal.topic_alias, 1);
+            buf[pos++] = STRING_LEN_BYTE(publish->internal.topic_alias, 0);
+        }
+    }
+
+    pos += tx_buffer_copy_string(&publish->payload, buf + pos);
+
+    publish->internal.encode_count++;
+    return pos;
+}
+
+/* Packets sent once per connection or subscription change (CONNECT,
+   SUBSCRIBE, UNSUBSCRIBE, CONNACK and SUBACK) are always encoded field by
+   field */
+static lmqtt_fast_encoder_t LMQTT_MOCKABLE_IMPL(
+    tx_buffer_fast_encoder_by_kind)(lmqtt_kind_t kind)
+{
+    switch (kind) {
+        case LMQTT_KIND_PUBLISH_0:
+        case LMQTT_KIND_PUBLISH_1:
+        case LMQTT_KIND_PUBLISH_2: return &tx_buffer_encode_publish_fast;
+        case LMQTT_KIND_PUBACK: return &tx_buffer_encode_puback_fast;
+        case LMQTT_KIND_PUBREC: return &tx_buffer_encode_pubrec_fast;
+        case LMQTT_KIND_PUBREL: return &tx_buffer_encode_pubrel_fast;
+        case LMQTT_KIND_PUBCOMP: return &tx_buffer_encode_pubcomp_fast;
+        case LMQTT_KIND_PINGREQ: return &tx_buffer_encode_pingreq_fast;
+        case LMQTT_KIND_DISCONNECT: return &tx_buffer_encode_disconnect_fast;
+        case LMQTT_KIND_UNSUBACK: return &tx_buffer_encode_unsuback_fast;
+        case LMQTT_KIND_PINGRESP: return &tx_buffer_encode_pingresp_fast;
+        default: break;
+    }
+    return NULL;
+}
+
+#ifdef LMQTT_TEST
+/* Enable mocking of tx_buffer_fast_encoder_by_kind() */
+LMQTT_STATIC lmqtt_fast_encoder_t (*tx_buffer_fast_encoder_by_kind)(
+    lmqtt_kind_t) = &tx_buffer_fast_encoder_by_kind_impl;
+#endif
+
+/* Returns 1 if `kind` is a QoS 1 or 2 PUBLISH which cannot be sent because the
+   in-flight window is full. Outgoing QoS 2 messages are in flight until
+   PUBCOMP, i.e. including while their PUBREL waits to be sent. */
+LMQTT_STATIC int tx_buffer_is_window_full(lmqtt_tx_buffer_t *state, int kind)
+{
+    if (state->inflight_window == 0 || (kind != LMQTT_KIND_PUBLISH_1 &&
+            kind != LMQTT_KIND_PUBLISH_2))
+        return 0;
+
+    return lmqtt_store_count_inflight(state->store) >= state->inflight_window;
+}
+
+/* Makes the first acknowledgement or PINGREQ queued after the current packet
+   the current one, so that they are not held back by a full in-flight window.
+   Requests of the user (SUBSCRIBE, UNSUBSCRIBE) keep their order relative to
+   the held PUBLISH packets, and nothing is taken past a DISCONNECT, which must
+   follow all of them. */
+LMQTT_STATIC int tx_buffer_skip_held_publish(lmqtt_tx_buffer_t *state)
+{
+    lmqtt_store_t *store = state->store;
+    size_t i;
+
+    assert(state->internal.pos == 0 && state->internal.offset == 0);
+
+    for (i = store->pos + 1; i < store->count; i++) {
+        int k;
+        lmqtt_store_get_at(store, i, &k, NULL);
+        if (k == LMQTT_KIND_DISCONNECT)
+            return 0;
+        if (k == LMQTT_KIND_PUBACK || k == LMQTT_KIND_PUBREC ||
+                k == LMQTT_KIND_PUBREL || k == LMQTT_KIND_PUBCOMP ||
+                k == LMQTT_KIND_PINGREQ)
+            return lmqtt_store_move_to_current(store, i);
+    }
+
+    return 0;
+}
+
+/* Takes the next packet to encode: the oldest message in the QoS 0 ring,
+   unless a packet from the store is partially written */
+LMQTT_STATIC int tx_buffer_peek(lmqtt_tx_buffer_t *state, int *kind,
+    lmqtt_store_value_t *value)
+{
+    lmqtt_publish_ring_t *ring = state->qos0_ring;
+    lmqtt_ack_queue_t *acks = state->ack_queue;
+
+    if (acks && acks->count > 0 && !state->internal.from_ring &&
+            (state->internal.from_ack_queue || (state->internal.pos == 0 &&
+            state->internal.offset == 0 && !state->internal.buffer.encoded))) {
+        lmqtt_ack_t *ack = &acks->items[acks->head];
+        state->internal.from_ack_queue = 1;
+        switch (ack->type >> 4) {
+            case LMQTT_TYPE_PUBACK: *kind = LMQTT_KIND_PUBACK; break;
+            case LMQTT_TYPE_PUBREC: *kind = LMQTT_KIND_PUBREC; break;
+            default: *kind = LMQTT_KIND_PUBCOMP; break;
+        }
+        memset(value, 0, sizeof(*value));
+        value->packet_id = ack->packet_id;
+        return 1;
+    }
+
+    if (ring && ring->count > 0 && (state->internal.from_ring ||
+            (state->internal.pos == 0 && state->internal.offset == 0 &&
+                !state->internal.buffer.encoded))) {
+        state->internal.from_ring = 1;
+        *kind = LMQTT_KIND_PUBLISH_0;
+        value->packet_id = 0;
+        value->value = ring->items[ring->head];
+        value->callback = ring->callback;
+        value->callback_data = ring->callback_data;
+        return 1;
+    }
+
+    if (lmqtt_store_peek(state->store, kind, value))
+        return 1;
+
+    /* nothing is partially written when the current store is exhausted */
+    if (state->pipeline_store) {
+        state->store = state->pipeline_store;
+        state->pipeline_store = NULL;
+        return lmqtt_store_peek(state->store, kind, value);
+    }
+
+    return 0;
+}
+
+LMQTT_STATIC void tx_buffer_drop_current(lmqtt_tx_buffer_t *state)
+{
+    if (state->internal.from_ack_queue) {
+        lmqtt_ack_queue_shift(state->ack_queue, NULL);
+        state->internal.from_ack_queue = 0;
+    } else if (state->internal.from_ring) {
+        lmqtt_publish_ring_shift(state->qos0_ring, NULL);
+        state->internal.from_ring = 0;
+    } else {
+        lmqtt_store_drop_current(state->store);
+    }
+}
+
+LMQTT_STATIC int tx_buffer_is_expired(lmqtt_tx_buffer_t *state, int kind,
+    lmqtt_store_value_t *value)
+{
+    lmqtt_publish_t *publish = (lmqtt_publish_t *) value->value;
+    long secs, nsecs;
+
+    if (kind != LMQTT_KIND_PUBLISH_0 || publish->expiry == 0)
+        return 0;
+
+    lmqtt_time_get_timeout_to(&publish->internal.queued_at,
+        state->store->get_time, publish->expiry, &secs, &nsecs);
+    return secs == 0 && nsecs == 0;
+}
+
+/* Writes as many queued acknowledgements as fit entirely in `buf`; one which
+   does not fit is encoded later like any other packet */
+LMQTT_STATIC size_t tx_buffer_drain_acks(lmqtt_tx_buffer_t *state,
+    unsigned char *buf, size_t buf_len)
+{
+    lmqtt_ack_queue_t *acks = state->ack_queue;
+    size_t pos = 0;
+
+    if (!acks || state->internal.pos != 0 || state->internal.offset != 0 ||
+            state->internal.buffer.encoded)
+        return 0;
+
+    while (acks->count > 0 && buf_len - pos >= 2 + LMQTT_PACKET_ID_SIZE) {
+        lmqtt_ack_t *ack = &acks->items[acks->head];
+
+        buf[pos++] = ack->type;
+        buf[pos++] = LMQTT_PACKET_ID_SIZE;
+        buf[pos++] = STRING_LEN_BYTE(ack->packet_id, 1);
+        buf[pos++] = STRING_LEN_BYTE(ack->packet_id, 0);
+        lmqtt_ack_queue_shift(acks, NULL);
+    }
+
+    return pos;
+}
+
+/* Releases or marks the current packet after its last byte is encoded.
+   Returns 0 if the PUBLISH callback fails. */
+LMQTT_STATIC int tx_buffer_complete_current(lmqtt_tx_buffer_t *state,
+    int kind, lmqtt_store_value_t *value)
+{
+    if (!kind_expects_response(kind)) {
+        if (state->ack_queue && state->ack_queue->spilled > 0 &&
+                !state->internal.from_ack_queue &&
+                (kind == LMQTT_KIND_PUBACK || kind == LMQTT_KIND_PUBREC ||
+                kind == LMQTT_KIND_PUBCOMP))
+            state->ack_queue->spilled--;
+        tx_buffer_drop_current(state);
+
+        if (kind == LMQTT_KIND_DISCONNECT) {
+            lmqtt_tx_buffer_finish(state);
+            return 1;
+        } else if (value->callback &&
+                !value->callback(value->callback_data, value->value)) {
+            assert(kind == LMQTT_KIND_PUBLISH_0);
+            return 0;
+        }
+    } else {
+        lmqtt_store_mark_current(state->store);
+    }
+    lmqtt_tx_buffer_reset(state);
+    return 1;
+}
 
 LMQTT_STATIC lmqtt_io_result_t tx_buffer_fail(lmqtt_tx_buffer_t *state,
     lmqtt_error_t error, int os_error)
@@ -1019,19 +1912,22 @@ void lmqtt_tx_buffer_finish(lmqtt_tx_buffer_t *state)
     state->closed = 1;
 }
 
-lmqtt_error_t lmqtt_tx_buffer_get_error_impl(lmqtt_tx_buffer_t *state,
-    int *os_error)
+lmqtt_error_t LMQTT_MOCKABLE_IMPL(lmqtt_tx_buffer_get_error)(
+    lmqtt_tx_buffer_t *state, int *os_error)
 {
     *os_error = state->internal.os_error;
     return state->internal.error;
 }
 
+#ifdef LMQTT_TEST
 /* Enable mocking of lmqtt_tx_buffer_get_error() */
 lmqtt_error_t (*lmqtt_tx_buffer_get_error)(lmqtt_tx_buffer_t *, int *) =
     &lmqtt_tx_buffer_get_error_impl;
+#endif
 
-static lmqtt_io_result_t lmqtt_tx_buffer_encode_impl(lmqtt_tx_buffer_t *state,
-    unsigned char *buf, size_t buf_len, size_t *bytes_written)
+lmqtt_io_result_t LMQTT_MOCKABLE_IMPL(lmqtt_tx_buffer_encode)(
+    lmqtt_tx_buffer_t *state, unsigned char *buf, size_t buf_len,
+    size_t *bytes_written)
 {
     size_t offset = 0;
     int kind;
@@ -1041,8 +1937,57 @@ static lmqtt_io_result_t lmqtt_tx_buffer_encode_impl(lmqtt_tx_buffer_t *state,
     if (state->internal.error)
         return LMQTT_IO_ERROR;
 
-    while (!state->closed && lmqtt_store_peek(state->store, &kind, &value)) {
-        lmqtt_encoder_finder_t finder = tx_buffer_finder_by_kind(kind);
+    if (!state->closed) {
+        offset = tx_buffer_drain_acks(state, buf, buf_len);
+        *bytes_written = offset;
+    }
+
+    while (!state->closed && tx_buffer_peek(state, &kind, &value)) {
+        lmqtt_encoder_finder_t finder;
+
+        /* a packet partially written (or whose header is already built) must
+           be finished regardless */
+        if (state->internal.pos == 0 && state->internal.offset == 0 &&
+                !state->internal.buffer.encoded &&
+                tx_buffer_is_window_full(state, kind)) {
+            if (!tx_buffer_skip_held_publish(state))
+                break;
+            continue;
+        }
+
+        /* dead telemetry is released unsent, unless its header is already
+           built */
+        if (state->internal.pos == 0 && state->internal.offset == 0 &&
+                !state->internal.buffer.encoded &&
+                tx_buffer_is_expired(state, kind, &value)) {
+            ((lmqtt_publish_t *) value.value)->response.status =
+                LMQTT_PUBLISH_STATUS_EXPIRED;
+            tx_buffer_drop_current(state);
+            if (value.callback &&
+                    !value.callback(value.callback_data, value.value))
+                return tx_buffer_fail(state, LMQTT_ERROR_CALLBACK_PUBLISH, 0);
+            continue;
+        }
+
+        if (state->internal.pos == 0 && state->internal.offset == 0 &&
+                !state->internal.buffer.encoded) {
+            lmqtt_fast_encoder_t fast_encoder =
+                tx_buffer_fast_encoder_by_kind(kind);
+            size_t cur_bytes = fast_encoder ?
+                fast_encoder(state, &value, buf + offset, buf_len - offset) :
+                0;
+
+            if (cur_bytes > 0) {
+                offset += cur_bytes;
+                *bytes_written += cur_bytes;
+                if (!tx_buffer_complete_current(state, kind, &value))
+                    return tx_buffer_fail(state,
+                        LMQTT_ERROR_CALLBACK_PUBLISH, 0);
+                continue;
+            }
+        }
+
+        finder = tx_buffer_finder_by_kind(kind);
         assert(finder);
 
         while (1) {
@@ -1051,22 +1996,9 @@ static lmqtt_io_result_t lmqtt_tx_buffer_encode_impl(lmqtt_tx_buffer_t *state,
             lmqtt_encoder_t encoder = finder(state, &value);
 
             if (!encoder) {
-                if (!kind_expects_response(kind)) {
-                    lmqtt_store_drop_current(state->store);
-
-                    if (kind == LMQTT_KIND_DISCONNECT) {
-                        lmqtt_tx_buffer_finish(state);
-                        break;
-                    } else if (value.callback &&
-                            !value.callback(value.callback_data, value.value)) {
-                        assert(kind == LMQTT_KIND_PUBLISH_0);
-                        return tx_buffer_fail(state,
-                            LMQTT_ERROR_CALLBACK_PUBLISH, 0);
-                    }
-                } else {
-                    lmqtt_store_mark_current(state->store);
-                }
-                lmqtt_tx_buffer_reset(state);
+                if (!tx_buffer_complete_current(state, kind, &value))
+                    return tx_buffer_fail(state,
+                        LMQTT_ERROR_CALLBACK_PUBLISH, 0);
                 break;
             }
 
@@ -1095,9 +2027,11 @@ static lmqtt_io_result_t lmqtt_tx_buffer_encode_impl(lmqtt_tx_buffer_t *state,
         LMQTT_IO_SUCCESS : LMQTT_IO_WOULD_BLOCK;
 }
 
+#ifdef LMQTT_TEST
 /* Enable mocking of lmqtt_tx_buffer_encode() */
 lmqtt_io_result_t (*lmqtt_tx_buffer_encode)(lmqtt_tx_buffer_t *,
     unsigned char *, size_t, size_t *) = &lmqtt_tx_buffer_encode_impl;
+#endif
 
 lmqtt_string_t *lmqtt_tx_buffer_get_blocking_str(lmqtt_tx_buffer_t *state)
 {
@@ -1164,6 +2098,34 @@ LMQTT_STATIC lmqtt_io_result_t rx_buffer_fail(lmqtt_rx_buffer_t *state,
     return LMQTT_IO_ERROR;
 }
 
+/* Queues a PUBACK, PUBREC or PUBCOMP in the ack queue, or in the store if there
+   is no room left in the former or older acknowledgements are still there */
+LMQTT_STATIC int rx_buffer_queue_ack(lmqtt_rx_buffer_t *state, int kind,
+    lmqtt_packet_id_t packet_id)
+{
+    lmqtt_store_value_t value;
+    unsigned char type;
+
+    switch (kind) {
+        case LMQTT_KIND_PUBACK: type = LMQTT_TYPE_PUBACK << 4; break;
+        case LMQTT_KIND_PUBREC: type = LMQTT_TYPE_PUBREC << 4; break;
+        default: type = LMQTT_TYPE_PUBCOMP << 4; break;
+    }
+
+    if (state->ack_queue && state->ack_queue->spilled == 0 &&
+            lmqtt_ack_queue_push(state->ack_queue, type, packet_id))
+        return 1;
+
+    memset(&value, 0, sizeof(value));
+    value.packet_id = packet_id;
+    if (!lmqtt_store_append(state->store, kind, &value))
+        return 0;
+
+    if (state->ack_queue)
+        state->ack_queue->spilled++;
+    return 1;
+}
+
 LMQTT_STATIC int rx_buffer_allocate_write(lmqtt_rx_buffer_t *state, long when,
     struct _lmqtt_publish_part_t *publish_part, size_t len,
     lmqtt_decode_bytes_t *bytes)
@@ -1224,6 +2186,158 @@ LMQTT_STATIC void rx_buffer_deallocate_publish(lmqtt_rx_buffer_t *state)
             &state->internal.publish);
 }
 
+typedef void (*rx_buffer_on_property_t)(lmqtt_rx_buffer_t *, unsigned char,
+    unsigned long);
+
+/* Decodes a single byte `b` of the property list (MQTT 5) which starts at the
+   current position of the remaining length, calling `on_property` (if not NULL)
+   for each integer property. Returns LMQTT_DECODE_FINISHED after the last byte
+   of the list. */
+LMQTT_STATIC lmqtt_decode_result_t rx_buffer_decode_property(
+    lmqtt_rx_buffer_t *state, unsigned char b, rx_buffer_on_property_t on_property)
+{
+    int complete = 0;
+    long rem_pos = state->internal.remain_buf_pos + 1;
+    long rem_len = state->internal.header.remaining_length;
+    lmqtt_property_decoder_t *p = &state->internal.property;
+
+    if (!p->len_finished) {
+        if (p->len_multiplier == 0)
+            p->len_multiplier = 1;
+        p->len += (b & 0x7f) * p->len_multiplier;
+        p->len_multiplier *= 128;
+
+        if (b & 0x80) {
+            if (p->len_multiplier > 128 * 128 * 128)
+                goto fail;
+            return LMQTT_DECODE_CONTINUE;
+        }
+
+        p->len_finished = 1;
+        p->end = rem_pos + p->len;
+        if (p->end > rem_len)
+            goto fail;
+        return p->len == 0 ? LMQTT_DECODE_FINISHED : LMQTT_DECODE_CONTINUE;
+    }
+
+    if (!p->type) {
+        p->id = b;
+        p->value = 0;
+        p->type = property_get_type(b);
+        if (!p->type)
+            goto fail;
+
+        p->strings = 0;
+        p->string_len = 0;
+        if (p->type == LMQTT_PROPERTY_TYPE_STRING ||
+                p->type == LMQTT_PROPERTY_TYPE_STRING_PAIR) {
+            p->strings = p->type == LMQTT_PROPERTY_TYPE_STRING_PAIR ? 2 : 1;
+            p->string_len = 1;
+            p->remaining = LMQTT_STRING_LEN_SIZE;
+        } else if (p->type == LMQTT_PROPERTY_TYPE_VARIABLE) {
+            p->remaining = LMQTT_REMAINING_LENGTH_MAX_SIZE;
+        } else {
+            p->remaining = p->type;
+        }
+    } else if (p->type == LMQTT_PROPERTY_TYPE_VARIABLE) {
+        p->value |= (unsigned long) (b & 0x7f) <<
+            (7 * (LMQTT_REMAINING_LENGTH_MAX_SIZE - p->remaining));
+        p->remaining -= 1;
+        if (!(b & 0x80))
+            complete = 1;
+        else if (p->remaining == 0)
+            goto fail;
+    } else if (p->strings > 0) {
+        p->remaining -= 1;
+        if (p->string_len) {
+            p->value = (p->value << 8) | b;
+            if (p->remaining == 0) {
+                p->remaining = (long) p->value;
+                p->string_len = 0;
+            }
+        }
+        if (!p->string_len && p->remaining == 0) {
+            if (--p->strings > 0) {
+                p->value = 0;
+                p->string_len = 1;
+                p->remaining = LMQTT_STRING_LEN_SIZE;
+            } else {
+                complete = 1;
+            }
+        }
+    } else {
+        p->value = (p->value << 8) | b;
+        if (--p->remaining == 0)
+            complete = 1;
+    }
+
+    if (complete) {
+        if (on_property && p->type != LMQTT_PROPERTY_TYPE_STRING &&
+                p->type != LMQTT_PROPERTY_TYPE_STRING_PAIR)
+            on_property(state, p->id, p->value);
+        p->type = 0;
+    }
+
+    if (rem_pos < p->end)
+        return LMQTT_DECODE_CONTINUE;
+    if (!p->type)
+        return LMQTT_DECODE_FINISHED;
+
+fail:
+    rx_buffer_fail(state, LMQTT_ERROR_DECODE_INVALID_PROPERTIES, 0);
+    return LMQTT_DECODE_ERROR;
+}
+
+LMQTT_STATIC int rx_buffer_is_property_finished(lmqtt_rx_buffer_t *state)
+{
+    return state->internal.property.len_finished &&
+        state->internal.remain_buf_pos >= state->internal.property.end;
+}
+
+/* Decodes a byte of a property list which must extend to the end of the
+   packet */
+LMQTT_STATIC lmqtt_decode_result_t rx_buffer_decode_trailing_property(
+    lmqtt_rx_buffer_t *state, lmqtt_decode_bytes_t *bytes,
+    rx_buffer_on_property_t on_property)
+{
+    lmqtt_decode_result_t res;
+
+    assert(bytes->buf_len >= 1);
+    res = rx_buffer_decode_property(state, bytes->buf[0], on_property);
+    *bytes->bytes_written = 1;
+
+    if (res == LMQTT_DECODE_FINISHED && state->internal.remain_buf_pos + 1 <
+            state->internal.header.remaining_length) {
+        rx_buffer_fail(state, LMQTT_ERROR_DECODE_INVALID_PROPERTIES, 0);
+        return LMQTT_DECODE_ERROR;
+    }
+    return res;
+}
+
+LMQTT_STATIC lmqtt_error_t connack_reason_code_to_error(unsigned char b)
+{
+    switch (b) {
+        case 0x84: return LMQTT_ERROR_CONNACK_UNACCEPTABLE_PROTOCOL_VERSION;
+        case 0x85: return LMQTT_ERROR_CONNACK_IDENTIFIER_REJECTED;
+        case 0x86: return LMQTT_ERROR_CONNACK_BAD_USER_NAME_OR_PASSWORD;
+        case 0x87: return LMQTT_ERROR_CONNACK_NOT_AUTHORIZED;
+        case 0x88:
+        case 0x89: return LMQTT_ERROR_CONNACK_SERVER_UNAVAILABLE;
+    }
+    return LMQTT_ERROR_CONNACK_REFUSED;
+}
+
+static void rx_buffer_connack_property(lmqtt_rx_buffer_t *state,
+    unsigned char id, unsigned long value)
+{
+    lmqtt_connect_t *connect = (lmqtt_connect_t *) state->internal.value.value;
+
+    if (id == LMQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM)
+        connect->response.topic_alias_maximum = (unsigned short) value;
+    else if (id == LMQTT_PROPERTY_RECEIVE_MAXIMUM)
+        connect->response.receive_maximum = (unsigned short) value;
+}
+
 LMQTT_STATIC lmqtt_decode_result_t rx_buffer_decode_connack(
     lmqtt_rx_buffer_t *state, lmqtt_decode_bytes_t *bytes)
 {
@@ -1245,11 +2359,29 @@ LMQTT_STATIC lmqtt_decode_result_t rx_buffer_decode_connack(
             *bytes->bytes_written += 1;
             return LMQTT_DECODE_CONTINUE;
         case 1:
+            if (state->protocol == LMQTT_PROTOCOL_MQTT_5) {
+                /* reason codes below 0x80 other than success are not valid
+                   in CONNACK */
+                if (b != 0 && b < 0x80) {
+                    rx_buffer_fail(state,
+                        LMQTT_ERROR_DECODE_CONNACK_INVALID_RETURN_CODE, 0);
+                    return LMQTT_DECODE_ERROR;
+                }
+                connect->response.return_code = b;
+                *bytes->bytes_written += 1;
+                if (b != 0) {
+                    rx_buffer_fail(state, connack_reason_code_to_error(b), 0);
+                    return LMQTT_DECODE_ERROR;
+                }
+                return LMQTT_DECODE_CONTINUE;
+            }
             if (b > LMQTT_CONNACK_RETURN_CODE_MAX) {
                 rx_buffer_fail(state,
                     LMQTT_ERROR_DECODE_CONNACK_INVALID_RETURN_CODE, 0);
                 return LMQTT_DECODE_ERROR;
-            } else if (b != 0) {
+            }
+            connect->response.return_code = b;
+            if (b != 0) {
                 rx_buffer_fail(state, LMQTT_ERROR_CONNACK_BASE + b, 0);
                 *bytes->bytes_written += 1;
                 return LMQTT_DECODE_ERROR;
@@ -1258,139 +2390,530 @@ LMQTT_STATIC lmqtt_decode_result_t rx_buffer_decode_connack(
                 return LMQTT_DECODE_FINISHED;
             }
         default:
+            if (state->protocol == LMQTT_PROTOCOL_MQTT_5)
+                return rx_buffer_decode_trailing_property(state, bytes,
+                    &rx_buffer_connack_property);
             rx_buffer_fail(state, LMQTT_ERROR_DECODE_CONNACK_INVALID_LENGTH, 0);
             return LMQTT_DECODE_ERROR;
     }
 }
 
-LMQTT_STATIC lmqtt_decode_result_t rx_buffer_decode_publish(
+LMQTT_STATIC lmqtt_decode_result_t rx_buffer_decode_publish(
+    lmqtt_rx_buffer_t *state, lmqtt_decode_bytes_t *bytes)
+{
+    size_t *bytes_w;
+    long rem_len = state->internal.header.remaining_length;
+    long rem_pos = state->internal.remain_buf_pos + 1;
+    lmqtt_publish_t *publish = &state->internal.publish;
+    lmqtt_message_callbacks_t *message = state->message_callbacks;
+    lmqtt_qos_t qos = QOS_TO_LMQTT_QOS(state->internal.header.qos);
+    static const long s_len = LMQTT_STRING_LEN_SIZE;
+    long p_len = qos == LMQTT_QOS_0 ? 0 : LMQTT_PACKET_ID_SIZE;
+    /* minimum length of the properties (MQTT 5) */
+    long h_len = state->protocol == LMQTT_PROTOCOL_MQTT_5 &&
+        !state->server_role ? 1 : 0;
+    lmqtt_packet_id_t packet_id;
+
+    assert(bytes->buf_len >= 1);
+    bytes_w = bytes->bytes_written;
+    *bytes_w = 0;
+
+    if (rem_pos <= s_len) {
+        state->internal.topic_len |= bytes->buf[0] << ((s_len - rem_pos) * 8);
+        if (rem_pos == s_len && (state->internal.topic_len == 0 ||
+                state->internal.topic_len + s_len + p_len + h_len > rem_len)) {
+            rx_buffer_fail(state, LMQTT_ERROR_DECODE_PUBLISH_INVALID_LENGTH, 0);
+            return LMQTT_DECODE_ERROR;
+        }
+        *bytes_w += 1;
+    } else {
+        long t_len = (long) state->internal.topic_len;
+        long p_start = s_len + t_len;
+
+        if (rem_pos == s_len + 1) {
+            /* known before the allocation callbacks are called */
+            publish->qos = qos;
+            if (!message->on_publish || !message->on_publish_allocate_topic ||
+                    !message->on_publish_allocate_payload)
+                state->internal.ignore_publish = 1;
+        }
+
+        if (rem_pos <= p_start) {
+            if (!rx_buffer_allocate_write(state, s_len + 1,
+                    &rx_buffer_publish_part_topic, t_len, bytes)) {
+                rx_buffer_deallocate_publish(state);
+                return LMQTT_DECODE_ERROR;
+            }
+        } else if (rem_pos <= p_start + p_len) {
+            state->internal.packet_id |= (bytes->buf[0] << ((p_len - rem_pos +
+                    p_start) * 8));
+            *bytes_w += 1;
+        } else if (h_len > 0 && !rx_buffer_is_property_finished(state)) {
+            /* properties are not reported to the user */
+            if (rx_buffer_decode_property(state, bytes->buf[0], NULL) ==
+                    LMQTT_DECODE_ERROR) {
+                rx_buffer_deallocate_publish(state);
+                return LMQTT_DECODE_ERROR;
+            }
+            *bytes_w += 1;
+        } else {
+            long h_end = h_len > 0 ? state->internal.property.end :
+                p_start + p_len;
+            if (!rx_buffer_allocate_write(state, h_end + 1,
+                    &rx_buffer_publish_part_payload, rem_len - h_end,
+                    bytes)) {
+                rx_buffer_deallocate_publish(state);
+                return LMQTT_DECODE_ERROR;
+            }
+        }
+    }
+
+    if (state->internal.blocking_str)
+        return LMQTT_DECODE_WOULD_BLOCK;
+    if (rem_len >= rem_pos + *bytes_w)
+        return LMQTT_DECODE_CONTINUE;
+
+    packet_id = state->internal.packet_id;
+
+    if (qos != LMQTT_QOS_0)
+        rx_buffer_queue_ack(state, qos == LMQTT_QOS_2 ? LMQTT_KIND_PUBREC :
+            LMQTT_KIND_PUBACK, packet_id);
+
+    if (qos != LMQTT_QOS_2 || !lmqtt_id_set_contains(&state->id_set, packet_id)) {
+        if (qos == LMQTT_QOS_2 && !lmqtt_id_set_put(&state->id_set, packet_id)) {
+            rx_buffer_deallocate_publish(state);
+            rx_buffer_fail(state, LMQTT_ERROR_DECODE_PUBLISH_ID_SET_FULL, 0);
+            return LMQTT_DECODE_ERROR;
+        }
+
+        publish->qos = qos;
+        publish->retain = state->internal.header.retain;
+
+        if (!state->internal.ignore_publish && message->on_publish &&
+                !message->on_publish(message->on_publish_data, publish)) {
+            rx_buffer_deallocate_publish(state);
+            rx_buffer_fail(state,
+                LMQTT_ERROR_DECODE_PUBLISH_MESSAGE_CALLBACK_FAILED, 0);
+            return LMQTT_DECODE_ERROR;
+        }
+    }
+
+    rx_buffer_deallocate_publish(state);
+    return LMQTT_DECODE_FINISHED;
+}
+
+LMQTT_STATIC lmqtt_decode_result_t rx_buffer_decode_suback(
+    lmqtt_rx_buffer_t *state, lmqtt_decode_bytes_t *bytes)
+{
+    unsigned char b;
+    lmqtt_subscribe_t *subscribe =
+        (lmqtt_subscribe_t *) state->internal.value.value;
+    int mqtt_5 = state->protocol == LMQTT_PROTOCOL_MQTT_5;
+    long start = LMQTT_PACKET_ID_SIZE;
+    long pos;
+
+    assert(bytes->buf_len >= 1);
+    b = bytes->buf[0];
+    *bytes->bytes_written = 0;
+
+    if (mqtt_5) {
+        if (!rx_buffer_is_property_finished(state)) {
+            *bytes->bytes_written = 1;
+            if (rx_buffer_decode_property(state, b, NULL) == LMQTT_DECODE_ERROR)
+                return LMQTT_DECODE_ERROR;
+            if (state->internal.remain_buf_pos + 1 <
+                    state->internal.header.remaining_length)
+                return LMQTT_DECODE_CONTINUE;
+            /* no return codes after the properties */
+            rx_buffer_fail(state, LMQTT_ERROR_DECODE_SUBACK_COUNT_MISMATCH, 0);
+            return LMQTT_DECODE_ERROR;
+        }
+        start = state->internal.property.end;
+    }
+
+    pos = state->internal.remain_buf_pos - start;
+    if (pos == 0) {
+        long len = state->internal.header.remaining_length - start;
+        if (len != subscribe_get_count(subscribe)) {
+            rx_buffer_fail(state, LMQTT_ERROR_DECODE_SUBACK_COUNT_MISMATCH, 0);
+            return LMQTT_DECODE_ERROR;
+        }
+    }
+
+    /* MQTT 5 has several failure codes, all of them greater than 0x80 */
+    if (b > 2 && (mqtt_5 ? b < 0x80 : b != 0x80)) {
+        rx_buffer_fail(state, LMQTT_ERROR_DECODE_SUBACK_INVALID_RETURN_CODE, 0);
+        return LMQTT_DECODE_ERROR;
+    }
+
+    subscribe_get_subscription(subscribe, pos)->return_code = b;
+    *bytes->bytes_written += 1;
+    return pos + 1 >= subscribe_get_count(subscribe) ?
+        LMQTT_DECODE_FINISHED : LMQTT_DECODE_CONTINUE;
+}
+
+/* Decodes the reason code and properties which may follow the packet id of
+   PUBACK, PUBREC, PUBREL and PUBCOMP in MQTT 5; the reason code is ignored,
+   i.e. the packet is handled as a successful acknowledgement */
+LMQTT_STATIC lmqtt_decode_result_t rx_buffer_decode_reason_code(
+    lmqtt_rx_buffer_t *state, lmqtt_decode_bytes_t *bytes)
+{
+    long rem_len = state->internal.header.remaining_length;
+
+    if (state->internal.remain_buf_pos > LMQTT_PACKET_ID_SIZE)
+        return rx_buffer_decode_trailing_property(state, bytes, NULL);
+
+    *bytes->bytes_written = 1;
+    return rem_len == LMQTT_PACKET_ID_SIZE + 1 ?
+        LMQTT_DECODE_FINISHED : LMQTT_DECODE_CONTINUE;
+}
+
+/* Decodes the properties and skips the reason codes of an MQTT 5 UNSUBACK */
+LMQTT_STATIC lmqtt_decode_result_t rx_buffer_decode_unsuback(
+    lmqtt_rx_buffer_t *state, lmqtt_decode_bytes_t *bytes)
+{
+    long rem_pos = state->internal.remain_buf_pos;
+    long rem_len = state->internal.header.remaining_length;
+    size_t cnt = (size_t) (rem_len - rem_pos);
+
+    if (!rx_buffer_is_property_finished(state)) {
+        lmqtt_decode_result_t res;
+
+        assert(bytes->buf_len >= 1);
+        res = rx_buffer_decode_property(state, bytes->buf[0], NULL);
+        *bytes->bytes_written = 1;
+        if (res == LMQTT_DECODE_FINISHED && rem_pos + 1 < rem_len)
+            return LMQTT_DECODE_CONTINUE;
+        return res;
+    }
+
+    if (cnt > bytes->buf_len)
+        cnt = bytes->buf_len;
+    *bytes->bytes_written = cnt;
+    return rem_pos + (long) cnt >= rem_len ?
+        LMQTT_DECODE_FINISHED : LMQTT_DECODE_CONTINUE;
+}
+
+/* Decodes part of the length-prefixed string field which starts at offset
+   `field_start` of the remaining length, writing it to `str` (or skipping it
+   if `str` is NULL or not allocated by the user); `trailing_len` is the number
+   of bytes which must follow the string in the same packet */
+LMQTT_STATIC lmqtt_decode_result_t rx_buffer_decode_string_field(
+    lmqtt_rx_buffer_t *state, lmqtt_decode_bytes_t *bytes, lmqtt_string_t *str,
+    long min_len, long trailing_len, lmqtt_error_t length_error)
+{
+    static const long s_len = LMQTT_STRING_LEN_SIZE;
+    long rem_len = state->internal.header.remaining_length;
+    long pos = state->internal.remain_buf_pos - state->internal.field_start;
+    lmqtt_request_callbacks_t *request = state->request_callbacks;
+    long len;
+    size_t max_len;
+    size_t buf_len;
+    int os_error = 0;
+
+    assert(bytes->buf_len >= 1);
+    *bytes->bytes_written = 0;
+
+    if (pos < s_len) {
+        state->internal.field_len |= bytes->buf[0] << ((s_len - pos - 1) * 8);
+        *bytes->bytes_written = 1;
+        if (pos + 1 < s_len)
+            return LMQTT_DECODE_CONTINUE;
+
+        len = (long) state->internal.field_len;
+        if (len < min_len || state->internal.field_start + s_len + len +
+                trailing_len > rem_len) {
+            rx_buffer_fail(state, length_error, 0);
+            return LMQTT_DECODE_ERROR;
+        }
+
+        state->internal.ignore_field = !str || !request ||
+            !request->on_allocate_string;
+        if (str) {
+            memset(str, 0, sizeof(*str));
+            str->len = len;
+        }
+        if (len == 0)
+            return LMQTT_DECODE_FINISHED;
+
+        if (!state->internal.ignore_field) {
+            switch (request->on_allocate_string(request->on_request_data, str,
+                    (size_t) len)) {
+                case LMQTT_ALLOCATE_SUCCESS:
+                    break;
+                case LMQTT_ALLOCATE_IGNORE:
+                    state->internal.ignore_field = 1;
+                    break;
+                default:
+                    rx_buffer_fail(state,
+                        LMQTT_ERROR_DECODE_REQUEST_ALLOCATE_FAILED, 0);
+                    return LMQTT_DECODE_ERROR;
+            }
+        }
+        return LMQTT_DECODE_CONTINUE;
+    }
+
+    /* the buffer may hold bytes belonging to the fields after this one */
+    max_len = (size_t) (s_len + (long) state->internal.field_len - pos);
+    buf_len = bytes->buf_len > max_len ? max_len : bytes->buf_len;
+
+    if (state->internal.ignore_field) {
+        *bytes->bytes_written = buf_len;
+    } else {
+        state->internal.blocking_str = NULL;
+        switch (string_write(str, bytes->buf, buf_len, bytes->bytes_written,
+                &os_error)) {
+            case LMQTT_STRING_SUCCESS:
+                break;
+            case LMQTT_STRING_WOULD_BLOCK:
+                state->internal.blocking_str = str;
+                return LMQTT_DECODE_WOULD_BLOCK;
+            default:
+                rx_buffer_fail(state, LMQTT_ERROR_DECODE_REQUEST_WRITE_FAILED,
+                    os_error);
+                return LMQTT_DECODE_ERROR;
+        }
+    }
+
+    return *bytes->bytes_written >= max_len ?
+        LMQTT_DECODE_FINISHED : LMQTT_DECODE_CONTINUE;
+}
+
+LMQTT_STATIC lmqtt_string_t *rx_buffer_connect_get_field(
+    lmqtt_rx_buffer_t *state, int field)
+{
+    lmqtt_connect_t *connect = &state->internal.connect;
+    unsigned char flags = state->internal.connect_flags;
+
+    switch (field) {
+        case 0:
+            return &connect->client_id;
+        case 1:
+            return flags & LMQTT_FLAG_WILL_FLAG ? &connect->will_topic : NULL;
+        case 2:
+            return flags & LMQTT_FLAG_WILL_FLAG ? &connect->will_message : NULL;
+        case 3:
+            return flags & LMQTT_FLAG_USER_NAME_FLAG ? &connect->user_name : NULL;
+        case 4:
+            return flags & LMQTT_FLAG_PASSWORD_FLAG ? &connect->password : NULL;
+    }
+    return NULL;
+}
+
+LMQTT_STATIC int rx_buffer_decode_connect_flags(lmqtt_rx_buffer_t *state,
+    unsigned char flags)
+{
+    lmqtt_connect_t *connect = &state->internal.connect;
+    int will_qos = (flags >> 3) & 3;
+
+    if ((flags & 0x01) != 0 || will_qos > LMQTT_QOS_2)
+        return 0;
+    if (!(flags & LMQTT_FLAG_WILL_FLAG) &&
+            (will_qos != 0 || (flags & LMQTT_FLAG_WILL_RETAIN)))
+        return 0;
+    if (!(flags & LMQTT_FLAG_USER_NAME_FLAG) &&
+            (flags & LMQTT_FLAG_PASSWORD_FLAG))
+        return 0;
+
+    state->internal.connect_flags = flags;
+    connect->clean_session = (flags & LMQTT_FLAG_CLEAN_SESSION) != 0;
+    connect->will_retain = (flags & LMQTT_FLAG_WILL_RETAIN) != 0;
+    connect->will_qos = QOS_TO_LMQTT_QOS(will_qos);
+    return 1;
+}
+
+LMQTT_STATIC lmqtt_decode_result_t rx_buffer_decode_connect(
     lmqtt_rx_buffer_t *state, lmqtt_decode_bytes_t *bytes)
 {
-    size_t *bytes_w;
+    static const unsigned char protocol[] = "\x00\x04MQTT\x04";
+    lmqtt_connect_t *connect = &state->internal.connect;
+    lmqtt_request_callbacks_t *request = state->request_callbacks;
     long rem_len = state->internal.header.remaining_length;
-    long rem_pos = state->internal.remain_buf_pos + 1;
-    lmqtt_store_value_t value;
-    lmqtt_publish_t *publish = &state->internal.publish;
-    lmqtt_message_callbacks_t *message = state->message_callbacks;
-    lmqtt_qos_t qos = QOS_TO_LMQTT_QOS(state->internal.header.qos);
-    static const long s_len = LMQTT_STRING_LEN_SIZE;
-    long p_len = qos == LMQTT_QOS_0 ? 0 : LMQTT_PACKET_ID_SIZE;
-    lmqtt_packet_id_t packet_id;
+    long pos = state->internal.remain_buf_pos;
+    unsigned char b;
+    lmqtt_decode_result_t res;
+    long end;
 
     assert(bytes->buf_len >= 1);
-    bytes_w = bytes->bytes_written;
-    *bytes_w = 0;
-
-    if (rem_pos <= s_len) {
-        state->internal.topic_len |= bytes->buf[0] << ((s_len - rem_pos) * 8);
-        if (rem_pos == s_len && (state->internal.topic_len == 0 ||
-                state->internal.topic_len + s_len + p_len > rem_len)) {
-            rx_buffer_fail(state, LMQTT_ERROR_DECODE_PUBLISH_INVALID_LENGTH, 0);
-            return LMQTT_DECODE_ERROR;
-        }
-        *bytes_w += 1;
-    } else {
-        long t_len = (long) state->internal.topic_len;
-        long p_start = s_len + t_len;
-
-        if (rem_pos == s_len + 1 && (!message->on_publish ||
-                !message->on_publish_allocate_topic ||
-                !message->on_publish_allocate_payload))
-            state->internal.ignore_publish = 1;
+    b = bytes->buf[0];
+    *bytes->bytes_written = 0;
 
-        if (rem_pos <= p_start) {
-            if (!rx_buffer_allocate_write(state, s_len + 1,
-                    &rx_buffer_publish_part_topic, t_len, bytes)) {
-                rx_buffer_deallocate_publish(state);
+    if (pos < LMQTT_CONNECT_HEADER_SIZE) {
+        if (pos < (long) sizeof(protocol) - 1) {
+            if (b != protocol[pos]) {
+                rx_buffer_fail(state,
+                    LMQTT_ERROR_DECODE_CONNECT_INVALID_PROTOCOL, 0);
                 return LMQTT_DECODE_ERROR;
             }
-        } else if (rem_pos <= p_start + p_len) {
-            state->internal.packet_id |= (bytes->buf[0] << ((p_len - rem_pos +
-                    p_start) * 8));
-            *bytes_w += 1;
-        } else {
-            if (!rx_buffer_allocate_write(state, p_start + p_len + 1,
-                    &rx_buffer_publish_part_payload, rem_len - p_len - p_start,
-                    bytes)) {
-                rx_buffer_deallocate_publish(state);
+        } else if (pos == sizeof(protocol) - 1) {
+            if (!rx_buffer_decode_connect_flags(state, b)) {
+                rx_buffer_fail(state, LMQTT_ERROR_DECODE_CONNECT_INVALID_FLAGS,
+                    0);
                 return LMQTT_DECODE_ERROR;
             }
+        } else {
+            connect->keep_alive |= b << ((LMQTT_CONNECT_HEADER_SIZE - pos - 1)
+                * 8);
+            state->internal.field_start = LMQTT_CONNECT_HEADER_SIZE;
         }
+        *bytes->bytes_written = 1;
+        return LMQTT_DECODE_CONTINUE;
     }
 
-    if (state->internal.blocking_str)
-        return LMQTT_DECODE_WOULD_BLOCK;
-    if (rem_len >= rem_pos + *bytes_w)
+    res = rx_buffer_decode_string_field(state, bytes,
+        rx_buffer_connect_get_field(state, state->internal.field), 0, 0,
+        LMQTT_ERROR_DECODE_CONNECT_INVALID_LENGTH);
+    if (res != LMQTT_DECODE_FINISHED)
+        return res;
+
+    /* skip fields which are not present according to the CONNECT flags */
+    do {
+        state->internal.field++;
+    } while (state->internal.field <= 4 &&
+        !rx_buffer_connect_get_field(state, state->internal.field));
+
+    end = pos + (long) *bytes->bytes_written;
+    if (state->internal.field <= 4 ?
+            rem_len - end < LMQTT_STRING_LEN_SIZE : end != rem_len) {
+        rx_buffer_fail(state, LMQTT_ERROR_DECODE_CONNECT_INVALID_LENGTH, 0);
+        return LMQTT_DECODE_ERROR;
+    }
+
+    if (state->internal.field <= 4) {
+        state->internal.field_start = end;
+        state->internal.field_len = 0;
         return LMQTT_DECODE_CONTINUE;
+    }
 
-    packet_id = state->internal.packet_id;
+    if (request && request->on_connect &&
+            !request->on_connect(request->on_request_data, connect)) {
+        rx_buffer_fail(state, LMQTT_ERROR_CALLBACK_CONNECT, 0);
+        return LMQTT_DECODE_ERROR;
+    }
+
+    return LMQTT_DECODE_FINISHED;
+}
+
+LMQTT_STATIC lmqtt_decode_result_t rx_buffer_decode_subscriptions(
+    lmqtt_rx_buffer_t *state, lmqtt_decode_bytes_t *bytes, int include_qos)
+{
+    lmqtt_subscribe_t *subscribe = &state->internal.subscribe;
+    lmqtt_request_callbacks_t *request = state->request_callbacks;
+    lmqtt_subscription_t *subscription = NULL;
+    long rem_len = state->internal.header.remaining_length;
+    long pos = state->internal.remain_buf_pos;
+    long min_len = LMQTT_STRING_LEN_SIZE + 1 + (include_qos ? 1 : 0);
+    lmqtt_decode_result_t res;
+    long end;
+
+    assert(bytes->buf_len >= 1);
+    *bytes->bytes_written = 0;
 
-    if (qos != LMQTT_QOS_0) {
-        memset(&value, 0, sizeof(value));
-        value.packet_id = packet_id;
-        lmqtt_store_append(state->store, qos == LMQTT_QOS_2 ?
-            LMQTT_KIND_PUBREC : LMQTT_KIND_PUBACK, &value);
+    if (pos == LMQTT_PACKET_ID_SIZE) {
+        state->internal.field_start = pos;
+        if (request && request->on_allocate_subscriptions &&
+                request->on_allocate_subscriptions(request->on_request_data,
+                    subscribe, (size_t) ((rem_len - pos) / min_len)) !=
+                    LMQTT_ALLOCATE_SUCCESS) {
+            rx_buffer_fail(state, LMQTT_ERROR_DECODE_REQUEST_ALLOCATE_FAILED,
+                0);
+            return LMQTT_DECODE_ERROR;
+        }
+        subscribe->count = 0;
     }
 
-    if (qos != LMQTT_QOS_2 || !lmqtt_id_set_contains(&state->id_set, packet_id)) {
-        if (qos == LMQTT_QOS_2 && !lmqtt_id_set_put(&state->id_set, packet_id)) {
-            rx_buffer_deallocate_publish(state);
-            rx_buffer_fail(state, LMQTT_ERROR_DECODE_PUBLISH_ID_SET_FULL, 0);
+    if (subscribe->subscriptions)
+        subscription = &subscribe->subscriptions[subscribe->count];
+
+    if (state->internal.field == 0) {
+        res = rx_buffer_decode_string_field(state, bytes,
+            subscription ? &subscription->topic : NULL, 1, include_qos ? 1 : 0,
+            LMQTT_ERROR_DECODE_SUBSCRIBE_INVALID_LENGTH);
+        if (res != LMQTT_DECODE_FINISHED)
+            return res;
+        if (include_qos) {
+            state->internal.field = 1;
+            return LMQTT_DECODE_CONTINUE;
+        }
+        end = pos + (long) *bytes->bytes_written;
+    } else {
+        unsigned char b = bytes->buf[0];
+        if (b > LMQTT_QOS_2) {
+            rx_buffer_fail(state, LMQTT_ERROR_DECODE_SUBSCRIBE_INVALID_QOS, 0);
             return LMQTT_DECODE_ERROR;
         }
+        if (subscription)
+            subscription->requested_qos = QOS_TO_LMQTT_QOS(b);
+        *bytes->bytes_written = 1;
+        end = pos + 1;
+    }
 
-        publish->qos = qos;
-        publish->retain = state->internal.header.retain;
+    if (subscription)
+        subscribe->count++;
 
-        if (!state->internal.ignore_publish && message->on_publish &&
-                !message->on_publish(message->on_publish_data, publish)) {
-            rx_buffer_deallocate_publish(state);
-            rx_buffer_fail(state,
-                LMQTT_ERROR_DECODE_PUBLISH_MESSAGE_CALLBACK_FAILED, 0);
+    if (end < rem_len) {
+        if (rem_len - end < min_len) {
+            rx_buffer_fail(state, LMQTT_ERROR_DECODE_SUBSCRIBE_INVALID_LENGTH,
+                0);
             return LMQTT_DECODE_ERROR;
         }
+        state->internal.field = 0;
+        state->internal.field_start = end;
+        state->internal.field_len = 0;
+        return LMQTT_DECODE_CONTINUE;
     }
 
-    rx_buffer_deallocate_publish(state);
     return LMQTT_DECODE_FINISHED;
 }
 
-LMQTT_STATIC lmqtt_decode_result_t rx_buffer_decode_suback(
+LMQTT_STATIC lmqtt_decode_result_t rx_buffer_decode_subscribe(
     lmqtt_rx_buffer_t *state, lmqtt_decode_bytes_t *bytes)
 {
-    unsigned char b;
-    lmqtt_subscribe_t *subscribe =
-        (lmqtt_subscribe_t *) state->internal.value.value;
-    long pos = state->internal.remain_buf_pos - LMQTT_PACKET_ID_SIZE;
+    lmqtt_request_callbacks_t *request = state->request_callbacks;
+    lmqtt_decode_result_t res = rx_buffer_decode_subscriptions(state, bytes, 1);
 
-    assert(bytes->buf_len >= 1);
-    b = bytes->buf[0];
-    *bytes->bytes_written = 0;
+    if (res == LMQTT_DECODE_FINISHED && request && request->on_subscribe &&
+            !request->on_subscribe(request->on_request_data,
+                state->internal.packet_id, &state->internal.subscribe)) {
+        rx_buffer_fail(state, LMQTT_ERROR_CALLBACK_SUBSCRIBE, 0);
+        return LMQTT_DECODE_ERROR;
+    }
 
-    if (pos == 0) {
-        long len = state->internal.header.remaining_length -
-            LMQTT_PACKET_ID_SIZE;
-        if (len != (long) subscribe->count) {
-            rx_buffer_fail(state, LMQTT_ERROR_DECODE_SUBACK_COUNT_MISMATCH, 0);
-            return LMQTT_DECODE_ERROR;
-        }
+    return res;
+}
+
+LMQTT_STATIC lmqtt_decode_result_t rx_buffer_decode_unsubscribe(
+    lmqtt_rx_buffer_t *state, lmqtt_decode_bytes_t *bytes)
+{
+    lmqtt_request_callbacks_t *request = state->request_callbacks;
+    lmqtt_decode_result_t res = rx_buffer_decode_subscriptions(state, bytes, 0);
+    lmqtt_store_value_t value;
+
+    if (res != LMQTT_DECODE_FINISHED)
+        return res;
+
+    if (request && request->on_unsubscribe &&
+            !request->on_unsubscribe(request->on_request_data,
+                state->internal.packet_id, &state->internal.subscribe)) {
+        rx_buffer_fail(state, LMQTT_ERROR_CALLBACK_UNSUBSCRIBE, 0);
+        return LMQTT_DECODE_ERROR;
     }
 
-    if (b > 2 && b != 0x80) {
-        rx_buffer_fail(state, LMQTT_ERROR_DECODE_SUBACK_INVALID_RETURN_CODE, 0);
+    memset(&value, 0, sizeof(value));
+    value.packet_id = state->internal.packet_id;
+    if (!lmqtt_store_append(state->store, LMQTT_KIND_UNSUBACK, &value)) {
+        rx_buffer_fail(state, LMQTT_ERROR_DECODE_REQUEST_STORE_FULL, 0);
         return LMQTT_DECODE_ERROR;
     }
 
-    subscribe->subscriptions[pos].return_code = b;
-    *bytes->bytes_written += 1;
-    return pos + 1 >= (long) subscribe->count ?
-        LMQTT_DECODE_FINISHED : LMQTT_DECODE_CONTINUE;
+    return LMQTT_DECODE_FINISHED;
 }
 
 /*
  * Return: 1 on success, 0 on failure
  */
-static int rx_buffer_call_callback_impl(lmqtt_rx_buffer_t *state)
+static int LMQTT_MOCKABLE_IMPL(rx_buffer_call_callback)(
+    lmqtt_rx_buffer_t *state)
 {
     lmqtt_store_value_t *value = &state->internal.value;
 
@@ -1400,11 +2923,13 @@ static int rx_buffer_call_callback_impl(lmqtt_rx_buffer_t *state)
     return 1;
 }
 
+#ifdef LMQTT_TEST
 /* Enable mocking of rx_buffer_call_callback() */
 LMQTT_STATIC int (*rx_buffer_call_callback)(
     lmqtt_rx_buffer_t *) = &rx_buffer_call_callback_impl;
+#endif
 
-static lmqtt_decode_result_t rx_buffer_decode_type_impl(
+static lmqtt_decode_result_t LMQTT_MOCKABLE_IMPL(rx_buffer_decode_type)(
     lmqtt_rx_buffer_t *state, lmqtt_decode_bytes_t *bytes)
 {
     if (!state->internal.decoder->decode_bytes) {
@@ -1416,9 +2941,11 @@ static lmqtt_decode_result_t rx_buffer_decode_type_impl(
     return state->internal.decoder->decode_bytes(state, bytes);
 }
 
+#ifdef LMQTT_TEST
 /* Enable mocking of rx_buffer_decode_type() */
 LMQTT_STATIC lmqtt_decode_result_t (*rx_buffer_decode_type)(
     lmqtt_rx_buffer_t *, lmqtt_decode_bytes_t *) = &rx_buffer_decode_type_impl;
+#endif
 
 LMQTT_STATIC int rx_buffer_pop_packet(lmqtt_rx_buffer_t *state,
     lmqtt_packet_id_t packet_id)
@@ -1477,7 +3004,6 @@ LMQTT_STATIC int rx_buffer_pop_packet_ignore(lmqtt_rx_buffer_t *state)
 
 LMQTT_STATIC int rx_buffer_pubrel(lmqtt_rx_buffer_t *state)
 {
-    static lmqtt_store_value_t value;
     lmqtt_packet_id_t packet_id = state->internal.packet_id;
 
     /* PUBCOMP should be always sent, even if the client has already released
@@ -1485,9 +3011,7 @@ LMQTT_STATIC int rx_buffer_pubrel(lmqtt_rx_buffer_t *state)
        failed attempts to remove such packet from the queue */
     lmqtt_id_set_remove(&state->id_set, packet_id);
 
-    memset(&value, 0, sizeof(value));
-    value.packet_id = packet_id;
-    if (lmqtt_store_append(state->store, LMQTT_KIND_PUBCOMP, &value))
+    if (rx_buffer_queue_ack(state, LMQTT_KIND_PUBCOMP, packet_id))
         return 1;
 
     /* if the call to `lmqtt_id_set_remove` failed and the queue was full before
@@ -1497,6 +3021,39 @@ LMQTT_STATIC int rx_buffer_pubrel(lmqtt_rx_buffer_t *state)
     return 0;
 }
 
+LMQTT_STATIC int rx_buffer_pingreq(lmqtt_rx_buffer_t *state)
+{
+    lmqtt_store_value_t value;
+
+    /* a PINGREQ with a non-zero remaining length will be rejected when decoding
+       its remaining bytes */
+    if (state->internal.header.remaining_length > 0)
+        return 1;
+
+    memset(&value, 0, sizeof(value));
+    if (lmqtt_store_append(state->store, LMQTT_KIND_PINGRESP, &value))
+        return 1;
+
+    rx_buffer_fail(state, LMQTT_ERROR_DECODE_REQUEST_STORE_FULL, 0);
+    return 0;
+}
+
+LMQTT_STATIC int rx_buffer_disconnect(lmqtt_rx_buffer_t *state)
+{
+    lmqtt_request_callbacks_t *request = state->request_callbacks;
+
+    if (state->internal.header.remaining_length > 0)
+        return 1;
+
+    if (request && request->on_disconnect &&
+            !request->on_disconnect(request->on_request_data)) {
+        rx_buffer_fail(state, LMQTT_ERROR_CALLBACK_DISCONNECT, 0);
+        return 0;
+    }
+
+    return 1;
+}
+
 LMQTT_STATIC lmqtt_decode_result_t rx_buffer_decode_remaining_without_id(
     lmqtt_rx_buffer_t *state, lmqtt_decode_bytes_t *bytes)
 {
@@ -1636,6 +3193,154 @@ static struct _lmqtt_rx_buffer_decoder_t const
     NULL    /* DISCONNECT */
 };
 
+static const struct _lmqtt_rx_buffer_decoder_t rx_buffer_decoder_connack_5 = {
+    3,
+    LMQTT_KIND_CONNECT,
+    &rx_buffer_pop_packet_without_id,
+    &rx_buffer_pop_packet_ignore,
+    &rx_buffer_decode_remaining_without_id,
+    &rx_buffer_decode_connack,
+    LMQTT_ERROR_CALLBACK_CONNACK
+};
+static const struct _lmqtt_rx_buffer_decoder_t rx_buffer_decoder_puback_5 = {
+    2,
+    LMQTT_KIND_PUBLISH_1,
+    &rx_buffer_pop_packet_ignore,
+    &rx_buffer_pop_packet_with_id,
+    &rx_buffer_decode_remaining_with_id,
+    &rx_buffer_decode_reason_code,
+    LMQTT_ERROR_CALLBACK_PUBLISH
+};
+static const struct _lmqtt_rx_buffer_decoder_t rx_buffer_decoder_pubrec_5 = {
+    2,
+    LMQTT_KIND_PUBLISH_2,
+    &rx_buffer_pop_packet_ignore,
+    &rx_buffer_pop_packet_with_id,
+    &rx_buffer_decode_remaining_with_id,
+    &rx_buffer_decode_reason_code,
+    0
+};
+static const struct _lmqtt_rx_buffer_decoder_t rx_buffer_decoder_pubrel_5 = {
+    2,
+    0, /* never used */
+    &rx_buffer_pop_packet_ignore,
+    &rx_buffer_pubrel,
+    &rx_buffer_decode_remaining_with_id,
+    &rx_buffer_decode_reason_code,
+    0
+};
+static const struct _lmqtt_rx_buffer_decoder_t rx_buffer_decoder_pubcomp_5 = {
+    2,
+    LMQTT_KIND_PUBREL,
+    &rx_buffer_pop_packet_ignore,
+    &rx_buffer_pop_packet_with_id,
+    &rx_buffer_decode_remaining_with_id,
+    &rx_buffer_decode_reason_code,
+    LMQTT_ERROR_CALLBACK_PUBLISH
+};
+static const struct _lmqtt_rx_buffer_decoder_t rx_buffer_decoder_suback_5 = {
+    4,
+    LMQTT_KIND_SUBSCRIBE,
+    &rx_buffer_pop_packet_ignore,
+    &rx_buffer_pop_packet_with_id,
+    &rx_buffer_decode_remaining_with_id,
+    &rx_buffer_decode_suback,
+    LMQTT_ERROR_CALLBACK_SUBACK
+};
+static const struct _lmqtt_rx_buffer_decoder_t rx_buffer_decoder_unsuback_5 = {
+    3,
+    LMQTT_KIND_UNSUBSCRIBE,
+    &rx_buffer_pop_packet_ignore,
+    &rx_buffer_pop_packet_with_id,
+    &rx_buffer_decode_remaining_with_id,
+    &rx_buffer_decode_unsuback,
+    LMQTT_ERROR_CALLBACK_UNSUBACK
+};
+
+static struct _lmqtt_rx_buffer_decoder_t const
+        *rx_buffer_decoders_5[LMQTT_TYPE_MAX + 1] = {
+    NULL,   /* 0 */
+    NULL,   /* CONNECT */
+    &rx_buffer_decoder_connack_5,
+    &rx_buffer_decoder_publish,
+    &rx_buffer_decoder_puback_5,
+    &rx_buffer_decoder_pubrec_5,
+    &rx_buffer_decoder_pubrel_5,
+    &rx_buffer_decoder_pubcomp_5,
+    NULL,   /* SUBSCRIBE */
+    &rx_buffer_decoder_suback_5,
+    NULL,   /* UNSUBSCRIBE */
+    &rx_buffer_decoder_unsuback_5,
+    NULL,   /* PINGREQ */
+    &rx_buffer_decoder_pingresp,
+    NULL    /* DISCONNECT */
+};
+
+static const struct _lmqtt_rx_buffer_decoder_t rx_buffer_decoder_connect = {
+    LMQTT_CONNECT_HEADER_SIZE + LMQTT_STRING_LEN_SIZE,
+    0, /* never used */
+    &rx_buffer_pop_packet_ignore,
+    &rx_buffer_pop_packet_ignore,
+    &rx_buffer_decode_remaining_without_id,
+    &rx_buffer_decode_connect,
+    0
+};
+static const struct _lmqtt_rx_buffer_decoder_t rx_buffer_decoder_subscribe = {
+    6,
+    0, /* never used */
+    &rx_buffer_pop_packet_ignore,
+    &rx_buffer_pop_packet_ignore,
+    &rx_buffer_decode_remaining_with_id,
+    &rx_buffer_decode_subscribe,
+    0
+};
+static const struct _lmqtt_rx_buffer_decoder_t rx_buffer_decoder_unsubscribe = {
+    5,
+    0, /* never used */
+    &rx_buffer_pop_packet_ignore,
+    &rx_buffer_pop_packet_ignore,
+    &rx_buffer_decode_remaining_with_id,
+    &rx_buffer_decode_unsubscribe,
+    0
+};
+static const struct _lmqtt_rx_buffer_decoder_t rx_buffer_decoder_pingreq = {
+    0,
+    0, /* never used */
+    &rx_buffer_pingreq,
+    &rx_buffer_pop_packet_ignore,
+    &rx_buffer_decode_remaining_without_id,
+    NULL,
+    0
+};
+static const struct _lmqtt_rx_buffer_decoder_t rx_buffer_decoder_disconnect = {
+    0,
+    0, /* never used */
+    &rx_buffer_disconnect,
+    &rx_buffer_pop_packet_ignore,
+    &rx_buffer_decode_remaining_without_id,
+    NULL,
+    0
+};
+
+static struct _lmqtt_rx_buffer_decoder_t const
+        *rx_buffer_server_decoders[LMQTT_TYPE_MAX + 1] = {
+    NULL,   /* 0 */
+    &rx_buffer_decoder_connect,
+    NULL,   /* CONNACK */
+    &rx_buffer_decoder_publish,
+    &rx_buffer_decoder_puback,
+    &rx_buffer_decoder_pubrec,
+    &rx_buffer_decoder_pubrel,
+    &rx_buffer_decoder_pubcomp,
+    &rx_buffer_decoder_subscribe,
+    NULL,   /* SUBACK */
+    &rx_buffer_decoder_unsubscribe,
+    NULL,   /* UNSUBACK */
+    &rx_buffer_decoder_pingreq,
+    NULL,   /* PINGRESP */
+    &rx_buffer_decoder_disconnect
+};
+
 /******************************************************************************
  * lmqtt_rx_buffer_t PUBLIC functions
  ******************************************************************************/
@@ -1650,19 +3355,22 @@ void lmqtt_rx_buffer_finish(lmqtt_rx_buffer_t *state)
     rx_buffer_call_callback(state);
 }
 
-lmqtt_error_t lmqtt_rx_buffer_get_error_impl(lmqtt_rx_buffer_t *state,
-    int *os_error)
+lmqtt_error_t LMQTT_MOCKABLE_IMPL(lmqtt_rx_buffer_get_error)(
+    lmqtt_rx_buffer_t *state, int *os_error)
 {
     *os_error = state->internal.os_error;
     return state->internal.error;
 }
 
+#ifdef LMQTT_TEST
 /* Enable mocking of lmqtt_rx_buffer_get_error() */
 lmqtt_error_t (*lmqtt_rx_buffer_get_error)(lmqtt_rx_buffer_t *, int *) =
     &lmqtt_rx_buffer_get_error_impl;
+#endif
 
-static lmqtt_io_result_t lmqtt_rx_buffer_decode_impl(lmqtt_rx_buffer_t *state,
-    unsigned char *buf, size_t buf_len, size_t *bytes_read)
+lmqtt_io_result_t LMQTT_MOCKABLE_IMPL(lmqtt_rx_buffer_decode)(
+    lmqtt_rx_buffer_t *state, unsigned char *buf, size_t buf_len,
+    size_t *bytes_read)
 {
     int i = 0;
     *bytes_read = 0;
@@ -1687,12 +3395,20 @@ static lmqtt_io_result_t lmqtt_rx_buffer_decode_impl(lmqtt_rx_buffer_t *state,
                 continue;
 
             state->internal.header_finished = 1;
-            state->internal.decoder =
-                rx_buffer_decoders[state->internal.header.type];
+            if (state->server_role)
+                state->internal.decoder =
+                    rx_buffer_server_decoders[state->internal.header.type];
+            else if (state->protocol == LMQTT_PROTOCOL_MQTT_5)
+                state->internal.decoder =
+                    rx_buffer_decoders_5[state->internal.header.type];
+            else
+                state->internal.decoder =
+                    rx_buffer_decoders[state->internal.header.type];
             rem_len = state->internal.header.remaining_length;
 
             if (!state->internal.decoder)
-                return rx_buffer_fail(state,
+                return rx_buffer_fail(state, state->server_role ?
+                    LMQTT_ERROR_DECODE_FIXED_HEADER_CLIENT_SPECIFIC :
                     LMQTT_ERROR_DECODE_FIXED_HEADER_SERVER_SPECIFIC, 0);
 
             if (rem_len < state->internal.decoder->min_length)
@@ -1743,9 +3459,11 @@ static lmqtt_io_result_t lmqtt_rx_buffer_decode_impl(lmqtt_rx_buffer_t *state,
     }
 }
 
+#ifdef LMQTT_TEST
 /* Enable mocking of lmqtt_rx_buffer_decode() */
 lmqtt_io_result_t (*lmqtt_rx_buffer_decode)(lmqtt_rx_buffer_t *,
     unsigned char *, size_t, size_t *) = &lmqtt_rx_buffer_decode_impl;
+#endif
 
 lmqtt_string_t *lmqtt_rx_buffer_get_blocking_str(lmqtt_rx_buffer_t *state)
 {
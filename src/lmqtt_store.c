@@ -1,38 +1,120 @@
 #include <lightmqtt/store.h>
+#include <lightmqtt/packet.h>
 #include <string.h>
 
 /******************************************************************************
  * lmqtt_store_t PRIVATE functions
  ******************************************************************************/
 
+/* The arrays are laid out in decreasing order of alignment, so that each one
+   is aligned as long as `entries` is */
+
+LMQTT_STATIC lmqtt_store_data_t *store_get_data(lmqtt_store_t *store)
+{
+    return (lmqtt_store_data_t *) store->entries;
+}
+
+LMQTT_STATIC lmqtt_packet_id_t *store_get_ids(lmqtt_store_t *store)
+{
+    return (lmqtt_packet_id_t *) (store_get_data(store) + store->capacity);
+}
+
+LMQTT_STATIC short *store_get_kinds(lmqtt_store_t *store)
+{
+    return (short *) (store_get_ids(store) + store->capacity);
+}
+
+/* The entries form a ring: the entry at position `pos` (0 being the oldest
+   one) is kept at index `head + pos`, wrapping around at `capacity`. Removing
+   the oldest entry, by far the most common case, only advances `head`. */
+LMQTT_STATIC size_t store_index(lmqtt_store_t *store, size_t pos)
+{
+    size_t i = store->head + pos;
+    return i >= store->capacity ? i - store->capacity : i;
+}
+
+LMQTT_STATIC void store_set_at(lmqtt_store_t *store, size_t pos, int kind,
+    lmqtt_store_value_t *value)
+{
+    size_t i = store_index(store, pos);
+    lmqtt_store_data_t *data = &store_get_data(store)[i];
+
+    store_get_kinds(store)[i] = (short) kind;
+    store_get_ids(store)[i] = value ? value->packet_id : 0;
+    data->value = value ? value->value : NULL;
+    data->callback = value ? value->callback : NULL;
+    data->callback_data = value ? value->callback_data : NULL;
+}
+
+/* copies the entry at position `src` over the one at `dst` */
+LMQTT_STATIC void store_copy(lmqtt_store_t *store, size_t dst, size_t src)
+{
+    size_t i = store_index(store, dst);
+    size_t j = store_index(store, src);
+    lmqtt_store_data_t *data = store_get_data(store);
+
+    data[i] = data[j];
+    store_get_ids(store)[i] = store_get_ids(store)[j];
+    store_get_kinds(store)[i] = store_get_kinds(store)[j];
+}
+
+/* QoS 1 and 2 PUBLISH packets are in flight once sent (marked), and QoS 2 ones
+   remain so until PUBCOMP, i.e. while their PUBREL is in the store */
+LMQTT_STATIC int store_is_inflight(int kind, int marked)
+{
+    return kind == LMQTT_KIND_PUBREL || (marked &&
+        (kind == LMQTT_KIND_PUBLISH_1 || kind == LMQTT_KIND_PUBLISH_2));
+}
+
 LMQTT_STATIC int store_find(lmqtt_store_t *store, int kind,
     lmqtt_packet_id_t packet_id, size_t *pos)
 {
+    lmqtt_packet_id_t *ids = store_get_ids(store);
+    short *kinds = store_get_kinds(store);
     size_t i;
+    size_t j = store->head;
 
     for (i = 0; i < store->pos; i++) {
-        lmqtt_store_entry_t *entry = &store->entries[i];
-        if (entry->kind == kind && entry->value.packet_id == packet_id) {
+        if (ids[j] == packet_id && kinds[j] == kind) {
             *pos = i;
             return 1;
         }
+        if (++j >= store->capacity)
+            j = 0;
     }
 
     *pos = 0;
     return 0;
 }
 
+/* Closes the gap left by the removed entry by moving the entries on its
+   shorter side, so that removing from either end takes constant time */
 LMQTT_STATIC int store_pop_at(lmqtt_store_t *store, size_t pos, int *kind,
     lmqtt_store_value_t *value)
 {
-    if (!lmqtt_store_get_at(store, pos, kind, value))
+    size_t i;
+    int k;
+
+    if (!lmqtt_store_get_at(store, pos, &k, value))
         return 0;
+    if (kind)
+        *kind = k;
+    store->inflight -= store_is_inflight(k, pos < store->pos);
+
+    if (pos < store->count - pos - 1) {
+        for (i = pos; i > 0; i--)
+            store_copy(store, i, i - 1);
+        store->head = store_index(store, 1);
+    } else {
+        for (i = pos; i + 1 < store->count; i++)
+            store_copy(store, i, i + 1);
+    }
 
     store->count -= 1;
     if (store->pos > pos)
         store->pos -= 1;
-    memmove(&store->entries[pos], &store->entries[pos + 1],
-        sizeof(store->entries[0]) * (store->capacity - pos - 1));
+    if (store->count == 0)
+        store->head = 0;
     return 1;
 }
 
@@ -66,26 +148,19 @@ int lmqtt_store_is_queueable(lmqtt_store_t *store)
 int lmqtt_store_append(lmqtt_store_t *store, int kind,
     lmqtt_store_value_t *value)
 {
-    lmqtt_store_entry_t *entry;
-
     if (!lmqtt_store_is_queueable(store))
         return 0;
 
-    entry = &store->entries[store->count++];
-
-    entry->kind = kind;
-    if (value)
-        memcpy(&entry->value, value, sizeof(entry->value));
-    else
-        memset(&entry->value, 0, sizeof(entry->value));
-
+    store->inflight += store_is_inflight(kind, 0);
+    store_set_at(store, store->count++, kind, value);
     return 1;
 }
 
 int lmqtt_store_get_at(lmqtt_store_t *store, size_t pos, int *kind,
     lmqtt_store_value_t *value)
 {
-    lmqtt_store_entry_t *entry;
+    lmqtt_store_data_t *data;
+    size_t i;
 
     if (pos < 0 || pos >= store->count) {
         if (kind)
@@ -95,11 +170,16 @@ int lmqtt_store_get_at(lmqtt_store_t *store, size_t pos, int *kind,
         return 0;
     }
 
-    entry = &store->entries[pos];
+    i = store_index(store, pos);
     if (kind)
-        *kind = entry->kind;
-    if (value)
-        memcpy(value, &entry->value, sizeof(entry->value));
+        *kind = store_get_kinds(store)[i];
+    if (value) {
+        data = &store_get_data(store)[i];
+        value->packet_id = store_get_ids(store)[i];
+        value->value = data->value;
+        value->callback = data->callback;
+        value->callback_data = data->callback_data;
+    }
     return 1;
 }
 
@@ -108,9 +188,45 @@ int lmqtt_store_delete_at(lmqtt_store_t *store, size_t pos)
     return store_pop_at(store, pos, NULL, NULL);
 }
 
+int lmqtt_store_replace_at(lmqtt_store_t *store, size_t pos, int kind,
+    lmqtt_store_value_t *value)
+{
+    int old_kind;
+
+    if (!lmqtt_store_get_at(store, pos, &old_kind, NULL))
+        return 0;
+
+    store->inflight -= store_is_inflight(old_kind, pos < store->pos);
+    store->inflight += store_is_inflight(kind, pos < store->pos);
+    store_set_at(store, pos, kind, value);
+    return 1;
+}
+
+/* moves the unmarked entry at `pos` ahead of the other unmarked entries, making
+   it the current one */
+int lmqtt_store_move_to_current(lmqtt_store_t *store, size_t pos)
+{
+    int kind;
+    lmqtt_store_value_t value;
+    size_t i;
+
+    if (pos < store->pos || pos >= store->count)
+        return 0;
+
+    lmqtt_store_get_at(store, pos, &kind, &value);
+    for (i = pos; i > store->pos; i--)
+        store_copy(store, i, i - 1);
+    store_set_at(store, store->pos, kind, &value);
+    return 1;
+}
+
 int lmqtt_store_mark_current(lmqtt_store_t *store)
 {
-    if (store->pos < store->count) {
+    int kind;
+
+    if (lmqtt_store_peek(store, &kind, NULL)) {
+        store->inflight += store_is_inflight(kind, 1) -
+            store_is_inflight(kind, 0);
         store->pos++;
         return 1;
     }
@@ -151,16 +267,28 @@ int lmqtt_store_shift(lmqtt_store_t *store, int *kind,
 
 void lmqtt_store_unmark_all(lmqtt_store_t *store)
 {
-    store->pos = 0;
+    int kind;
+
+    while (store->pos > 0) {
+        lmqtt_store_get_at(store, --store->pos, &kind, NULL);
+        store->inflight -= store_is_inflight(kind, 1) -
+            store_is_inflight(kind, 0);
+    }
+}
+
+size_t lmqtt_store_count_inflight(lmqtt_store_t *store)
+{
+    return store->inflight;
 }
 
 int lmqtt_store_get_timeout(lmqtt_store_t *store, size_t *count, long *secs,
     long *nsecs)
 {
     lmqtt_time_t *tm = &store->last_touch;
-    unsigned short when = store->count > 0 ? store->timeout : store->keep_alive;
+    long when = store->count > 0 ? (long) store->timeout * 1000 :
+        (long) store->keep_alive * 1000 - store->keep_alive_offset;
 
-    if (when == 0 || tm->secs == 0 && tm->nsecs == 0) {
+    if (when <= 0 || tm->secs == 0 && tm->nsecs == 0) {
         *count = 0;
         *secs = 0;
         *nsecs = 0;
@@ -168,7 +296,8 @@ int lmqtt_store_get_timeout(lmqtt_store_t *store, size_t *count, long *secs,
     }
 
     *count = store->count;
-    return lmqtt_time_get_timeout_to(tm, store->get_time, when, secs, nsecs);
+    return lmqtt_time_get_timeout_to_msecs(tm, store->get_time, when, secs,
+        nsecs);
 }
 
 void lmqtt_store_touch(lmqtt_store_t *store)
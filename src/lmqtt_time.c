@@ -6,10 +6,16 @@
 
 int lmqtt_time_get_timeout_to(lmqtt_time_t *tm, lmqtt_get_time_t get_time,
     unsigned short when, long *secs, long *nsecs)
+{
+    return lmqtt_time_get_timeout_to_msecs(tm, get_time, (long) when * 1000,
+        secs, nsecs);
+}
+
+int lmqtt_time_get_timeout_to_msecs(lmqtt_time_t *tm,
+    lmqtt_get_time_t get_time, long when, long *secs, long *nsecs)
 {
     long tmo_secs, tmo_nsecs;
     long cur_secs, cur_nsecs;
-    long diff;
 
     if (when == 0) {
         *nsecs = 0;
@@ -17,8 +23,12 @@ int lmqtt_time_get_timeout_to(lmqtt_time_t *tm, lmqtt_get_time_t get_time,
         return 0;
     }
 
-    tmo_secs = tm->secs + (long) when;
-    tmo_nsecs = tm->nsecs;
+    tmo_secs = tm->secs + when / 1000;
+    tmo_nsecs = tm->nsecs + (when % 1000) * 1000000;
+    if (tmo_nsecs >= 1e9) {
+        tmo_nsecs -= 1e9;
+        tmo_secs += 1;
+    }
 
     get_time(&cur_secs, &cur_nsecs);
 
@@ -37,7 +47,85 @@ int lmqtt_time_get_timeout_to(lmqtt_time_t *tm, lmqtt_get_time_t get_time,
     return 1;
 }
 
+void lmqtt_time_get_elapsed(lmqtt_time_t *tm, lmqtt_get_time_t get_time,
+    long *secs, long *nsecs)
+{
+    long cur_secs, cur_nsecs;
+
+    get_time(&cur_secs, &cur_nsecs);
+
+    if (cur_nsecs < tm->nsecs) {
+        cur_nsecs += 1e9;
+        cur_secs -= 1;
+    }
+
+    if (cur_secs >= tm->secs) {
+        *secs = cur_secs - tm->secs;
+        *nsecs = cur_nsecs - tm->nsecs;
+    } else {
+        *secs = 0;
+        *nsecs = 0;
+    }
+}
+
 void lmqtt_time_touch(lmqtt_time_t *tm, lmqtt_get_time_t get_time)
 {
     get_time(&tm->secs, &tm->nsecs);
 }
+
+/******************************************************************************
+ * lmqtt_rate_limiter_t PUBLIC functions
+ ******************************************************************************/
+
+void lmqtt_rate_limiter_initialize(lmqtt_rate_limiter_t *limiter,
+    lmqtt_get_time_t get_time, unsigned short rate, unsigned short burst)
+{
+    limiter->get_time = get_time;
+    limiter->rate = rate > 0 ? rate : 1;
+    limiter->burst = burst > 0 ? burst : 1;
+    limiter->tokens = (long) limiter->burst * 1000;
+    lmqtt_time_touch(&limiter->last, get_time);
+}
+
+/* Takes a token if one is available; otherwise returns 0 and the time until
+   the next one. Tokens are counted in thousandths. */
+int lmqtt_rate_limiter_acquire(lmqtt_rate_limiter_t *limiter, long *secs,
+    long *nsecs)
+{
+    long max = (long) limiter->burst * 1000;
+    long el_secs, el_nsecs;
+    long wait;
+    /* milliseconds needed to fill the bucket */
+    long full = (max - limiter->tokens + limiter->rate - 1) / limiter->rate;
+
+    lmqtt_time_get_elapsed(&limiter->last, limiter->get_time, &el_secs,
+        &el_nsecs);
+
+    /* checked before multiplying, which may overflow a 32-bit long past the
+       capacity of the bucket */
+    if (el_secs > full / 1000 || el_secs * 1000 + el_nsecs / 1000000 >= full)
+        limiter->tokens = max;
+    else
+        limiter->tokens += (el_secs * 1000 + el_nsecs / 1000000) *
+            (long) limiter->rate;
+
+    /* keep the sub-millisecond remainder for the next refill */
+    limiter->last.nsecs += el_nsecs - el_nsecs % 1000000;
+    limiter->last.secs += el_secs;
+    if (limiter->last.nsecs >= 1e9) {
+        limiter->last.nsecs -= 1e9;
+        limiter->last.secs += 1;
+    }
+
+    if (limiter->tokens >= 1000) {
+        limiter->tokens -= 1000;
+        *secs = 0;
+        *nsecs = 0;
+        return 1;
+    }
+
+    wait = (1000 - limiter->tokens + limiter->rate - 1) / limiter->rate;
+    *secs = wait / 1000;
+    *nsecs = (wait % 1000) * 1000000;
+    return 0;
+}
@@ -0,0 +1,550 @@
+#include "check_lightmqtt.h"
+#include "lightmqtt/broker.h"
+
+#define SESSION_COUNT 3
+#define NODE_COUNT 8
+#define SUBSCRIPTION_COUNT 8
+#define MESSAGE_COUNT 8
+#define MESSAGE_SIZE 32
+
+typedef struct {
+    lmqtt_broker_session_t session;
+    test_buffer_t read_buf;
+    test_buffer_t write_buf;
+    lmqtt_store_entry_t entries[8];
+    unsigned char rx_buffer[64];
+    unsigned char tx_buffer[64];
+    lmqtt_packet_id_t id_set[4];
+    lmqtt_broker_delivery_t deliveries[4];
+    lmqtt_subscription_t subscriptions[8];
+    char topics[32];
+    lmqtt_client_callbacks_t callbacks;
+} test_session_t;
+
+static lmqtt_broker_t broker;
+static lmqtt_broker_node_t nodes[NODE_COUNT];
+static lmqtt_broker_subscription_t subscriptions[SUBSCRIPTION_COUNT];
+static lmqtt_broker_message_t messages[MESSAGE_COUNT];
+static char message_data[MESSAGE_COUNT * MESSAGE_SIZE];
+static test_session_t sessions[SESSION_COUNT];
+
+static const char CONNECT[] =
+    "\x10\x0c\x00\x04MQTT\x04\x02\x00\x0a\x00\x00";
+static const char CONNACK[] = "\x20\x02\x00\x00";
+
+static lmqtt_io_result_t read_ts(void *data, void *buf, size_t buf_len,
+    size_t *bytes_read, int *os_error)
+{
+    return test_buffer_read(&((test_session_t *) data)->read_buf, buf,
+        buf_len, bytes_read, os_error);
+}
+
+static lmqtt_io_result_t write_ts(void *data, void *buf, size_t buf_len,
+    size_t *bytes_written, int *os_error)
+{
+    return test_buffer_write(&((test_session_t *) data)->write_buf, buf,
+        buf_len, bytes_written, os_error);
+}
+
+static void init_broker()
+{
+    lmqtt_broker_buffers_t buffers;
+    int i;
+
+    buffers.nodes_size = sizeof(nodes);
+    buffers.nodes = nodes;
+    buffers.subscriptions_size = sizeof(subscriptions);
+    buffers.subscriptions = subscriptions;
+    buffers.messages_size = sizeof(messages);
+    buffers.messages = messages;
+    buffers.message_data_size = sizeof(message_data);
+    buffers.message_data = message_data;
+
+    lmqtt_broker_initialize(&broker, &buffers);
+    test_time_set(10, 0);
+
+    for (i = 0; i < SESSION_COUNT; i++) {
+        test_session_t *ts = &sessions[i];
+        lmqtt_broker_session_buffers_t session_buffers;
+
+        memset(ts, 0, sizeof(*ts));
+        ts->read_buf.len = sizeof(ts->read_buf.buf);
+        ts->write_buf.len = sizeof(ts->write_buf.buf);
+        ts->write_buf.available_len = sizeof(ts->write_buf.buf);
+
+        ts->callbacks.data = ts;
+        ts->callbacks.read = &read_ts;
+        ts->callbacks.write = &write_ts;
+        ts->callbacks.get_time = &test_time_get;
+
+        session_buffers.store_size = sizeof(ts->entries);
+        session_buffers.store = ts->entries;
+        session_buffers.rx_buffer_size = sizeof(ts->rx_buffer);
+        session_buffers.rx_buffer = ts->rx_buffer;
+        session_buffers.tx_buffer_size = sizeof(ts->tx_buffer);
+        session_buffers.tx_buffer = ts->tx_buffer;
+        session_buffers.id_set_size = 4;
+        session_buffers.id_set = ts->id_set;
+        session_buffers.deliveries_size = sizeof(ts->deliveries);
+        session_buffers.deliveries = ts->deliveries;
+        session_buffers.subscriptions_size = sizeof(ts->subscriptions);
+        session_buffers.subscriptions = ts->subscriptions;
+        session_buffers.topics_size = sizeof(ts->topics);
+        session_buffers.topics = ts->topics;
+
+        lmqtt_broker_session_initialize(&ts->session, &broker, &ts->callbacks,
+            &session_buffers);
+    }
+}
+
+static void feed(int i, const char *buf, size_t len)
+{
+    test_buffer_t *read_buf = &sessions[i].read_buf;
+
+    memcpy(&read_buf->buf[read_buf->available_len], buf, len);
+    read_buf->available_len += len;
+}
+
+#define FEED(i, str) feed((i), (str), sizeof(str) - 1)
+
+static int run(int i)
+{
+    return lmqtt_broker_session_run_once(&sessions[i].session);
+}
+
+/* checks the bytes written to the session since the last call */
+static int written(int i, const char *buf, size_t len)
+{
+    test_buffer_t *write_buf = &sessions[i].write_buf;
+    int res = write_buf->pos == len && memcmp(write_buf->buf, buf, len) == 0;
+
+    write_buf->pos = 0;
+    return res;
+}
+
+#define WRITTEN(i, str) written((i), (str), sizeof(str) - 1)
+
+static void connect_session(int i)
+{
+    FEED(i, CONNECT);
+    run(i);
+    ck_assert(WRITTEN(i, CONNACK));
+}
+
+static size_t count_free_messages()
+{
+    lmqtt_broker_message_t *message;
+    size_t count = 0;
+
+    for (message = broker.free_messages; message; message = message->next)
+        count++;
+    return count;
+}
+
+static size_t count_free_nodes()
+{
+    lmqtt_broker_node_t *node;
+    size_t count = 0;
+
+    for (node = broker.free_nodes; node; node = node->next)
+        count++;
+    return count;
+}
+
+START_TEST(should_send_connack)
+{
+    int res;
+
+    init_broker();
+
+    FEED(0, CONNECT);
+    res = run(0);
+
+    ck_assert_int_eq(LMQTT_RES_WOULD_BLOCK_CONN_RD, res);
+    ck_assert(WRITTEN(0, CONNACK));
+    ck_assert_int_eq(1, sessions[0].session.connected);
+}
+END_TEST
+
+START_TEST(should_fail_subscribe_before_connect)
+{
+    int res;
+
+    init_broker();
+
+    FEED(0, "\x82\x08\x00\x01\x00\x03" "a/b\x00");
+    res = run(0);
+
+    ck_assert_int_eq(LMQTT_ERROR_DECODE_REQUEST_ALLOCATE_FAILED,
+        LMQTT_ERROR_NUM(res));
+}
+END_TEST
+
+START_TEST(should_fail_second_connect)
+{
+    int res;
+
+    init_broker();
+    connect_session(0);
+
+    FEED(0, CONNECT);
+    res = run(0);
+
+    ck_assert_int_eq(LMQTT_ERROR_CALLBACK_CONNECT, LMQTT_ERROR_NUM(res));
+}
+END_TEST
+
+START_TEST(should_send_suback_with_granted_qos)
+{
+    init_broker();
+    connect_session(0);
+
+    FEED(0, "\x82\x0e\x00\x05\x00\x03" "a/b\x02\x00\x03" "a/#\x00");
+    run(0);
+
+    ck_assert(WRITTEN(0, "\x90\x04\x00\x05\x01\x00"));
+}
+END_TEST
+
+START_TEST(should_reject_invalid_filters)
+{
+    init_broker();
+    connect_session(0);
+
+    FEED(0, "\x82\x0e\x00\x05\x00\x04" "a/b#\x00\x00\x02" "a+\x00");
+    run(0);
+
+    ck_assert(WRITTEN(0, "\x90\x04\x00\x05\x80\x80"));
+    ck_assert_uint_eq(NODE_COUNT, count_free_nodes());
+}
+END_TEST
+
+START_TEST(should_send_pipelined_subacks)
+{
+    init_broker();
+    connect_session(0);
+
+    FEED(0, "\x82\x08\x00\x01\x00\x03" "a/b\x01");
+    FEED(0, "\x82\x06\x00\x02\x00\x01" "c\x00");
+    run(0);
+
+    ck_assert(WRITTEN(0, "\x90\x03\x00\x01\x01" "\x90\x03\x00\x02\x00"));
+    ck_assert_int_eq(0, sessions[0].session.suback_count);
+}
+END_TEST
+
+START_TEST(should_fan_out_qos_0_publish)
+{
+    init_broker();
+    connect_session(0);
+    connect_session(1);
+    connect_session(2);
+
+    FEED(1, "\x82\x08\x00\x01\x00\x03" "a/+\x00");
+    run(1);
+    ck_assert(WRITTEN(1, "\x90\x03\x00\x01\x00"));
+    FEED(2, "\x82\x06\x00\x01\x00\x01" "#\x00");
+    run(2);
+    ck_assert(WRITTEN(2, "\x90\x03\x00\x01\x00"));
+
+    FEED(0, "\x30\x07\x00\x03" "a/b" "hi");
+    run(0);
+    ck_assert(WRITTEN(0, ""));
+    ck_assert_uint_eq(MESSAGE_COUNT - 1, count_free_messages());
+
+    run(1);
+    ck_assert(WRITTEN(1, "\x30\x07\x00\x03" "a/b" "hi"));
+    run(2);
+    ck_assert(WRITTEN(2, "\x30\x07\x00\x03" "a/b" "hi"));
+    ck_assert_uint_eq(MESSAGE_COUNT, count_free_messages());
+}
+END_TEST
+
+START_TEST(should_not_match_other_topics)
+{
+    init_broker();
+    connect_session(0);
+    connect_session(1);
+
+    FEED(1, "\x82\x08\x00\x01\x00\x03" "a/+\x00");
+    FEED(1, "\x82\x06\x00\x02\x00\x01" "#\x00");
+    run(1);
+    ck_assert(WRITTEN(1, "\x90\x03\x00\x01\x00" "\x90\x03\x00\x02\x00"));
+
+    /* wildcards in the first level don't match topics starting with '$' */
+    FEED(0, "\x30\x08\x00\x05" "$SYS/" "x");
+    FEED(0, "\x30\x08\x00\x05" "a/b/c" "x");
+    run(0);
+    run(1);
+
+    ck_assert(WRITTEN(1, "\x30\x08\x00\x05" "a/b/c" "x"));
+}
+END_TEST
+
+START_TEST(should_deliver_once_with_overlapping_subscriptions)
+{
+    init_broker();
+    connect_session(0);
+
+    FEED(0, "\x82\x0c\x00\x01\x00\x03" "a/b\x00\x00\x01" "#\x00");
+    run(0);
+    ck_assert(WRITTEN(0, "\x90\x04\x00\x01\x00\x00"));
+
+    FEED(0, "\x30\x06\x00\x03" "a/b" "x");
+    run(0);
+
+    ck_assert(WRITTEN(0, "\x30\x06\x00\x03" "a/b" "x"));
+}
+END_TEST
+
+START_TEST(should_match_parent_of_multi_level_wildcard)
+{
+    init_broker();
+    connect_session(0);
+
+    FEED(0, "\x82\x08\x00\x01\x00\x03" "a/#\x00");
+    run(0);
+    ck_assert(WRITTEN(0, "\x90\x03\x00\x01\x00"));
+
+    FEED(0, "\x30\x04\x00\x01" "a" "x");
+    run(0);
+
+    ck_assert(WRITTEN(0, "\x30\x04\x00\x01" "a" "x"));
+}
+END_TEST
+
+START_TEST(should_fan_out_qos_1_publish)
+{
+    init_broker();
+    connect_session(0);
+    connect_session(1);
+
+    FEED(1, "\x82\x08\x00\x01\x00\x03" "a/b\x01");
+    run(1);
+    ck_assert(WRITTEN(1, "\x90\x03\x00\x01\x01"));
+
+    FEED(0, "\x32\x09\x00\x03" "a/b" "\x00\x07" "hi");
+    run(0);
+    ck_assert(WRITTEN(0, "\x40\x02\x00\x07"));
+
+    run(1);
+    ck_assert(WRITTEN(1, "\x32\x09\x00\x03" "a/b" "\x00\x01" "hi"));
+    ck_assert_uint_eq(MESSAGE_COUNT - 1, count_free_messages());
+
+    FEED(1, "\x40\x02\x00\x01");
+    run(1);
+    ck_assert_uint_eq(MESSAGE_COUNT, count_free_messages());
+}
+END_TEST
+
+START_TEST(should_downgrade_qos_to_subscription)
+{
+    init_broker();
+    connect_session(0);
+    connect_session(1);
+
+    FEED(1, "\x82\x08\x00\x01\x00\x03" "a/b\x00");
+    run(1);
+    ck_assert(WRITTEN(1, "\x90\x03\x00\x01\x00"));
+
+    FEED(0, "\x32\x09\x00\x03" "a/b" "\x00\x07" "hi");
+    run(0);
+    run(1);
+
+    ck_assert(WRITTEN(1, "\x30\x07\x00\x03" "a/b" "hi"));
+}
+END_TEST
+
+START_TEST(should_stop_delivering_after_unsubscribe)
+{
+    init_broker();
+    connect_session(0);
+    connect_session(1);
+
+    FEED(1, "\x82\x08\x00\x01\x00\x03" "a/b\x00");
+    run(1);
+    ck_assert(WRITTEN(1, "\x90\x03\x00\x01\x00"));
+    ck_assert_uint_eq(NODE_COUNT - 2, count_free_nodes());
+
+    FEED(1, "\xa2\x07\x00\x02\x00\x03" "a/b");
+    run(1);
+    ck_assert(WRITTEN(1, "\xb0\x02\x00\x02"));
+    ck_assert_uint_eq(NODE_COUNT, count_free_nodes());
+
+    FEED(0, "\x30\x06\x00\x03" "a/b" "x");
+    run(0);
+    run(1);
+
+    ck_assert(WRITTEN(1, ""));
+}
+END_TEST
+
+START_TEST(should_drop_large_message)
+{
+    init_broker();
+    connect_session(0);
+
+    FEED(0, "\x82\x06\x00\x01\x00\x01" "a\x00");
+    run(0);
+    ck_assert(WRITTEN(0, "\x90\x03\x00\x01\x00"));
+
+    FEED(0, "\x30\x25\x00\x01" "a" "0123456789012345678901234567890123");
+    run(0);
+
+    ck_assert(WRITTEN(0, ""));
+    ck_assert_uint_eq(1, lmqtt_broker_get_dropped(&broker));
+    ck_assert_uint_eq(MESSAGE_COUNT, count_free_messages());
+}
+END_TEST
+
+START_TEST(should_drop_message_when_no_delivery_is_available)
+{
+    int i;
+
+    init_broker();
+    connect_session(0);
+    connect_session(1);
+
+    FEED(1, "\x82\x06\x00\x01\x00\x01" "a\x01");
+    run(1);
+    ck_assert(WRITTEN(1, "\x90\x03\x00\x01\x01"));
+
+    /* four QoS 1 deliveries are kept waiting for PUBACK */
+    for (i = 0; i < 5; i++) {
+        FEED(0, "\x30\x04\x00\x01" "a" "x");
+        run(0);
+    }
+
+    ck_assert_uint_eq(1, lmqtt_broker_get_dropped(&broker));
+}
+END_TEST
+
+START_TEST(should_release_resources_on_finalize)
+{
+    init_broker();
+    connect_session(0);
+    connect_session(1);
+
+    FEED(1, "\x82\x08\x00\x01\x00\x03" "a/b\x01");
+    run(1);
+    ck_assert(WRITTEN(1, "\x90\x03\x00\x01\x01"));
+
+    FEED(0, "\x30\x06\x00\x03" "a/b" "x");
+    run(0);
+
+    lmqtt_broker_session_finalize(&sessions[1].session);
+
+    ck_assert_uint_eq(NODE_COUNT, count_free_nodes());
+    ck_assert_uint_eq(MESSAGE_COUNT, count_free_messages());
+    ck_assert_int_eq(LMQTT_ERROR_CLOSED, LMQTT_ERROR_NUM(run(1)));
+}
+END_TEST
+
+START_TEST(should_return_eof_after_disconnect)
+{
+    int res;
+
+    init_broker();
+    connect_session(0);
+
+    FEED(0, "\xe0\x00");
+    res = run(0);
+
+    ck_assert_int_eq(LMQTT_RES_EOF, res);
+}
+END_TEST
+
+START_TEST(should_return_eof_when_connection_is_closed)
+{
+    int res;
+
+    init_broker();
+    connect_session(0);
+
+    sessions[0].read_buf.len = sessions[0].read_buf.available_len;
+    res = run(0);
+
+    ck_assert_int_eq(LMQTT_RES_EOF_RD, res);
+}
+END_TEST
+
+START_TEST(should_answer_pingreq)
+{
+    init_broker();
+    connect_session(0);
+
+    FEED(0, "\xc0\x00");
+    run(0);
+
+    ck_assert(WRITTEN(0, "\xd0\x00"));
+}
+END_TEST
+
+START_TEST(should_time_out_after_one_and_a_half_keep_alive)
+{
+    int res;
+
+    init_broker();
+    connect_session(0);
+
+    test_time_set(24, 0);
+    res = run(0);
+    ck_assert_int_eq(LMQTT_RES_WOULD_BLOCK_CONN_RD, res);
+
+    test_time_set(25, 0);
+    res = run(0);
+    ck_assert_int_eq(LMQTT_ERROR_TIMEOUT, LMQTT_ERROR_NUM(res));
+}
+END_TEST
+
+START_TEST(should_validate_filters)
+{
+    lmqtt_string_t str;
+
+    memset(&str, 0, sizeof(str));
+
+#define VALIDATE(s) (str.buf = (s), str.len = sizeof(s) - 1, \
+    broker_validate_filter(&str))
+
+    ck_assert_int_eq(1, VALIDATE("a"));
+    ck_assert_int_eq(1, VALIDATE("a/b/c"));
+    ck_assert_int_eq(1, VALIDATE("/"));
+    ck_assert_int_eq(1, VALIDATE("+/+"));
+    ck_assert_int_eq(1, VALIDATE("a/+/c"));
+    ck_assert_int_eq(1, VALIDATE("#"));
+    ck_assert_int_eq(1, VALIDATE("a/#"));
+    ck_assert_int_eq(0, VALIDATE(""));
+    ck_assert_int_eq(0, VALIDATE("a+"));
+    ck_assert_int_eq(0, VALIDATE("a/#/c"));
+    ck_assert_int_eq(0, VALIDATE("a#"));
+    ck_assert_int_eq(0, VALIDATE("a/0123456789012345678901234567890123"));
+
+#undef VALIDATE
+}
+END_TEST
+
+START_TCASE("Broker")
+{
+    ADD_TEST(should_send_connack);
+    ADD_TEST(should_fail_subscribe_before_connect);
+    ADD_TEST(should_fail_second_connect);
+    ADD_TEST(should_send_suback_with_granted_qos);
+    ADD_TEST(should_reject_invalid_filters);
+    ADD_TEST(should_send_pipelined_subacks);
+    ADD_TEST(should_fan_out_qos_0_publish);
+    ADD_TEST(should_not_match_other_topics);
+    ADD_TEST(should_deliver_once_with_overlapping_subscriptions);
+    ADD_TEST(should_match_parent_of_multi_level_wildcard);
+    ADD_TEST(should_fan_out_qos_1_publish);
+    ADD_TEST(should_downgrade_qos_to_subscription);
+    ADD_TEST(should_stop_delivering_after_unsubscribe);
+    ADD_TEST(should_drop_large_message);
+    ADD_TEST(should_drop_message_when_no_delivery_is_available);
+    ADD_TEST(should_release_resources_on_finalize);
+    ADD_TEST(should_return_eof_after_disconnect);
+    ADD_TEST(should_return_eof_when_connection_is_closed);
+    ADD_TEST(should_answer_pingreq);
+    ADD_TEST(should_time_out_after_one_and_a_half_keep_alive);
+    ADD_TEST(should_validate_filters);
+}
+END_TCASE
@@ -24,6 +24,8 @@ static test_buffer_t test_dst;
 static unsigned char rx_buffer[RX_BUFFER_SIZE];
 static unsigned char tx_buffer[TX_BUFFER_SIZE];
 static lmqtt_store_entry_t entries[ENTRY_COUNT];
+static unsigned char pool_memory[2 * TX_BUFFER_SIZE];
+static lmqtt_buffer_pool_t pool;
 
 lmqtt_io_result_t lmqtt_rx_buffer_decode_mock(lmqtt_rx_buffer_t *state,
     unsigned char *buf, size_t buf_len, size_t *bytes_read)
@@ -111,6 +113,15 @@ static void prepare_write()
     client.write_buf_capacity = TX_BUFFER_SIZE;
 }
 
+static void prepare_write_pooled(size_t pool_size)
+{
+    prepare_write();
+
+    lmqtt_buffer_pool_initialize(&pool, pool_memory, pool_size,
+        TX_BUFFER_SIZE);
+    lmqtt_client_set_buffer_pool(&client, &pool);
+}
+
 START_TEST(should_process_input_without_data)
 {
     lmqtt_io_status_t res;
@@ -547,6 +558,87 @@ START_TEST(should_set_error_if_encode_fails)
 }
 END_TEST
 
+START_TEST(should_initialize_buffer_pool)
+{
+    void *first, *second;
+
+    lmqtt_buffer_pool_initialize(&pool, pool_memory, sizeof(pool_memory) - 1,
+        TX_BUFFER_SIZE / 2);
+    ck_assert_uint_eq(3, pool.available);
+
+    first = lmqtt_buffer_pool_get(&pool);
+    second = lmqtt_buffer_pool_get(&pool);
+    ck_assert(first != NULL);
+    ck_assert(second != NULL);
+    ck_assert(first != second);
+    ck_assert(lmqtt_buffer_pool_get(&pool) != NULL);
+    ck_assert_ptr_eq(NULL, lmqtt_buffer_pool_get(&pool));
+
+    lmqtt_buffer_pool_put(&pool, first);
+    ck_assert_ptr_eq(first, lmqtt_buffer_pool_get(&pool));
+}
+END_TEST
+
+START_TEST(should_return_pooled_buffer_after_write_completes)
+{
+    lmqtt_io_status_t res;
+
+    prepare_write_pooled(sizeof(pool_memory));
+
+    test_src.len = 5;
+    test_src.available_len = test_src.len;
+    test_dst.available_len = test_dst.len;
+
+    res = client_process_output(&client);
+    ck_assert_int_eq(LMQTT_IO_STATUS_READY, res);
+
+    ck_assert_int_eq(5, test_dst.pos);
+    ck_assert_ptr_eq(NULL, client.write_buf);
+    ck_assert_uint_eq(2, pool.available);
+}
+END_TEST
+
+START_TEST(should_keep_pooled_buffer_while_write_blocks)
+{
+    lmqtt_io_status_t res;
+
+    prepare_write_pooled(sizeof(pool_memory));
+
+    test_src.available_len = 20;
+    test_dst.available_len = 2;
+
+    res = client_process_output(&client);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, res);
+    ck_assert(client.write_buf != NULL);
+    ck_assert_uint_eq(1, pool.available);
+
+    test_dst.available_len = test_dst.len;
+    test_src.len = 20;
+
+    res = client_process_output(&client);
+    ck_assert_int_eq(LMQTT_IO_STATUS_READY, res);
+    ck_assert_int_eq(20, test_dst.pos);
+    ck_assert_ptr_eq(NULL, client.write_buf);
+    ck_assert_uint_eq(2, pool.available);
+}
+END_TEST
+
+START_TEST(should_block_if_buffer_pool_is_empty)
+{
+    lmqtt_io_status_t res;
+
+    prepare_write_pooled(0);
+
+    test_src.available_len = 20;
+    test_dst.available_len = test_dst.len;
+
+    res = client_process_output(&client);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_POOL, res);
+    ck_assert_int_eq(0, test_src.pos);
+    ck_assert_int_eq(0, test_dst.pos);
+}
+END_TEST
+
 START_TCASE("Client buffers")
 {
     lmqtt_rx_buffer_decode = &lmqtt_rx_buffer_decode_mock;
@@ -575,5 +667,9 @@ START_TCASE("Client buffers")
     ADD_TEST(should_set_error_if_write_fails);
     ADD_TEST(should_set_error_if_decode_fails);
     ADD_TEST(should_set_error_if_encode_fails);
+    ADD_TEST(should_initialize_buffer_pool);
+    ADD_TEST(should_return_pooled_buffer_after_write_completes);
+    ADD_TEST(should_keep_pooled_buffer_while_write_blocks);
+    ADD_TEST(should_block_if_buffer_pool_is_empty);
 }
 END_TCASE
@@ -43,6 +43,13 @@ static int on_subscribe(void *data, lmqtt_subscribe_t *subscribe, int succeeded)
     return test_cb_result_set(data, subscribe, succeeded);
 }
 
+static int on_subscribe_count(void *data, lmqtt_subscribe_t *subscribe,
+    int succeeded)
+{
+    *(int *) data += 1;
+    return 1;
+}
+
 static int on_unsubscribe(void *data, lmqtt_subscribe_t *subscribe, int succeeded)
 {
     return test_cb_result_set(data, subscribe, succeeded);
@@ -232,6 +239,12 @@ static void check_connect_and_receive_message(lmqtt_client_t *client,
     client_process_input(client);
 }
 
+static void on_shared_payload_release(void *data,
+    lmqtt_shared_payload_t *shared)
+{
+    *(int *) data += 1;
+}
+
 START_TEST(should_initialize_client)
 {
     lmqtt_client_t client;
@@ -675,6 +688,202 @@ START_TEST(should_publish_with_qos_2)
 }
 END_TEST
 
+START_TEST(should_hold_publish_until_inflight_window_opens)
+{
+    lmqtt_client_t client;
+    lmqtt_publish_t second;
+
+    do_init(&client, 3);
+    lmqtt_client_set_inflight_window(&client, 1);
+    ck_assert_int_eq(1, do_connect_connack_process(&client, 5));
+
+    ck_assert_int_eq(1, do_publish(&client, 1));
+    memcpy(&second, &publish, sizeof(second));
+    ck_assert_int_eq(1, lmqtt_client_publish(&client, &second));
+
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(TEST_PUBLISH, test_socket_shift(&ts));
+    ck_assert_int_eq(-1, test_socket_shift(&ts));
+
+    test_socket_append_param(&ts, TEST_PUBACK, 0);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, client_process_input(&client));
+
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(TEST_PUBLISH, test_socket_shift(&ts));
+}
+END_TEST
+
+START_TEST(should_conflate_unsent_publish_with_same_topic)
+{
+    lmqtt_client_t client;
+    test_cb_result_t cb_result = { 0, 0, 1 };
+    lmqtt_publish_t second;
+    lmqtt_store_value_t value;
+    int kind;
+
+    ck_assert_int_eq(1, do_init_connect_connack_process(&client, 5, 3));
+    lmqtt_client_set_on_publish(&client, on_publish, &cb_result);
+
+    ck_assert_int_eq(1, do_publish(&client, 1));
+    publish.conflate = 1;
+    memcpy(&second, &publish, sizeof(second));
+    ck_assert_int_eq(1, lmqtt_client_publish(&client, &second));
+
+    ck_assert_int_eq(1, lmqtt_store_count(&client.main_store));
+    lmqtt_store_get_at(&client.main_store, 0, &kind, &value);
+    ck_assert_ptr_eq(&second, value.value);
+
+    ck_assert_ptr_eq(&publish, cb_result.data);
+    ck_assert_int_eq(0, cb_result.succeeded);
+    ck_assert_int_eq(LMQTT_PUBLISH_STATUS_CONFLATED, publish.response.status);
+    ck_assert_int_eq(LMQTT_PUBLISH_STATUS_NONE, second.response.status);
+}
+END_TEST
+
+START_TEST(should_not_conflate_publish_without_flag)
+{
+    lmqtt_client_t client;
+    lmqtt_publish_t second;
+
+    ck_assert_int_eq(1, do_init_connect_connack_process(&client, 5, 3));
+
+    ck_assert_int_eq(1, do_publish(&client, 1));
+    memcpy(&second, &publish, sizeof(second));
+    second.conflate = 1;
+    ck_assert_int_eq(1, lmqtt_client_publish(&client, &second));
+
+    ck_assert_int_eq(2, lmqtt_store_count(&client.main_store));
+}
+END_TEST
+
+START_TEST(should_not_conflate_sent_publish)
+{
+    lmqtt_client_t client;
+    lmqtt_publish_t second;
+
+    ck_assert_int_eq(1, do_init_connect_connack_process(&client, 5, 3));
+
+    ck_assert_int_eq(1, do_publish(&client, 1));
+    publish.conflate = 1;
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(TEST_PUBLISH, test_socket_shift(&ts));
+
+    memcpy(&second, &publish, sizeof(second));
+    ck_assert_int_eq(1, lmqtt_client_publish(&client, &second));
+
+    ck_assert_int_eq(2, lmqtt_store_count(&client.main_store));
+}
+END_TEST
+
+START_TEST(should_not_conflate_publish_with_other_topic)
+{
+    lmqtt_client_t client;
+    lmqtt_publish_t second;
+
+    ck_assert_int_eq(1, do_init_connect_connack_process(&client, 5, 3));
+
+    ck_assert_int_eq(1, do_publish(&client, 0));
+    publish.conflate = 1;
+    memcpy(&second, &publish, sizeof(second));
+    second.topic.buf = "other";
+    ck_assert_int_eq(1, lmqtt_client_publish(&client, &second));
+
+    ck_assert_int_eq(2, lmqtt_store_count(&client.main_store));
+}
+END_TEST
+
+START_TEST(should_drop_expired_publish)
+{
+    lmqtt_client_t client;
+    test_cb_result_t cb_result = { 0, 0, 1 };
+
+    test_time_set(10, 0);
+    ck_assert_int_eq(1, do_init_connect_connack_process(&client, 5, 3));
+    lmqtt_client_set_on_publish(&client, on_publish, &cb_result);
+
+    memset(&publish, 0, sizeof(publish));
+    publish.topic.buf = "topic";
+    publish.topic.len = strlen(publish.topic.buf);
+    publish.expiry = 1;
+    ck_assert_int_eq(1, lmqtt_client_publish(&client, &publish));
+
+    test_time_set(11, 0);
+    client_process_output(&client);
+    ck_assert_int_eq(-1, test_socket_shift(&ts));
+
+    ck_assert_ptr_eq(&publish, cb_result.data);
+    ck_assert_int_eq(0, cb_result.succeeded);
+    ck_assert_int_eq(LMQTT_PUBLISH_STATUS_EXPIRED, publish.response.status);
+}
+END_TEST
+
+START_TEST(should_publish_with_qos_0_ring)
+{
+    lmqtt_client_t client;
+    test_cb_result_t cb_result = { 0, 0, 1 };
+    lmqtt_publish_t *items[1];
+
+    do_init(&client, 3);
+    lmqtt_client_set_qos_0_ring(&client, items, sizeof(items));
+    ck_assert_int_eq(1, do_connect_connack_process(&client, 5));
+    lmqtt_client_set_on_publish(&client, on_publish, &cb_result);
+
+    ck_assert_int_eq(1, do_publish(&client, 0));
+    ck_assert_int_eq(0, lmqtt_store_count(&client.main_store));
+    ck_assert_int_eq(0, lmqtt_client_publish(&client, &publish));
+
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(TEST_PUBLISH, test_socket_shift(&ts));
+
+    ck_assert_ptr_eq(&publish, cb_result.data);
+    ck_assert_int_eq(1, cb_result.succeeded);
+}
+END_TEST
+
+START_TEST(should_conflate_publish_in_qos_0_ring)
+{
+    lmqtt_client_t client;
+    test_cb_result_t cb_result = { 0, 0, 1 };
+    lmqtt_publish_t *items[4];
+    lmqtt_publish_t second;
+
+    do_init(&client, 3);
+    lmqtt_client_set_qos_0_ring(&client, items, sizeof(items));
+    ck_assert_int_eq(1, do_connect_connack_process(&client, 5));
+    lmqtt_client_set_on_publish(&client, on_publish, &cb_result);
+
+    ck_assert_int_eq(1, do_publish(&client, 0));
+    publish.conflate = 1;
+    memcpy(&second, &publish, sizeof(second));
+    ck_assert_int_eq(1, lmqtt_client_publish(&client, &second));
+
+    ck_assert_uint_eq(1, client.qos0_ring.count);
+    ck_assert_ptr_eq(&publish, cb_result.data);
+    ck_assert_int_eq(0, cb_result.succeeded);
+    ck_assert_int_eq(LMQTT_PUBLISH_STATUS_CONFLATED, publish.response.status);
+}
+END_TEST
+
+START_TEST(should_flush_qos_0_ring_after_close)
+{
+    lmqtt_client_t client;
+    test_cb_result_t cb_result = { 0, 0, 1 };
+    lmqtt_publish_t *items[1];
+
+    do_init(&client, 3);
+    lmqtt_client_set_qos_0_ring(&client, items, sizeof(items));
+    ck_assert_int_eq(1, do_connect_connack_process(&client, 5));
+    lmqtt_client_set_on_publish(&client, on_publish, &cb_result);
+
+    ck_assert_int_eq(1, do_publish(&client, 0));
+    lmqtt_client_finalize(&client);
+
+    ck_assert_uint_eq(0, client.qos0_ring.count);
+    ck_assert_ptr_eq(&publish, cb_result.data);
+    ck_assert_int_eq(0, cb_result.succeeded);
+}
+END_TEST
+
 START_TEST(should_not_publish_invalid_packet)
 {
     lmqtt_client_t client;
@@ -1251,123 +1460,894 @@ START_TEST(should_reset_after_eof)
 }
 END_TEST
 
-START_TEST(should_not_reset_finalized_client)
-{
-    lmqtt_client_t client;
-
-    do_init_connect_process(&client, 5, 3);
-    lmqtt_client_finalize(&client);
+static int reconnect_attempts;
+static long reconnect_secs;
 
-    lmqtt_client_reset(&client);
-    ck_assert_int_eq(LMQTT_ERROR_CLOSED, client.error);
-    ck_assert_int_eq(1, client.closed);
+static void on_reconnect(void *data, unsigned int attempts, long secs,
+    long nsecs)
+{
+    reconnect_attempts = attempts;
+    reconnect_secs = secs;
 }
-END_TEST
 
-START_TEST(should_wait_connack_to_resend_packets_from_previous_connection)
+START_TEST(should_not_reconnect_without_lost_connection)
 {
     lmqtt_client_t client;
 
-    do_init_connect_connack_process(&client, 5, 3);
-    ck_assert(do_publish(&client, 1));
-    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
-    ck_assert_int_eq(TEST_PUBLISH, test_socket_shift(&ts));
-
-    ck_assert(close_read_buf(&client));
-    ck_assert(do_connect_process(&client, 5));
-    ck_assert_int_eq(-1, test_socket_shift(&ts));
+    do_init(&client, 3);
+    lmqtt_client_set_reconnect(&client, 2, 8, 1);
+    ck_assert_int_eq(1, do_connect_connack_process(&client, 5));
 
-    test_socket_append(&ts, TEST_CONNACK_SUCCESS);
-    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, client_process_input(&client));
-    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
-    ck_assert_int_eq(TEST_PUBLISH, test_socket_shift(&ts));
-    ck_assert_int_eq(-1, test_socket_shift(&ts));
+    ck_assert_int_eq(0, lmqtt_client_reconnect(&client));
 }
 END_TEST
 
-START_TEST(should_wait_connack_to_send_unsent_packets_from_previous_connection)
+START_TEST(should_reconnect_after_backoff_delay)
 {
     lmqtt_client_t client;
+    long secs, nsecs;
+
+    test_time_set(10, 0);
+    do_init(&client, 3);
+    lmqtt_client_set_reconnect(&client, 2, 8, 1);
+    ck_assert_int_eq(1, do_connect_connack_process(&client, 5));
 
-    do_init_connect_connack_process(&client, 5, 3);
-    ck_assert(do_publish(&client, 1));
     ck_assert(close_read_buf(&client));
-    ck_assert(do_connect_process(&client, 5));
-    ck_assert_int_eq(-1, test_socket_shift(&ts));
+    ck_assert_int_eq(0, lmqtt_client_reconnect(&client));
 
-    test_socket_append(&ts, TEST_CONNACK_SUCCESS);
-    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, client_process_input(&client));
+    /* between half and all of the minimum delay */
+    ck_assert_int_eq(1, lmqtt_client_get_timeout(&client, &secs, &nsecs));
+    ck_assert(secs >= 1 && secs <= 2);
+    ck_assert(client.reconnect.delay >= 1000 && client.reconnect.delay <= 2000);
+
+    test_time_set(12, 0);
+    ck_assert_int_eq(1, lmqtt_client_reconnect(&client));
+    ck_assert_int_eq(0, lmqtt_client_reconnect(&client));
     ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
-    ck_assert_int_eq(TEST_PUBLISH, test_socket_shift(&ts));
-    ck_assert_int_eq(-1, test_socket_shift(&ts));
+    ck_assert_int_eq(TEST_CONNECT, test_socket_shift(&ts));
 }
 END_TEST
 
-START_TEST(should_not_resend_connect_from_previous_connection)
+START_TEST(should_double_reconnect_delay_after_failed_attempt)
 {
     lmqtt_client_t client;
-    test_cb_result_t cb_result = { 0, -1, 1 };
-    lmqtt_connect_t connect_2;
+    lmqtt_string_t *str_rd, *str_wr;
 
+    test_time_set(10, 0);
     do_init(&client, 3);
-
-    memset(&connect_2, 0, sizeof(connect_2));
-    connect_2.keep_alive = 5;
-    connect_2.clean_session = 1;
-
-    lmqtt_client_set_on_connect(&client, &on_connect, &cb_result);
-    lmqtt_client_connect(&client, &connect_2);
+    lmqtt_client_set_reconnect(&client, 2, 3, 1);
+    ck_assert_int_eq(1, do_connect_connack_process(&client, 5));
 
     ck_assert(close_read_buf(&client));
-    ck_assert(do_connect_process(&client, 5));
+    test_time_set(12, 0);
+    ck_assert_int_eq(1, lmqtt_client_reconnect(&client));
 
-    ck_assert_int_eq(-1, test_socket_shift(&ts));
-    ck_assert_ptr_eq(&connect_2, cb_result.data);
-    ck_assert_int_eq(0, cb_result.succeeded);
+    /* connection timeout before CONNACK */
+    test_time_set(16, 0);
+    lmqtt_client_run_once(&client, &str_rd, &str_wr);
+    ck_assert_int_eq(1, client.reconnect.pending);
+    ck_assert_uint_eq(2, client.reconnect.attempts);
+    /* capped by the maximum delay */
+    ck_assert(client.reconnect.delay >= 1500 && client.reconnect.delay <= 3000);
 }
 END_TEST
 
-START_TEST(should_not_resend_packets_if_previous_connection_had_clean_session_set)
+START_TEST(should_not_reconnect_after_disconnect)
 {
-    check_resend_packets_with_clean_session(1, 0);
-}
-END_TEST
+    lmqtt_client_t client;
 
-START_TEST(should_not_resend_packets_if_new_connection_has_clean_session_set)
-{
-    check_resend_packets_with_clean_session(0, 1);
+    do_init(&client, 3);
+    lmqtt_client_set_reconnect(&client, 2, 8, 1);
+    ck_assert_int_eq(1, do_connect_connack_process(&client, 5));
+
+    ck_assert_int_eq(1, lmqtt_client_disconnect(&client));
+    ck_assert_int_eq(LMQTT_IO_STATUS_READY, client_process_output(&client));
+    ck_assert_int_eq(0, client.reconnect.pending);
 }
 END_TEST
 
-START_TEST(should_preserve_non_clean_session_ids_after_reconnect)
+START_TEST(should_resend_publish_with_dup_flag_after_reconnect)
 {
     lmqtt_client_t client;
 
+    test_time_set(10, 0);
     do_init(&client, 3);
+    lmqtt_client_set_reconnect(&client, 2, 8, 1);
+    lmqtt_client_set_on_reconnect(&client, on_reconnect, NULL);
+    ck_assert_int_eq(1, do_connect_connack_process(&client, 5));
 
-    check_connect_and_receive_message(&client, 0, 0x0304);
-    ck_assert_str_eq("topic: X, payload: X", message_received);
+    ck_assert_int_eq(1, do_publish(&client, 1));
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(TEST_PUBLISH, test_socket_shift(&ts));
 
-    close_read_buf(&client);
+    ck_assert(close_read_buf(&client));
+    test_time_set(13, 0);
+    ck_assert_int_eq(1, lmqtt_client_reconnect(&client));
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(TEST_CONNECT, test_socket_shift(&ts));
 
-    check_connect_and_receive_message(&client, 0, 0x0304);
-    ck_assert_str_eq("", message_received);
+    reconnect_attempts = 0;
+    test_socket_append(&ts, TEST_CONNACK_SUCCESS);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, client_process_input(&client));
+    ck_assert_int_eq(1, reconnect_attempts);
+    ck_assert_int_eq(3, reconnect_secs);
+
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_uint_eq(0x3a, ts.write_buf.buf[ts.test_pos_write]);
+    ck_assert_int_eq(TEST_PUBLISH, test_socket_shift(&ts));
 }
 END_TEST
 
-START_TEST(should_not_preserve_clean_session_ids_after_reconnect)
+START_TEST(should_send_pingreq_early_with_keep_alive_jitter)
 {
     lmqtt_client_t client;
+    long secs, nsecs;
 
+    test_time_set(10, 0);
     do_init(&client, 3);
+    lmqtt_client_set_keep_alive_jitter(&client, 50);
+    ck_assert_int_eq(1, do_connect_connack_process(&client, 10));
 
-    check_connect_and_receive_message(&client, 1, 0x0304);
-    ck_assert_str_eq("topic: X, payload: X", message_received);
-
-    close_read_buf(&client);
+    ck_assert(client.main_store.keep_alive_offset <= 5000);
+    ck_assert_int_eq(1, lmqtt_client_get_timeout(&client, &secs, &nsecs));
+    ck_assert(secs * 1000 + nsecs / 1000000 ==
+        10000 - client.main_store.keep_alive_offset);
+}
+END_TEST
+
+START_TEST(should_limit_reconnect_rate)
+{
+    lmqtt_client_t client;
+    lmqtt_rate_limiter_t limiter;
+    long secs, nsecs;
+
+    test_time_set(10, 0);
+    lmqtt_rate_limiter_initialize(&limiter, test_time_get, 1, 1);
+    do_init(&client, 3);
+    lmqtt_client_set_reconnect(&client, 1, 1, 1);
+    lmqtt_client_set_connect_limiter(&client, &limiter);
+    ck_assert_int_eq(1, do_connect_connack_process(&client, 5));
+    ck_assert(close_read_buf(&client));
+
+    /* another client took the token */
+    test_time_set(10, 500e6);
+    ck_assert_int_eq(1, lmqtt_rate_limiter_acquire(&limiter, &secs, &nsecs));
+
+    /* the backoff delay is over, but the limiter is not refilled */
+    test_time_set(11, 0);
+    ck_assert_int_eq(0, lmqtt_client_reconnect(&client));
+    ck_assert_int_eq(1, lmqtt_client_get_timeout(&client, &secs, &nsecs));
+    ck_assert_int_eq(0, secs);
+    ck_assert_int_eq(500e6, nsecs);
+
+    test_time_set(11, 500e6);
+    ck_assert_int_eq(1, lmqtt_client_reconnect(&client));
+}
+END_TEST
+
+START_TEST(should_not_reset_finalized_client)
+{
+    lmqtt_client_t client;
+
+    do_init_connect_process(&client, 5, 3);
+    lmqtt_client_finalize(&client);
+
+    lmqtt_client_reset(&client);
+    ck_assert_int_eq(LMQTT_ERROR_CLOSED, client.error);
+    ck_assert_int_eq(1, client.closed);
+}
+END_TEST
+
+START_TEST(should_wait_connack_to_resend_packets_from_previous_connection)
+{
+    lmqtt_client_t client;
+
+    do_init_connect_connack_process(&client, 5, 3);
+    ck_assert(do_publish(&client, 1));
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(TEST_PUBLISH, test_socket_shift(&ts));
+
+    ck_assert(close_read_buf(&client));
+    ck_assert(do_connect_process(&client, 5));
+    ck_assert_int_eq(-1, test_socket_shift(&ts));
+
+    test_socket_append(&ts, TEST_CONNACK_SUCCESS);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, client_process_input(&client));
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(TEST_PUBLISH, test_socket_shift(&ts));
+    ck_assert_int_eq(-1, test_socket_shift(&ts));
+}
+END_TEST
+
+START_TEST(should_wait_connack_to_send_unsent_packets_from_previous_connection)
+{
+    lmqtt_client_t client;
+
+    do_init_connect_connack_process(&client, 5, 3);
+    ck_assert(do_publish(&client, 1));
+    ck_assert(close_read_buf(&client));
+    ck_assert(do_connect_process(&client, 5));
+    ck_assert_int_eq(-1, test_socket_shift(&ts));
+
+    test_socket_append(&ts, TEST_CONNACK_SUCCESS);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, client_process_input(&client));
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(TEST_PUBLISH, test_socket_shift(&ts));
+    ck_assert_int_eq(-1, test_socket_shift(&ts));
+}
+END_TEST
+
+START_TEST(should_not_resend_connect_from_previous_connection)
+{
+    lmqtt_client_t client;
+    test_cb_result_t cb_result = { 0, -1, 1 };
+    lmqtt_connect_t connect_2;
+
+    do_init(&client, 3);
+
+    memset(&connect_2, 0, sizeof(connect_2));
+    connect_2.keep_alive = 5;
+    connect_2.clean_session = 1;
+
+    lmqtt_client_set_on_connect(&client, &on_connect, &cb_result);
+    lmqtt_client_connect(&client, &connect_2);
+
+    ck_assert(close_read_buf(&client));
+    ck_assert(do_connect_process(&client, 5));
+
+    ck_assert_int_eq(-1, test_socket_shift(&ts));
+    ck_assert_ptr_eq(&connect_2, cb_result.data);
+    ck_assert_int_eq(0, cb_result.succeeded);
+}
+END_TEST
+
+START_TEST(should_not_resend_packets_if_previous_connection_had_clean_session_set)
+{
+    check_resend_packets_with_clean_session(1, 0);
+}
+END_TEST
+
+START_TEST(should_not_resend_packets_if_new_connection_has_clean_session_set)
+{
+    check_resend_packets_with_clean_session(0, 1);
+}
+END_TEST
+
+START_TEST(should_preserve_non_clean_session_ids_after_reconnect)
+{
+    lmqtt_client_t client;
+
+    do_init(&client, 3);
+
+    check_connect_and_receive_message(&client, 0, 0x0304);
+    ck_assert_str_eq("topic: X, payload: X", message_received);
+
+    close_read_buf(&client);
+
+    check_connect_and_receive_message(&client, 0, 0x0304);
+    ck_assert_str_eq("", message_received);
+}
+END_TEST
+
+START_TEST(should_not_preserve_clean_session_ids_after_reconnect)
+{
+    lmqtt_client_t client;
+
+    do_init(&client, 3);
+
+    check_connect_and_receive_message(&client, 1, 0x0304);
+    ck_assert_str_eq("topic: X, payload: X", message_received);
+
+    close_read_buf(&client);
+
+    check_connect_and_receive_message(&client, 0, 0x0304);
+    ck_assert_str_eq("topic: X, payload: X", message_received);
+}
+END_TEST
+
+START_TEST(should_send_ack_from_ack_queue)
+{
+    lmqtt_client_t client;
+    lmqtt_ack_t items[2];
+    unsigned char *written;
+
+    do_init(&client, 3);
+    lmqtt_client_set_ack_queue(&client, items, sizeof(items));
+
+    check_connect_and_receive_message(&client, 0, 0x0304);
+    ck_assert_str_eq("topic: X, payload: X", message_received);
+    ck_assert_uint_eq(1, client.ack_queue.count);
+    ck_assert_int_eq(0, lmqtt_store_count(&client.main_store));
+
+    client_process_output(&client);
+
+    written = &ts.write_buf.buf[ts.test_pos_write];
+    ck_assert_uint_eq(4, ts.write_buf.pos - ts.test_pos_write);
+    ck_assert_int_eq(0, memcmp("\x50\x02\x03\x04", written, 4));
+    ck_assert_uint_eq(0, client.ack_queue.count);
+}
+END_TEST
+
+START_TEST(should_receive_message_with_slab)
+{
+    lmqtt_client_t client;
+    lmqtt_buffer_pool_t classes[2];
+    lmqtt_message_slab_t slab;
+    void *small[2];
+    void *large[1];
+
+    do_init(&client, 3);
+    lmqtt_buffer_pool_initialize(&classes[0], small, sizeof(small),
+        sizeof(small[0]));
+    lmqtt_buffer_pool_initialize(&classes[1], large, sizeof(large),
+        sizeof(large[0]));
+    lmqtt_message_slab_initialize(&slab, classes, 2);
+    lmqtt_message_slab_set_callbacks(&slab, &client.message_callbacks);
+
+    check_connect_and_receive_message(&client, 0, 0x0304);
 
-    check_connect_and_receive_message(&client, 0, 0x0304);
     ck_assert_str_eq("topic: X, payload: X", message_received);
+    ck_assert_uint_eq(2, slab.hits);
+    ck_assert_uint_eq(0, slab.misses);
+    ck_assert_uint_eq(2, classes[0].available);
+    ck_assert_uint_eq(1, classes[1].available);
+}
+END_TEST
+
+START_TEST(should_ignore_message_which_does_not_fit_slab)
+{
+    lmqtt_client_t client;
+    lmqtt_buffer_pool_t classes[1];
+    lmqtt_message_slab_t slab;
+    void *small[1];
+
+    do_init(&client, 3);
+    lmqtt_buffer_pool_initialize(&classes[0], small, sizeof(small),
+        sizeof(small[0]));
+    lmqtt_message_slab_initialize(&slab, classes, 1);
+    lmqtt_message_slab_set_callbacks(&slab, &client.message_callbacks);
+
+    do_connect(&client, 5, 0);
+    client_process_output(&client);
+    test_socket_shift(&ts);
+
+    test_socket_append(&ts, TEST_CONNACK_SUCCESS);
+    test_socket_append(&ts, TEST_PUBLISH_QOS_0);
+    memset(message_received, 0, sizeof(message_received));
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, client_process_input(&client));
+
+    ck_assert_str_eq("", message_received);
+    ck_assert_uint_eq(1, slab.hits);
+    ck_assert_uint_eq(1, slab.misses);
+    ck_assert_uint_eq(1, classes[0].available);
+}
+END_TEST
+
+START_TEST(should_not_acknowledge_message_which_does_not_fit_slab)
+{
+    lmqtt_client_t client;
+    lmqtt_buffer_pool_t classes[1];
+    lmqtt_message_slab_t slab;
+    void *small[1];
+
+    do_init(&client, 3);
+    lmqtt_buffer_pool_initialize(&classes[0], small, sizeof(small),
+        sizeof(small[0]));
+    lmqtt_message_slab_initialize(&slab, classes, 1);
+    lmqtt_message_slab_set_callbacks(&slab, &client.message_callbacks);
+
+    do_connect(&client, 5, 0);
+    client_process_output(&client);
+    test_socket_shift(&ts);
+
+    /* the slab is exhausted */
+    lmqtt_buffer_pool_get(&classes[0]);
+
+    test_socket_append(&ts, TEST_CONNACK_SUCCESS);
+    test_socket_append_param(&ts, TEST_PUBLISH_QOS_1, 0x0304);
+    memset(message_received, 0, sizeof(message_received));
+    ck_assert_int_eq(LMQTT_IO_STATUS_ERROR, client_process_input(&client));
+
+    ck_assert_str_eq("", message_received);
+    ck_assert_uint_eq(1, slab.misses);
+    ck_assert_int_eq(0, lmqtt_store_count(&client.main_store));
+
+    client_process_output(&client);
+    ck_assert_int_eq(-1, test_socket_shift(&ts));
+}
+END_TEST
+
+START_TEST(should_publish_copy_and_release_it_after_puback)
+{
+    lmqtt_client_t client;
+    test_cb_result_t cb_result = { 0, 0, 1 };
+    lmqtt_publish_t items[2];
+    char data[64];
+    lmqtt_publish_pool_t pool;
+    lmqtt_store_value_t value;
+    lmqtt_publish_t *copy;
+
+    ck_assert_int_eq(1, do_init_connect_connack_process(&client, 5, 3));
+    lmqtt_publish_pool_initialize(&pool, items, sizeof(items), data,
+        sizeof(data));
+    lmqtt_client_set_publish_pool(&client, &pool);
+    lmqtt_client_set_on_publish(&client, on_publish, &cb_result);
+    lmqtt_store_get_id(&client.main_store);
+
+    memset(&publish, 0, sizeof(publish));
+    publish.qos = 1;
+    publish.topic.buf = "topic";
+    publish.topic.len = strlen(publish.topic.buf);
+    publish.payload.buf = "payload";
+    publish.payload.len = strlen(publish.payload.buf);
+    publish.user_data = &publish;
+
+    ck_assert_int_eq(1, lmqtt_client_publish_copy(&client, &publish));
+    ck_assert_uint_eq(1, pool.free.available);
+
+    lmqtt_store_get_at(&client.main_store, 0, NULL, &value);
+    copy = value.value;
+    ck_assert(copy != &publish);
+    ck_assert_ptr_eq(&publish, copy->user_data);
+    ck_assert_int_eq(0, memcmp("topic", copy->topic.buf, 5));
+    ck_assert_int_eq(0, memcmp("payload", copy->payload.buf, 7));
+
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(TEST_PUBLISH, test_socket_shift(&ts));
+
+    test_socket_append_param(&ts, TEST_PUBACK, 1);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, client_process_input(&client));
+
+    ck_assert_ptr_eq(copy, cb_result.data);
+    ck_assert_int_eq(1, cb_result.succeeded);
+    ck_assert_uint_eq(2, pool.free.available);
+}
+END_TEST
+
+START_TEST(should_not_publish_copy_larger_than_pool_data)
+{
+    lmqtt_client_t client;
+    lmqtt_publish_t items[2];
+    char data[20];
+    lmqtt_publish_pool_t pool;
+
+    ck_assert_int_eq(1, do_init_connect_connack_process(&client, 5, 3));
+    lmqtt_publish_pool_initialize(&pool, items, sizeof(items), data,
+        sizeof(data));
+    lmqtt_client_set_publish_pool(&client, &pool);
+
+    memset(&publish, 0, sizeof(publish));
+    publish.topic.buf = "topic";
+    publish.topic.len = strlen(publish.topic.buf);
+    publish.payload.buf = "payload";
+    publish.payload.len = strlen(publish.payload.buf);
+
+    ck_assert_int_eq(0, lmqtt_client_publish_copy(&client, &publish));
+    ck_assert_uint_eq(2, pool.free.available);
+    ck_assert_int_eq(0, client.main_store.count);
+}
+END_TEST
+
+START_TEST(should_release_shared_payload_after_last_message)
+{
+    lmqtt_client_t client;
+    lmqtt_shared_payload_t shared;
+    lmqtt_publish_t publishes[2];
+    int released = 0;
+    int i;
+
+    ck_assert_int_eq(1, do_init_connect_connack_process(&client, 5, 3));
+    lmqtt_store_get_id(&client.main_store);
+
+    memset(&shared, 0, sizeof(shared));
+    shared.payload.buf = "payload";
+    shared.payload.len = strlen(shared.payload.buf);
+    shared.release = &on_shared_payload_release;
+    shared.release_data = &released;
+
+    for (i = 0; i < 2; i++) {
+        memset(&publishes[i], 0, sizeof(publishes[i]));
+        publishes[i].qos = 1;
+        publishes[i].topic.buf = i == 0 ? "a" : "b";
+        publishes[i].topic.len = 1;
+        lmqtt_publish_set_shared_payload(&publishes[i], &shared);
+        ck_assert_int_eq(1, lmqtt_client_publish(&client, &publishes[i]));
+    }
+    ck_assert_uint_eq(2, shared.references);
+
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(TEST_PUBLISH, test_socket_shift(&ts));
+    ck_assert_int_eq(TEST_PUBLISH, test_socket_shift(&ts));
+
+    test_socket_append_param(&ts, TEST_PUBACK, 1);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, client_process_input(&client));
+    ck_assert_uint_eq(1, shared.references);
+    ck_assert_int_eq(0, released);
+
+    test_socket_append_param(&ts, TEST_PUBACK, 2);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, client_process_input(&client));
+    ck_assert_uint_eq(0, shared.references);
+    ck_assert_int_eq(1, released);
+}
+END_TEST
+
+START_TEST(should_not_release_shared_payload_of_conflated_publish)
+{
+    lmqtt_client_t client;
+    lmqtt_shared_payload_t shared;
+    lmqtt_publish_t publishes[2];
+    int released = 0;
+    int i;
+
+    ck_assert_int_eq(1, do_init_connect_connack_process(&client, 5, 3));
+
+    memset(&shared, 0, sizeof(shared));
+    shared.payload.buf = "payload";
+    shared.payload.len = strlen(shared.payload.buf);
+    shared.release = &on_shared_payload_release;
+    shared.release_data = &released;
+
+    for (i = 0; i < 2; i++) {
+        memset(&publishes[i], 0, sizeof(publishes[i]));
+        publishes[i].qos = 1;
+        publishes[i].conflate = 1;
+        publishes[i].topic.buf = "topic";
+        publishes[i].topic.len = strlen(publishes[i].topic.buf);
+        lmqtt_publish_set_shared_payload(&publishes[i], &shared);
+        ck_assert_int_eq(1, lmqtt_client_publish(&client, &publishes[i]));
+    }
+
+    ck_assert_int_eq(LMQTT_PUBLISH_STATUS_CONFLATED,
+        publishes[0].response.status);
+    ck_assert_uint_eq(1, shared.references);
+    ck_assert_int_eq(0, released);
+}
+END_TEST
+
+START_TEST(should_not_publish_shared_payload_with_read_callback)
+{
+    lmqtt_client_t client;
+    lmqtt_shared_payload_t shared;
+
+    ck_assert_int_eq(1, do_init_connect_connack_process(&client, 5, 3));
+
+    memset(&shared, 0, sizeof(shared));
+    shared.payload.len = 1;
+    shared.payload.read = &test_write_block;
+
+    memset(&publish, 0, sizeof(publish));
+    publish.topic.buf = "topic";
+    publish.topic.len = strlen(publish.topic.buf);
+    lmqtt_publish_set_shared_payload(&publish, &shared);
+
+    ck_assert_int_eq(0, lmqtt_client_publish(&client, &publish));
+    ck_assert_uint_eq(0, shared.references);
+}
+END_TEST
+
+static void init_subscribe(lmqtt_subscribe_t *subscribe,
+    lmqtt_subscription_t *subscription, char *topic_name)
+{
+    memset(subscribe, 0, sizeof(*subscribe));
+    memset(subscription, 0, sizeof(*subscription));
+    subscribe->count = 1;
+    subscribe->subscriptions = subscription;
+    subscription->requested_qos = LMQTT_QOS_1;
+    subscription->topic.buf = topic_name;
+    subscription->topic.len = strlen(topic_name);
+}
+
+START_TEST(should_batch_queued_subscribe_requests)
+{
+    lmqtt_client_t client;
+    lmqtt_subscribe_t subscribe[2];
+    lmqtt_subscription_t subscription[2];
+    int called = 0;
+
+    ck_assert_int_eq(1, do_init_connect_connack_process(&client, 5, 3));
+    lmqtt_client_set_on_subscribe(&client, on_subscribe_count, &called);
+    lmqtt_client_set_subscribe_batch(&client, 100);
+
+    init_subscribe(&subscribe[0], &subscription[0], "a");
+    init_subscribe(&subscribe[1], &subscription[1], "b");
+    ck_assert_int_eq(1, lmqtt_client_subscribe(&client, &subscribe[0]));
+    ck_assert_int_eq(1, lmqtt_client_subscribe(&client, &subscribe[1]));
+    ck_assert_int_eq(1, client.main_store.count);
+
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(TEST_SUBSCRIBE, test_socket_shift(&ts));
+    ck_assert_int_eq(-1, test_socket_shift(&ts));
+
+    test_socket_append(&ts, TEST_SUBACK_SUCCESS_2);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, client_process_input(&client));
+    ck_assert_int_eq(2, called);
+    ck_assert_uint_eq(0, subscription[0].return_code);
+    ck_assert_uint_eq(1, subscription[1].return_code);
+}
+END_TEST
+
+START_TEST(should_not_batch_subscribe_requests_over_limit)
+{
+    lmqtt_client_t client;
+    lmqtt_subscribe_t subscribe[2];
+    lmqtt_subscription_t subscription[2];
+
+    ck_assert_int_eq(1, do_init_connect_connack_process(&client, 5, 3));
+    /* packet id plus one topic */
+    lmqtt_client_set_subscribe_batch(&client, 6);
+
+    init_subscribe(&subscribe[0], &subscription[0], "a");
+    init_subscribe(&subscribe[1], &subscription[1], "b");
+    ck_assert_int_eq(1, lmqtt_client_subscribe(&client, &subscribe[0]));
+    ck_assert_int_eq(1, lmqtt_client_subscribe(&client, &subscribe[1]));
+    ck_assert_int_eq(2, client.main_store.count);
+}
+END_TEST
+
+START_TEST(should_not_batch_subscribe_request_already_sent)
+{
+    lmqtt_client_t client;
+    lmqtt_subscribe_t subscribe[2];
+    lmqtt_subscription_t subscription[2];
+
+    ck_assert_int_eq(1, do_init_connect_connack_process(&client, 5, 3));
+    lmqtt_client_set_subscribe_batch(&client, 100);
+
+    init_subscribe(&subscribe[0], &subscription[0], "a");
+    init_subscribe(&subscribe[1], &subscription[1], "b");
+    ck_assert_int_eq(1, lmqtt_client_subscribe(&client, &subscribe[0]));
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(1, lmqtt_client_subscribe(&client, &subscribe[1]));
+    ck_assert_int_eq(2, client.main_store.count);
+}
+END_TEST
+
+static void do_subscribe_suback(lmqtt_client_t *client,
+    lmqtt_subscribe_t *subscribe, lmqtt_subscription_t *subscription)
+{
+    init_subscribe(subscribe, subscription, "a");
+    ck_assert_int_eq(1, lmqtt_client_subscribe(client, subscribe));
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(client));
+    ck_assert_int_eq(TEST_SUBSCRIBE, test_socket_shift(&ts));
+
+    test_socket_append(&ts, TEST_SUBACK_SUCCESS);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, client_process_input(client));
+}
+
+static void do_reconnect(lmqtt_client_t *client, int connack)
+{
+    ck_assert_int_eq(1, close_read_buf(client));
+
+    do_connect(client, 5, 0);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(client));
+    ck_assert_int_eq(TEST_CONNECT, test_socket_shift(&ts));
+
+    test_socket_append(&ts, connack);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, client_process_input(client));
+}
+
+START_TEST(should_restore_subscriptions_if_session_is_not_present)
+{
+    lmqtt_client_t client;
+    lmqtt_subscribe_t subscribe;
+    lmqtt_subscription_t subscription;
+    lmqtt_subscription_t registry[4];
+
+    ck_assert_int_eq(1, do_init_connect_connack_process(&client, 5, 3));
+    lmqtt_client_set_subscription_registry(&client, registry,
+        sizeof(registry));
+
+    do_subscribe_suback(&client, &subscribe, &subscription);
+    ck_assert_uint_eq(1, client.registry.count);
+
+    do_reconnect(&client, TEST_CONNACK_SUCCESS);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(TEST_SUBSCRIBE, test_socket_shift(&ts));
+    ck_assert_int_eq(-1, test_socket_shift(&ts));
+    ck_assert_int_eq(1, client.registry.restoring);
+
+    test_socket_append_param(&ts, TEST_SUBACK_SUCCESS, 1);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, client_process_input(&client));
+    ck_assert_int_eq(0, client.registry.restoring);
+    ck_assert_uint_eq(1, client.registry.count);
+}
+END_TEST
+
+START_TEST(should_restore_subscriptions_after_unsuback_in_between)
+{
+    lmqtt_client_t client;
+    lmqtt_subscribe_t subscribe[2];
+    lmqtt_subscription_t subscription[2];
+    lmqtt_subscription_t registry[4];
+
+    ck_assert_int_eq(1, do_init_connect_connack_process(&client, 5, 3));
+    lmqtt_client_set_subscription_registry(&client, registry,
+        sizeof(registry));
+
+    init_subscribe(&subscribe[0], &subscription[0], "a");
+    init_subscribe(&subscribe[1], &subscription[1], "b");
+    ck_assert_int_eq(1, lmqtt_client_subscribe(&client, &subscribe[0]));
+    ck_assert_int_eq(1, lmqtt_client_subscribe(&client, &subscribe[1]));
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(TEST_SUBSCRIBE, test_socket_shift(&ts));
+    ck_assert_int_eq(TEST_SUBSCRIBE, test_socket_shift(&ts));
+    test_socket_append_param(&ts, TEST_SUBACK_SUCCESS, 0);
+    test_socket_append_param(&ts, TEST_SUBACK_SUCCESS, 1);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, client_process_input(&client));
+    ck_assert_uint_eq(2, client.registry.count);
+
+    do_reconnect(&client, TEST_CONNACK_SUCCESS);
+    ck_assert_int_eq(1, lmqtt_client_unsubscribe(&client, &subscribe[0]));
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+
+    /* the restore SUBSCRIBE has id 2 and the UNSUBSCRIBE id 3 */
+    test_socket_append_param(&ts, TEST_UNSUBACK_SUCCESS, 3);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, client_process_input(&client));
+    ck_assert_uint_eq(1, client.registry.count);
+
+    test_socket_append_param(&ts, TEST_SUBACK_SUCCESS_2, 2);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, client_process_input(&client));
+    ck_assert_int_eq(0, client.registry.restoring);
+    ck_assert_uint_eq(1, client.registry.count);
+    ck_assert_int_eq('b', registry[0].topic.buf[0]);
+    ck_assert_int_eq(1, registry[0].return_code);
+}
+END_TEST
+
+START_TEST(should_not_restore_subscriptions_if_session_is_present)
+{
+    lmqtt_client_t client;
+    lmqtt_subscribe_t subscribe;
+    lmqtt_subscription_t subscription;
+    lmqtt_subscription_t registry[4];
+
+    ck_assert_int_eq(1, do_init_connect_connack_process(&client, 5, 3));
+    lmqtt_client_set_subscription_registry(&client, registry,
+        sizeof(registry));
+
+    do_subscribe_suback(&client, &subscribe, &subscription);
+
+    do_reconnect(&client, TEST_CONNACK_SESSION_PRESENT);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA,
+        client_process_output(&client));
+    ck_assert_int_eq(-1, test_socket_shift(&ts));
+}
+END_TEST
+
+START_TEST(should_forget_unsubscribed_topics)
+{
+    lmqtt_client_t client;
+    lmqtt_subscribe_t subscribe;
+    lmqtt_subscription_t subscription;
+    lmqtt_subscription_t registry[4];
+
+    ck_assert_int_eq(1, do_init_connect_connack_process(&client, 5, 3));
+    lmqtt_client_set_subscription_registry(&client, registry,
+        sizeof(registry));
+
+    do_subscribe_suback(&client, &subscribe, &subscription);
+
+    ck_assert_int_eq(1, lmqtt_client_unsubscribe(&client, &subscribe));
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(TEST_UNSUBSCRIBE, test_socket_shift(&ts));
+
+    test_socket_append_param(&ts, TEST_UNSUBACK_SUCCESS, 1);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, client_process_input(&client));
+    ck_assert_uint_eq(0, client.registry.count);
+}
+END_TEST
+
+START_TEST(should_send_preconnect_publish_after_connack)
+{
+    lmqtt_client_t client;
+
+    do_init(&client, 3);
+    lmqtt_client_set_preconnect_queue(&client, 1);
+
+    ck_assert_int_eq(1, do_publish(&client, 1));
+    ck_assert_int_eq(1, do_connect(&client, 5, 1));
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(TEST_CONNECT, test_socket_shift(&ts));
+    ck_assert_int_eq(-1, test_socket_shift(&ts));
+
+    test_socket_append(&ts, TEST_CONNACK_SUCCESS);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, client_process_input(&client));
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(TEST_PUBLISH, test_socket_shift(&ts));
+    ck_assert_uint_eq(0, client.preconnect_count);
+}
+END_TEST
+
+START_TEST(should_not_publish_before_connack_without_preconnect_queue)
+{
+    lmqtt_client_t client;
+
+    do_init(&client, 3);
+
+    ck_assert_int_eq(0, do_publish(&client, 1));
+    ck_assert_int_eq(1, do_connect(&client, 5, 1));
+    ck_assert_int_eq(0, do_publish(&client, 1));
+    ck_assert_int_eq(0, client.main_store.count);
+}
+END_TEST
+
+static void do_pipelined_connect(lmqtt_client_t *client,
+    lmqtt_subscribe_t *subscribe, lmqtt_subscription_t *subscription)
+{
+    do_init(client, 3);
+    lmqtt_client_set_preconnect_queue(client, 1);
+    lmqtt_client_set_pipelined_connect(client, 1);
+
+    init_subscribe(subscribe, subscription, "a");
+    ck_assert_int_eq(1, lmqtt_client_subscribe(client, subscribe));
+    ck_assert_int_eq(1, do_publish(client, 1));
+    ck_assert_int_eq(1, do_connect(client, 5, 1));
+}
+
+START_TEST(should_pipeline_requests_after_connect)
+{
+    lmqtt_client_t client;
+    lmqtt_subscribe_t subscribe;
+    lmqtt_subscription_t subscription;
+
+    do_pipelined_connect(&client, &subscribe, &subscription);
+
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(TEST_CONNECT, test_socket_shift(&ts));
+    ck_assert_int_eq(TEST_SUBSCRIBE, test_socket_shift(&ts));
+    ck_assert_int_eq(TEST_PUBLISH, test_socket_shift(&ts));
+    ck_assert_int_eq(-1, test_socket_shift(&ts));
+
+    test_socket_append(&ts, TEST_CONNACK_SUCCESS);
+    test_socket_append_param(&ts, TEST_SUBACK_SUCCESS, 0);
+    test_socket_append_param(&ts, TEST_PUBACK, 1);
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_CONN, client_process_input(&client));
+    ck_assert_int_eq(0, client.main_store.count);
+
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(-1, test_socket_shift(&ts));
+}
+END_TEST
+
+START_TEST(should_resend_pipelined_requests_after_refused_connect)
+{
+    lmqtt_client_t client;
+    lmqtt_subscribe_t subscribe;
+    lmqtt_subscription_t subscription;
+
+    do_pipelined_connect(&client, &subscribe, &subscription);
+
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    test_socket_append(&ts, TEST_CONNACK_FAILURE);
+    ck_assert_int_eq(LMQTT_IO_STATUS_ERROR, client_process_input(&client));
+    ck_assert_int_eq(2, client.main_store.count);
+
+    test_socket_init(&ts);
+    lmqtt_client_reset(&client);
+    ck_assert_int_eq(1, do_connect(&client, 5, 1));
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(TEST_CONNECT, test_socket_shift(&ts));
+    ck_assert_int_eq(TEST_SUBSCRIBE, test_socket_shift(&ts));
+    ck_assert_int_eq(TEST_PUBLISH, test_socket_shift(&ts));
+    ck_assert_int_eq(-1, test_socket_shift(&ts));
+}
+END_TEST
+
+START_TEST(should_not_pipeline_requests_of_previous_session)
+{
+    lmqtt_client_t client;
+
+    ck_assert_int_eq(1, do_init_connect_connack_process(&client, 5, 3));
+    lmqtt_client_set_preconnect_queue(&client, 1);
+    lmqtt_client_set_pipelined_connect(&client, 1);
+
+    ck_assert_int_eq(1, do_publish(&client, 1));
+    ck_assert_int_eq(1, close_read_buf(&client));
+
+    ck_assert_int_eq(1, do_connect(&client, 5, 0));
+    ck_assert_int_eq(LMQTT_IO_STATUS_BLOCK_DATA, client_process_output(&client));
+    ck_assert_int_eq(TEST_CONNECT, test_socket_shift(&ts));
+    ck_assert_int_eq(-1, test_socket_shift(&ts));
 }
 END_TEST
 
@@ -1392,6 +2372,15 @@ START_TCASE("Client commands")
     ADD_TEST(should_publish_with_qos_0);
     ADD_TEST(should_publish_with_qos_1);
     ADD_TEST(should_publish_with_qos_2);
+    ADD_TEST(should_hold_publish_until_inflight_window_opens);
+    ADD_TEST(should_conflate_unsent_publish_with_same_topic);
+    ADD_TEST(should_not_conflate_publish_without_flag);
+    ADD_TEST(should_not_conflate_sent_publish);
+    ADD_TEST(should_not_conflate_publish_with_other_topic);
+    ADD_TEST(should_drop_expired_publish);
+    ADD_TEST(should_publish_with_qos_0_ring);
+    ADD_TEST(should_conflate_publish_in_qos_0_ring);
+    ADD_TEST(should_flush_qos_0_ring_after_close);
     ADD_TEST(should_not_publish_invalid_packet);
 
     ADD_TEST(should_send_pingreq_after_timeout);
@@ -1424,6 +2413,13 @@ START_TCASE("Client commands")
     ADD_TEST(should_touch_store_on_reset);
     ADD_TEST(should_reset_after_eof);
     ADD_TEST(should_not_reset_finalized_client);
+    ADD_TEST(should_not_reconnect_without_lost_connection);
+    ADD_TEST(should_reconnect_after_backoff_delay);
+    ADD_TEST(should_double_reconnect_delay_after_failed_attempt);
+    ADD_TEST(should_not_reconnect_after_disconnect);
+    ADD_TEST(should_resend_publish_with_dup_flag_after_reconnect);
+    ADD_TEST(should_send_pingreq_early_with_keep_alive_jitter);
+    ADD_TEST(should_limit_reconnect_rate);
 
     ADD_TEST(should_wait_connack_to_resend_packets_from_previous_connection);
     ADD_TEST(should_wait_connack_to_send_unsent_packets_from_previous_connection);
@@ -1433,5 +2429,26 @@ START_TCASE("Client commands")
 
     ADD_TEST(should_preserve_non_clean_session_ids_after_reconnect);
     ADD_TEST(should_not_preserve_clean_session_ids_after_reconnect);
+    ADD_TEST(should_send_ack_from_ack_queue);
+    ADD_TEST(should_receive_message_with_slab);
+    ADD_TEST(should_ignore_message_which_does_not_fit_slab);
+    ADD_TEST(should_not_acknowledge_message_which_does_not_fit_slab);
+    ADD_TEST(should_publish_copy_and_release_it_after_puback);
+    ADD_TEST(should_not_publish_copy_larger_than_pool_data);
+    ADD_TEST(should_release_shared_payload_after_last_message);
+    ADD_TEST(should_not_release_shared_payload_of_conflated_publish);
+    ADD_TEST(should_not_publish_shared_payload_with_read_callback);
+    ADD_TEST(should_batch_queued_subscribe_requests);
+    ADD_TEST(should_not_batch_subscribe_requests_over_limit);
+    ADD_TEST(should_not_batch_subscribe_request_already_sent);
+    ADD_TEST(should_restore_subscriptions_if_session_is_not_present);
+    ADD_TEST(should_restore_subscriptions_after_unsuback_in_between);
+    ADD_TEST(should_not_restore_subscriptions_if_session_is_present);
+    ADD_TEST(should_forget_unsubscribed_topics);
+    ADD_TEST(should_send_preconnect_publish_after_connack);
+    ADD_TEST(should_not_publish_before_connack_without_preconnect_queue);
+    ADD_TEST(should_pipeline_requests_after_connect);
+    ADD_TEST(should_resend_pipelined_requests_after_refused_connect);
+    ADD_TEST(should_not_pipeline_requests_of_previous_session);
 }
 END_TCASE
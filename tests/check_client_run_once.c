@@ -121,6 +121,42 @@ START_TEST(should_run_after_connect)
 }
 END_TEST
 
+START_TEST(should_run_with_empty_buffer_pool)
+{
+    lmqtt_string_t dummy;
+    lmqtt_client_t client;
+    lmqtt_string_t *str_rd = &dummy, *str_wr = &dummy;
+    lmqtt_connect_t connect;
+    lmqtt_buffer_pool_t pool;
+    int res;
+
+    do_client_initialize(&client);
+    lmqtt_buffer_pool_initialize(&pool, NULL, 0, TX_BUFFER_SIZE);
+    lmqtt_client_set_buffer_pool(&client, &pool);
+
+    memset(&connect, 0, sizeof(connect));
+    connect.clean_session = 1;
+
+    lmqtt_client_connect(&client, &connect);
+    test_socket_append(&ts, TEST_CONNACK_SUCCESS);
+
+    res = lmqtt_client_run_once(&client, &str_rd, &str_wr);
+
+    ck_assert_int_eq(-1, test_socket_shift(&ts));
+
+    ck_assert(!LMQTT_IS_ERROR(res));
+    ck_assert(!LMQTT_IS_EOF(res));
+    ck_assert(!LMQTT_WOULD_BLOCK_CONN_RD(res));
+    ck_assert(!LMQTT_WOULD_BLOCK_CONN_WR(res));
+    ck_assert(!LMQTT_WOULD_BLOCK_DATA_RD(res));
+    ck_assert(!LMQTT_WOULD_BLOCK_DATA_WR(res));
+    ck_assert(LMQTT_WOULD_BLOCK_POOL(res));
+
+    ck_assert_ptr_eq(NULL, str_rd);
+    ck_assert_ptr_eq(NULL, str_wr);
+}
+END_TEST
+
 START_TEST(should_run_with_output_blocked)
 {
     lmqtt_string_t dummy;
@@ -514,6 +550,7 @@ START_TCASE("Client run once")
 {
     ADD_TEST(should_run_before_connect);
     ADD_TEST(should_run_after_connect);
+    ADD_TEST(should_run_with_empty_buffer_pool);
     ADD_TEST(should_run_with_output_blocked);
     ADD_TEST(should_run_with_data_blocked_for_read);
     ADD_TEST(should_run_with_data_blocked_for_write);
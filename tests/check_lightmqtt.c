@@ -98,12 +98,22 @@ void test_socket_append_param(test_socket_t *socket, int val, int param)
             memcpy(src, "\x20\x02\x00\x01", 4);
             len = 4;
             break;
+        case TEST_CONNACK_SESSION_PRESENT:
+            memcpy(src, "\x20\x02\x01\x00", 4);
+            len = 4;
+            break;
         case TEST_SUBACK_SUCCESS:
             memcpy(src, "\x90\x03\x00\x00\x00", 5);
             src[2] = param >> 8;
             src[3] = param;
             len = 5;
             break;
+        case TEST_SUBACK_SUCCESS_2:
+            memcpy(src, "\x90\x04\x00\x00\x00\x01", 6);
+            src[2] = param >> 8;
+            src[3] = param;
+            len = 6;
+            break;
         case TEST_UNSUBACK_SUCCESS:
             memcpy(src, "\xb0\x02\x00\x00", 4);
             src[2] = param >> 8;
@@ -126,6 +136,16 @@ void test_socket_append_param(test_socket_t *socket, int val, int param)
             src[7] = param;
             len = sizeof(src);
             break;
+        case TEST_PUBLISH_QOS_0:
+            memcpy(src, "\x30\x04\x00\x01XX", 6);
+            len = 6;
+            break;
+        case TEST_PUBLISH_QOS_1:
+            memcpy(src, "\x32\x06\x00\x01X\x00\x00X", 8);
+            src[5] = param >> 8;
+            src[6] = param;
+            len = 8;
+            break;
         case TEST_PUBACK:
             memcpy(src, "\x40\x02\x00\x00", 4);
             src[2] = param >> 8;
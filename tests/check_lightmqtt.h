@@ -37,6 +37,11 @@
 
 #define ADD_TEST(method) tcase_add_test(tcase, method)
 
+/* Tests see the mockable functions as pointers they can replace */
+#ifndef LMQTT_TEST
+    #define LMQTT_TEST
+#endif
+
 #include "lightmqtt/packet.h"
 #include "lightmqtt/client.h"
 #include "lightmqtt/types.h"
@@ -73,10 +78,14 @@ typedef enum {
     TEST_UNSUBACK_SUCCESS,
     TEST_PUBLISH_QOS_2,
     TEST_PUBLISH_QOS_0_BIG,
+    TEST_PUBLISH_QOS_0,
+    TEST_PUBLISH_QOS_1,
     TEST_PUBACK,
     TEST_PUBREC,
     TEST_PUBCOMP,
-    TEST_PINGRESP
+    TEST_PINGRESP,
+    TEST_SUBACK_SUCCESS_2,
+    TEST_CONNACK_SESSION_PRESENT
 } test_type_response_t;
 
 lmqtt_io_result_t test_buffer_move(test_buffer_t *test_buffer, void *dst,
@@ -180,9 +189,12 @@ extern int (*rx_buffer_call_callback)(lmqtt_rx_buffer_t *);
 extern lmqtt_decode_result_t (*rx_buffer_decode_type)(lmqtt_rx_buffer_t *,
     lmqtt_decode_bytes_t *);
 extern lmqtt_encoder_finder_t (*tx_buffer_finder_by_kind)(lmqtt_kind_t);
+extern lmqtt_fast_encoder_t (*tx_buffer_fast_encoder_by_kind)(lmqtt_kind_t);
 
 lmqtt_io_status_t client_process_input(lmqtt_client_t *client);
 lmqtt_io_status_t client_process_output(lmqtt_client_t *client);
 lmqtt_io_status_t client_keep_alive(lmqtt_client_t *client);
 
+int broker_validate_filter(lmqtt_string_t *topic);
+
 #endif
@@ -0,0 +1,520 @@
+#include "check_lightmqtt.h"
+#include <stdio.h>
+
+#define ENTRY_COUNT 16
+
+#define PREPARE \
+    unsigned char buf[512]; \
+    lmqtt_tx_buffer_t tx_state; \
+    lmqtt_rx_buffer_t rx_state; \
+    lmqtt_store_t store; \
+    lmqtt_io_result_t res; \
+    size_t bytes_w; \
+    size_t bytes_r; \
+    lmqtt_store_value_t value; \
+    lmqtt_store_entry_t entries[ENTRY_COUNT]; \
+    lmqtt_topic_alias_t aliases[4]; \
+    memset(buf, 0xcc, sizeof(buf)); \
+    memset(&tx_state, 0, sizeof(tx_state)); \
+    memset(&rx_state, 0, sizeof(rx_state)); \
+    memset(&store, 0, sizeof(store)); \
+    memset(&value, 0, sizeof(value)); \
+    memset(entries, 0, sizeof(entries)); \
+    memset(aliases, 0, sizeof(aliases)); \
+    tx_state.store = &store; \
+    tx_state.protocol = LMQTT_PROTOCOL_MQTT_5; \
+    tx_state.topic_aliases.items = aliases; \
+    tx_state.topic_aliases.capacity = 4; \
+    tx_state.topic_aliases.maximum = 10; \
+    rx_state.store = &store; \
+    rx_state.message_callbacks = &message_callbacks; \
+    rx_state.protocol = LMQTT_PROTOCOL_MQTT_5; \
+    store.get_time = &test_time_get; \
+    store.entries = entries; \
+    store.capacity = ENTRY_COUNT; \
+    memset(&message_callbacks, 0, sizeof(message_callbacks)); \
+    memset(message_received, 0, sizeof(message_received))
+
+#define APPEND_PUBLISH(publish, topic_str, qos_val, id) \
+    do { \
+        memset(&(publish), 0, sizeof(publish)); \
+        (publish).qos = (qos_val); \
+        (publish).topic.buf = (topic_str); \
+        (publish).topic.len = strlen(topic_str); \
+        (publish).payload.buf = "p"; \
+        (publish).payload.len = 1; \
+        value.packet_id = (id); \
+        value.value = &(publish); \
+        ck_assert_int_eq(1, lmqtt_store_append(&store, (qos_val) == \
+            LMQTT_QOS_0 ? LMQTT_KIND_PUBLISH_0 : LMQTT_KIND_PUBLISH_1, \
+            &value)); \
+    } while (0)
+
+#define ENCODE(exp) \
+    do { \
+        res = lmqtt_tx_buffer_encode(&tx_state, buf, sizeof(buf), \
+            &bytes_w); \
+        ck_assert_int_eq(LMQTT_IO_SUCCESS, res); \
+        ck_assert_uint_eq(sizeof(exp) - 1, bytes_w); \
+        ck_assert_int_eq(0, memcmp((exp), buf, bytes_w)); \
+    } while (0)
+
+#define DECODE(b) \
+    res = lmqtt_rx_buffer_decode(&rx_state, (unsigned char *) (b), \
+        sizeof(b) - 1, &bytes_r)
+
+#define STORE_APPEND_MARK(kind, id, data) \
+    do { \
+        value.packet_id = (id); \
+        value.value = (data); \
+        ck_assert_int_eq(1, lmqtt_store_append(&store, (kind), &value)); \
+        ck_assert_int_eq(1, lmqtt_store_mark_current(&store)); \
+    } while (0)
+
+static lmqtt_message_callbacks_t message_callbacks;
+static char topic[64];
+static char payload[64];
+static char message_received[128];
+
+static int test_on_publish(void *data, lmqtt_publish_t *publish)
+{
+    sprintf(message_received, "%.*s: %.*s",
+        (int) publish->topic.len, publish->topic.buf,
+        (int) publish->payload.len, publish->payload.buf);
+    return 1;
+}
+
+static lmqtt_allocate_result_t test_allocate_topic(void *data,
+    lmqtt_publish_t *publish, size_t len)
+{
+    publish->topic.len = len;
+    publish->topic.buf = topic;
+    return LMQTT_ALLOCATE_SUCCESS;
+}
+
+static lmqtt_allocate_result_t test_allocate_payload(void *data,
+    lmqtt_publish_t *publish, size_t len)
+{
+    publish->payload.len = len;
+    publish->payload.buf = payload;
+    return LMQTT_ALLOCATE_SUCCESS;
+}
+
+START_TEST(should_encode_connect_with_session_expiry_interval)
+{
+    lmqtt_connect_t connect;
+
+    PREPARE;
+    memset(&connect, 0, sizeof(connect));
+    connect.protocol = LMQTT_PROTOCOL_MQTT_5;
+    connect.clean_session = 1;
+    connect.keep_alive = 10;
+    connect.session_expiry_interval = 0x100;
+    connect.client_id.buf = "a";
+    connect.client_id.len = 1;
+
+    value.value = &connect;
+    lmqtt_store_append(&store, LMQTT_KIND_CONNECT, &value);
+
+    ENCODE("\x10\x13\x00\x04" "MQTT\x05\x02\x00\x0a"
+        "\x05\x11\x00\x00\x01\x00" "\x00\x01" "a");
+}
+END_TEST
+
+START_TEST(should_encode_connect_with_will_properties)
+{
+    lmqtt_connect_t connect;
+
+    PREPARE;
+    memset(&connect, 0, sizeof(connect));
+    connect.protocol = LMQTT_PROTOCOL_MQTT_5;
+    connect.clean_session = 1;
+    connect.client_id.buf = "a";
+    connect.client_id.len = 1;
+    connect.will_topic.buf = "b";
+    connect.will_topic.len = 1;
+    connect.will_message.buf = "c";
+    connect.will_message.len = 1;
+
+    value.value = &connect;
+    lmqtt_store_append(&store, LMQTT_KIND_CONNECT, &value);
+
+    ENCODE("\x10\x15\x00\x04" "MQTT\x05\x06\x00\x00" "\x00"
+        "\x00\x01" "a" "\x00" "\x00\x01" "b" "\x00\x01" "c");
+}
+END_TEST
+
+START_TEST(should_send_topic_once_and_then_alias)
+{
+    lmqtt_publish_t publish[2];
+
+    PREPARE;
+    APPEND_PUBLISH(publish[0], "topic", LMQTT_QOS_0, 0);
+    ENCODE("\x30\x0c\x00\x05" "topic" "\x03\x23\x00\x01" "p");
+
+    APPEND_PUBLISH(publish[1], "topic", LMQTT_QOS_0, 0);
+    ENCODE("\x30\x07\x00\x00" "\x03\x23\x00\x01" "p");
+
+    ck_assert_uint_eq(1, tx_state.topic_aliases.count);
+}
+END_TEST
+
+START_TEST(should_assign_one_alias_per_topic)
+{
+    lmqtt_publish_t publish[3];
+
+    PREPARE;
+    APPEND_PUBLISH(publish[0], "a", LMQTT_QOS_0, 0);
+    ENCODE("\x30\x08\x00\x01" "a" "\x03\x23\x00\x01" "p");
+
+    APPEND_PUBLISH(publish[1], "b", LMQTT_QOS_0, 0);
+    ENCODE("\x30\x08\x00\x01" "b" "\x03\x23\x00\x02" "p");
+
+    APPEND_PUBLISH(publish[2], "a", LMQTT_QOS_0, 0);
+    ENCODE("\x30\x07\x00\x00" "\x03\x23\x00\x01" "p");
+}
+END_TEST
+
+START_TEST(should_encode_alias_after_packet_id)
+{
+    lmqtt_publish_t publish;
+
+    PREPARE;
+    APPEND_PUBLISH(publish, "topic", LMQTT_QOS_1, 0x0102);
+    ENCODE("\x32\x0e\x00\x05" "topic" "\x01\x02" "\x03\x23\x00\x01" "p");
+}
+END_TEST
+
+START_TEST(should_not_use_aliases_without_server_maximum)
+{
+    lmqtt_publish_t publish[2];
+
+    PREPARE;
+    tx_state.topic_aliases.maximum = 0;
+
+    APPEND_PUBLISH(publish[0], "topic", LMQTT_QOS_0, 0);
+    ENCODE("\x30\x09\x00\x05" "topic" "\x00" "p");
+
+    APPEND_PUBLISH(publish[1], "topic", LMQTT_QOS_0, 0);
+    ENCODE("\x30\x09\x00\x05" "topic" "\x00" "p");
+}
+END_TEST
+
+START_TEST(should_not_use_aliases_with_mqtt_3_1_1)
+{
+    lmqtt_publish_t publish;
+
+    PREPARE;
+    tx_state.protocol = LMQTT_PROTOCOL_MQTT_3_1_1;
+
+    APPEND_PUBLISH(publish, "topic", LMQTT_QOS_0, 0);
+    ENCODE("\x30\x08\x00\x05" "topic" "p");
+    ck_assert_uint_eq(0, tx_state.topic_aliases.count);
+}
+END_TEST
+
+START_TEST(should_replace_aliases_when_table_is_full)
+{
+    lmqtt_publish_t publish[3];
+
+    PREPARE;
+    tx_state.topic_aliases.maximum = 1;
+
+    APPEND_PUBLISH(publish[0], "a", LMQTT_QOS_0, 0);
+    ENCODE("\x30\x08\x00\x01" "a" "\x03\x23\x00\x01" "p");
+
+    APPEND_PUBLISH(publish[1], "b", LMQTT_QOS_0, 0);
+    ENCODE("\x30\x08\x00\x01" "b" "\x03\x23\x00\x01" "p");
+
+    APPEND_PUBLISH(publish[2], "a", LMQTT_QOS_0, 0);
+    ENCODE("\x30\x08\x00\x01" "a" "\x03\x23\x00\x01" "p");
+}
+END_TEST
+
+START_TEST(should_not_alias_topics_longer_than_alias_size)
+{
+    char long_topic[LMQTT_TOPIC_ALIAS_SIZE + 2];
+    lmqtt_publish_t publish;
+
+    PREPARE;
+    memset(long_topic, 'a', sizeof(long_topic) - 1);
+    long_topic[sizeof(long_topic) - 1] = 0;
+
+    APPEND_PUBLISH(publish, long_topic, LMQTT_QOS_0, 0);
+    res = lmqtt_tx_buffer_encode(&tx_state, buf, sizeof(buf), &bytes_w);
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_uint_eq(2 + 2 + sizeof(long_topic) - 1 + 1 + 1, bytes_w);
+    ck_assert_uint_eq(0, tx_state.topic_aliases.count);
+}
+END_TEST
+
+START_TEST(should_resolve_alias_once_when_output_is_split)
+{
+    lmqtt_publish_t publish[2];
+    size_t total = 0;
+    int i;
+
+    PREPARE;
+    APPEND_PUBLISH(publish[0], "topic", LMQTT_QOS_0, 0);
+    APPEND_PUBLISH(publish[1], "topic", LMQTT_QOS_0, 0);
+
+    for (i = 0; i < 30 && total < 23; i++) {
+        res = lmqtt_tx_buffer_encode(&tx_state, &buf[total], 1, &bytes_w);
+        ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+        total += bytes_w;
+    }
+
+    ck_assert_uint_eq(23, total);
+    ck_assert_int_eq(0, memcmp("\x30\x0c\x00\x05" "topic" "\x03\x23\x00\x01"
+        "p" "\x30\x07\x00\x00" "\x03\x23\x00\x01" "p", buf, total));
+}
+END_TEST
+
+START_TEST(should_encode_subscribe_and_unsubscribe_properties)
+{
+    lmqtt_subscribe_t subscribe;
+    lmqtt_subscription_t subscription;
+
+    PREPARE;
+    memset(&subscribe, 0, sizeof(subscribe));
+    memset(&subscription, 0, sizeof(subscription));
+    subscribe.count = 1;
+    subscribe.subscriptions = &subscription;
+    subscription.requested_qos = LMQTT_QOS_1;
+    subscription.topic.buf = "a";
+    subscription.topic.len = 1;
+
+    value.packet_id = 1;
+    value.value = &subscribe;
+    lmqtt_store_append(&store, LMQTT_KIND_SUBSCRIBE, &value);
+    ENCODE("\x82\x07\x00\x01\x00" "\x00\x01" "a" "\x01");
+
+    value.packet_id = 2;
+    lmqtt_store_append(&store, LMQTT_KIND_UNSUBSCRIBE, &value);
+    ENCODE("\xa2\x06\x00\x02\x00" "\x00\x01" "a");
+}
+END_TEST
+
+START_TEST(should_decode_connack_with_properties)
+{
+    lmqtt_connect_t connect;
+
+    PREPARE;
+    memset(&connect, 0, sizeof(connect));
+    STORE_APPEND_MARK(LMQTT_KIND_CONNECT, 0, &connect);
+
+    /* assigned client identifier (string), topic alias maximum */
+    DECODE("\x20\x0c\x01\x00\x09" "\x12\x00\x03" "abc" "\x22\x00\x0a");
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_uint_eq(14, bytes_r);
+    ck_assert_uint_eq(1, connect.response.session_present);
+    ck_assert_uint_eq(10, connect.response.topic_alias_maximum);
+}
+END_TEST
+
+START_TEST(should_decode_connack_with_receive_maximum)
+{
+    lmqtt_connect_t connect;
+
+    PREPARE;
+    memset(&connect, 0, sizeof(connect));
+    STORE_APPEND_MARK(LMQTT_KIND_CONNECT, 0, &connect);
+
+    DECODE("\x20\x06\x00\x00\x03" "\x21\x00\x05");
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_uint_eq(8, bytes_r);
+    ck_assert_uint_eq(5, connect.response.receive_maximum);
+}
+END_TEST
+
+START_TEST(should_decode_connack_with_failure_reason_code)
+{
+    lmqtt_connect_t connect;
+    lmqtt_error_t error;
+    int os_error;
+
+    PREPARE;
+    memset(&connect, 0, sizeof(connect));
+    STORE_APPEND_MARK(LMQTT_KIND_CONNECT, 0, &connect);
+
+    DECODE("\x20\x03\x00\x87\x00");
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, res);
+    error = lmqtt_rx_buffer_get_error(&rx_state, &os_error);
+    ck_assert_int_eq(LMQTT_ERROR_CONNACK_NOT_AUTHORIZED, error);
+    ck_assert_uint_eq(0x87, connect.response.return_code);
+}
+END_TEST
+
+START_TEST(should_decode_connack_with_unknown_failure_reason_code)
+{
+    lmqtt_connect_t connect;
+    lmqtt_error_t error;
+    int os_error;
+
+    PREPARE;
+    memset(&connect, 0, sizeof(connect));
+    STORE_APPEND_MARK(LMQTT_KIND_CONNECT, 0, &connect);
+
+    DECODE("\x20\x03\x00\x97\x00");
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, res);
+    error = lmqtt_rx_buffer_get_error(&rx_state, &os_error);
+    ck_assert_int_eq(LMQTT_ERROR_CONNACK_REFUSED, error);
+}
+END_TEST
+
+START_TEST(should_not_decode_connack_with_invalid_property)
+{
+    lmqtt_connect_t connect;
+    lmqtt_error_t error;
+    int os_error;
+
+    PREPARE;
+    memset(&connect, 0, sizeof(connect));
+    STORE_APPEND_MARK(LMQTT_KIND_CONNECT, 0, &connect);
+
+    DECODE("\x20\x05\x00\x00\x02\x7f\x00");
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, res);
+    error = lmqtt_rx_buffer_get_error(&rx_state, &os_error);
+    ck_assert_int_eq(LMQTT_ERROR_DECODE_INVALID_PROPERTIES, error);
+}
+END_TEST
+
+START_TEST(should_not_decode_connack_with_truncated_properties)
+{
+    lmqtt_connect_t connect;
+    lmqtt_error_t error;
+    int os_error;
+
+    PREPARE;
+    memset(&connect, 0, sizeof(connect));
+    STORE_APPEND_MARK(LMQTT_KIND_CONNECT, 0, &connect);
+
+    /* property list ends in the middle of topic alias maximum */
+    DECODE("\x20\x05\x00\x00\x02\x22\x00");
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, res);
+    error = lmqtt_rx_buffer_get_error(&rx_state, &os_error);
+    ck_assert_int_eq(LMQTT_ERROR_DECODE_INVALID_PROPERTIES, error);
+}
+END_TEST
+
+START_TEST(should_decode_puback_with_reason_code_and_properties)
+{
+    int data = 0;
+    int kind;
+
+    PREPARE;
+    STORE_APPEND_MARK(LMQTT_KIND_PUBLISH_1, 1, &data);
+    STORE_APPEND_MARK(LMQTT_KIND_PUBLISH_1, 2, &data);
+    STORE_APPEND_MARK(LMQTT_KIND_PUBLISH_1, 3, &data);
+
+    DECODE("\x40\x02\x00\x01" "\x40\x03\x00\x02\x10"
+        "\x40\x08\x00\x03\x10\x04" "\x1f\x00\x01" "x");
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_uint_eq(19, bytes_r);
+    ck_assert_int_eq(0, lmqtt_store_peek(&store, &kind, &value));
+}
+END_TEST
+
+START_TEST(should_decode_suback_with_properties)
+{
+    lmqtt_subscribe_t subscribe;
+    lmqtt_subscription_t subscriptions[2];
+
+    PREPARE;
+    memset(&subscribe, 0, sizeof(subscribe));
+    memset(subscriptions, 0, sizeof(subscriptions));
+    subscribe.count = 2;
+    subscribe.subscriptions = subscriptions;
+    STORE_APPEND_MARK(LMQTT_KIND_SUBSCRIBE, 1, &subscribe);
+
+    DECODE("\x90\x08\x00\x01\x03\x1f\x00\x00" "\x01\x87");
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_uint_eq(10, bytes_r);
+    ck_assert_uint_eq(0x01, subscriptions[0].return_code);
+    ck_assert_uint_eq(0x87, subscriptions[1].return_code);
+}
+END_TEST
+
+START_TEST(should_decode_unsuback_with_reason_codes)
+{
+    lmqtt_subscribe_t subscribe;
+    int kind;
+
+    PREPARE;
+    memset(&subscribe, 0, sizeof(subscribe));
+    STORE_APPEND_MARK(LMQTT_KIND_UNSUBSCRIBE, 1, &subscribe);
+
+    DECODE("\xb0\x05\x00\x01\x00\x00\x11");
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_uint_eq(7, bytes_r);
+    ck_assert_int_eq(0, lmqtt_store_peek(&store, &kind, &value));
+}
+END_TEST
+
+START_TEST(should_decode_publish_with_properties)
+{
+    PREPARE;
+    message_callbacks.on_publish = &test_on_publish;
+    message_callbacks.on_publish_allocate_topic = &test_allocate_topic;
+    message_callbacks.on_publish_allocate_payload = &test_allocate_payload;
+
+    /* payload format indicator, user property */
+    DECODE("\x30\x0f\x00\x01" "t" "\x09\x01\x01" "\x26\x00\x01" "k"
+        "\x00\x01" "v" "xy");
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_uint_eq(17, bytes_r);
+    ck_assert_str_eq("t: xy", message_received);
+}
+END_TEST
+
+START_TEST(should_decode_publish_with_empty_payload)
+{
+    PREPARE;
+    message_callbacks.on_publish = &test_on_publish;
+    message_callbacks.on_publish_allocate_topic = &test_allocate_topic;
+    message_callbacks.on_publish_allocate_payload = &test_allocate_payload;
+
+    DECODE("\x30\x04\x00\x01" "t" "\x00");
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_uint_eq(6, bytes_r);
+    ck_assert_str_eq("t: ", message_received);
+}
+END_TEST
+
+START_TCASE("MQTT 5")
+{
+    ADD_TEST(should_encode_connect_with_session_expiry_interval);
+    ADD_TEST(should_encode_connect_with_will_properties);
+    ADD_TEST(should_send_topic_once_and_then_alias);
+    ADD_TEST(should_assign_one_alias_per_topic);
+    ADD_TEST(should_encode_alias_after_packet_id);
+    ADD_TEST(should_not_use_aliases_without_server_maximum);
+    ADD_TEST(should_not_use_aliases_with_mqtt_3_1_1);
+    ADD_TEST(should_replace_aliases_when_table_is_full);
+    ADD_TEST(should_not_alias_topics_longer_than_alias_size);
+    ADD_TEST(should_resolve_alias_once_when_output_is_split);
+    ADD_TEST(should_encode_subscribe_and_unsubscribe_properties);
+    ADD_TEST(should_decode_connack_with_properties);
+    ADD_TEST(should_decode_connack_with_receive_maximum);
+    ADD_TEST(should_decode_connack_with_failure_reason_code);
+    ADD_TEST(should_decode_connack_with_unknown_failure_reason_code);
+    ADD_TEST(should_not_decode_connack_with_invalid_property);
+    ADD_TEST(should_not_decode_connack_with_truncated_properties);
+    ADD_TEST(should_decode_puback_with_reason_code_and_properties);
+    ADD_TEST(should_decode_suback_with_properties);
+    ADD_TEST(should_decode_unsuback_with_reason_codes);
+    ADD_TEST(should_decode_publish_with_properties);
+    ADD_TEST(should_decode_publish_with_empty_payload);
+}
+END_TCASE
@@ -181,6 +181,67 @@ START_TEST(should_encode_payload_from_offset)
 }
 END_TEST
 
+static size_t encode_publish_in_chunks(lmqtt_publish_t *publish,
+    unsigned char *buf, size_t chunk_len)
+{
+    lmqtt_tx_buffer_t state;
+    lmqtt_store_t store;
+    lmqtt_store_entry_t entries[2];
+    lmqtt_store_value_t value;
+    size_t bytes_w;
+    size_t pos = 0;
+
+    memset(&state, 0, sizeof(state));
+    memset(&store, 0, sizeof(store));
+    memset(&value, 0, sizeof(value));
+    store.entries = entries;
+    store.capacity = 2;
+    state.store = &store;
+    value.packet_id = 0x0102;
+    value.value = publish;
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1, &value);
+
+    while (lmqtt_tx_buffer_encode(&state, buf + pos, chunk_len, &bytes_w) ==
+            LMQTT_IO_SUCCESS && bytes_w > 0)
+        pos += bytes_w;
+    return pos;
+}
+
+START_TEST(should_encode_whole_publish_at_once)
+{
+    PREPARE;
+    INIT_TOPIC("topic");
+
+    publish.payload.buf = "payload";
+    publish.payload.len = strlen(publish.payload.buf);
+
+    bytes_w = encode_publish_in_chunks(&publish, buf, sizeof(buf));
+
+    ck_assert_int_eq(18, bytes_w);
+    ck_assert_int_eq(0, memcmp("\x32\x10\x00\x05topic\x01\x02payload", buf,
+        bytes_w));
+    ck_assert_uint_eq(0xcc, buf[18]);
+}
+END_TEST
+
+START_TEST(should_encode_same_publish_in_small_buffers)
+{
+    unsigned char buf_chunks[256];
+    PREPARE;
+    INIT_TOPIC("topic");
+
+    publish.payload.buf = "payload";
+    publish.payload.len = strlen(publish.payload.buf);
+
+    bytes_w = encode_publish_in_chunks(&publish, buf, sizeof(buf));
+    publish.internal.encode_count = 0;
+    res = encode_publish_in_chunks(&publish, buf_chunks, 3);
+
+    ck_assert_int_eq(18, res);
+    ck_assert_int_eq(0, memcmp(buf, buf_chunks, bytes_w));
+}
+END_TEST
+
 START_TCASE("Publish encode")
 {
     ADD_TEST(should_encode_fixed_header_with_empty_payload_and_qos_0);
@@ -194,5 +255,7 @@ START_TCASE("Publish encode")
     ADD_TEST(should_encode_payload);
     ADD_TEST(should_encode_empty_payload);
     ADD_TEST(should_encode_payload_from_offset);
+    ADD_TEST(should_encode_whole_publish_at_once);
+    ADD_TEST(should_encode_same_publish_in_small_buffers);
 }
 END_TCASE
@@ -0,0 +1,318 @@
+#include "check_lightmqtt.h"
+
+#define ENTRY_COUNT 16
+
+static lmqtt_rx_buffer_t state;
+static lmqtt_store_t store;
+static lmqtt_store_entry_t entries[ENTRY_COUNT];
+static lmqtt_request_callbacks_t request_callbacks;
+static lmqtt_connect_t connect_received;
+static int connect_count;
+static int on_connect_retval;
+static char strings[5][64];
+static int allocate_count;
+static lmqtt_allocate_result_t allocate_result;
+static lmqtt_error_t error;
+static int os_error;
+
+static int test_on_connect(void *data, lmqtt_connect_t *connect)
+{
+    connect_received = *connect;
+    connect_count++;
+    return on_connect_retval;
+}
+
+static lmqtt_allocate_result_t test_on_allocate_string(void *data,
+    lmqtt_string_t *str, size_t len)
+{
+    if (allocate_result == LMQTT_ALLOCATE_SUCCESS)
+        str->buf = strings[allocate_count];
+    allocate_count++;
+    return allocate_result;
+}
+
+static void init_state()
+{
+    memset(&state, 0, sizeof(state));
+    memset(&store, 0, sizeof(store));
+    memset(entries, 0, sizeof(entries));
+    memset(&request_callbacks, 0, sizeof(request_callbacks));
+    memset(&connect_received, 0, sizeof(connect_received));
+    memset(strings, 0, sizeof(strings));
+    state.store = &store;
+    state.server_role = 1;
+    state.request_callbacks = &request_callbacks;
+    request_callbacks.on_connect = &test_on_connect;
+    request_callbacks.on_allocate_string = &test_on_allocate_string;
+    store.get_time = &test_time_get;
+    store.entries = entries;
+    store.capacity = ENTRY_COUNT;
+    connect_count = 0;
+    on_connect_retval = 1;
+    allocate_count = 0;
+    allocate_result = LMQTT_ALLOCATE_SUCCESS;
+    error = 0xcccc;
+    os_error = 0xcccc;
+}
+
+static lmqtt_io_result_t decode(const char *buf, size_t len, size_t *bytes_r)
+{
+    lmqtt_io_result_t res = lmqtt_rx_buffer_decode(&state,
+        (unsigned char *) buf, len, bytes_r);
+    error = lmqtt_rx_buffer_get_error(&state, &os_error);
+    return res;
+}
+
+START_TEST(should_decode_connect_with_client_id)
+{
+    static const char buf[] = "\x10\x0f\x00\x04MQTT\x04\x02\x01\x2c"
+        "\x00\x03" "abc";
+    size_t bytes_r;
+
+    init_state();
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_uint_eq(sizeof(buf) - 1, bytes_r);
+
+    ck_assert_int_eq(1, connect_count);
+    ck_assert_int_eq(300, connect_received.keep_alive);
+    ck_assert_int_eq(1, connect_received.clean_session);
+    ck_assert_int_eq(3, connect_received.client_id.len);
+    ck_assert_str_eq("abc", connect_received.client_id.buf);
+    ck_assert_int_eq(0, connect_received.will_topic.len);
+    ck_assert_int_eq(0, connect_received.user_name.len);
+    ck_assert_int_eq(0, lmqtt_store_count(&store));
+}
+END_TEST
+
+START_TEST(should_decode_connect_with_all_fields)
+{
+    static const char buf[] = "\x10\x26\x00\x04MQTT\x04\xf4\x00\x0a"
+        "\x00\x03" "cid" "\x00\x01" "w" "\x00\x04" "will"
+        "\x00\x04" "user" "\x00\x06" "secret";
+    size_t bytes_r;
+
+    init_state();
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_uint_eq(sizeof(buf) - 1, bytes_r);
+
+    ck_assert_int_eq(1, connect_count);
+    ck_assert_int_eq(5, allocate_count);
+    ck_assert_int_eq(10, connect_received.keep_alive);
+    ck_assert_int_eq(0, connect_received.clean_session);
+    ck_assert_int_eq(LMQTT_QOS_2, connect_received.will_qos);
+    ck_assert_int_eq(1, connect_received.will_retain);
+    ck_assert_str_eq("cid", connect_received.client_id.buf);
+    ck_assert_str_eq("w", connect_received.will_topic.buf);
+    ck_assert_str_eq("will", connect_received.will_message.buf);
+    ck_assert_str_eq("user", connect_received.user_name.buf);
+    ck_assert_str_eq("secret", connect_received.password.buf);
+}
+END_TEST
+
+START_TEST(should_decode_connect_byte_by_byte)
+{
+    static const char buf[] = "\x10\x17\x00\x04MQTT\x04\xc2\x00\x0a"
+        "\x00\x00" "\x00\x04" "user" "\x00\x03" "pwd";
+    size_t bytes_r;
+    size_t i;
+
+    init_state();
+
+    for (i = 0; i < sizeof(buf) - 1; i++) {
+        ck_assert_int_eq(LMQTT_IO_SUCCESS, decode(&buf[i], 1, &bytes_r));
+        ck_assert_uint_eq(1, bytes_r);
+    }
+
+    ck_assert_int_eq(1, connect_count);
+    ck_assert_int_eq(2, allocate_count);
+    ck_assert_int_eq(0, connect_received.client_id.len);
+    ck_assert_str_eq("user", connect_received.user_name.buf);
+    ck_assert_str_eq("pwd", connect_received.password.buf);
+}
+END_TEST
+
+START_TEST(should_skip_strings_without_allocate_callback)
+{
+    static const char buf[] = "\x10\x0f\x00\x04MQTT\x04\x02\x00\x00"
+        "\x00\x03" "abc";
+    size_t bytes_r;
+
+    init_state();
+    request_callbacks.on_allocate_string = NULL;
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_uint_eq(sizeof(buf) - 1, bytes_r);
+
+    ck_assert_int_eq(1, connect_count);
+    ck_assert_int_eq(3, connect_received.client_id.len);
+    ck_assert_ptr_eq(NULL, connect_received.client_id.buf);
+}
+END_TEST
+
+START_TEST(should_skip_ignored_strings)
+{
+    static const char buf[] = "\x10\x0f\x00\x04MQTT\x04\x02\x00\x00"
+        "\x00\x03" "abc";
+    size_t bytes_r;
+
+    init_state();
+    allocate_result = LMQTT_ALLOCATE_IGNORE;
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, decode(buf, sizeof(buf) - 1, &bytes_r));
+
+    ck_assert_int_eq(1, allocate_count);
+    ck_assert_int_eq(1, connect_count);
+    ck_assert_ptr_eq(NULL, connect_received.client_id.buf);
+}
+END_TEST
+
+START_TEST(should_fail_if_allocate_fails)
+{
+    static const char buf[] = "\x10\x0f\x00\x04MQTT\x04\x02\x00\x00"
+        "\x00\x03" "abc";
+    size_t bytes_r;
+
+    init_state();
+    allocate_result = LMQTT_ALLOCATE_ERROR;
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_int_eq(LMQTT_ERROR_DECODE_REQUEST_ALLOCATE_FAILED, error);
+    ck_assert_int_eq(0, connect_count);
+}
+END_TEST
+
+START_TEST(should_fail_if_connect_callback_fails)
+{
+    static const char buf[] = "\x10\x0f\x00\x04MQTT\x04\x02\x00\x00"
+        "\x00\x03" "abc";
+    size_t bytes_r;
+
+    init_state();
+    on_connect_retval = 0;
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_int_eq(LMQTT_ERROR_CALLBACK_CONNECT, error);
+    ck_assert_int_eq(1, connect_count);
+}
+END_TEST
+
+START_TEST(should_fail_with_invalid_protocol_name)
+{
+    static const char buf[] = "\x10\x0f\x00\x04MQTX\x04\x02\x00\x00"
+        "\x00\x03" "abc";
+    size_t bytes_r;
+
+    init_state();
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_uint_eq(7, bytes_r);
+    ck_assert_int_eq(LMQTT_ERROR_DECODE_CONNECT_INVALID_PROTOCOL, error);
+}
+END_TEST
+
+START_TEST(should_fail_with_invalid_protocol_level)
+{
+    static const char buf[] = "\x10\x0f\x00\x04MQTT\x05\x02\x00\x00"
+        "\x00\x03" "abc";
+    size_t bytes_r;
+
+    init_state();
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_int_eq(LMQTT_ERROR_DECODE_CONNECT_INVALID_PROTOCOL, error);
+}
+END_TEST
+
+START_TEST(should_fail_with_invalid_flags)
+{
+    /* reserved, will QoS 3, will QoS without will flag and password without
+       user name */
+    static const unsigned char flags[] = { 0x03, 0x1c, 0x08, 0x40 };
+    char buf[] = "\x10\x0f\x00\x04MQTT\x04\x02\x00\x00\x00\x03" "abc";
+    size_t bytes_r;
+    size_t i;
+
+    for (i = 0; i < sizeof(flags); i++) {
+        init_state();
+        buf[9] = flags[i];
+
+        ck_assert_int_eq(LMQTT_IO_ERROR,
+            decode(buf, sizeof(buf) - 1, &bytes_r));
+        ck_assert_int_eq(LMQTT_ERROR_DECODE_CONNECT_INVALID_FLAGS, error);
+    }
+}
+END_TEST
+
+START_TEST(should_fail_if_string_exceeds_remaining_length)
+{
+    static const char buf[] = "\x10\x0f\x00\x04MQTT\x04\x02\x00\x00"
+        "\x00\x04" "abc";
+    size_t bytes_r;
+
+    init_state();
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_int_eq(LMQTT_ERROR_DECODE_CONNECT_INVALID_LENGTH, error);
+}
+END_TEST
+
+START_TEST(should_fail_if_flagged_field_is_missing)
+{
+    static const char buf[] = "\x10\x0f\x00\x04MQTT\x04\x82\x00\x00"
+        "\x00\x03" "abc";
+    size_t bytes_r;
+
+    init_state();
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_int_eq(LMQTT_ERROR_DECODE_CONNECT_INVALID_LENGTH, error);
+    ck_assert_int_eq(0, connect_count);
+}
+END_TEST
+
+START_TEST(should_fail_with_trailing_bytes)
+{
+    static const char buf[] = "\x10\x11\x00\x04MQTT\x04\x02\x00\x00"
+        "\x00\x03" "abc" "\x00\x00";
+    size_t bytes_r;
+
+    init_state();
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_int_eq(LMQTT_ERROR_DECODE_CONNECT_INVALID_LENGTH, error);
+    ck_assert_int_eq(0, connect_count);
+}
+END_TEST
+
+START_TEST(should_fail_with_client_specific_packet)
+{
+    static const char buf[] = "\x20\x02\x00\x00";
+    size_t bytes_r;
+
+    init_state();
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_int_eq(LMQTT_ERROR_DECODE_FIXED_HEADER_CLIENT_SPECIFIC, error);
+}
+END_TEST
+
+START_TCASE("Rx buffer decode CONNECT")
+{
+    ADD_TEST(should_decode_connect_with_client_id);
+    ADD_TEST(should_decode_connect_with_all_fields);
+    ADD_TEST(should_decode_connect_byte_by_byte);
+    ADD_TEST(should_skip_strings_without_allocate_callback);
+    ADD_TEST(should_skip_ignored_strings);
+    ADD_TEST(should_fail_if_allocate_fails);
+    ADD_TEST(should_fail_if_connect_callback_fails);
+    ADD_TEST(should_fail_with_invalid_protocol_name);
+    ADD_TEST(should_fail_with_invalid_protocol_level);
+    ADD_TEST(should_fail_with_invalid_flags);
+    ADD_TEST(should_fail_if_string_exceeds_remaining_length);
+    ADD_TEST(should_fail_if_flagged_field_is_missing);
+    ADD_TEST(should_fail_with_trailing_bytes);
+    ADD_TEST(should_fail_with_client_specific_packet);
+}
+END_TCASE
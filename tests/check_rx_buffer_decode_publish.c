@@ -374,6 +374,64 @@ START_TEST(should_reply_to_publish_with_qos_2)
 }
 END_TEST
 
+START_TEST(should_queue_reply_in_ack_queue)
+{
+    lmqtt_ack_t ack_items[1];
+    lmqtt_ack_queue_t ack_queue;
+    lmqtt_ack_t ack;
+    init_state();
+
+    memset(&ack_queue, 0, sizeof(ack_queue));
+    ack_queue.items = ack_items;
+    ack_queue.capacity = 1;
+    state.ack_queue = &ack_queue;
+
+    state.internal.header.qos = 1;
+    do_decode_buffer("\x00\x01X\x02\x05X", 6);
+    do_decode_buffer("\x00\x01X\x02\x06X", 6);
+
+    ck_assert_int_eq(1, lmqtt_ack_queue_shift(&ack_queue, &ack));
+    ck_assert_uint_eq(0x40, ack.type);
+    ck_assert_uint_eq(0x0205, ack.packet_id);
+
+    /* the second reply did not fit in the queue */
+    ck_assert_int_eq(1, lmqtt_store_peek(&store, &kind, &value));
+    ck_assert_int_eq(LMQTT_KIND_PUBACK, kind);
+    ck_assert_int_eq(0x0206, value.packet_id);
+}
+END_TEST
+
+START_TEST(should_queue_reply_after_spilled_replies)
+{
+    lmqtt_ack_t ack_items[1];
+    lmqtt_ack_queue_t ack_queue;
+    lmqtt_ack_t ack;
+    init_state();
+
+    memset(&ack_queue, 0, sizeof(ack_queue));
+    ack_queue.items = ack_items;
+    ack_queue.capacity = 1;
+    state.ack_queue = &ack_queue;
+
+    state.internal.header.qos = 1;
+    do_decode_buffer("\x00\x01X\x02\x05X", 6);
+    do_decode_buffer("\x00\x01X\x02\x06X", 6);
+    ck_assert_uint_eq(1, ack_queue.spilled);
+
+    /* the queue has room again, but the reply must go after the one in the
+       store */
+    ck_assert_int_eq(1, lmqtt_ack_queue_shift(&ack_queue, &ack));
+    do_decode_buffer("\x00\x01X\x02\x07X", 6);
+    ck_assert_uint_eq(0, ack_queue.count);
+    ck_assert_uint_eq(2, ack_queue.spilled);
+
+    ck_assert_int_eq(1, lmqtt_store_shift(&store, &kind, &value));
+    ck_assert_int_eq(0x0206, value.packet_id);
+    ck_assert_int_eq(1, lmqtt_store_shift(&store, &kind, &value));
+    ck_assert_int_eq(0x0207, value.packet_id);
+}
+END_TEST
+
 START_TEST(should_call_callback_multiple_times_with_qos_1)
 {
     init_state();
@@ -636,6 +694,8 @@ START_TCASE("Rx buffer decode publish")
     ADD_TEST(should_not_reply_to_publish_with_qos_0);
     ADD_TEST(should_reply_to_publish_with_qos_1);
     ADD_TEST(should_reply_to_publish_with_qos_2);
+    ADD_TEST(should_queue_reply_in_ack_queue);
+    ADD_TEST(should_queue_reply_after_spilled_replies);
     ADD_TEST(should_call_callback_multiple_times_with_qos_1);
     ADD_TEST(should_not_call_callback_multiple_times_with_qos_2);
     ADD_TEST(should_call_allocate_callbacks);
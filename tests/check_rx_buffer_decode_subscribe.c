@@ -0,0 +1,391 @@
+#include "check_lightmqtt.h"
+
+#define ENTRY_COUNT 16
+#define SUBSCRIPTION_COUNT 8
+
+static lmqtt_rx_buffer_t state;
+static lmqtt_store_t store;
+static lmqtt_store_entry_t entries[ENTRY_COUNT];
+static lmqtt_message_callbacks_t message_callbacks;
+static lmqtt_request_callbacks_t request_callbacks;
+static lmqtt_subscription_t subscriptions[SUBSCRIPTION_COUNT];
+static char topics[SUBSCRIPTION_COUNT][64];
+static lmqtt_subscribe_t subscribe_received;
+static lmqtt_packet_id_t packet_id_received;
+static size_t max_count_received;
+static int subscribe_count;
+static int unsubscribe_count;
+static int disconnect_count;
+static int callback_retval;
+static int string_count;
+static lmqtt_error_t error;
+static int os_error;
+
+static int test_on_subscribe(void *data, lmqtt_packet_id_t packet_id,
+    lmqtt_subscribe_t *subscribe)
+{
+    packet_id_received = packet_id;
+    subscribe_received = *subscribe;
+    subscribe_count++;
+    return callback_retval;
+}
+
+static int test_on_unsubscribe(void *data, lmqtt_packet_id_t packet_id,
+    lmqtt_subscribe_t *subscribe)
+{
+    packet_id_received = packet_id;
+    subscribe_received = *subscribe;
+    unsubscribe_count++;
+    return callback_retval;
+}
+
+static int test_on_disconnect(void *data)
+{
+    disconnect_count++;
+    return callback_retval;
+}
+
+static lmqtt_allocate_result_t test_on_allocate_subscriptions(void *data,
+    lmqtt_subscribe_t *subscribe, size_t max_count)
+{
+    max_count_received = max_count;
+    if (max_count > SUBSCRIPTION_COUNT)
+        return LMQTT_ALLOCATE_ERROR;
+    subscribe->subscriptions = subscriptions;
+    return LMQTT_ALLOCATE_SUCCESS;
+}
+
+static lmqtt_allocate_result_t test_on_allocate_string(void *data,
+    lmqtt_string_t *str, size_t len)
+{
+    str->buf = topics[string_count++];
+    return LMQTT_ALLOCATE_SUCCESS;
+}
+
+static void init_state()
+{
+    memset(&state, 0, sizeof(state));
+    memset(&store, 0, sizeof(store));
+    memset(entries, 0, sizeof(entries));
+    memset(&message_callbacks, 0, sizeof(message_callbacks));
+    memset(&request_callbacks, 0, sizeof(request_callbacks));
+    memset(subscriptions, 0xcc, sizeof(subscriptions));
+    memset(topics, 0, sizeof(topics));
+    memset(&subscribe_received, 0, sizeof(subscribe_received));
+    state.store = &store;
+    state.message_callbacks = &message_callbacks;
+    state.server_role = 1;
+    state.request_callbacks = &request_callbacks;
+    request_callbacks.on_subscribe = &test_on_subscribe;
+    request_callbacks.on_unsubscribe = &test_on_unsubscribe;
+    request_callbacks.on_disconnect = &test_on_disconnect;
+    request_callbacks.on_allocate_subscriptions =
+        &test_on_allocate_subscriptions;
+    request_callbacks.on_allocate_string = &test_on_allocate_string;
+    store.get_time = &test_time_get;
+    store.entries = entries;
+    store.capacity = ENTRY_COUNT;
+    packet_id_received = 0;
+    max_count_received = 0;
+    subscribe_count = 0;
+    unsubscribe_count = 0;
+    disconnect_count = 0;
+    callback_retval = 1;
+    string_count = 0;
+    error = 0xcccc;
+    os_error = 0xcccc;
+}
+
+static lmqtt_io_result_t decode(const char *buf, size_t len, size_t *bytes_r)
+{
+    lmqtt_io_result_t res = lmqtt_rx_buffer_decode(&state,
+        (unsigned char *) buf, len, bytes_r);
+    error = lmqtt_rx_buffer_get_error(&state, &os_error);
+    return res;
+}
+
+START_TEST(should_decode_subscribe)
+{
+    static const char buf[] = "\x82\x0d\x01\x02" "\x00\x03" "a/b" "\x01"
+        "\x00\x02" "c#" "\x02";
+    size_t bytes_r;
+
+    init_state();
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_uint_eq(sizeof(buf) - 1, bytes_r);
+
+    ck_assert_int_eq(1, subscribe_count);
+    ck_assert_uint_eq(0x0102, packet_id_received);
+    ck_assert_uint_eq(2, max_count_received);
+    ck_assert_int_eq(2, subscribe_received.count);
+    ck_assert_ptr_eq(subscriptions, subscribe_received.subscriptions);
+    ck_assert_int_eq(3, subscriptions[0].topic.len);
+    ck_assert_str_eq("a/b", subscriptions[0].topic.buf);
+    ck_assert_int_eq(LMQTT_QOS_1, subscriptions[0].requested_qos);
+    ck_assert_int_eq(2, subscriptions[1].topic.len);
+    ck_assert_str_eq("c#", subscriptions[1].topic.buf);
+    ck_assert_int_eq(LMQTT_QOS_2, subscriptions[1].requested_qos);
+
+    /* SUBACK is queued by the user from the callback */
+    ck_assert_int_eq(0, lmqtt_store_count(&store));
+}
+END_TEST
+
+START_TEST(should_decode_subscribe_byte_by_byte)
+{
+    static const char buf[] = "\x82\x0d\x01\x02" "\x00\x03" "a/b" "\x01"
+        "\x00\x02" "c#" "\x02";
+    size_t bytes_r;
+    size_t i;
+
+    init_state();
+
+    for (i = 0; i < sizeof(buf) - 1; i++) {
+        ck_assert_int_eq(LMQTT_IO_SUCCESS, decode(&buf[i], 1, &bytes_r));
+        ck_assert_uint_eq(1, bytes_r);
+    }
+
+    ck_assert_int_eq(1, subscribe_count);
+    ck_assert_int_eq(2, subscribe_received.count);
+    ck_assert_str_eq("a/b", subscriptions[0].topic.buf);
+    ck_assert_str_eq("c#", subscriptions[1].topic.buf);
+}
+END_TEST
+
+START_TEST(should_skip_topics_without_allocate_callback)
+{
+    static const char buf[] = "\x82\x08\x01\x02" "\x00\x03" "a/b" "\x01";
+    size_t bytes_r;
+
+    init_state();
+    request_callbacks.on_allocate_subscriptions = NULL;
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_uint_eq(sizeof(buf) - 1, bytes_r);
+
+    ck_assert_int_eq(1, subscribe_count);
+    ck_assert_int_eq(0, subscribe_received.count);
+    ck_assert_ptr_eq(NULL, subscribe_received.subscriptions);
+}
+END_TEST
+
+START_TEST(should_fail_if_subscriptions_allocate_fails)
+{
+    char buf[64] = "\x82\x2a\x01\x02";
+    size_t bytes_r;
+    int i;
+
+    /* 10 one-byte topics */
+    for (i = 0; i < 10; i++)
+        memcpy(&buf[4 + i * 4], "\x00\x01x\x00", 4);
+
+    init_state();
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, decode(buf, 44, &bytes_r));
+    ck_assert_uint_eq(10, max_count_received);
+    ck_assert_int_eq(LMQTT_ERROR_DECODE_REQUEST_ALLOCATE_FAILED, error);
+    ck_assert_int_eq(0, subscribe_count);
+}
+END_TEST
+
+START_TEST(should_fail_with_invalid_requested_qos)
+{
+    static const char buf[] = "\x82\x08\x01\x02" "\x00\x03" "a/b" "\x03";
+    size_t bytes_r;
+
+    init_state();
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_int_eq(LMQTT_ERROR_DECODE_SUBSCRIBE_INVALID_QOS, error);
+    ck_assert_int_eq(0, subscribe_count);
+}
+END_TEST
+
+START_TEST(should_fail_with_empty_topic)
+{
+    static const char buf[] = "\x82\x08\x01\x02" "\x00\x00" "\x01\x00\x00\x01";
+    size_t bytes_r;
+
+    init_state();
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_int_eq(LMQTT_ERROR_DECODE_SUBSCRIBE_INVALID_LENGTH, error);
+}
+END_TEST
+
+START_TEST(should_fail_with_truncated_subscription)
+{
+    static const char buf[] = "\x82\x0a\x01\x02" "\x00\x03" "a/b" "\x01"
+        "\x00\x01";
+    size_t bytes_r;
+
+    init_state();
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_int_eq(LMQTT_ERROR_DECODE_SUBSCRIBE_INVALID_LENGTH, error);
+    ck_assert_int_eq(0, subscribe_count);
+}
+END_TEST
+
+START_TEST(should_fail_if_subscribe_callback_fails)
+{
+    static const char buf[] = "\x82\x08\x01\x02" "\x00\x03" "a/b" "\x01";
+    size_t bytes_r;
+
+    init_state();
+    callback_retval = 0;
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_int_eq(LMQTT_ERROR_CALLBACK_SUBSCRIBE, error);
+}
+END_TEST
+
+START_TEST(should_decode_unsubscribe_and_reply)
+{
+    static const char buf[] = "\xa2\x0b\x01\x02" "\x00\x03" "a/b"
+        "\x00\x02" "c#";
+    size_t bytes_r;
+    int kind;
+    lmqtt_store_value_t value;
+
+    init_state();
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_uint_eq(sizeof(buf) - 1, bytes_r);
+
+    ck_assert_int_eq(1, unsubscribe_count);
+    ck_assert_uint_eq(3, max_count_received);
+    ck_assert_int_eq(2, subscribe_received.count);
+    ck_assert_str_eq("a/b", subscriptions[0].topic.buf);
+    ck_assert_str_eq("c#", subscriptions[1].topic.buf);
+
+    ck_assert_int_eq(1, lmqtt_store_shift(&store, &kind, &value));
+    ck_assert_int_eq(LMQTT_KIND_UNSUBACK, kind);
+    ck_assert_uint_eq(0x0102, value.packet_id);
+}
+END_TEST
+
+START_TEST(should_not_reply_if_unsubscribe_callback_fails)
+{
+    static const char buf[] = "\xa2\x07\x01\x02" "\x00\x03" "a/b";
+    size_t bytes_r;
+
+    init_state();
+    callback_retval = 0;
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_int_eq(LMQTT_ERROR_CALLBACK_UNSUBSCRIBE, error);
+    ck_assert_int_eq(0, lmqtt_store_count(&store));
+}
+END_TEST
+
+START_TEST(should_reply_to_pingreq)
+{
+    static const char buf[] = "\xc0\x00\xc0\x00";
+    size_t bytes_r;
+    int kind;
+    lmqtt_store_value_t value;
+
+    init_state();
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_uint_eq(4, bytes_r);
+
+    ck_assert_int_eq(1, lmqtt_store_shift(&store, &kind, &value));
+    ck_assert_int_eq(LMQTT_KIND_PINGRESP, kind);
+    ck_assert_int_eq(1, lmqtt_store_shift(&store, &kind, &value));
+    ck_assert_int_eq(LMQTT_KIND_PINGRESP, kind);
+    ck_assert_int_eq(0, lmqtt_store_shift(&store, &kind, &value));
+}
+END_TEST
+
+START_TEST(should_fail_if_store_is_full_on_pingreq)
+{
+    static const char buf[] = "\xc0\x00";
+    size_t bytes_r;
+
+    init_state();
+    store.capacity = 0;
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_int_eq(LMQTT_ERROR_DECODE_REQUEST_STORE_FULL, error);
+}
+END_TEST
+
+START_TEST(should_fail_with_nonzero_pingreq_length)
+{
+    static const char buf[] = "\xc0\x01\x00";
+    size_t bytes_r;
+
+    init_state();
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_int_eq(LMQTT_ERROR_DECODE_NONZERO_REMAINING_LENGTH, error);
+    ck_assert_int_eq(0, lmqtt_store_count(&store));
+}
+END_TEST
+
+START_TEST(should_decode_disconnect)
+{
+    static const char buf[] = "\xe0\x00";
+    size_t bytes_r;
+
+    init_state();
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_int_eq(1, disconnect_count);
+}
+END_TEST
+
+START_TEST(should_fail_if_disconnect_callback_fails)
+{
+    static const char buf[] = "\xe0\x00";
+    size_t bytes_r;
+
+    init_state();
+    callback_retval = 0;
+
+    ck_assert_int_eq(LMQTT_IO_ERROR, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_int_eq(LMQTT_ERROR_CALLBACK_DISCONNECT, error);
+}
+END_TEST
+
+START_TEST(should_decode_publish_in_server_role)
+{
+    static const char buf[] = "\x32\x06\x00\x01" "t" "\x0a\x0b" "p";
+    size_t bytes_r;
+    int kind;
+    lmqtt_store_value_t value;
+
+    init_state();
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, decode(buf, sizeof(buf) - 1, &bytes_r));
+    ck_assert_uint_eq(sizeof(buf) - 1, bytes_r);
+
+    ck_assert_int_eq(1, lmqtt_store_shift(&store, &kind, &value));
+    ck_assert_int_eq(LMQTT_KIND_PUBACK, kind);
+    ck_assert_uint_eq(0x0a0b, value.packet_id);
+}
+END_TEST
+
+START_TCASE("Rx buffer decode SUBSCRIBE")
+{
+    ADD_TEST(should_decode_subscribe);
+    ADD_TEST(should_decode_subscribe_byte_by_byte);
+    ADD_TEST(should_skip_topics_without_allocate_callback);
+    ADD_TEST(should_fail_if_subscriptions_allocate_fails);
+    ADD_TEST(should_fail_with_invalid_requested_qos);
+    ADD_TEST(should_fail_with_empty_topic);
+    ADD_TEST(should_fail_with_truncated_subscription);
+    ADD_TEST(should_fail_if_subscribe_callback_fails);
+    ADD_TEST(should_decode_unsubscribe_and_reply);
+    ADD_TEST(should_not_reply_if_unsubscribe_callback_fails);
+    ADD_TEST(should_reply_to_pingreq);
+    ADD_TEST(should_fail_if_store_is_full_on_pingreq);
+    ADD_TEST(should_fail_with_nonzero_pingreq_length);
+    ADD_TEST(should_decode_disconnect);
+    ADD_TEST(should_fail_if_disconnect_callback_fails);
+    ADD_TEST(should_decode_publish_in_server_role);
+}
+END_TCASE
@@ -534,6 +534,82 @@ START_TEST(should_not_delete_nonexistent_item)
 }
 END_TEST
 
+START_TEST(should_replace_item_at_position)
+{
+    PREPARE;
+
+    value_in.packet_id = 1;
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1, &value_in);
+    value_in.packet_id = 2;
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1, &value_in);
+
+    value_in.packet_id = 3;
+    res = lmqtt_store_replace_at(&store, 1, LMQTT_KIND_PUBLISH_0, &value_in);
+    ck_assert_int_eq(1, res);
+    ck_assert_int_eq(2, lmqtt_store_count(&store));
+
+    res = lmqtt_store_get_at(&store, 1, &kind, &value_out);
+    ck_assert_int_eq(1, res);
+    ck_assert_int_eq(LMQTT_KIND_PUBLISH_0, kind);
+    ck_assert_uint_eq(3, value_out.packet_id);
+}
+END_TEST
+
+START_TEST(should_not_replace_nonexistent_item)
+{
+    PREPARE;
+
+    value_in.packet_id = 1;
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1, &value_in);
+
+    res = lmqtt_store_replace_at(&store, 1, LMQTT_KIND_PUBLISH_1, &value_in);
+    ck_assert_int_eq(0, res);
+    ck_assert_int_eq(1, lmqtt_store_count(&store));
+}
+END_TEST
+
+START_TEST(should_move_item_to_current_position)
+{
+    PREPARE;
+
+    value_in.packet_id = 1;
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1, &value_in);
+    value_in.packet_id = 2;
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1, &value_in);
+    value_in.packet_id = 3;
+    lmqtt_store_append(&store, LMQTT_KIND_PUBACK, &value_in);
+    lmqtt_store_mark_current(&store);
+
+    res = lmqtt_store_move_to_current(&store, 2);
+    ck_assert_int_eq(1, res);
+
+    res = lmqtt_store_peek(&store, &kind, &value_out);
+    ck_assert_int_eq(1, res);
+    ck_assert_int_eq(LMQTT_KIND_PUBACK, kind);
+    ck_assert_uint_eq(3, value_out.packet_id);
+
+    res = lmqtt_store_get_at(&store, 2, &kind, &value_out);
+    ck_assert_int_eq(1, res);
+    ck_assert_uint_eq(2, value_out.packet_id);
+    ck_assert_int_eq(3, lmqtt_store_count(&store));
+}
+END_TEST
+
+START_TEST(should_not_move_marked_item_to_current_position)
+{
+    PREPARE;
+
+    value_in.packet_id = 1;
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1, &value_in);
+    value_in.packet_id = 2;
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1, &value_in);
+    lmqtt_store_mark_current(&store);
+
+    ck_assert_int_eq(0, lmqtt_store_move_to_current(&store, 0));
+    ck_assert_int_eq(0, lmqtt_store_move_to_current(&store, 2));
+}
+END_TEST
+
 START_TEST(should_get_timeout_before_touch)
 {
     PREPARE;
@@ -588,6 +664,181 @@ START_TEST(should_get_timeout_after_touch_with_zeroed_keep_alive)
 }
 END_TEST
 
+START_TEST(should_keep_entries_within_given_memory)
+{
+    lmqtt_store_entry_t guarded[3];
+    unsigned char guard[sizeof(guarded[2])];
+    PREPARE;
+
+    memset(guarded, 0, sizeof(guarded));
+    memset(&guarded[2], 0xcc, sizeof(guarded[2]));
+    memset(guard, 0xcc, sizeof(guard));
+    store.entries = guarded;
+    store.capacity = 2;
+
+    value_in.packet_id = 0xffff;
+    value_in.value = &data[0];
+    ck_assert_int_eq(1, lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1,
+        &value_in));
+    value_in.value = &data[1];
+    ck_assert_int_eq(1, lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_2,
+        &value_in));
+    ck_assert_int_eq(0, lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1,
+        &value_in));
+    ck_assert_int_eq(1, lmqtt_store_move_to_current(&store, 1));
+    ck_assert_int_eq(1, lmqtt_store_mark_current(&store));
+    ck_assert_int_eq(1, lmqtt_store_mark_current(&store));
+
+    ck_assert_int_eq(1, lmqtt_store_pop_marked_by(&store,
+        LMQTT_KIND_PUBLISH_1, 0xffff, &value_out));
+    ck_assert_ptr_eq(&data[0], value_out.value);
+    ck_assert_int_eq(1, lmqtt_store_shift(&store, &kind, &value_out));
+    ck_assert_int_eq(LMQTT_KIND_PUBLISH_2, kind);
+    ck_assert_ptr_eq(&data[1], value_out.value);
+    ck_assert_uint_eq(0xffff, value_out.packet_id);
+
+    ck_assert_int_eq(0, memcmp(guard, &guarded[2], sizeof(guard)));
+}
+END_TEST
+
+START_TEST(should_keep_fifo_order_after_wrapping_around)
+{
+    int i;
+    PREPARE;
+
+    store.capacity = 4;
+
+    /* leave the oldest entry at the end of the arrays */
+    for (i = 0; i < 3; i++) {
+        value_in.value = &data[i];
+        ck_assert_int_eq(1, lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_0,
+            &value_in));
+        ck_assert_int_eq(1, lmqtt_store_shift(&store, &kind, &value_out));
+    }
+
+    for (i = 3; i < 7; i++) {
+        value_in.value = &data[i];
+        ck_assert_int_eq(1, lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_0,
+            &value_in));
+    }
+    ck_assert_int_eq(0, lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_0,
+        &value_in));
+
+    for (i = 3; i < 7; i++) {
+        ck_assert_int_eq(1, lmqtt_store_shift(&store, &kind, &value_out));
+        ck_assert_ptr_eq(&data[i], value_out.value);
+    }
+    ck_assert_int_eq(0, lmqtt_store_shift(&store, &kind, &value_out));
+}
+END_TEST
+
+START_TEST(should_delete_from_both_halves_after_wrapping_around)
+{
+    int i;
+    PREPARE;
+
+    store.capacity = 5;
+
+    for (i = 0; i < 3; i++) {
+        ck_assert_int_eq(1, lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_0,
+            &value_in));
+        ck_assert_int_eq(1, lmqtt_store_shift(&store, &kind, &value_out));
+    }
+
+    for (i = 0; i < 5; i++) {
+        value_in.packet_id = i;
+        value_in.value = &data[i];
+        ck_assert_int_eq(1, lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1,
+            &value_in));
+        ck_assert_int_eq(1, lmqtt_store_mark_current(&store));
+    }
+
+    /* near the oldest entry */
+    ck_assert_int_eq(1, lmqtt_store_pop_marked_by(&store,
+        LMQTT_KIND_PUBLISH_1, 1, &value_out));
+    ck_assert_ptr_eq(&data[1], value_out.value);
+    /* near the newest entry */
+    ck_assert_int_eq(1, lmqtt_store_pop_marked_by(&store,
+        LMQTT_KIND_PUBLISH_1, 3, &value_out));
+    ck_assert_ptr_eq(&data[3], value_out.value);
+    ck_assert_int_eq(3, lmqtt_store_count(&store));
+    ck_assert_int_eq(3, store.pos);
+
+    ck_assert_int_eq(1, lmqtt_store_shift(&store, &kind, &value_out));
+    ck_assert_ptr_eq(&data[0], value_out.value);
+    ck_assert_int_eq(1, lmqtt_store_shift(&store, &kind, &value_out));
+    ck_assert_ptr_eq(&data[2], value_out.value);
+    ck_assert_int_eq(1, lmqtt_store_shift(&store, &kind, &value_out));
+    ck_assert_ptr_eq(&data[4], value_out.value);
+    ck_assert_uint_eq(4, value_out.packet_id);
+}
+END_TEST
+
+START_TEST(should_move_item_to_current_position_after_wrapping_around)
+{
+    int i;
+    PREPARE;
+
+    store.capacity = 4;
+
+    for (i = 0; i < 3; i++) {
+        ck_assert_int_eq(1, lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_0,
+            &value_in));
+        ck_assert_int_eq(1, lmqtt_store_shift(&store, &kind, &value_out));
+    }
+
+    for (i = 0; i < 4; i++) {
+        value_in.value = &data[i];
+        ck_assert_int_eq(1, lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_0,
+            &value_in));
+    }
+    ck_assert_int_eq(1, lmqtt_store_mark_current(&store));
+    ck_assert_int_eq(1, lmqtt_store_move_to_current(&store, 3));
+
+    ck_assert_int_eq(1, lmqtt_store_peek(&store, &kind, &value_out));
+    ck_assert_ptr_eq(&data[3], value_out.value);
+    ck_assert_int_eq(1, lmqtt_store_get_at(&store, 2, &kind, &value_out));
+    ck_assert_ptr_eq(&data[1], value_out.value);
+    ck_assert_int_eq(1, lmqtt_store_get_at(&store, 3, &kind, &value_out));
+    ck_assert_ptr_eq(&data[2], value_out.value);
+}
+END_TEST
+
+START_TEST(should_count_inflight_messages)
+{
+    PREPARE;
+
+    value_in.packet_id = 1;
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1, &value_in);
+    value_in.packet_id = 2;
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_2, &value_in);
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_0, &value_in);
+    ck_assert_uint_eq(0, lmqtt_store_count_inflight(&store));
+
+    lmqtt_store_mark_current(&store);
+    lmqtt_store_mark_current(&store);
+    ck_assert_uint_eq(2, lmqtt_store_count_inflight(&store));
+
+    /* PUBREC: the QoS 2 message stays in flight until PUBCOMP */
+    lmqtt_store_pop_marked_by(&store, LMQTT_KIND_PUBLISH_2, 2, &value_out);
+    lmqtt_store_append(&store, LMQTT_KIND_PUBREL, &value_out);
+    ck_assert_uint_eq(2, lmqtt_store_count_inflight(&store));
+
+    lmqtt_store_unmark_all(&store);
+    ck_assert_uint_eq(1, lmqtt_store_count_inflight(&store));
+
+    lmqtt_store_mark_current(&store);
+    lmqtt_store_pop_marked_by(&store, LMQTT_KIND_PUBLISH_1, 1, &value_out);
+    ck_assert_uint_eq(1, lmqtt_store_count_inflight(&store));
+
+    lmqtt_store_drop_current(&store);
+    lmqtt_store_mark_current(&store);
+    ck_assert_uint_eq(1, lmqtt_store_count_inflight(&store));
+    lmqtt_store_pop_marked_by(&store, LMQTT_KIND_PUBREL, 2, &value_out);
+    ck_assert_uint_eq(0, lmqtt_store_count_inflight(&store));
+}
+END_TEST
+
 START_TCASE("Store")
 {
     ADD_TEST(should_get_id);
@@ -618,8 +869,17 @@ START_TCASE("Store")
     ADD_TEST(should_not_get_nonexistent_item);
     ADD_TEST(should_delete_item_at_position);
     ADD_TEST(should_not_delete_nonexistent_item);
+    ADD_TEST(should_replace_item_at_position);
+    ADD_TEST(should_not_replace_nonexistent_item);
+    ADD_TEST(should_move_item_to_current_position);
+    ADD_TEST(should_not_move_marked_item_to_current_position);
     ADD_TEST(should_get_timeout_before_touch);
     ADD_TEST(should_get_timeout_after_touch);
     ADD_TEST(should_get_timeout_after_touch_with_zeroed_keep_alive);
+    ADD_TEST(should_keep_entries_within_given_memory);
+    ADD_TEST(should_keep_fifo_order_after_wrapping_around);
+    ADD_TEST(should_delete_from_both_halves_after_wrapping_around);
+    ADD_TEST(should_move_item_to_current_position_after_wrapping_around);
+    ADD_TEST(should_count_inflight_messages);
 }
 END_TCASE
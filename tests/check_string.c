@@ -353,6 +353,122 @@ START_TEST(should_reset_start_position_before_encoding_first_char)
 }
 END_TEST
 
+START_TEST(should_read_chars_from_segments)
+{
+    char buf[6];
+    lmqtt_string_segment_t segments[3];
+    lmqtt_string_t str;
+    lmqtt_string_result_t res;
+    size_t cnt = 0xcccc;
+    int os_error = 0xcccc;
+
+    memset(buf, 0, sizeof(buf));
+    memset(&str, 0, sizeof(str));
+
+    segments[0].buf = "ab";
+    segments[0].len = 2;
+    segments[1].buf = "";
+    segments[1].len = 0;
+    segments[2].buf = "cdef";
+    segments[2].len = 4;
+    lmqtt_string_set_segments(&str, segments, 3);
+    ck_assert_int_eq(6, str.len);
+
+    res = string_read(&str, (unsigned char *) &buf[0], 3, &cnt, &os_error);
+    ck_assert_int_eq(LMQTT_STRING_SUCCESS, res);
+    ck_assert_int_eq(3, cnt);
+    ck_assert_int_eq(0, os_error);
+    res = string_read(&str, (unsigned char *) &buf[3], 3, &cnt, &os_error);
+    ck_assert_int_eq(LMQTT_STRING_SUCCESS, res);
+    ck_assert_int_eq(3, cnt);
+    ck_assert_int_eq(0, memcmp("abcdef", buf, 6));
+}
+END_TEST
+
+START_TEST(should_write_chars_to_segments)
+{
+    char buf1[2];
+    char buf2[3];
+    lmqtt_string_segment_t segments[2];
+    lmqtt_string_t str;
+    lmqtt_string_result_t res;
+    size_t cnt = 0xcccc;
+    int os_error = 0xcccc;
+
+    memset(&str, 0, sizeof(str));
+
+    segments[0].buf = buf1;
+    segments[0].len = sizeof(buf1);
+    segments[1].buf = buf2;
+    segments[1].len = sizeof(buf2);
+    lmqtt_string_set_segments(&str, segments, 2);
+
+    res = string_write(&str, (unsigned char *) "a", 1, &cnt, &os_error);
+    ck_assert_int_eq(LMQTT_STRING_SUCCESS, res);
+    ck_assert_int_eq(1, cnt);
+    res = string_write(&str, (unsigned char *) "bcde", 4, &cnt, &os_error);
+    ck_assert_int_eq(LMQTT_STRING_SUCCESS, res);
+    ck_assert_int_eq(4, cnt);
+    ck_assert_int_eq(0, memcmp("ab", buf1, 2));
+    ck_assert_int_eq(0, memcmp("cde", buf2, 3));
+}
+END_TEST
+
+START_TEST(should_not_read_chars_from_segments_with_buffer)
+{
+    char buf[3];
+    lmqtt_string_segment_t segment;
+    lmqtt_string_t str;
+    lmqtt_string_result_t res;
+    size_t cnt = 0xcccc;
+    int os_error = 0xcccc;
+
+    memset(&str, 0, sizeof(str));
+
+    segment.buf = "abc";
+    segment.len = 3;
+    lmqtt_string_set_segments(&str, &segment, 1);
+    str.buf = "abc";
+
+    res = string_read(&str, (unsigned char *) buf, 3, &cnt, &os_error);
+    ck_assert_int_eq(LMQTT_STRING_INVALID_OBJECT, res);
+    ck_assert_int_eq(0, cnt);
+}
+END_TEST
+
+START_TEST(should_encode_segmented_string_in_parts)
+{
+    char buf[4];
+    lmqtt_string_segment_t segments[2];
+    lmqtt_string_t str;
+    lmqtt_encode_buffer_t enc_buf;
+    int res;
+    size_t bytes_w = (size_t) -1;
+
+    memset(buf, 0, sizeof(buf));
+    memset(&str, 0, sizeof(str));
+    memset(&enc_buf, 0, sizeof(enc_buf));
+
+    segments[0].buf = "abc";
+    segments[0].len = 3;
+    segments[1].buf = "de";
+    segments[1].len = 2;
+    lmqtt_string_set_segments(&str, segments, 2);
+
+    res = string_encode(&str, 1, 1, 0, (unsigned char *) buf, sizeof(buf),
+        &bytes_w, &enc_buf);
+    ck_assert_int_eq(LMQTT_ENCODE_CONTINUE, res);
+    ck_assert_int_eq(4, bytes_w);
+    ck_assert_int_eq(0, memcmp("\x00\x05" "ab", buf, 4));
+
+    res = string_encode(&str, 1, 1, 4, (unsigned char *) buf, sizeof(buf),
+        &bytes_w, &enc_buf);
+    ck_assert_int_eq(LMQTT_ENCODE_FINISHED, res);
+    ck_assert_int_eq(3, bytes_w);
+    ck_assert_int_eq(0, memcmp("cde", buf, 3));
+}
+END_TEST
+
 START_TCASE("String")
 {
     ADD_TEST(should_write_chars_to_buffer);
@@ -372,5 +488,10 @@ START_TCASE("String")
     ADD_TEST(should_encode_string_with_blocking_read);
     ADD_TEST(should_encode_string_with_read_error);
     ADD_TEST(should_reset_start_position_before_encoding_first_char);
+
+    ADD_TEST(should_read_chars_from_segments);
+    ADD_TEST(should_write_chars_to_segments);
+    ADD_TEST(should_not_read_chars_from_segments_with_buffer);
+    ADD_TEST(should_encode_segmented_string_in_parts);
 }
 END_TCASE
@@ -86,6 +86,99 @@ START_TEST(should_get_time_with_zeroed_keep_alive)
 }
 END_TEST
 
+START_TEST(should_get_time_until_timeout_in_milliseconds)
+{
+    lmqtt_time_t time = { 10, 700e6 };
+    long secs, nsecs;
+
+    test_time_set(11, 0);
+    ck_assert_int_eq(1, lmqtt_time_get_timeout_to_msecs(
+        &time, test_time_get, 1500, &secs, &nsecs));
+
+    ck_assert_int_eq(1, secs);
+    ck_assert_int_eq(200e6, nsecs);
+}
+END_TEST
+
+START_TEST(should_get_elapsed_time)
+{
+    lmqtt_time_t time = { 10, 700e6 };
+    long secs, nsecs;
+
+    test_time_set(13, 500e6);
+    lmqtt_time_get_elapsed(&time, test_time_get, &secs, &nsecs);
+
+    ck_assert_int_eq(2, secs);
+    ck_assert_int_eq(800e6, nsecs);
+}
+END_TEST
+
+START_TEST(should_acquire_rate_limiter_burst)
+{
+    lmqtt_rate_limiter_t limiter;
+    long secs, nsecs;
+
+    test_time_set(10, 0);
+    lmqtt_rate_limiter_initialize(&limiter, test_time_get, 2, 3);
+
+    ck_assert_int_eq(1, lmqtt_rate_limiter_acquire(&limiter, &secs, &nsecs));
+    ck_assert_int_eq(1, lmqtt_rate_limiter_acquire(&limiter, &secs, &nsecs));
+    ck_assert_int_eq(1, lmqtt_rate_limiter_acquire(&limiter, &secs, &nsecs));
+    ck_assert_int_eq(0, lmqtt_rate_limiter_acquire(&limiter, &secs, &nsecs));
+
+    ck_assert_int_eq(0, secs);
+    ck_assert_int_eq(500e6, nsecs);
+}
+END_TEST
+
+START_TEST(should_refill_rate_limiter)
+{
+    lmqtt_rate_limiter_t limiter;
+    long secs, nsecs;
+
+    test_time_set(10, 0);
+    lmqtt_rate_limiter_initialize(&limiter, test_time_get, 2, 1);
+    ck_assert_int_eq(1, lmqtt_rate_limiter_acquire(&limiter, &secs, &nsecs));
+
+    test_time_set(10, 300e6);
+    ck_assert_int_eq(0, lmqtt_rate_limiter_acquire(&limiter, &secs, &nsecs));
+    ck_assert_int_eq(0, secs);
+    ck_assert_int_eq(200e6, nsecs);
+
+    test_time_set(10, 500e6);
+    ck_assert_int_eq(1, lmqtt_rate_limiter_acquire(&limiter, &secs, &nsecs));
+
+    /* never more than the burst */
+    test_time_set(100, 0);
+    ck_assert_int_eq(1, lmqtt_rate_limiter_acquire(&limiter, &secs, &nsecs));
+    ck_assert_int_eq(0, lmqtt_rate_limiter_acquire(&limiter, &secs, &nsecs));
+}
+END_TEST
+
+START_TEST(should_refill_rate_limiter_after_long_idle_time)
+{
+    lmqtt_rate_limiter_t limiter;
+    long secs, nsecs;
+    long i;
+
+    test_time_set(10, 0);
+    lmqtt_rate_limiter_initialize(&limiter, test_time_get, 65535, 65535);
+    for (i = 0; i < 65535; i++)
+        ck_assert_int_eq(1, lmqtt_rate_limiter_acquire(&limiter, &secs,
+            &nsecs));
+    ck_assert_int_eq(0, lmqtt_rate_limiter_acquire(&limiter, &secs, &nsecs));
+
+    /* the refill is far larger than the bucket */
+    test_time_set(10 + 40L * 24 * 3600, 0);
+    for (i = 0; i < 65535; i++)
+        ck_assert_int_eq(1, lmqtt_rate_limiter_acquire(&limiter, &secs,
+            &nsecs));
+    ck_assert_int_eq(0, lmqtt_rate_limiter_acquire(&limiter, &secs, &nsecs));
+    ck_assert_int_eq(0, secs);
+    ck_assert_int_eq(1e6, nsecs);
+}
+END_TEST
+
 START_TCASE("Time")
 {
     ADD_TEST(should_get_integral_time_until_keep_alive);
@@ -94,5 +187,10 @@ START_TCASE("Time")
     ADD_TEST(should_get_time_until_expired_keep_alive);
     ADD_TEST(should_get_time_until_keep_alive_at_expiration_time);
     ADD_TEST(should_get_time_with_zeroed_keep_alive);
+    ADD_TEST(should_get_time_until_timeout_in_milliseconds);
+    ADD_TEST(should_get_elapsed_time);
+    ADD_TEST(should_acquire_rate_limiter_burst);
+    ADD_TEST(should_refill_rate_limiter);
+    ADD_TEST(should_refill_rate_limiter_after_long_idle_time);
 }
 END_TCASE
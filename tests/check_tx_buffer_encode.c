@@ -78,6 +78,14 @@ lmqtt_encoder_finder_t tx_buffer_finder_by_kind_mock(
     return test_finder_func;
 }
 
+/* the test encoders replace whole packets, which must not take the fast
+   path */
+lmqtt_fast_encoder_t tx_buffer_fast_encoder_by_kind_mock(
+    lmqtt_kind_t kind)
+{
+    return NULL;
+}
+
 static lmqtt_encode_result_t encode_test_0_9(lmqtt_store_value_t *value,
     lmqtt_encode_buffer_t *encode_buffer, size_t offset, unsigned char *buf,
     size_t buf_len, size_t *bytes_written)
@@ -108,6 +116,25 @@ static lmqtt_encode_result_t encode_test_fail(lmqtt_store_value_t *value,
     return LMQTT_ENCODE_ERROR;
 }
 
+/* builds a 3-byte header from the packet id, e.g. (70, 71, 72) for id 7 */
+static void build_test_header(lmqtt_store_value_t *value,
+    lmqtt_encode_buffer_t *encode_buffer)
+{
+    size_t i;
+
+    for (i = 0; i < 3; i++)
+        encode_buffer->buf[i] = value->packet_id * 10 + i;
+    encode_buffer->buf_len = 3;
+}
+
+static lmqtt_encode_result_t encode_test_header(lmqtt_store_value_t *value,
+    lmqtt_encode_buffer_t *encode_buffer, size_t offset, unsigned char *buf,
+    size_t buf_len, size_t *bytes_written)
+{
+    return encode_buffer_encode(encode_buffer, value, build_test_header,
+        offset, buf, buf_len, bytes_written);
+}
+
 START_TEST(should_encode_tx_buffer_with_one_encoding_function)
 {
     PREPARE;
@@ -448,9 +475,45 @@ START_TEST(should_clear_encoder_state_after_reset)
 }
 END_TEST
 
+START_TEST(should_finish_built_header_before_qos_0_ring)
+{
+    lmqtt_publish_t publish;
+    lmqtt_publish_t *items[1];
+    lmqtt_publish_ring_t ring;
+
+    PREPARE;
+    memset(&publish, 0, sizeof(publish));
+    memset(&ring, 0, sizeof(ring));
+    ring.items = items;
+    ring.capacity = 1;
+
+    encoders[0] = encode_test_header;
+    value.packet_id = 7;
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1, &value);
+
+    res = lmqtt_tx_buffer_encode(&state, buf, 0, &bytes_w);
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(0, bytes_w);
+
+    state.qos0_ring = &ring;
+    lmqtt_publish_ring_push(&ring, &publish);
+
+    res = lmqtt_tx_buffer_encode(&state, buf, sizeof(buf), &bytes_w);
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(6, bytes_w);
+
+    ck_assert_uint_eq(70, buf[0]);
+    ck_assert_uint_eq(72, buf[2]);
+    ck_assert_uint_eq(0, buf[3]);
+    ck_assert_uint_eq(2, buf[5]);
+    ck_assert_uint_eq(BUF_PLACEHOLDER, buf[6]);
+}
+END_TEST
+
 START_TCASE("Tx buffer encode")
 {
     tx_buffer_finder_by_kind = &tx_buffer_finder_by_kind_mock;
+    tx_buffer_fast_encoder_by_kind = &tx_buffer_fast_encoder_by_kind_mock;
 
     ADD_TEST(should_encode_tx_buffer_with_one_encoding_function);
     ADD_TEST(should_encode_tx_buffer_with_two_encoding_functions);
@@ -469,5 +532,6 @@ START_TCASE("Tx buffer encode")
     ADD_TEST(should_not_process_packets_after_disconnect);
     ADD_TEST(should_track_connect_packet);
     ADD_TEST(should_clear_encoder_state_after_reset);
+    ADD_TEST(should_finish_built_header_before_qos_0_ring);
 }
 END_TCASE
@@ -269,6 +269,169 @@ START_TEST(should_handle_publish_callback_failure_with_qos_0)
 }
 END_TEST
 
+START_TEST(should_drop_expired_publish_with_qos_0)
+{
+    lmqtt_publish_t publish;
+    void *data = NULL;
+
+    PREPARE;
+    memset(&publish, 0, sizeof(publish));
+    publish.topic.buf = "topic";
+    publish.topic.len = strlen(publish.topic.buf);
+    publish.expiry = 2;
+    test_time_set(10, 0);
+    lmqtt_time_touch(&publish.internal.queued_at, &test_time_get);
+
+    value.value = &publish;
+    value.callback = (lmqtt_store_entry_callback_t) &test_on_publish;
+    value.callback_data = &data;
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_0, &value);
+    lmqtt_store_append(&store, LMQTT_KIND_PINGREQ, NULL);
+
+    test_time_set(12, 1);
+    res = lmqtt_tx_buffer_encode(&state, (unsigned char *) buf, sizeof(buf),
+        &bytes_written);
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(2, bytes_written);
+    ck_assert_int_eq('\xc0', buf[0]);
+    ck_assert_ptr_eq(&publish, data);
+    ck_assert_int_eq(LMQTT_PUBLISH_STATUS_EXPIRED, publish.response.status);
+}
+END_TEST
+
+START_TEST(should_encode_publish_with_qos_0_before_expiry)
+{
+    lmqtt_publish_t publish;
+    void *data = NULL;
+
+    PREPARE;
+    memset(&publish, 0, sizeof(publish));
+    publish.topic.buf = "topic";
+    publish.topic.len = strlen(publish.topic.buf);
+    publish.expiry = 2;
+    test_time_set(10, 0);
+    lmqtt_time_touch(&publish.internal.queued_at, &test_time_get);
+
+    value.value = &publish;
+    value.callback = (lmqtt_store_entry_callback_t) &test_on_publish;
+    value.callback_data = &data;
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_0, &value);
+
+    test_time_set(11, 999999999);
+    res = lmqtt_tx_buffer_encode(&state, (unsigned char *) buf, sizeof(buf),
+        &bytes_written);
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(9, bytes_written);
+    ck_assert_ptr_eq(&publish, data);
+    ck_assert_int_eq(LMQTT_PUBLISH_STATUS_NONE, publish.response.status);
+}
+END_TEST
+
+START_TEST(should_not_expire_publish_with_qos_0_after_building_header)
+{
+    lmqtt_publish_t publish;
+    void *data = NULL;
+
+    PREPARE;
+    memset(&publish, 0, sizeof(publish));
+    publish.topic.buf = "topic";
+    publish.topic.len = strlen(publish.topic.buf);
+    publish.expiry = 2;
+    test_time_set(10, 0);
+    lmqtt_time_touch(&publish.internal.queued_at, &test_time_get);
+
+    value.value = &publish;
+    value.callback = (lmqtt_store_entry_callback_t) &test_on_publish;
+    value.callback_data = &data;
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_0, &value);
+
+    res = lmqtt_tx_buffer_encode(&state, (unsigned char *) buf, 0,
+        &bytes_written);
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(0, bytes_written);
+
+    test_time_set(12, 1);
+    res = lmqtt_tx_buffer_encode(&state, (unsigned char *) buf, sizeof(buf),
+        &bytes_written);
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(9, bytes_written);
+    ck_assert_int_eq('\x30', buf[0]);
+    ck_assert_ptr_eq(&publish, data);
+    ck_assert_int_eq(LMQTT_PUBLISH_STATUS_NONE, publish.response.status);
+}
+END_TEST
+
+START_TEST(should_encode_qos_0_ring_before_store)
+{
+    lmqtt_publish_t publish;
+    lmqtt_publish_t *items[2];
+    lmqtt_publish_ring_t ring;
+    void *data = NULL;
+
+    PREPARE;
+    memset(&publish, 0, sizeof(publish));
+    publish.topic.buf = "topic";
+    publish.topic.len = strlen(publish.topic.buf);
+    memset(&ring, 0, sizeof(ring));
+    ring.items = items;
+    ring.capacity = 2;
+    ring.callback = (lmqtt_store_entry_callback_t) &test_on_publish;
+    ring.callback_data = &data;
+    state.qos0_ring = &ring;
+
+    lmqtt_store_append(&store, LMQTT_KIND_PINGREQ, NULL);
+    ck_assert_int_eq(1, lmqtt_publish_ring_push(&ring, &publish));
+
+    res = lmqtt_tx_buffer_encode(&state, (unsigned char *) buf, sizeof(buf),
+        &bytes_written);
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(11, bytes_written);
+    ck_assert_uint_eq(0x30, buf[0]);
+    ck_assert_int_eq('\xc0', buf[9]);
+    ck_assert_ptr_eq(&publish, data);
+    ck_assert_uint_eq(0, ring.count);
+}
+END_TEST
+
+START_TEST(should_finish_partial_store_packet_before_qos_0_ring)
+{
+    lmqtt_publish_t publish;
+    lmqtt_publish_t *items[2];
+    lmqtt_publish_ring_t ring;
+
+    PREPARE;
+    memset(&publish, 0, sizeof(publish));
+    publish.topic.buf = "topic";
+    publish.topic.len = strlen(publish.topic.buf);
+    memset(&ring, 0, sizeof(ring));
+    ring.items = items;
+    ring.capacity = 2;
+    state.qos0_ring = &ring;
+
+    value.packet_id = 0x0102;
+    lmqtt_store_append(&store, LMQTT_KIND_PUBACK, &value);
+
+    res = lmqtt_tx_buffer_encode(&state, (unsigned char *) buf, 3,
+        &bytes_written);
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(3, bytes_written);
+
+    ck_assert_int_eq(1, lmqtt_publish_ring_push(&ring, &publish));
+
+    res = lmqtt_tx_buffer_encode(&state, (unsigned char *) buf, sizeof(buf),
+        &bytes_written);
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(10, bytes_written);
+    ck_assert_uint_eq(0x02, buf[0]);
+    ck_assert_uint_eq(0x30, buf[1]);
+    ck_assert_uint_eq(0, ring.count);
+}
+END_TEST
+
 START_TEST(should_encode_publish_with_qos_1)
 {
     lmqtt_publish_t publish;
@@ -369,6 +532,34 @@ START_TEST(should_encode_puback)
 }
 END_TEST
 
+START_TEST(should_count_down_spilled_acks_after_encode)
+{
+    lmqtt_ack_t ack_items[1];
+    lmqtt_ack_queue_t ack_queue;
+
+    PREPARE;
+    memset(&ack_queue, 0, sizeof(ack_queue));
+    ack_queue.items = ack_items;
+    ack_queue.capacity = 1;
+    state.ack_queue = &ack_queue;
+
+    lmqtt_ack_queue_push(&ack_queue, 0x40, 0x0101);
+    value.packet_id = 0x0102;
+    lmqtt_store_append(&store, LMQTT_KIND_PUBACK, &value);
+    ack_queue.spilled = 1;
+
+    res = lmqtt_tx_buffer_encode(&state, (unsigned char *) buf, sizeof(buf),
+        &bytes_written);
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(8, bytes_written);
+    ck_assert_uint_eq(0x01, buf[3]);
+    ck_assert_uint_eq(0x02, buf[7]);
+    ck_assert_uint_eq(0, ack_queue.count);
+    ck_assert_uint_eq(0, ack_queue.spilled);
+}
+END_TEST
+
 START_TEST(should_encode_pubrec)
 {
     int kind;
@@ -477,6 +668,312 @@ START_TEST(should_encode_disconnect)
 }
 END_TEST
 
+START_TEST(should_hold_publish_when_inflight_window_is_full)
+{
+    lmqtt_publish_t publish[2];
+    int kind;
+
+    PREPARE;
+    memset(publish, 0, sizeof(publish));
+    publish[0].qos = LMQTT_QOS_1;
+    publish[0].topic.buf = "topic";
+    publish[0].topic.len = strlen(publish[0].topic.buf);
+    publish[1] = publish[0];
+    state.inflight_window = 1;
+
+    value.packet_id = 0x0102;
+    value.value = &publish[0];
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1, &value);
+    value.packet_id = 0x0304;
+    value.value = &publish[1];
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1, &value);
+
+    res = lmqtt_tx_buffer_encode(&state, (unsigned char *) buf, sizeof(buf),
+        &bytes_written);
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(11, bytes_written);
+    ck_assert_uint_eq(0x01, buf[9]);
+    ck_assert_uint_eq(0x02, buf[10]);
+
+    ck_assert_int_eq(1, lmqtt_store_shift(&store, &kind, &value));
+
+    res = lmqtt_tx_buffer_encode(&state, (unsigned char *) buf, sizeof(buf),
+        &bytes_written);
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(11, bytes_written);
+    ck_assert_uint_eq(0x03, buf[9]);
+    ck_assert_uint_eq(0x04, buf[10]);
+}
+END_TEST
+
+START_TEST(should_send_acknowledgement_behind_held_publish)
+{
+    lmqtt_publish_t publish[2];
+
+    PREPARE;
+    memset(publish, 0, sizeof(publish));
+    publish[0].qos = LMQTT_QOS_1;
+    publish[0].topic.buf = "topic";
+    publish[0].topic.len = strlen(publish[0].topic.buf);
+    publish[1] = publish[0];
+    state.inflight_window = 1;
+
+    value.packet_id = 0x0102;
+    value.value = &publish[0];
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1, &value);
+    value.packet_id = 0x0304;
+    value.value = &publish[1];
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1, &value);
+    value.packet_id = 0x0506;
+    value.value = NULL;
+    lmqtt_store_append(&store, LMQTT_KIND_PUBACK, &value);
+
+    res = lmqtt_tx_buffer_encode(&state, (unsigned char *) buf, sizeof(buf),
+        &bytes_written);
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(15, bytes_written);
+    ck_assert_uint_eq(0x40, buf[11]);
+    ck_assert_uint_eq(0x05, buf[13]);
+    ck_assert_uint_eq(0x06, buf[14]);
+    ck_assert_int_eq(2, lmqtt_store_count(&store));
+}
+END_TEST
+
+START_TEST(should_not_send_unsubscribe_behind_held_publish)
+{
+    lmqtt_publish_t publish[2];
+    lmqtt_subscribe_t subscribe;
+    lmqtt_subscription_t subscription;
+
+    PREPARE;
+    memset(publish, 0, sizeof(publish));
+    publish[0].qos = LMQTT_QOS_1;
+    publish[0].topic.buf = "topic";
+    publish[0].topic.len = strlen(publish[0].topic.buf);
+    publish[1] = publish[0];
+    state.inflight_window = 1;
+
+    memset(&subscribe, 0, sizeof(subscribe));
+    memset(&subscription, 0, sizeof(subscription));
+    subscribe.count = 1;
+    subscribe.subscriptions = &subscription;
+    subscription.topic.buf = "topic";
+    subscription.topic.len = strlen(subscription.topic.buf);
+
+    value.packet_id = 0x0102;
+    value.value = &publish[0];
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1, &value);
+    value.packet_id = 0x0304;
+    value.value = &publish[1];
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1, &value);
+    value.packet_id = 0x0506;
+    value.value = &subscribe;
+    lmqtt_store_append(&store, LMQTT_KIND_UNSUBSCRIBE, &value);
+    value.packet_id = 0x0708;
+    value.value = NULL;
+    lmqtt_store_append(&store, LMQTT_KIND_PUBACK, &value);
+
+    /* the PUBACK still goes ahead */
+    res = lmqtt_tx_buffer_encode(&state, (unsigned char *) buf, sizeof(buf),
+        &bytes_written);
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(15, bytes_written);
+    ck_assert_uint_eq(0x40, buf[11]);
+    ck_assert_uint_eq(0x07, buf[13]);
+    ck_assert_uint_eq(0x08, buf[14]);
+    ck_assert_int_eq(3, lmqtt_store_count(&store));
+}
+END_TEST
+
+START_TEST(should_not_send_disconnect_behind_held_publish)
+{
+    lmqtt_publish_t publish[2];
+
+    PREPARE;
+    memset(publish, 0, sizeof(publish));
+    publish[0].qos = LMQTT_QOS_1;
+    publish[0].topic.buf = "topic";
+    publish[0].topic.len = strlen(publish[0].topic.buf);
+    publish[1] = publish[0];
+    state.inflight_window = 1;
+
+    value.packet_id = 0x0102;
+    value.value = &publish[0];
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1, &value);
+    value.packet_id = 0x0304;
+    value.value = &publish[1];
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_1, &value);
+    lmqtt_store_append(&store, LMQTT_KIND_DISCONNECT, NULL);
+
+    res = lmqtt_tx_buffer_encode(&state, (unsigned char *) buf, sizeof(buf),
+        &bytes_written);
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(11, bytes_written);
+    ck_assert_int_eq(0, state.closed);
+    ck_assert_int_eq(3, lmqtt_store_count(&store));
+}
+END_TEST
+
+START_TEST(should_count_pubrel_in_inflight_window)
+{
+    lmqtt_publish_t publish[2];
+
+    PREPARE;
+    memset(publish, 0, sizeof(publish));
+    publish[0].qos = LMQTT_QOS_2;
+    publish[0].topic.buf = "topic";
+    publish[0].topic.len = strlen(publish[0].topic.buf);
+    publish[1] = publish[0];
+    state.inflight_window = 1;
+
+    value.packet_id = 0x0102;
+    value.value = &publish[0];
+    lmqtt_store_append(&store, LMQTT_KIND_PUBREL, &value);
+    value.packet_id = 0x0304;
+    value.value = &publish[1];
+    lmqtt_store_append(&store, LMQTT_KIND_PUBLISH_2, &value);
+
+    res = lmqtt_tx_buffer_encode(&state, (unsigned char *) buf, sizeof(buf),
+        &bytes_written);
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(4, bytes_written);
+    ck_assert_uint_eq(0x62, buf[0]);
+    ck_assert_int_eq(2, lmqtt_store_count(&store));
+}
+END_TEST
+
+START_TEST(should_encode_connack)
+{
+    int kind;
+    lmqtt_connect_t connect;
+
+    PREPARE;
+    memset(&connect, 0, sizeof(connect));
+    connect.response.session_present = 1;
+
+    value.value = &connect;
+    lmqtt_store_append(&store, LMQTT_KIND_CONNACK, &value);
+
+    res = lmqtt_tx_buffer_encode(&state, (unsigned char *) buf, sizeof(buf),
+        &bytes_written);
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(4, bytes_written);
+
+    ck_assert_uint_eq(0x20, buf[0]);
+    ck_assert_uint_eq(0x02, buf[1]);
+    ck_assert_uint_eq(0x01, buf[2]);
+    ck_assert_uint_eq(0x00, buf[3]);
+
+    ck_assert_int_eq(0, lmqtt_store_shift(&store, &kind, &value));
+}
+END_TEST
+
+START_TEST(should_encode_connack_with_failed_return_code)
+{
+    lmqtt_connect_t connect;
+
+    PREPARE;
+    memset(&connect, 0, sizeof(connect));
+    connect.response.session_present = 1;
+    connect.response.return_code = 5;
+
+    value.value = &connect;
+    lmqtt_store_append(&store, LMQTT_KIND_CONNACK, &value);
+
+    res = lmqtt_tx_buffer_encode(&state, (unsigned char *) buf, sizeof(buf),
+        &bytes_written);
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(4, bytes_written);
+
+    ck_assert_uint_eq(0x00, buf[2]);
+    ck_assert_uint_eq(0x05, buf[3]);
+}
+END_TEST
+
+START_TEST(should_encode_suback)
+{
+    int kind;
+    lmqtt_subscribe_t subscribe;
+    lmqtt_subscription_t subscriptions[3];
+
+    PREPARE;
+    memset(&subscribe, 0, sizeof(subscribe));
+    memset(subscriptions, 0, sizeof(subscriptions));
+    subscribe.count = 3;
+    subscribe.subscriptions = subscriptions;
+    subscriptions[0].return_code = 0x00;
+    subscriptions[1].return_code = 0x02;
+    subscriptions[2].return_code = 0x80;
+
+    value.packet_id = 0x0102;
+    value.value = &subscribe;
+    lmqtt_store_append(&store, LMQTT_KIND_SUBACK, &value);
+
+    res = lmqtt_tx_buffer_encode(&state, (unsigned char *) buf, sizeof(buf),
+        &bytes_written);
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(7, bytes_written);
+
+    ck_assert_uint_eq(0x90, (unsigned char) buf[0]);
+    ck_assert_uint_eq(0x05, buf[1]);
+    ck_assert_uint_eq(0x01, buf[2]);
+    ck_assert_uint_eq(0x02, buf[3]);
+    ck_assert_uint_eq(0x00, buf[4]);
+    ck_assert_uint_eq(0x02, buf[5]);
+    ck_assert_uint_eq(0x80, (unsigned char) buf[6]);
+
+    ck_assert_int_eq(0, lmqtt_store_shift(&store, &kind, &value));
+}
+END_TEST
+
+START_TEST(should_encode_unsuback)
+{
+    int kind;
+
+    PREPARE;
+
+    value.packet_id = 0x0102;
+    lmqtt_store_append(&store, LMQTT_KIND_UNSUBACK, &value);
+
+    res = lmqtt_tx_buffer_encode(&state, (unsigned char *) buf, sizeof(buf),
+        &bytes_written);
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(4, bytes_written);
+
+    ck_assert_uint_eq(0xb0, (unsigned char) buf[0]);
+    ck_assert_uint_eq(0x02, buf[1]);
+    ck_assert_uint_eq(0x01, buf[2]);
+    ck_assert_uint_eq(0x02, buf[3]);
+
+    ck_assert_int_eq(0, lmqtt_store_shift(&store, &kind, &value));
+}
+END_TEST
+
+START_TEST(should_encode_pingresp)
+{
+    int kind;
+
+    PREPARE;
+
+    lmqtt_store_append(&store, LMQTT_KIND_PINGRESP, &value);
+
+    res = lmqtt_tx_buffer_encode(&state, (unsigned char *) buf, sizeof(buf),
+        &bytes_written);
+
+    ck_assert_int_eq(LMQTT_IO_SUCCESS, res);
+    ck_assert_int_eq(2, bytes_written);
+
+    ck_assert_int_eq('\xd0', buf[0]);
+    ck_assert_int_eq('\x00', buf[1]);
+
+    ck_assert_int_eq(0, lmqtt_store_shift(&store, &kind, &value));
+}
+END_TEST
+
 START_TCASE("Tx buffer finders")
 {
     ADD_TEST(should_encode_connect);
@@ -485,13 +982,29 @@ START_TCASE("Tx buffer finders")
     ADD_TEST(should_encode_unsubscribe_to_multiple_topics);
     ADD_TEST(should_encode_publish_with_qos_0);
     ADD_TEST(should_handle_publish_callback_failure_with_qos_0);
+    ADD_TEST(should_drop_expired_publish_with_qos_0);
+    ADD_TEST(should_encode_publish_with_qos_0_before_expiry);
+    ADD_TEST(should_not_expire_publish_with_qos_0_after_building_header);
+    ADD_TEST(should_encode_qos_0_ring_before_store);
+    ADD_TEST(should_finish_partial_store_packet_before_qos_0_ring);
     ADD_TEST(should_encode_publish_with_qos_1);
     ADD_TEST(should_increment_publish_encode_count_after_encode);
     ADD_TEST(should_encode_puback);
+    ADD_TEST(should_count_down_spilled_acks_after_encode);
     ADD_TEST(should_encode_pubrec);
     ADD_TEST(should_encode_pubrel);
     ADD_TEST(should_encode_pubcomp);
     ADD_TEST(should_encode_pingreq);
     ADD_TEST(should_encode_disconnect);
+    ADD_TEST(should_hold_publish_when_inflight_window_is_full);
+    ADD_TEST(should_send_acknowledgement_behind_held_publish);
+    ADD_TEST(should_not_send_unsubscribe_behind_held_publish);
+    ADD_TEST(should_not_send_disconnect_behind_held_publish);
+    ADD_TEST(should_count_pubrel_in_inflight_window);
+    ADD_TEST(should_encode_connack);
+    ADD_TEST(should_encode_connack_with_failed_return_code);
+    ADD_TEST(should_encode_suback);
+    ADD_TEST(should_encode_unsuback);
+    ADD_TEST(should_encode_pingresp);
 }
 END_TCASE